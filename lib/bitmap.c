@@ -8,7 +8,7 @@
 # define CHAR_BIT 8
 #endif
 
-typedef unsigned int bmap;
+typedef unsigned long bmap;
 
 #define MAPSIZE (sizeof(bmap) * CHAR_BIT)
 #define MAPMASK (MAPSIZE - 1) /* bits - 1, so 63 for 64-bit machines */
@@ -19,6 +19,172 @@ struct bitmap {
 	unsigned long alloc;
 };
 
+/*
+ * The word-crunching parts of the bitmap api. Each operation works on
+ * 'n' words and writes its result to 'dst', which may be one of the
+ * inputs. Which implementation we use is decided the first time we
+ * need one, based on what the cpu we're running on supports, so a
+ * single binary works everywhere but still uses popcnt and vector
+ * instructions where it can.
+ */
+struct bitmap_ops {
+	const char *name;
+	unsigned long (*count)(const bmap *v, unsigned long n);
+	void (*op_and)(bmap *dst, const bmap *a, const bmap *b, unsigned long n);
+	void (*op_or)(bmap *dst, const bmap *a, const bmap *b, unsigned long n);
+	void (*op_andnot)(bmap *dst, const bmap *a, const bmap *b, unsigned long n);
+	void (*op_xor)(bmap *dst, const bmap *a, const bmap *b, unsigned long n);
+};
+
+static inline unsigned int l_bits(bmap map)
+{
+#ifdef __GNUC__
+	return __builtin_popcountl(map);
+#else
+	/* count bits in parallel within ever larger chunks of the word */
+	map = map - ((map >> 1) & (bmap)0x5555555555555555ULL);
+	map = (map & (bmap)0x3333333333333333ULL) + ((map >> 2) & (bmap)0x3333333333333333ULL);
+	map = (map + (map >> 4)) & (bmap)0x0f0f0f0f0f0f0f0fULL;
+	return (map * (bmap)0x0101010101010101ULL) >> (MAPSIZE - CHAR_BIT);
+#endif
+}
+
+static unsigned long count_generic(const bmap *v, unsigned long n)
+{
+	unsigned long i, set_bits = 0;
+
+	for (i = 0; i < n; i++)
+		set_bits += l_bits(v[i]);
+	return set_bits;
+}
+
+#define BITMAP_OP_GENERIC(name, expr) \
+	static void name##_generic(bmap *dst, const bmap *a, const bmap *b, unsigned long n) \
+	{ \
+		unsigned long i; \
+		for (i = 0; i < n; i++) \
+			dst[i] = expr; \
+	}
+BITMAP_OP_GENERIC(and, a[i] & b[i])
+BITMAP_OP_GENERIC(or, a[i] | b[i])
+BITMAP_OP_GENERIC(andnot, a[i] & ~b[i])
+BITMAP_OP_GENERIC(xor, a[i] ^ b[i])
+
+static const struct bitmap_ops ops_generic = {
+	"generic", count_generic, and_generic, or_generic, andnot_generic, xor_generic,
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITMAP_X86 1
+#include <immintrin.h>
+
+__attribute__((target("popcnt")))
+static unsigned long count_popcnt(const bmap *v, unsigned long n)
+{
+	unsigned long i = 0, c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+	/* four counters so the popcnt's don't wait for each other */
+	for (; i + 4 <= n; i += 4) {
+		c0 += __builtin_popcountl(v[i]);
+		c1 += __builtin_popcountl(v[i + 1]);
+		c2 += __builtin_popcountl(v[i + 2]);
+		c3 += __builtin_popcountl(v[i + 3]);
+	}
+	for (; i < n; i++)
+		c0 += __builtin_popcountl(v[i]);
+	return c0 + c1 + c2 + c3;
+}
+
+/*
+ * Counts 32 bytes at a time by looking up the bit count of each nibble
+ * in a 16 entry table with vpshufb and summing the byte counts with
+ * vpsadbw. This beats one popcnt per word once there's a few cache
+ * lines worth of map to count.
+ */
+__attribute__((target("avx2,popcnt")))
+static unsigned long count_avx2(const bmap *v, unsigned long n)
+{
+	const unsigned char *p = (const unsigned char *)v;
+	unsigned long i = 0, len = n * sizeof(bmap), set_bits;
+	const __m256i lookup = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i acc = _mm256_setzero_si256();
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i lo = _mm256_and_si256(x, low_mask);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+		__m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+	}
+	set_bits = (unsigned long)_mm256_extract_epi64(acc, 0) + (unsigned long)_mm256_extract_epi64(acc, 1)
+	         + (unsigned long)_mm256_extract_epi64(acc, 2) + (unsigned long)_mm256_extract_epi64(acc, 3);
+	for (i /= sizeof(bmap); i < n; i++)
+		set_bits += __builtin_popcountl(v[i]);
+	return set_bits;
+}
+
+#define BITMAP_OP_VECTOR(isa, vtype, width, load, store, name, vexpr, expr) \
+	__attribute__((target(#isa))) \
+	static void name##_##isa(bmap *dst, const bmap *a, const bmap *b, unsigned long n) \
+	{ \
+		unsigned long i = 0; \
+		for (; i + (width) / sizeof(bmap) <= n; i += (width) / sizeof(bmap)) { \
+			vtype x = load((const vtype *)(a + i)); \
+			vtype y = load((const vtype *)(b + i)); \
+			store((vtype *)(dst + i), vexpr); \
+		} \
+		for (; i < n; i++) \
+			dst[i] = expr; \
+	}
+#define BITMAP_OP_SSE2(name, vexpr, expr) \
+	BITMAP_OP_VECTOR(sse2, __m128i, 16, _mm_loadu_si128, _mm_storeu_si128, name, vexpr, expr)
+#define BITMAP_OP_AVX2(name, vexpr, expr) \
+	BITMAP_OP_VECTOR(avx2, __m256i, 32, _mm256_loadu_si256, _mm256_storeu_si256, name, vexpr, expr)
+
+BITMAP_OP_SSE2(and, _mm_and_si128(x, y), a[i] & b[i])
+BITMAP_OP_SSE2(or, _mm_or_si128(x, y), a[i] | b[i])
+BITMAP_OP_SSE2(andnot, _mm_andnot_si128(y, x), a[i] & ~b[i])
+BITMAP_OP_SSE2(xor, _mm_xor_si128(x, y), a[i] ^ b[i])
+BITMAP_OP_AVX2(and, _mm256_and_si256(x, y), a[i] & b[i])
+BITMAP_OP_AVX2(or, _mm256_or_si256(x, y), a[i] | b[i])
+BITMAP_OP_AVX2(andnot, _mm256_andnot_si256(y, x), a[i] & ~b[i])
+BITMAP_OP_AVX2(xor, _mm256_xor_si256(x, y), a[i] ^ b[i])
+#endif
+
+static struct bitmap_ops bitmap_impl;
+
+static const struct bitmap_ops *bitmap_ops(void)
+{
+	if (bitmap_impl.name)
+		return &bitmap_impl;
+
+	bitmap_impl = ops_generic;
+#ifdef BITMAP_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("popcnt"))
+		bitmap_impl.count = count_popcnt;
+	if (__builtin_cpu_supports("sse2")) {
+		bitmap_impl.name = "sse2";
+		bitmap_impl.op_and = and_sse2;
+		bitmap_impl.op_or = or_sse2;
+		bitmap_impl.op_andnot = andnot_sse2;
+		bitmap_impl.op_xor = xor_sse2;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		bitmap_impl.name = "avx2";
+		bitmap_impl.count = count_avx2;
+		bitmap_impl.op_and = and_avx2;
+		bitmap_impl.op_or = or_avx2;
+		bitmap_impl.op_andnot = andnot_avx2;
+		bitmap_impl.op_xor = xor_avx2;
+	}
+#endif
+	return &bitmap_impl;
+}
+
 void bitmap_clear(bitmap *bm)
 {
 	if (bm)
@@ -48,6 +214,9 @@ int bitmap_resize(bitmap *bm, unsigned long size)
 	if (!nvec) {
 		return -1;
 	}
+	/* bits we grow into must start out unset */
+	if (ralloc > bm->alloc)
+		memset(nvec + bm->alloc, 0, (ralloc - bm->alloc) * sizeof(bmap));
 	bm->vector = nvec;
 	bm->alloc = ralloc;
 	return 0;
@@ -101,81 +270,45 @@ bitmap *bitmap_copy(const bitmap *bm)
 	if (!ret)
 		return NULL;
 
-	memcpy(ret->vector, bm->vector, bitmap_size(bm));
+	memcpy(ret->vector, bm->vector, bm->alloc * sizeof(bmap));
 	return ret;
 }
 
-static inline unsigned int l_bits(bmap map)
-{
-	unsigned int i, tot_bits = 0;
-
-	/*
-	 * bits per byte. A 16k entry table would be slightly faster
-	 * on most archs but a damn sight uglier on all of them
-	 */
-	const unsigned char bpb[256] = {
-		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
-		1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-		1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-		2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-		1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-		2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-		2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-		3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-		1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-		2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-		2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-		3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-		2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-		3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-		3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-		4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8,
-	};
-
-	for (i = 0; i < sizeof(bmap); i++) {
-		const unsigned char ch = (map >> (i * CHAR_BIT)) & 0xff;
-		const unsigned char cbits = bpb[ch];
-		tot_bits += cbits;
-	}
-
-	return tot_bits;
-}
-
-
 int bitmap_set(bitmap *bm, unsigned long pos)
 {
-	const bmap l = pos >> SHIFTOUT;
+	const unsigned long l = pos >> SHIFTOUT;
 	const unsigned int bit = pos & MAPMASK;
 
 	if (!bm)
 		return 0;
-	if (l > bm->alloc)
+	if (l >= bm->alloc)
 		return -1;
 
-	bm->vector[l] |= (1 << bit);
+	bm->vector[l] |= ((bmap)1 << bit);
 	return 0;
 }
 
 int bitmap_isset(const bitmap *bm, unsigned long pos)
 {
-	const bmap l = pos >> SHIFTOUT;
+	const unsigned long l = pos >> SHIFTOUT;
 	const int bit = pos & MAPMASK;
 	int set;
 
-	if (!bm || l > bm->alloc)
+	if (!bm || l >= bm->alloc)
 		return 0;
 
-	set = !!(bm->vector[l] & (1 << bit));
+	set = !!(bm->vector[l] & ((bmap)1 << bit));
 	return set;
 }
 
 int bitmap_unset(bitmap *bm, unsigned long pos)
 {
-	const bmap l = pos >> SHIFTOUT;
+	const unsigned long l = pos >> SHIFTOUT;
 	const int bit = pos & MAPMASK;
 	const int val = bitmap_isset(bm, pos);
 
-	bm->vector[l] &= ~(1 << bit);
+	if (val)
+		bm->vector[l] &= ~((bmap)1 << bit);
 	return val;
 }
 
@@ -187,21 +320,12 @@ unsigned long bitmap_cardinality(const bitmap *bm)
 	return bm->alloc * MAPSIZE;
 }
 
-/*
- * count set bits in alloc * (mapsize / 8) ops
- */
 unsigned long bitmap_count_set_bits(const bitmap *bm)
 {
-	unsigned long i, set_bits = 0;
-
 	if (!bm)
 		return 0;
 
-	for (i = 0; i < bm->alloc; i++) {
-		set_bits += l_bits(bm->vector[i]);
-	}
-
-	return set_bits;
+	return bitmap_ops()->count(bm->vector, bm->alloc);
 }
 
 unsigned long bitmap_count_unset_bits(const bitmap *bm)
@@ -209,29 +333,42 @@ unsigned long bitmap_count_unset_bits(const bitmap *bm)
 	return bitmap_cardinality(bm) - bitmap_count_set_bits(bm);
 }
 
-#define BITMAP_MATH(a, b) \
-	unsigned int i; \
-	bitmap *bm; \
-	/* a->alloc has to be smallest */ \
-	if (a->alloc > b->alloc) { \
-		const bitmap *temp = b; \
-		b = a; \
-		a = temp; \
-	} \
-	bm = bitmap_create(bitmap_cardinality(b)); \
-	if (!bm) \
-		return NULL; \
-	for (i = 0; i < a->alloc; i++)
+#define min(a, b) (a > b ? b : a)
+#define max(a, b) (a > b ? a : b)
 
-bitmap *bitmap_intersect(const bitmap *a, const bitmap *b)
+/*
+ * Creates a bitmap as large as the largest of a and b, runs 'op' on
+ * the words they have in common and copies the words only the larger
+ * one has if 'tail_a' or 'tail_b' says so. Anything else is left unset.
+ */
+static bitmap *bitmap_math(const bitmap *a, const bitmap *b,
+                           void (*op)(bmap *, const bmap *, const bmap *, unsigned long),
+                           int tail_a, int tail_b)
 {
-	BITMAP_MATH(a, b) {
-		bm->vector[i] = a->vector[i] & b->vector[i];
-	}
+	unsigned long common;
+	bitmap *bm;
+
+	if (!a || !b)
+		return NULL;
 
+	bm = bitmap_create(max(a->alloc, b->alloc) * MAPSIZE);
+	if (!bm)
+		return NULL;
+
+	common = min(a->alloc, b->alloc);
+	op(bm->vector, a->vector, b->vector, common);
+	if (tail_a && a->alloc > common)
+		memcpy(&bm->vector[common], &a->vector[common], (a->alloc - common) * sizeof(bmap));
+	if (tail_b && b->alloc > common)
+		memcpy(&bm->vector[common], &b->vector[common], (b->alloc - common) * sizeof(bmap));
 	return bm;
 }
 
+bitmap *bitmap_intersect(const bitmap *a, const bitmap *b)
+{
+	return bitmap_math(a, b, bitmap_ops()->op_and, 0, 0);
+}
+
 
 bitmap *bitmap_union(const bitmap *a, const bitmap *b)
 {
@@ -239,28 +376,32 @@ bitmap *bitmap_union(const bitmap *a, const bitmap *b)
 		return bitmap_copy(b);
 	if (!b)
 		return bitmap_copy(a);
-	do {
-		BITMAP_MATH(a, b) {
-			bm->vector[i] = a->vector[i] | b->vector[i];
-		}
-		return bm;
-	} while (0);
+	return bitmap_math(a, b, bitmap_ops()->op_or, 1, 1);
 }
 
 bitmap *bitmap_unite(bitmap *res, const bitmap *addme)
 {
-	unsigned int i;
-
 	if (!addme || !res)
 		return res;
 
-	if (bitmap_size(addme) > bitmap_size(res)) {
-		bitmap_resize(res, bitmap_size(addme));
-	}
+	if (addme->alloc > res->alloc && bitmap_resize(res, bitmap_size(addme)) < 0)
+		return NULL;
 
-	for (i = 0; i < addme->alloc; i++) {
-		res->vector[i] |= addme->vector[i];
-	}
+	bitmap_ops()->op_or(res->vector, res->vector, addme->vector, addme->alloc);
+	return res;
+}
+
+bitmap *bitmap_intersect_with(bitmap *res, const bitmap *b)
+{
+	unsigned long common;
+
+	if (!res || !b)
+		return NULL;
+
+	common = min(res->alloc, b->alloc);
+	bitmap_ops()->op_and(res->vector, res->vector, b->vector, common);
+	if (res->alloc > common)
+		memset(&res->vector[common], 0, (res->alloc - common) * sizeof(bmap));
 	return res;
 }
 
@@ -271,15 +412,16 @@ bitmap *bitmap_unite(bitmap *res, const bitmap *addme)
  */
 bitmap *bitmap_diff(const bitmap *a, const bitmap *b)
 {
-	const bitmap *a_ = a, *b_ = b;
+	return bitmap_math(a, b, bitmap_ops()->op_andnot, 1, 0);
+}
 
-	BITMAP_MATH(a, b) {
-		bm->vector[i] = a->vector[i] & ~(b->vector[i]);
-	}
-	if (a_->alloc > b_->alloc) {
-		memcpy(&bm->vector[i], &b->vector[i], (b->alloc - a->alloc) * MAPSIZE);
-	}
-	return bm;
+bitmap *bitmap_diff_with(bitmap *res, const bitmap *b)
+{
+	if (!res || !b)
+		return NULL;
+
+	bitmap_ops()->op_andnot(res->vector, res->vector, b->vector, min(res->alloc, b->alloc));
+	return res;
 }
 
 /*
@@ -287,21 +429,26 @@ bitmap *bitmap_diff(const bitmap *a, const bitmap *b)
  */
 bitmap *bitmap_symdiff(const bitmap *a, const bitmap *b)
 {
-	BITMAP_MATH(a, b) {
-		bm->vector[i] = (a->vector[i] | b->vector[i]) ^ (a->vector[i] & b->vector[i]);
-	}
-	if (b->alloc > a->alloc) {
-		memcpy(&bm->vector[i], &b->vector[i], (b->alloc - a->alloc) * MAPSIZE);
-	}
-	return bm;
+	return bitmap_math(a, b, bitmap_ops()->op_xor, 1, 1);
+}
+
+bitmap *bitmap_symdiff_with(bitmap *res, const bitmap *b)
+{
+	if (!res || !b)
+		return NULL;
+
+	if (b->alloc > res->alloc && bitmap_resize(res, bitmap_size(b)) < 0)
+		return NULL;
+
+	bitmap_ops()->op_xor(res->vector, res->vector, b->vector, b->alloc);
+	return res;
 }
 
-#define min(a, b) (a > b ? b : a)
 int bitmap_cmp(const bitmap *a, const bitmap *b)
 {
 	int ret;
 
-	ret = memcmp(a->vector, b->vector, min(a->alloc, b->alloc) * MAPSIZE);
+	ret = memcmp(a->vector, b->vector, min(a->alloc, b->alloc) * sizeof(bmap));
 	if (ret || a->alloc == b->alloc) {
 		return ret;
 	}
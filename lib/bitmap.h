@@ -14,7 +14,8 @@ NAGIOS_BEGIN_DECL
  * @brief Bit map API
  *
  * The bitmap api is useful for running set operations on objects
- * indexed by unsigned integers.
+ * indexed by unsigned integers. Bit counting and set operations use
+ * popcnt, SSE2 or AVX2 when the cpu running us supports them.
  * @{
  */
 struct bitmap;
@@ -112,6 +113,15 @@ extern void bitmap_clear(bitmap *bm);
  */
 extern bitmap *bitmap_intersect(const bitmap *a, const bitmap *b);
 
+/**
+ * Calculate intersection of two bitmaps and store result in the first
+ * Bits in res beyond the cardinality of b are cleared.
+ * @param res The first bitmap
+ * @param b The bitmap to intersect the first bitmap with
+ * @return NULL on errors, res on success
+ */
+extern bitmap *bitmap_intersect_with(bitmap *res, const bitmap *b);
+
 /**
  * Calculate union of two bitmaps
  * The union is defined as all bits that are members of
@@ -143,6 +153,15 @@ extern bitmap *bitmap_unite(bitmap *res, const bitmap *addme);
  */
 extern bitmap *bitmap_diff(const bitmap *a, const bitmap *b);
 
+/**
+ * Calculate set difference between two bitmaps and store result in
+ * the first
+ * @param res The bitmap to remove members from (numerator)
+ * @param b The bitmap holding the members to remove (denominator)
+ * @return NULL on errors, res on success
+ */
+extern bitmap *bitmap_diff_with(bitmap *res, const bitmap *b);
+
 /**
  * Calculate symmetric difference between two bitmaps
  * The symmetric difference between A and B is the set that
@@ -153,6 +172,15 @@ extern bitmap *bitmap_diff(const bitmap *a, const bitmap *b);
  */
 extern bitmap *bitmap_symdiff(const bitmap *a, const bitmap *b);
 
+/**
+ * Calculate symmetric difference between two bitmaps and store result
+ * in the first, which grows to the size of the second if need be
+ * @param res The first bitmap
+ * @param b The second bitmap
+ * @return NULL on errors, res on success
+ */
+extern bitmap *bitmap_symdiff_with(bitmap *res, const bitmap *b);
+
 /**
  * Compare two bitmaps for equality
  * @param a The first bitmaptor
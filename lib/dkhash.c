@@ -1,27 +1,46 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include "dkhash.h"
 #include "lnae-utils.h"
 
-#define dkhash_func(k) hash((unsigned char *)k)
-#define dkhash_func2(k1, k2) (dkhash_func(k1) ^ dkhash_func(k2))
+/*
+ * The table is open addressing with linear probing over two parallel
+ * arrays: the full hash of each slot's keys, and the keys and data
+ * themselves. Probes walk the hashes, sixteen to a cache line, and
+ * only look at a slot (and strcmp() its keys) when the hash matched,
+ * so a failed lookup rarely touches anything but the hash array.
+ * Resizing never has to re-hash a single string either.
+ *
+ * Two hash values are reserved: DKHASH_EMPTY for slots never used and
+ * DKHASH_DELETED for tombstones, which removed entries leave behind
+ * so probe chains passing through them stay intact. Tombstones are
+ * dropped whenever the table is rebuilt, and also right away when
+ * nothing can be probing past them.
+ */
+#define DKHASH_EMPTY   0
+#define DKHASH_DELETED 1
 
-typedef struct dkhash_bucket {
+typedef struct dkhash_slot {
 	const char *key;
 	const char *key2;
 	void *data;
-	struct dkhash_bucket *next;
-} dkhash_bucket;
+} dkhash_slot;
 
 struct dkhash_table {
-	dkhash_bucket **buckets;
-	unsigned int num_buckets;
+	unsigned int *hashes;
+	dkhash_slot *slots;
+	unsigned int num_slots; /* always a power of 2 */
+	unsigned int mask;
 	unsigned int added, removed;
 	unsigned int entries;
 	unsigned int max_entries;
 	unsigned int collisions;
+	unsigned int deleted; /* tombstones */
 };
 
+#define slot_is_live(t, i) ((t)->hashes[i] > DKHASH_DELETED)
+
 /* struct data access functions */
 unsigned int dkhash_collisions(dkhash_table *t)
 {
@@ -50,83 +69,172 @@ unsigned int dkhash_num_entries_removed(dkhash_table *t)
 
 unsigned int dkhash_table_size(dkhash_table *t)
 {
-	return t ? t->num_buckets : 0;
+	return t ? t->num_slots : 0;
 }
 
 /*
- * polynomial conversion ignoring overflows.
- * Pretty standard hash, once based on Ozan Yigit's sdbm() hash
- * but later modified for Nagios to produce better results on our
- * typical data.
+ * MurmurHash64A by Austin Appleby (public domain), which eats the key
+ * eight bytes at a time. Object names are mostly well over eight
+ * bytes, so this beats any byte-at-a-time hash by a wide margin. The
+ * second key of a pair is hashed using the first key's hash as seed,
+ * so (a, b) and (b, a) don't end up in the same slot.
  */
-#define PRIME 509
-static inline unsigned int hash(register const unsigned char *k)
+#define DKHASH_SEED 0x123 /* magic */
+static inline uint64_t hash(const char *key, uint64_t seed)
 {
-	register unsigned int h = 0x123; /* magic */
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	size_t len = strlen(key);
+	const unsigned char *p = (const unsigned char *)key;
+	const unsigned char *end = p + (len & ~(size_t)7);
+	uint64_t h = seed ^ (len * m);
+
+	for (; p != end; p += 8) {
+		uint64_t k;
+		memcpy(&k, p, sizeof(k));
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
 
-	while (*k)
-		h = *k++ + PRIME * h;
+	switch (len & 7) {
+	case 7: h ^= (uint64_t)p[6] << 48; /* fallthrough */
+	case 6: h ^= (uint64_t)p[5] << 40; /* fallthrough */
+	case 5: h ^= (uint64_t)p[4] << 32; /* fallthrough */
+	case 4: h ^= (uint64_t)p[3] << 24; /* fallthrough */
+	case 3: h ^= (uint64_t)p[2] << 16; /* fallthrough */
+	case 2: h ^= (uint64_t)p[1] << 8; /* fallthrough */
+	case 1: h ^= (uint64_t)p[0];
+		h *= m;
+	}
 
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
 	return h;
 }
 
-static inline unsigned int dkhash_slot(dkhash_table *t, const char *k1, const char *k2)
+static inline unsigned int dkhash_func(const char *k1, const char *k2)
 {
+	uint64_t h = hash(k1, DKHASH_SEED);
+	unsigned int ret;
+
 	if (k2)
-		return dkhash_func2(k1, k2) % t->num_buckets;
-	return dkhash_func(k1) % t->num_buckets;
+		h = hash(k2, h);
+	ret = (unsigned int)(h ^ (h >> 32));
+	return ret > DKHASH_DELETED ? ret : ret + 2;
 }
 
-static dkhash_bucket *dkhash_get_bucket(dkhash_table *t, const char *key, unsigned int slot)
+static inline int dkhash_key_match(const dkhash_slot *s, const char *k1, const char *k2)
 {
-	dkhash_bucket *bkt;
+	if (s->key != k1 && strcmp(s->key, k1))
+		return 0;
+	if (!k2 || !s->key2)
+		return k2 == s->key2;
+	return s->key2 == k2 || !strcmp(s->key2, k2);
+}
 
-	for (bkt = t->buckets[slot]; bkt; bkt = bkt->next) {
-		if (!strcmp(key, bkt->key))
-			return bkt;
-	}
+static dkhash_slot *dkhash_find(dkhash_table *t, unsigned int h, const char *k1, const char *k2)
+{
+	unsigned int i;
 
+	for (i = h & t->mask; t->hashes[i] != DKHASH_EMPTY; i = (i + 1) & t->mask) {
+		if (t->hashes[i] == h && dkhash_key_match(&t->slots[i], k1, k2))
+			return &t->slots[i];
+	}
 	return NULL;
 }
 
-static dkhash_bucket *dkhash_get_bucket2(dkhash_table *t, const char *k1, const char *k2, unsigned int slot)
+/*
+ * Rebuild the table, doubling it if live entries plus the one about
+ * to be added would push it past half full. Otherwise it's the
+ * tombstones that got us here, and rebuilding at the same size is
+ * enough to get rid of them.
+ */
+static int dkhash_resize(dkhash_table *t)
 {
-	dkhash_bucket *bkt;
+	dkhash_slot *slots, *old = t->slots;
+	unsigned int *hashes, *old_hashes = t->hashes;
+	unsigned int i, size = t->num_slots, mask;
+
+	while ((t->entries + 1) * 2 > size) {
+		if (size & (1U << 31))
+			return DKHASH_ENOMEM;
+		size <<= 1;
+	}
 
-	for (bkt = t->buckets[slot]; bkt; bkt = bkt->next) {
-		if (!strcmp(k1, bkt->key) && bkt->key2 && !strcmp(k2, bkt->key2))
-			return bkt;
+	if (!(hashes = calloc(size, sizeof(*hashes))))
+		return DKHASH_ENOMEM;
+	if (!(slots = malloc(size * sizeof(*slots)))) {
+		free(hashes);
+		return DKHASH_ENOMEM;
 	}
 
-	return NULL;
+	mask = size - 1;
+	for (i = 0; i < t->num_slots; i++) {
+		unsigned int x;
+
+		if (!slot_is_live(t, i))
+			continue;
+		for (x = old_hashes[i] & mask; hashes[x] != DKHASH_EMPTY; x = (x + 1) & mask)
+			; /* empty loop */
+		hashes[x] = old_hashes[i];
+		slots[x] = old[i];
+	}
+
+	free(old);
+	free(old_hashes);
+	t->hashes = hashes;
+	t->slots = slots;
+	t->num_slots = size;
+	t->mask = mask;
+	t->deleted = 0;
+	return DKHASH_OK;
 }
 
 int dkhash_insert(dkhash_table *t, const char *k1, const char *k2, void *data)
 {
-	unsigned int slot;
-	dkhash_bucket *bkt;
+	unsigned int h, i, tomb = 0, have_tomb = 0;
+	dkhash_slot *s;
 
 	if (!t || !k1)
 		return DKHASH_EINVAL;
 
-	slot = dkhash_slot(t, k1, k2);
-	bkt = k2 ? dkhash_get_bucket2(t, k1, k2, slot) : dkhash_get_bucket(t, k1, slot);
+	/* keep at least a quarter of the slots empty so probes stay short */
+	if ((t->entries + t->deleted + 1) * 4 > t->num_slots * 3) {
+		if (dkhash_resize(t) < 0)
+			return DKHASH_ENOMEM;
+	}
 
-	if (bkt)
-		return DKHASH_EDUPE;
+	h = dkhash_func(k1, k2);
+	for (i = h & t->mask; t->hashes[i] != DKHASH_EMPTY; i = (i + 1) & t->mask) {
+		if (t->hashes[i] == DKHASH_DELETED) {
+			if (!have_tomb) {
+				tomb = i;
+				have_tomb = 1;
+			}
+			continue;
+		}
+		if (t->hashes[i] == h && dkhash_key_match(&t->slots[i], k1, k2))
+			return DKHASH_EDUPE;
+	}
 
-	if (!(bkt = malloc(sizeof(*bkt))))
-		return DKHASH_ENOMEM;
+	if (have_tomb) {
+		i = tomb;
+		t->deleted--;
+	}
 
-	if (t->buckets[slot])
+	if (i != (h & t->mask))
 		t->collisions++; /* "soft" collision */
 
 	t->added++;
-	bkt->data = data;
-	bkt->key = k1;
-	bkt->key2 = k2;
-	bkt->next = t->buckets[slot];
-	t->buckets[slot] = bkt;
+	t->hashes[i] = h;
+	s = &t->slots[i];
+	s->data = data;
+	s->key = k1;
+	s->key2 = k2;
 
 	if (++t->entries > t->max_entries)
 		t->max_entries = t->entries;
@@ -136,126 +244,115 @@ int dkhash_insert(dkhash_table *t, const char *k1, const char *k2, void *data)
 
 void *dkhash_get(dkhash_table *t, const char *k1, const char *k2)
 {
-	dkhash_bucket *bkt;
-	unsigned int slot;
+	dkhash_slot *s;
 
 	if (!t || !k1)
 		return NULL;
 
-	slot = dkhash_slot(t, k1, k2);
-	bkt = k2 ? dkhash_get_bucket2(t, k1, k2, slot) : dkhash_get_bucket(t, k1, slot);
-
-	return bkt ? bkt->data : NULL;
+	s = dkhash_find(t, dkhash_func(k1, k2), k1, k2);
+	return s ? s->data : NULL;
 }
 
 dkhash_table *dkhash_create(unsigned int size)
 {
 	dkhash_table *t;
+	unsigned int num_slots = 1;
 
 	if (!size)
 		return NULL;
 
+	while (num_slots < size) {
+		if (num_slots & (1U << 31))
+			return NULL;
+		num_slots <<= 1;
+	}
+
 	if (!(t = calloc(1, sizeof(*t))))
 		return NULL;
 
-	if (!(t->buckets = calloc(size, sizeof(dkhash_bucket *)))) {
+	t->hashes = calloc(num_slots, sizeof(*t->hashes));
+	t->slots = malloc(num_slots * sizeof(dkhash_slot));
+	if (!t->hashes || !t->slots) {
+		free(t->hashes);
+		free(t->slots);
 		free(t);
 		return NULL;
 	}
 
-	t->num_buckets = size;
+	t->num_slots = num_slots;
+	t->mask = num_slots - 1;
 	return t;
 }
 
 int dkhash_destroy(dkhash_table *t)
 {
-	unsigned int i;
-
 	if (!t)
 		return DKHASH_EINVAL;
 
-	for (i = 0; i < t->num_buckets; i++) {
-		dkhash_bucket *b, *next;
-		for (b = t->buckets[i]; b; b = next) {
-			next = b->next;
-			free(b);
-		}
-	}
-	free(t->buckets);
+	free(t->hashes);
+	free(t->slots);
 	free(t);
 	return DKHASH_OK;
 }
 
-static inline void *dkhash_destroy_bucket(dkhash_bucket *bkt)
+static void *dkhash_destroy_slot(dkhash_table *t, dkhash_slot *s)
 {
-	void *data;
+	unsigned int i = s - t->slots;
+	void *data = s->data;
+
+	t->hashes[i] = DKHASH_DELETED;
+	s->key = NULL;
+	s->key2 = NULL;
+	s->data = NULL;
+	t->deleted++;
+	t->entries--;
+	t->removed++;
+
+	/*
+	 * if the next slot is empty, no probe ever goes past this one,
+	 * so it and the tombstones leading up to it can all be emptied
+	 */
+	if (t->hashes[(i + 1) & t->mask] == DKHASH_EMPTY) {
+		while (t->hashes[i] == DKHASH_DELETED) {
+			t->hashes[i] = DKHASH_EMPTY;
+			t->deleted--;
+			i = (i - 1) & t->mask;
+		}
+	}
 
-	data = bkt->data;
-	free(bkt);
 	return data;
 }
 
 void *dkhash_remove(dkhash_table *t, const char *k1, const char *k2)
 {
-	unsigned int slot;
-	dkhash_bucket *bkt, *prev;
+	dkhash_slot *s;
 
 	if (!t || !k1)
 		return NULL;
 
-	slot = dkhash_slot(t, k1, k2);
-	if (!(bkt = t->buckets[slot]))
+	if (!(s = dkhash_find(t, dkhash_func(k1, k2), k1, k2)))
 		return NULL;
 
-	for (prev = bkt; bkt; prev = bkt, bkt = bkt->next) {
-		if (strcmp(k1, bkt->key))
-			continue;
-		if ((!k2 && !bkt->key2) || !strcmp(k2, bkt->key2)) {
-			if (prev == bkt) {
-				/* first entry deleted */
-				t->buckets[slot] = bkt->next;
-			} else {
-				prev->next = bkt->next;
-			}
-			t->entries--;
-			t->removed++;
-			return dkhash_destroy_bucket(bkt);
-		}
-	}
-
-	return NULL;
+	return dkhash_destroy_slot(t, s);
 }
 
 void dkhash_walk_data(dkhash_table *t, int (*walker)(void *))
 {
-	dkhash_bucket *bkt, *prev;
 	unsigned int i;
 
-	if (!t->entries)
+	if (!t || !t->entries)
 		return;
 
-	for (i = 0; i < t->num_buckets; i++) {
-		int depth = 0;
-		dkhash_bucket *next;
+	for (i = 0; i < t->num_slots && t->entries; i++) {
+		int ret;
 
-		prev = t->buckets[i];
-		for (bkt = t->buckets[i]; bkt; bkt = next) {
-			next = bkt->next;
+		if (!slot_is_live(t, i))
+			continue;
 
-			if (walker(bkt->data) != DKHASH_WALK_REMOVE) {
-				/* only update prev if we don't remove current */
-				prev = bkt;
-				depth++;
-				continue;
-			}
-			t->removed++;
-			t->entries--;
-			dkhash_destroy_bucket(bkt);
-			if (depth) {
-				prev->next = next;
-			} else {
-				t->buckets[i] = next;
-			}
-		}
+		ret = walker(t->slots[i].data);
+		if (ret & DKHASH_WALK_REMOVE)
+			dkhash_destroy_slot(t, &t->slots[i]);
+		if (ret & DKHASH_WALK_STOP)
+			return;
 	}
 }
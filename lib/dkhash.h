@@ -40,9 +40,10 @@ typedef struct dkhash_table dkhash_table;
 
 /**
  * Create a dual-keyed hash-table of the given size
- * Note that it's generally useful to make the table 25-30% larger
- * than the number of items you intend to store, and also note that
- * the 'size' arguments gets rounded up to the nearest power of 2.
+ * Note that the 'size' argument gets rounded up to the nearest power
+ * of 2. The table grows on its own when it's more than 75% full, but
+ * sizing it ~50% larger than the number of items you intend to store
+ * up front avoids rehashing while it's being populated.
  * @param size The desired size of the hash-table.
  */
 extern dkhash_table *dkhash_create(unsigned int size);
@@ -97,6 +98,7 @@ extern void dkhash_walk_data(dkhash_table *t, int (*walker)(void *data));
 
 /**
  * Get number of collisions in hash table
+ * An insert collides when the slot its keys hash to is already taken.
  * Many collisions is a sign of a too small hash table or
  * poor hash-function.
  * @param t The hash table to report on
@@ -134,9 +136,9 @@ extern unsigned int dkhash_num_entries_added(dkhash_table *t);
 extern unsigned int dkhash_num_entries_removed(dkhash_table *t);
 
 /**
- * Get actual table size (in number of buckets)
+ * Get actual table size (in number of slots)
  * @param t The hash table
- * @return Number of bucket-slots in hash table
+ * @return Number of slots in hash table
  */
 extern unsigned int dkhash_table_size(dkhash_table *t);
 /** @} */
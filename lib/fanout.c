@@ -1,35 +1,91 @@
 #include <unistd.h>
+#include <stdint.h>
 #include "fanout.h"
 
+/* number of entries carved out of each slab */
+#define FANOUT_SLAB_ENTRIES 128
+
 struct fanout_entry {
 	unsigned long key;
 	void *data;
 	struct fanout_entry *next;
 };
 
+/*
+ * Entries are handed out from slabs and returned to a free-list on
+ * removal, so a table that sees a steady stream of adds and removes
+ * (like the per-worker job tables) stops touching malloc() once it
+ * has enough slabs for its peak load.
+ */
+struct fanout_slab {
+	struct fanout_slab *next;
+	struct fanout_entry entries[FANOUT_SLAB_ENTRIES];
+};
+
 struct fanout_table {
-	unsigned long alloc;
+	unsigned long alloc; /* always a power of 2 */
+	unsigned int shift;
 	struct fanout_entry **entries;
+	struct fanout_entry *free_entries;
+	struct fanout_slab *slabs;
+	unsigned long num_entries;
+	unsigned long collisions;
 };
 
+unsigned long fanout_num_entries(fanout_table *t)
+{
+	return t ? t->num_entries : 0;
+}
+
+unsigned long fanout_table_size(fanout_table *t)
+{
+	return t ? t->alloc : 0;
+}
+
+unsigned long fanout_collisions(fanout_table *t)
+{
+	return t ? t->collisions : 0;
+}
+
+/*
+ * Fibonacci hashing. Sequential keys (job id's, pids) end up nicely
+ * spread, and so do keys that only differ in their high bits, which
+ * a plain modulo would pile into the same few slots.
+ */
+static inline unsigned long fanout_slot(fanout_table *t, unsigned long key)
+{
+	return (unsigned long)(((uint64_t)key * 0x9e3779b97f4a7c15ULL) >> t->shift);
+}
+
 fanout_table *fanout_create(unsigned long size)
 {
-	fanout_table *t = calloc(1, sizeof(*t));
+	fanout_table *t;
+	unsigned long alloc = 2;
+	unsigned int bits = 1;
+
+	while (alloc < size) {
+		alloc <<= 1;
+		bits++;
+	}
+
+	t = calloc(1, sizeof(*t));
 	if (!t)
 		return NULL;
-	t->entries = calloc(size, sizeof(struct fanout_entry *));
+	t->entries = calloc(alloc, sizeof(struct fanout_entry *));
 	if (!t->entries) {
 		free(t);
 		return NULL;
 	}
-	t->alloc = size;
+	t->alloc = alloc;
+	t->shift = 64 - bits;
 	return t;
 }
 
 void fanout_destroy(fanout_table *t, void (*destructor)(void *))
 {
 	unsigned long i;
-	struct fanout_entry **entries, *next;
+	struct fanout_entry **entries;
+	struct fanout_slab *slab, *next;
 
 	if (!t || !t->entries || !t->alloc)
 		return;
@@ -38,36 +94,114 @@ void fanout_destroy(fanout_table *t, void (*destructor)(void *))
 	entries = t->entries;
 	t->entries = NULL;
 
-	for (i = 0; i < t->alloc; i++) {
-		struct fanout_entry *entry;
+	if (destructor) {
+		for (i = 0; i < t->alloc; i++) {
+			struct fanout_entry *entry;
 
-		for (entry = entries[i]; entry; entry = next) {
-			void *data = entry->data;
-			next = entry->next;
-			free(entry);
-			if (destructor) {
-				destructor(data);
+			for (entry = entries[i]; entry; entry = entry->next) {
+				destructor(entry->data);
 			}
 		}
 	}
+	for (slab = t->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
 	free(entries);
 	free(t);
 }
 
+static struct fanout_entry *fanout_entry_alloc(fanout_table *t)
+{
+	struct fanout_entry *entry;
+
+	if (!t->free_entries) {
+		struct fanout_slab *slab;
+		int i;
+
+		if (!(slab = malloc(sizeof(*slab))))
+			return NULL;
+		slab->next = t->slabs;
+		t->slabs = slab;
+		for (i = 0; i < FANOUT_SLAB_ENTRIES; i++) {
+			slab->entries[i].next = t->free_entries;
+			t->free_entries = &slab->entries[i];
+		}
+	}
+
+	entry = t->free_entries;
+	t->free_entries = entry->next;
+	return entry;
+}
+
+static inline void fanout_entry_free(fanout_table *t, struct fanout_entry *entry)
+{
+	entry->data = NULL;
+	entry->next = t->free_entries;
+	t->free_entries = entry;
+}
+
+/*
+ * Double the number of slots. Entries that share a key must keep
+ * their order so fanout_remove() keeps taking the latest one first,
+ * so each chain is split in two by appending to the new chains
+ * rather than pushing onto them.
+ */
+static void fanout_grow(fanout_table *t)
+{
+	struct fanout_entry **entries, *entry, *next;
+	unsigned long i, alloc = t->alloc << 1;
+
+	if (!alloc || t->shift <= 1)
+		return;
+
+	/* not being able to grow only means longer chains */
+	if (!(entries = calloc(alloc, sizeof(struct fanout_entry *))))
+		return;
+
+	/* slot i is split into slots 2i and 2i+1 */
+	t->shift--;
+	for (i = 0; i < t->alloc; i++) {
+		struct fanout_entry **tail[2] = { &entries[i << 1], &entries[(i << 1) + 1] };
+
+		for (entry = t->entries[i]; entry; entry = next) {
+			int x = fanout_slot(t, entry->key) & 1;
+
+			next = entry->next;
+			entry->next = NULL;
+			*tail[x] = entry;
+			tail[x] = &entry->next;
+		}
+	}
+	free(t->entries);
+	t->entries = entries;
+	t->alloc = alloc;
+}
+
 int fanout_add(struct fanout_table *t, unsigned long key, void *data)
 {
 	struct fanout_entry *entry;
+	unsigned long slot;
+
 	if (!t || !t->entries || !t->alloc || !data)
 		return -1;
 
-	entry = calloc(1, sizeof(*entry));
+	entry = fanout_entry_alloc(t);
 	if (!entry)
 		return -1;
 
+	if (t->num_entries >= t->alloc)
+		fanout_grow(t);
+
+	slot = fanout_slot(t, key);
+	if (t->entries[slot])
+		t->collisions++;
+
 	entry->key = key;
 	entry->data = data;
-	entry->next = t->entries[key % t->alloc];
-	t->entries[key % t->alloc] = entry;
+	entry->next = t->entries[slot];
+	t->entries[slot] = entry;
+	t->num_entries++;
 
 	return 0;
 }
@@ -75,13 +209,11 @@ int fanout_add(struct fanout_table *t, unsigned long key, void *data)
 void *fanout_get(fanout_table *t, unsigned long key)
 {
 	struct fanout_entry *entry;
-	unsigned long slot;
 
 	if (!t || !t->entries || !t->alloc)
 		return NULL;
 
-	slot = key % t->alloc;
-	for (entry = t->entries[slot]; entry; entry = entry->next) {
+	for (entry = t->entries[fanout_slot(t, key)]; entry; entry = entry->next) {
 		if (entry->key == key)
 			return entry->data;
 	}
@@ -97,7 +229,7 @@ void *fanout_remove(fanout_table *t, unsigned long key)
 	if (!t || !t->entries || !t->alloc)
 		return NULL;
 
-	slot = key % t->alloc;
+	slot = fanout_slot(t, key);
 	for (entry = t->entries[slot]; entry; prev = entry, entry = next) {
 		next = entry->next;
 		if (entry->key == key) {
@@ -107,7 +239,8 @@ void *fanout_remove(fanout_table *t, unsigned long key)
 			} else {
 				t->entries[slot] = entry->next;
 			}
-			free(entry);
+			fanout_entry_free(t, entry);
+			t->num_entries--;
 			return data;
 		}
 	}
@@ -27,7 +27,9 @@ typedef struct fanout_table fanout_table;
 
 /**
  * Create a fanout table
- * @param[in] size The size of the table. Preferrably a power of 2
+ * The size gets rounded up to the nearest power of 2, and the table
+ * doubles in size whenever it holds more entries than it has slots.
+ * @param[in] size The initial size of the table
  * @return Pointer to a newly created table
  */
 extern fanout_table *fanout_create(unsigned long size);
@@ -73,6 +75,28 @@ extern int fanout_add(fanout_table *t, unsigned long key, void *data);
  * @return Pointer to the data stored on success; NULL on errors
  */
 extern void *fanout_remove(fanout_table *t, unsigned long key);
+
+/**
+ * Get number of entries in the fanout table
+ * @param[in] t The fanout table
+ * @return Number of entries currently in the table
+ */
+extern unsigned long fanout_num_entries(fanout_table *t);
+
+/**
+ * Get the current size of the fanout table (in number of slots)
+ * @param[in] t The fanout table
+ * @return Number of slots in the table
+ */
+extern unsigned long fanout_table_size(fanout_table *t);
+
+/**
+ * Get number of collisions in the fanout table
+ * An add collides when the slot its key maps to is already in use.
+ * @param[in] t The fanout table
+ * @return The total number of collisions from adds
+ */
+extern unsigned long fanout_collisions(fanout_table *t);
 NAGIOS_END_DECL
 /** @} */
 #endif
@@ -424,7 +424,7 @@ int iobroker_poll(iobroker_set *iobs, int timeout)
 			if (!iobs->iobroker_fds[i])
 				continue;
 			iobs->pfd[p].fd = iobs->iobroker_fds[i]->fd;
-			iobs->pfd[p].events = POLLIN;
+			iobs->pfd[p].events = iobs->iobroker_fds[i]->events;
 			p++;
 		}
 		nfds = poll(iobs->pfd, iobs->num_fds, timeout);
@@ -433,7 +433,7 @@ int iobroker_poll(iobroker_set *iobs, int timeout)
 		}
 		for (i = 0; i < iobs->num_fds; i++) {
 			iobroker_fd *s;
-			if ((iobs->pfd[i].revents & POLLIN) != POLLIN) {
+			if (!(iobs->pfd[i].revents & (iobs->pfd[i].events | POLLHUP | POLLERR))) {
 				continue;
 			}
 
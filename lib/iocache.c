@@ -4,11 +4,26 @@
 #include <string.h>
 #include <errno.h>
 
+/*
+ * Unread data lives between ioc_offset and ioc_buflen. Rather than
+ * moving it to the start of the buffer every time more data comes in,
+ * we only move it when it's smaller than what's been used up before
+ * it, or when there's no room left at the end. Moving is then never
+ * more work than what's been consumed since the last move, so the
+ * tail of a large message that trickles in isn't copied over and
+ * over, while the leftovers of small messages still get moved to the
+ * start of the buffer, where they stay in the cpu cache.
+ *
+ * ioc_scanned is where iocache_use_delim() gave up looking for a
+ * delimiter, so a large message trickling in a little at a time is
+ * only scanned once instead of once per read.
+ */
 struct iocache {
 	char *ioc_buf; /* the data */
 	unsigned long ioc_offset; /* where we're reading in the buffer */
 	unsigned long ioc_buflen; /* the amount of data read into the buffer */
 	unsigned long ioc_bufsize; /* size of the buffer */
+	unsigned long ioc_scanned; /* no delimiter starts before this */
 };
 
 void iocache_destroy(iocache *ioc)
@@ -41,14 +56,22 @@ static inline void iocache_move_data(iocache *ioc)
 	}
 	available = ioc->ioc_buflen - ioc->ioc_offset;
 	memmove(ioc->ioc_buf, ioc->ioc_buf + ioc->ioc_offset, available);
+	ioc->ioc_scanned = ioc->ioc_scanned > ioc->ioc_offset ? ioc->ioc_scanned - ioc->ioc_offset : 0;
 	ioc->ioc_offset = 0;
 	ioc->ioc_buflen = available;
 }
 
+/* make room for 'len' more bytes at the end, if the buffer can hold them */
+static inline void iocache_make_room(iocache *ioc, unsigned long len)
+{
+	if (ioc->ioc_offset > ioc->ioc_buflen - ioc->ioc_offset || ioc->ioc_bufsize - ioc->ioc_buflen < len)
+		iocache_move_data(ioc);
+}
+
 void iocache_reset(iocache *ioc)
 {
 	if (ioc)
-		ioc->ioc_offset = ioc->ioc_buflen = 0;
+		ioc->ioc_offset = ioc->ioc_buflen = ioc->ioc_scanned = 0;
 }
 
 int iocache_resize(iocache *ioc, unsigned long new_size)
@@ -83,9 +106,7 @@ unsigned long iocache_capacity(iocache *ioc)
 	if (!ioc || !ioc->ioc_buf || !ioc->ioc_bufsize)
 		return 0;
 
-	iocache_move_data(ioc);
-
-	return ioc->ioc_bufsize - ioc->ioc_buflen;
+	return ioc->ioc_bufsize - (ioc->ioc_buflen - ioc->ioc_offset);
 }
 
 unsigned long iocache_available(iocache *ioc)
@@ -119,6 +140,8 @@ int iocache_unuse_size(iocache *ioc, unsigned long size)
 		return -1;
 
 	ioc->ioc_offset -= size;
+	/* there may be delimiters in what we just got back */
+	ioc->ioc_scanned = ioc->ioc_offset;
 
 	return 0;
 }
@@ -126,9 +149,7 @@ int iocache_unuse_size(iocache *ioc, unsigned long size)
 
 char *iocache_use_delim(iocache *ioc, const char *delim, size_t delim_len, unsigned long *size)
 {
-	char *ptr = NULL;
-	char *buf;
-	unsigned long remains;
+	char *ptr, *buf, *end;
 
 	if (!ioc || !ioc->ioc_buf || !ioc->ioc_bufsize || !ioc->ioc_buflen)
 		return NULL;
@@ -138,28 +159,27 @@ char *iocache_use_delim(iocache *ioc, const char *delim, size_t delim_len, unsig
 		iocache_move_data(ioc);
 		return NULL;
 	}
+	if (!delim_len || iocache_available(ioc) < delim_len)
+		return NULL;
 
-	buf = &ioc->ioc_buf[ioc->ioc_offset];
-	remains = iocache_available(ioc);
-	while (remains >= delim_len) {
-		unsigned long jump;
-		ptr = memchr(buf, *delim, remains - (delim_len - 1));
-		if (!ptr) {
-			return NULL;
-		}
+	/* pick up where the last unsuccessful search left off */
+	buf = &ioc->ioc_buf[ioc->ioc_scanned > ioc->ioc_offset ? ioc->ioc_scanned : ioc->ioc_offset];
+	/* the last place a complete delimiter can start, plus one */
+	end = &ioc->ioc_buf[ioc->ioc_buflen - (delim_len - 1)];
+	while (buf < end) {
+		ptr = memchr(buf, *delim, end - buf);
+		if (!ptr)
+			break;
 		if (delim_len == 1 || !memcmp(ptr, delim, delim_len)) {
-			unsigned long ioc_start;
-
-			ioc_start = (unsigned long)ioc->ioc_buf + ioc->ioc_offset;
-			*size = (unsigned long)ptr - ioc_start;
+			*size = ptr - &ioc->ioc_buf[ioc->ioc_offset];
 
 			/* make sure we use up all of the delimiter as well */
 			return iocache_use_size(ioc, delim_len + *size);
 		}
-		jump = 1 + (unsigned long)ptr - (unsigned long)buf;
-		remains -= jump;
-		buf += jump;
+		buf = ptr + 1;
 	}
+
+	ioc->ioc_scanned = end - ioc->ioc_buf;
 	return NULL;
 }
 
@@ -187,8 +207,8 @@ int iocache_read(iocache *ioc, int fd)
 	if (!ioc || !ioc->ioc_buf || fd < 0)
 		return -1;
 
-	/* we make sure we've got as much room as possible */
-	iocache_move_data(ioc);
+	/* only move data if that buys us a reasonable amount of room */
+	iocache_make_room(ioc, 1);
 
 	/* calculate the size we should read */
 	to_read = ioc->ioc_bufsize - ioc->ioc_buflen;
@@ -207,6 +227,7 @@ int iocache_add(iocache *ioc, char *buf, unsigned int len)
 	if (!ioc || iocache_capacity(ioc) < len)
 		return -1;
 
+	iocache_make_room(ioc, len);
 	memcpy(ioc->ioc_buf + ioc->ioc_buflen, buf, len);
 	ioc->ioc_buflen += len;
 	return ioc->ioc_buflen - ioc->ioc_offset;
@@ -10,9 +10,24 @@
  * around in the key/value vector.
  */
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include "kvvec.h"
 
+/*
+ * Values added by the typed helpers are formatted into numbuf, which
+ * has one KVVEC_NUMBUF_SIZE slot per key/value slot and grows along
+ * with the kv array. These tell us if a value lives there, so it's
+ * never passed to free() and gets moved along when numbuf moves.
+ */
+#define numbuf_slot(kvv, i) ((kvv)->numbuf + ((size_t)(i) * KVVEC_NUMBUF_SIZE))
+static inline int in_numbuf(const char *numbuf, int alloc, const char *value)
+{
+	uintptr_t p = (uintptr_t)value, start = (uintptr_t)numbuf;
+
+	return numbuf && p >= start && p < start + (uintptr_t)alloc * KVVEC_NUMBUF_SIZE;
+}
+
 struct kvvec *kvvec_init(struct kvvec *kvv, int hint)
 {
 	if (!kvv)
@@ -45,6 +60,21 @@ int kvvec_resize(struct kvvec *kvv, int hint)
 	if (hint <= kvv->kv_alloc)
 		return 0;
 
+	if (kvv->numbuf) {
+		char *numbuf = malloc((size_t)hint * KVVEC_NUMBUF_SIZE);
+		int i;
+
+		if (!numbuf)
+			return -1;
+		memcpy(numbuf, kvv->numbuf, (size_t)kvv->kv_alloc * KVVEC_NUMBUF_SIZE);
+		for (i = 0; i < kvv->kv_pairs; i++) {
+			if (in_numbuf(kvv->numbuf, kvv->kv_alloc, kvv->kv[i].value))
+				kvv->kv[i].value = numbuf + (kvv->kv[i].value - kvv->numbuf);
+		}
+		free(kvv->numbuf);
+		kvv->numbuf = numbuf;
+	}
+
 	kv = realloc(kvv->kv, sizeof(struct key_value) * hint);
 	if (!kv)
 		return -1;
@@ -101,6 +131,134 @@ int kvvec_addkv_wlen(struct kvvec *kvv, const char *key, int keylen, const char
 	return 0;
 }
 
+/* formats v backwards from end, returning a pointer to the first digit */
+static inline char *fmt_ulong(char *end, unsigned long v)
+{
+	do {
+		*--end = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	return end;
+}
+
+/*
+ * Adds key with an empty value and hands back the numbuf slot the
+ * caller should format the value in
+ */
+static char *kvvec_add_numslot(struct kvvec *kvv, const char *key)
+{
+	if (kvvec_addkv_wlen(kvv, key, 0, NULL, 0) < 0)
+		return NULL;
+
+	if (!kvv->numbuf && !(kvv->numbuf = malloc((size_t)kvv->kv_alloc * KVVEC_NUMBUF_SIZE))) {
+		kvv->kv_pairs--;
+		return NULL;
+	}
+	return numbuf_slot(kvv, kvv->kv_pairs - 1);
+}
+
+static void kvvec_set_numslot(struct kvvec *kvv, char *slot, const char *start, const char *end)
+{
+	struct key_value *kv = &kvv->kv[kvv->kv_pairs - 1];
+
+	kv->value_len = end - start;
+	memmove(slot, start, kv->value_len);
+	slot[kv->value_len] = 0;
+	kv->value = slot;
+}
+
+int kvvec_addkv_long(struct kvvec *kvv, const char *key, long value)
+{
+	char buf[KVVEC_NUMBUF_SIZE], *end = buf + sizeof(buf), *p;
+	char *slot = kvvec_add_numslot(kvv, key);
+
+	if (!slot)
+		return -1;
+
+	/* negate as unsigned, so LONG_MIN works too */
+	p = fmt_ulong(end, value < 0 ? 0UL - (unsigned long)value : (unsigned long)value);
+	if (value < 0)
+		*--p = '-';
+	kvvec_set_numslot(kvv, slot, p, end);
+	return 0;
+}
+
+int kvvec_addkv_tv(struct kvvec *kvv, const char *key, const struct timeval *tv)
+{
+	char buf[KVVEC_NUMBUF_SIZE], *end = buf + sizeof(buf), *p;
+	char *slot = kvvec_add_numslot(kvv, key);
+	long sec = (long)tv->tv_sec;
+	int i;
+
+	if (!slot)
+		return -1;
+
+	/* same as "%ld.%06ld" */
+	p = fmt_ulong(end, (unsigned long)tv->tv_usec);
+	for (i = end - p; i < 6; i++)
+		*--p = '0';
+	*--p = '.';
+	p = fmt_ulong(p, sec < 0 ? 0UL - (unsigned long)sec : (unsigned long)sec);
+	if (sec < 0)
+		*--p = '-';
+	kvvec_set_numslot(kvv, slot, p, end);
+	return 0;
+}
+
+int kvvec_value_long(const struct key_value *kv, long *value)
+{
+	const char *p, *end;
+	unsigned long v = 0;
+	int neg = 0;
+
+	*value = 0;
+	if (!kv || !kv->value || !kv->value_len)
+		return -1;
+
+	p = kv->value;
+	end = p + kv->value_len;
+	if (*p == '-' || *p == '+')
+		neg = *p++ == '-';
+	if (p == end)
+		return -1;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+		v = v * 10 + (*p - '0');
+
+	*value = neg ? (long)(0UL - v) : (long)v;
+	return p == end ? 0 : -1;
+}
+
+int kvvec_value_tv(const struct key_value *kv, struct timeval *tv)
+{
+	const char *p, *end;
+	unsigned long sec = 0, usec = 0;
+	int digits = 0;
+
+	tv->tv_sec = tv->tv_usec = 0;
+	if (!kv || !kv->value || !kv->value_len)
+		return -1;
+
+	p = kv->value;
+	end = p + kv->value_len;
+	if (*p < '0' || *p > '9')
+		return -1;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+		sec = sec * 10 + (*p - '0');
+
+	if (p < end && (*p == '.' || *p == ',')) {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+			if (digits++ < 6)
+				usec = usec * 10 + (*p - '0');
+		}
+		for (; digits < 6; digits++)
+			usec *= 10;
+	}
+
+	tv->tv_sec = sec;
+	tv->tv_usec = usec;
+	return 0;
+}
+
 static int kv_compare(const void *a_, const void *b_)
 {
 	const struct key_value *a = (const struct key_value *)a_;
@@ -149,7 +307,8 @@ void kvvec_free_kvpairs(struct kvvec *kvv, int flags)
 	if (flags == KVVEC_FREE_ALL) {
 		for (i = 0; i < kvv->kv_pairs; i++) {
 			free(kvv->kv[i].key);
-			free(kvv->kv[i].value);
+			if (!in_numbuf(kvv->numbuf, kvv->kv_alloc, kvv->kv[i].value))
+				free(kvv->kv[i].value);
 		}
 	} else if (flags == KVVEC_FREE_KEYS) {
 		for (i = 0; i < kvv->kv_pairs; i++) {
@@ -157,7 +316,8 @@ void kvvec_free_kvpairs(struct kvvec *kvv, int flags)
 		}
 	} else if (flags == KVVEC_FREE_VALUES) {
 		for (i = 0; i < kvv->kv_pairs; i++) {
-			free(kvv->kv[i].value);
+			if (!in_numbuf(kvv->numbuf, kvv->kv_alloc, kvv->kv[i].value))
+				free(kvv->kv[i].value);
 		}
 	}
 
@@ -182,6 +342,7 @@ char *kvvec_get_value(struct kvvec *kvv, const char *key)
 int kvvec_destroy(struct kvvec *kvv, int flags)
 {
 	kvvec_free_kvpairs(kvv, flags);
+	free(kvv->numbuf);
 	free(kvv->kv);
 	free(kvv);
 	return 0;
@@ -191,48 +352,77 @@ int kvvec_destroy(struct kvvec *kvv, int flags)
  * Caller can tell us to over-allocate the buffer if he/she wants
  * to put extra stuff at the end of it.
  */
-struct kvvec_buf *kvvec2buf(struct kvvec *kvv, char kv_sep, char pair_sep, int overalloc)
+int kvvec2buf_prealloc(struct kvvec *kvv, struct kvvec_buf *kvvb, char kv_sep, char pair_sep, int overalloc)
 {
-	struct kvvec_buf *kvvb;
 	int i;
-	unsigned long len = 0;
+	unsigned long len = 0, bufsize;
+	char *buf;
 
-	if (!kvv)
-		return NULL;
-
-	kvvb = malloc(sizeof(struct kvvec_buf));
-	if (!kvvb)
-		return NULL;
+	if (!kvv || !kvvb)
+		return -1;
 
 	/* overalloc + (kv_sep_size * kv_pairs) + (pair_sep_size * kv_pairs) */
-	kvvb->bufsize = overalloc + (kvv->kv_pairs * 2);
+	bufsize = overalloc + (kvv->kv_pairs * 2);
 	for (i = 0; i < kvv->kv_pairs; i++) {
 		struct key_value *kv = &kvv->kv[i];
-		kvvb->bufsize += kv->key_len + kv->value_len;
+		bufsize += kv->key_len + kv->value_len;
 	}
 
-	kvvb->buf = malloc(kvvb->bufsize);
-	if (!kvvb->buf) {
-		free(kvvb);
-		return NULL;
+	if (bufsize > kvvb->alloc || !kvvb->buf) {
+		unsigned long alloc = kvvb->alloc * 2;
+
+		if (alloc < bufsize)
+			alloc = bufsize;
+		if (!(buf = realloc(kvvb->buf, alloc)))
+			return -1;
+		kvvb->buf = buf;
+		kvvb->alloc = alloc;
 	}
 
+	buf = kvvb->buf;
 	for (i = 0; i < kvv->kv_pairs; i++) {
 		struct key_value *kv = &kvv->kv[i];
-		memcpy(kvvb->buf + len, kv->key, kv->key_len);
+		memcpy(buf + len, kv->key, kv->key_len);
 		len += kv->key_len;
-		kvvb->buf[len++] = kv_sep;
+		buf[len++] = kv_sep;
 		if (kv->value_len) {
-			memcpy(kvvb->buf + len, kv->value, kv->value_len);
+			memcpy(buf + len, kv->value, kv->value_len);
 			len += kv->value_len;
 		}
-		kvvb->buf[len++] = pair_sep;
+		buf[len++] = pair_sep;
 	}
-	memset(kvvb->buf + len, 0, kvvb->bufsize - len);
+	memset(buf + len, 0, bufsize - len);
 	kvvb->buflen = len;
+	kvvb->bufsize = bufsize;
+	return 0;
+}
+
+struct kvvec_buf *kvvec2buf(struct kvvec *kvv, char kv_sep, char pair_sep, int overalloc)
+{
+	struct kvvec_buf *kvvb;
+
+	if (!kvv)
+		return NULL;
+
+	kvvb = calloc(1, sizeof(struct kvvec_buf));
+	if (!kvvb)
+		return NULL;
+
+	if (kvvec2buf_prealloc(kvv, kvvb, kv_sep, pair_sep, overalloc) < 0) {
+		free(kvvb);
+		return NULL;
+	}
 	return kvvb;
 }
 
+void kvvec_buf_destroy(struct kvvec_buf *kvvb)
+{
+	if (!kvvb)
+		return;
+	free(kvvb->buf);
+	free(kvvb);
+}
+
 unsigned int kvvec_capacity(struct kvvec *kvv)
 {
 	if (!kvv)
@@ -246,65 +436,48 @@ unsigned int kvvec_capacity(struct kvvec *kvv)
  * This requires a fairly rigid format in the input data to be of
  * much use, but it's nifty for ipc where only computers are
  * involved, and it will parse the kvvec2buf() produce nicely.
+ *
+ * The buffer is parsed in a single pass, growing the vector when
+ * needed, so a vector that's reused for a stream of messages stops
+ * allocating once it has seen the largest one.
  */
 int buf2kvvec_prealloc(struct kvvec *kvv, char *str,
                        unsigned int len, const char kvsep,
                        const char pair_sep, int flags)
 {
-	unsigned int num_pairs = 0, i, offset = 0;
+	unsigned int offset = 0;
+	int pairs = 0;
 
 	if (!str || !len || !kvv)
 		return -1;
 
-	/* first we count the number of key/value pairs */
-	while (offset < len) {
-		const char *ptr;
-
-		/* keys can't start with nul bytes */
-		if (*(str + offset)) {
-			num_pairs++;
-		}
-
-		ptr = memchr(str + offset, pair_sep, len - offset);
-		ptr++;
-		if (!ptr)
-			break;
-		offset += (unsigned long)ptr - ((unsigned long)str + offset);
-	}
-
-	if (!num_pairs) {
-		return 0;
-	}
-
-	/* make sure the key/value vector is large enough */
 	if (!(flags & KVVEC_APPEND)) {
-		kvvec_init(kvv, num_pairs);
-	} else if (kvvec_capacity(kvv) < num_pairs && kvvec_resize(kvv, num_pairs) < 0) {
-		return -1;
+		kvvec_init(kvv, 0);
 	}
 
-	offset = 0;
-	for (i = 0; i < num_pairs; i++) {
+	while (offset < len) {
 		struct key_value *kv;
 		char *key_end_ptr, *kv_end_ptr;
 
 		/* keys can't begin with nul bytes */
-		if (offset && str[offset] == '\0') {
-			return kvv->kv_pairs;
+		if (str[offset] == '\0') {
+			break;
 		}
 
 		key_end_ptr = memchr(str + offset, kvsep, len - offset);
 		if (!key_end_ptr) {
 			break;
 		}
-		kv_end_ptr = memchr(key_end_ptr + 1, pair_sep, len - ((unsigned long)key_end_ptr - (unsigned long)str));
+		kv_end_ptr = memchr(key_end_ptr + 1, pair_sep, len - ((unsigned long)key_end_ptr + 1 - (unsigned long)str));
 		if (!kv_end_ptr) {
-			if (i != num_pairs - 1)
-				break;
 			/* last pair doesn't need a pair separator */
 			kv_end_ptr = str + len;
 		}
 
+		if (kvv->kv_pairs >= kvv->kv_alloc && kvvec_grow(kvv, 0) < 0) {
+			return -1;
+		}
+
 		kv = &kvv->kv[kvv->kv_pairs++];
 		kv->key_len = (unsigned long)key_end_ptr - ((unsigned long)str + offset);
 		if (flags & KVVEC_COPY) {
@@ -317,15 +490,14 @@ int buf2kvvec_prealloc(struct kvvec *kvv, char *str,
 
 		offset += kv->key_len + 1;
 
-		if (str[offset] == pair_sep) {
-			kv->value_len = 0;
+		kv->value_len = (unsigned long)kv_end_ptr - ((unsigned long)str + offset);
+		if (!kv->value_len) {
 			if (flags & KVVEC_COPY) {
 				kv->value = strdup("");
 			} else {
 				kv->value = (char *)"";
 			}
 		} else {
-			kv->value_len = (unsigned long)kv_end_ptr - ((unsigned long)str + offset);
 			if (flags & KVVEC_COPY) {
 				kv->value = malloc(kv->value_len + 1);
 				memcpy(kv->value, str + offset, kv->value_len);
@@ -336,9 +508,11 @@ int buf2kvvec_prealloc(struct kvvec *kvv, char *str,
 		}
 
 		offset += kv->value_len + 1;
+		pairs++;
 	}
+	kvv->kvv_sorted = 0;
 
-	return i;
+	return pairs;
 }
 
 struct kvvec *buf2kvvec(char *str, unsigned int len, const char kvsep,
@@ -353,6 +527,6 @@ struct kvvec *buf2kvvec(char *str, unsigned int len, const char kvsep,
 	if (buf2kvvec_prealloc(kvv, str, len, kvsep, pair_sep, flags) >= 0)
 		return kvv;
 
-	free(kvv);
+	kvvec_destroy(kvv, 0);
 	return NULL;
 }
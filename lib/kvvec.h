@@ -5,6 +5,7 @@
 #error "Only <naemon/naemon.h> can be included directly."
 #endif
 
+#include <sys/time.h>
 #include "lnae-utils.h"
 
 NAGIOS_BEGIN_DECL
@@ -38,8 +39,12 @@ struct kvvec_buf {
 	char *buf;             /**< The buffer */
 	unsigned long buflen;  /**< Length of buffer */
 	unsigned long bufsize; /**< Size of buffer (includes overalloc) */
+	unsigned long alloc;   /**< Allocated size, used by kvvec2buf_prealloc() */
 };
 
+/** Initializer for kvvec_bufs that are reused with kvvec2buf_prealloc() */
+#define KVVEC_BUF_INITIALIZER { NULL, 0, 0, 0 }
+
 /**
  * key/value vector struct
  * This is the main component of the kvvec library
@@ -51,10 +56,17 @@ struct kvvec {
 	int kv_alloc;         /**< Allocated size of key/value array */
 	int kv_pairs;         /**< Number of key/value pairs */
 	int kvv_sorted;        /**< Determines if this kvvec has been sorted */
+	char *numbuf;         /**< Storage for values added by the typed helpers */
 };
 
 /** Portable initializer for stack-allocated key/value vectors */
-#define KVVEC_INITIALIZER { NULL, 0, 0, 0 }
+#define KVVEC_INITIALIZER { NULL, 0, 0, 0, NULL }
+
+/**
+ * Longest value the typed helpers produce (a timeval formatted as
+ * "seconds.microseconds"), including the terminating nul byte
+ */
+#define KVVEC_NUMBUF_SIZE 32
 
 /** Parameters for kvvec_destroy() */
 #define KVVEC_FREE_KEYS   1 /**< Free keys when destroying a kv vector */
@@ -141,6 +153,49 @@ extern int kvvec_addkv_wlen(struct kvvec *kvv, const char *key, int keylen, cons
  */
 #define kvvec_addkv(kvv, key, value) kvvec_addkv_wlen(kvv, key, 0, value, 0)
 
+/**
+ * Add a key and a signed integer value to a key/value vector.
+ * The number is formatted in storage that belongs to the vector,
+ * so there's no need for mkstr() or any other buffer that has to
+ * outlive the call, and no printf() machinery is involved.
+ * @param kvv The key/value vector to add this key/value pair to
+ * @param key The key
+ * @param value The value
+ * @return 0 on success, < 0 on errors
+ */
+extern int kvvec_addkv_long(struct kvvec *kvv, const char *key, long value);
+
+/**
+ * Add a key and a timeval, formatted as "seconds.microseconds",
+ * to a key/value vector. See kvvec_addkv_long().
+ * @param kvv The key/value vector to add this key/value pair to
+ * @param key The key
+ * @param tv The value
+ * @return 0 on success, < 0 on errors
+ */
+extern int kvvec_addkv_tv(struct kvvec *kvv, const char *key, const struct timeval *tv);
+
+/**
+ * Parse the value of a key/value pair as a signed decimal integer.
+ * Unlike strtol(), this only looks at the value_len bytes of the
+ * value and never consults the locale.
+ * @param[in] kv The key/value pair to parse
+ * @param[out] value Where to store the result
+ * @return 0 if the entire value was a number, < 0 otherwise. On
+ *         errors, value holds whatever could be parsed.
+ */
+extern int kvvec_value_long(const struct key_value *kv, long *value);
+
+/**
+ * Parse the value of a key/value pair as a timeval, the way
+ * kvvec_addkv_tv() formats it. A comma is accepted in place of the
+ * dot, and the fraction is read as the decimal fraction of a second.
+ * @param[in] kv The key/value pair to parse
+ * @param[out] tv Where to store the result
+ * @return 0 on success, < 0 on errors, in which case tv is zeroed
+ */
+extern int kvvec_value_tv(const struct key_value *kv, struct timeval *tv);
+
 /**
  * Walk each key/value pair in a key/value vector, sending them
  * as arguments to a callback function. The callback function has
@@ -182,10 +237,10 @@ char *kvvec_get_value(struct kvvec *kvv, const char *key);
 
 /**
  * Create a linear buffer of all the key/value pairs and
- * return it as a kvvec_buf. The caller must free() all
- * pointers in the returned kvvec_buf
- * (FIXME: add kvvec_buf_destroy(), or move this and its counterpart
- * out of the kvvec api into a separate one)
+ * return it as a kvvec_buf. The caller must release it with
+ * kvvec_buf_destroy() (or free() both the buffer and the struct).
+ * Code sending a stream of messages should use kvvec2buf_prealloc()
+ * instead.
  *
  * @param kvv The key/value vector to convert
  * @param kv_sep Character separating keys and their values
@@ -197,6 +252,27 @@ char *kvvec_get_value(struct kvvec *kvv, const char *key);
  */
 extern struct kvvec_buf *kvvec2buf(struct kvvec *kvv, char kv_sep, char pair_sep, int overalloc);
 
+/**
+ * Like kvvec2buf(), but builds the buffer in a kvvec_buf owned by
+ * the caller, whose memory is reused and only grows when a message
+ * doesn't fit. A kvvec_buf used with this function must start out
+ * as KVVEC_BUF_INITIALIZER, and its buf must eventually be free()'d
+ * by the caller.
+ * @param kvv The key/value vector to convert
+ * @param kvvb The buffer to build it in
+ * @param kv_sep Character separating keys and their values
+ * @param pair_sep Character separating key/value pairs
+ * @param overalloc Number of extra nul bytes to put at the end
+ * @return 0 on success, < 0 on errors
+ */
+extern int kvvec2buf_prealloc(struct kvvec *kvv, struct kvvec_buf *kvvb, char kv_sep, char pair_sep, int overalloc);
+
+/**
+ * Destroy a kvvec_buf returned by kvvec2buf()
+ * @param kvvb The kvvec_buf to destroy
+ */
+extern void kvvec_buf_destroy(struct kvvec_buf *kvvb);
+
 /**
  * Create a key/value vector from a pre-parsed buffer. Immensely
  * useful for ipc in combination with kvvec2buf().
@@ -81,7 +81,12 @@ int nsock_unix(const char *path, unsigned int flags)
 	if (flags & NSOCK_UDP)
 		return sock;
 
-	if (listen(sock, 3) < 0) {
+	/*
+	 * Let the kernel queue as many connections as it's willing to,
+	 * so a burst of clients connecting at once isn't turned away
+	 * before we get around to accepting them.
+	 */
+	if (listen(sock, SOMAXCONN) < 0) {
 		close(sock);
 		return NSOCK_ELISTEN;
 	}
@@ -89,16 +94,37 @@ int nsock_unix(const char *path, unsigned int flags)
 	return sock;
 }
 
+static int (*nsock_output_hook)(int, const void *, size_t);
+
+void nsock_set_output_hook(int (*hook)(int sd, const void *buf, size_t len))
+{
+	nsock_output_hook = hook;
+}
+
 static inline int nsock_vdprintf(int sd, const char *fmt, va_list ap, int plus)
 {
-	char *buf = NULL;
+	char sbuf[1024], *buf = sbuf;
+	va_list ap2;
 	int len, ret;
 
-	len = vasprintf(&buf, fmt, ap);
+	/* most messages are short, so try to get by without malloc() */
+	va_copy(ap2, ap);
+	len = vsnprintf(sbuf, sizeof(sbuf), fmt, ap2);
+	va_end(ap2);
 	if (len < 0)
 		return len;
-	ret = write(sd, buf, len + plus);
-	free(buf);
+	if ((size_t)len >= sizeof(sbuf)) {
+		buf = NULL;
+		len = vasprintf(&buf, fmt, ap);
+		if (len < 0)
+			return len;
+	}
+	if (nsock_output_hook && !nsock_output_hook(sd, buf, len + plus))
+		ret = len + plus;
+	else
+		ret = write(sd, buf, len + plus);
+	if (buf != sbuf)
+		free(buf);
 	return ret;
 }
 
@@ -133,6 +159,10 @@ int nsock_write_all(int fd, const void *buf, size_t nbyte)
 {
 	size_t c = 0;
 	int ret = 0;
+
+	if (nsock_output_hook && !nsock_output_hook(fd, buf, nbyte))
+		return 0;
+
 	while ( c < nbyte ) {
 		ret = write(fd, (char *) buf + c, nbyte - c);
 		if (ret < 0) {
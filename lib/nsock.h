@@ -87,6 +87,18 @@ extern int nsock_printf(int sd, const char *fmt, ...)
  */
 int nsock_write_all(int fd, const void *buf, size_t nbyte);
 
+/**
+ * Give a function first pick at everything nsock_printf(),
+ * nsock_printf_nul() and nsock_write_all() are asked to write.
+ * This lets a server buffer the output of handlers that write
+ * straight to a client's socket, instead of blocking on it.
+ * The hook gets the socket and the complete message. If it returns
+ * 0, the message is considered written. Any other return value
+ * means it's written to the socket as if there was no hook.
+ * @param hook The function to call, or NULL to remove the hook
+ */
+extern void nsock_set_output_hook(int (*hook)(int sd, const void *buf, size_t len));
+
 NAGIOS_END_DECL
 
 /** @} */
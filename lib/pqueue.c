@@ -162,12 +162,41 @@ pqueue_insert(pqueue_t *q, void *d)
 	/* insert item */
 	i = q->size++;
 	q->d[i] = d;
-	bubble_up(q, i);
+	if (q->bulk)
+		q->setpos(d, i);
+	else
+		bubble_up(q, i);
 
 	return 0;
 }
 
 
+void
+pqueue_bulk_begin(pqueue_t *q)
+{
+	if (q)
+		q->bulk = 1;
+}
+
+
+/*
+ * Floyd's method: sifting down every node that has children, from
+ * the last one up to the root, turns any array into a heap in O(n)
+ */
+void
+pqueue_bulk_end(pqueue_t *q)
+{
+	unsigned int i;
+
+	if (!q || !q->bulk)
+		return;
+
+	q->bulk = 0;
+	for (i = parent(q->size - 1); i >= 1; i--)
+		percolate_down(q, i);
+}
+
+
 void
 pqueue_change_priority(pqueue_t *q, pqueue_pri_t new_pri, void *d)
 {
@@ -189,6 +218,10 @@ pqueue_remove(pqueue_t *q, void *d)
 {
 	unsigned int posn = q->getpos(d);
 	q->d[posn] = q->d[--q->size];
+	if (q->bulk) {
+		q->setpos(q->d[posn], posn);
+		return 0;
+	}
 	if (q->cmppri(q->getpri(d), q->getpri(q->d[posn]))) {
 		bubble_up(q, posn);
 	} else {
@@ -208,6 +241,7 @@ pqueue_pop(pqueue_t *q)
 		return NULL;
 	}
 
+	pqueue_bulk_end(q);
 	head = q->d[1];
 	q->d[1] = q->d[--q->size];
 	percolate_down(q, 1);
@@ -222,9 +256,22 @@ pqueue_peek(pqueue_t *q)
 	if (!q || q->size == 1) {
 		return NULL;
 	}
+	pqueue_bulk_end(q);
 	return q->d[1];
 }
 
+
+void
+pqueue_walk(pqueue_t *q, void (*walker)(void *d, void *arg), void *arg)
+{
+	unsigned int i;
+
+	if (!q)
+		return;
+	for (i = 1; i < q->size; i++)
+		walker(q->d[i], arg);
+}
+
 #if 0
 void
 pqueue_dump(pqueue_t *q, FILE *out, pqueue_print_entry_f print)
@@ -81,6 +81,7 @@ typedef struct pqueue_t
     pqueue_get_pos_f getpos; /**< callback to get position of a node */
     pqueue_set_pos_f setpos; /**< callback to set position of a node */
     void **d;                /**< The actualy queue in binary heap form */
+    int bulk;                /**< set while inserts skip ordering */
 } pqueue_t;
 
 
@@ -131,6 +132,23 @@ unsigned int pqueue_size(pqueue_t *q);
 int pqueue_insert(pqueue_t *q, void *d);
 
 
+/**
+ * start inserting items in bulk. Until pqueue_bulk_end() is called,
+ * inserted items are just appended to the queue, which is then put
+ * in order in a single O(n) pass, rather than in O(lg n) per item.
+ * Popping or peeking ends the bulk insert.
+ * @param q the queue
+ */
+void pqueue_bulk_begin(pqueue_t *q);
+
+
+/**
+ * end a bulk insert, putting the queue in order
+ * @param q the queue
+ */
+void pqueue_bulk_end(pqueue_t *q);
+
+
 /**
  * move an existing entry to a different priority
  * @param q the queue
@@ -168,6 +186,16 @@ int pqueue_remove(pqueue_t *q, void *d);
 void *pqueue_peek(pqueue_t *q);
 
 
+/**
+ * call a function for every item in the queue, in no particular
+ * order. The walker must not add or remove items.
+ * @param q the queue
+ * @param walker the function to call, with the item and arg
+ * @param arg passed on to the walker
+ */
+void pqueue_walk(pqueue_t *q, void (*walker)(void *d, void *arg), void *arg);
+
+
 /**
  * print the queue
  * @internal
@@ -166,6 +166,16 @@ squeue_event *squeue_add_msec(squeue_t *q, time_t when, time_t msec, void *data)
 	return squeue_add_usec(q, when, msec * 1000, data);
 }
 
+void squeue_bulk_begin(squeue_t *q)
+{
+	pqueue_bulk_begin(q);
+}
+
+void squeue_bulk_end(squeue_t *q)
+{
+	pqueue_bulk_end(q);
+}
+
 void *squeue_peek(squeue_t *q)
 {
 	squeue_event *evt = pqueue_peek(q);
@@ -204,7 +214,7 @@ void squeue_destroy(squeue_t *q, int flags)
 {
 	unsigned int i;
 
-	if (!q || pqueue_size(q) < 1)
+	if (!q)
 		return;
 
 	/*
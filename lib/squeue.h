@@ -121,6 +121,23 @@ extern squeue_event *squeue_add_usec(squeue_t *q, time_t when, time_t usec, void
  */
 extern squeue_event *squeue_add_msec(squeue_t *q, time_t when, time_t msec, void *data);
 
+/**
+ * Starts adding events in bulk. Events added until squeue_bulk_end()
+ * is called are ordered all at once, in O(n) time rather than
+ * O(lg n) per event, which makes a big difference when filling a
+ * queue with hundreds of thousands of events at startup.
+ * Peeking at or popping from the queue ends the bulk add.
+ *
+ * @param q The scheduling queue to add events to
+ */
+extern void squeue_bulk_begin(squeue_t *q);
+
+/**
+ * Ends adding events in bulk and puts the queue in order
+ * @param q The scheduling queue events were added to
+ */
+extern void squeue_bulk_end(squeue_t *q);
+
 /**
  * Returns the data of the next scheduled event from the scheduling
  * queue without removing it from the queue.
@@ -1,10 +1,196 @@
+#include <stdio.h>
+#include <limits.h>
+#include <sys/time.h>
 #include "t-utils.h"
 #include "lnag-utils.h"
 #include "bitmap.c"
 
 #define PRIME 2089
+
+static double tv_delta_usec(const struct timeval *start, const struct timeval *stop)
+{
+	return (stop->tv_sec - start->tv_sec) * 1000000.0 + (stop->tv_usec - start->tv_usec);
+}
+
+/* bmap may be 32 or 64 bits wide, so build each word 16 bits at a time */
+static void random_fill(bitmap *bm, unsigned int seed)
+{
+	unsigned long i;
+	unsigned int shift;
+
+	srand(seed);
+	for (i = 0; i < bm->alloc; i++) {
+		bmap word = 0;
+
+		for (shift = 0; shift < sizeof(bmap) * CHAR_BIT; shift += 16)
+			word ^= ((bmap)rand() & 0xffff) << shift;
+		bm->vector[i] = word;
+	}
+}
+
+static int test_bounds(void)
+{
+	bitmap *a, *b, *c;
+	unsigned long last;
+
+	t_start("bitmap bounds and sizes");
+	a = bitmap_create(PRIME);
+	last = bitmap_cardinality(a) - 1;
+	ok_int(bitmap_set(a, last), 0, "the last bit can be set");
+	ok_int(bitmap_isset(a, last), 1, "the last bit is set");
+	ok_int(bitmap_set(a, last + 1), -1, "the bit after the last can't be set");
+	ok_int(bitmap_isset(a, last + 1), 0, "the bit after the last is never set");
+	ok_int(bitmap_unset(a, last + 1), 0, "the bit after the last can't be unset");
+	bitmap_set(a, 63);
+	ok_int(bitmap_isset(a, 63) && !bitmap_isset(a, 31) && !bitmap_isset(a, 95), 1, "high bits of a word are set on their own");
+
+	b = bitmap_copy(a);
+	ok_int(bitmap_cmp(a, b), 0, "a copy is identical to the original");
+	ok_int(bitmap_count_set_bits(b), 2, "a copy has the same bits set");
+
+	/* diff must keep the numerator's bits beyond the denominator */
+	c = bitmap_create(64);
+	bitmap_set(c, 63);
+	bitmap_destroy(b);
+	b = bitmap_diff(a, c);
+	ok_int(bitmap_isset(b, last) && !bitmap_isset(b, 63) && bitmap_count_set_bits(b) == 1, 1, "diff keeps the overflow of a larger numerator");
+	bitmap_destroy(b);
+	b = bitmap_diff(c, a);
+	ok_int(bitmap_count_set_bits(b), 0, "diff with a larger denominator");
+	bitmap_destroy(b);
+	b = bitmap_symdiff(c, a);
+	ok_int(bitmap_isset(b, last) && bitmap_count_set_bits(b) == 1, 1, "symdiff keeps the overflow of the larger set");
+	bitmap_destroy(b);
+
+	/* in-place variants */
+	b = bitmap_copy(a);
+	ok_int(bitmap_intersect_with(b, c) == b && bitmap_count_set_bits(b) == 1 && bitmap_isset(b, 63), 1, "intersect_with clears bits the other map can't have");
+	bitmap_destroy(b);
+	b = bitmap_copy(a);
+	ok_int(bitmap_diff_with(b, c) == b && bitmap_count_set_bits(b) == 1 && bitmap_isset(b, last), 1, "diff_with");
+	ok_int(bitmap_symdiff_with(c, a) == c && bitmap_count_set_bits(c) == 1 && bitmap_isset(c, last), 1, "symdiff_with grows the result");
+	ok_int(bitmap_cardinality(c), bitmap_cardinality(a), "symdiff_with result is as large as the larger map");
+
+	bitmap_destroy(a);
+	bitmap_destroy(b);
+	bitmap_destroy(c);
+	return t_end();
+}
+
+/*
+ * Every implementation the cpu can run must agree with the generic
+ * one, including on the odd words after the last full vector.
+ */
+static void check_impl(const struct bitmap_ops *o, const bitmap *a, const bitmap *b)
+{
+	bitmap *want = bitmap_create(bitmap_cardinality(a)), *got = bitmap_create(bitmap_cardinality(a));
+	unsigned long n = a->alloc;
+
+	test(o->count(a->vector, n) == count_generic(a->vector, n), "%s: counting set bits", o->name);
+	test(o->count(a->vector, n - 1) == count_generic(a->vector, n - 1), "%s: counting set bits, odd length", o->name);
+
+#define check_op(op) \
+	op##_generic(want->vector, a->vector, b->vector, n); \
+	o->op_##op(got->vector, a->vector, b->vector, n); \
+	test(!bitmap_cmp(want, got), "%s: " #op, o->name); \
+	memcpy(got->vector, a->vector, n * sizeof(bmap)); \
+	o->op_##op(got->vector, got->vector, b->vector, n); \
+	test(!bitmap_cmp(want, got), "%s: " #op " in place", o->name)
+	check_op(and);
+	check_op(or);
+	check_op(andnot);
+	check_op(xor);
+#undef check_op
+
+	bitmap_destroy(want);
+	bitmap_destroy(got);
+}
+
+static int test_impls(void)
+{
+	bitmap *a = bitmap_create(10007), *b = bitmap_create(10007);
+
+	t_start("bitmap implementations");
+	random_fill(a, 1);
+	random_fill(b, 2);
+	t_diag("using the %s implementation", bitmap_ops()->name);
+	check_impl(bitmap_ops(), a, b);
+#ifdef BITMAP_X86
+	if (__builtin_cpu_supports("popcnt")) {
+		struct bitmap_ops o = ops_generic;
+		o.name = "popcnt";
+		o.count = count_popcnt;
+		check_impl(&o, a, b);
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		struct bitmap_ops o = { "sse2", count_generic, and_sse2, or_sse2, andnot_sse2, xor_sse2 };
+		check_impl(&o, a, b);
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		struct bitmap_ops o = { "avx2", count_avx2, and_avx2, or_avx2, andnot_avx2, xor_avx2 };
+		check_impl(&o, a, b);
+	}
+#endif
+	bitmap_destroy(a);
+	bitmap_destroy(b);
+	return t_end();
+}
+
+/*
+ * Counting and in-place intersection over maps from 1k bits (about a
+ * hostgroup) to 10M bits (all services of a very large install), with
+ * the generic code and with whatever the cpu we run on gets us.
+ */
+static volatile unsigned long bench_sink;
+
+static void bench_impl(const struct bitmap_ops *o, bitmap *a, const bitmap *b)
+{
+	struct timeval start, stop;
+	unsigned long i, runs, bits = bitmap_cardinality(a), sum = 0;
+	double count_usec, and_usec;
+
+	/* around 4G bits per measurement */
+	runs = (1UL << 32) / bits;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < runs; i++)
+		sum += o->count(a->vector, a->alloc);
+	gettimeofday(&stop, NULL);
+	count_usec = tv_delta_usec(&start, &stop);
+	bench_sink = sum;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < runs; i++)
+		o->op_and(a->vector, a->vector, b->vector, a->alloc);
+	gettimeofday(&stop, NULL);
+	and_usec = tv_delta_usec(&start, &stop);
+
+	t_diag("%8lu bits, %-7s: count %6.1f Gbit/s, intersect_with %6.1f Gbit/s",
+	       bits, o->name, runs * bits / count_usec / 1000, runs * bits / and_usec / 1000);
+}
+
+static int bench_bitmaps(void)
+{
+	unsigned long sizes[] = { 1024, 65536, 1048576, 10485760 };
+	unsigned int i;
+
+	t_start("bitmap throughput");
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		bitmap *a = bitmap_create(sizes[i]), *b = bitmap_create(sizes[i]);
+
+		random_fill(a, i);
+		random_fill(b, i + 1);
+		bench_impl(&ops_generic, a, b);
+		bench_impl(bitmap_ops(), a, b);
+		bitmap_destroy(a);
+		bitmap_destroy(b);
+	}
+	return t_end();
+}
+
 int main(int argc, char **argv)
 {
+	int ret, r2;
 	bitmap *a = NULL, *b, *r_union, *r_diff, *r_symdiff, *r_intersect;
 	unsigned int i;
 	int sa[] = {    2, 3, 4, 1783, 1784, 1785 };
@@ -87,6 +273,18 @@ int main(int argc, char **argv)
 	ok_int(bitmap_count_unset_bits(a), bitmap_cardinality(a), "bitmap_clear() must clear all");
 	ok_int(bitmap_count_set_bits(a), 0, "bitmap_clear() must clear all (part 2)");
 
-	t_end();
-	return 0;
+	ret = t_end();
+	t_reset();
+
+	r2 = test_bounds();
+	ret = r2 ? r2 : ret;
+	t_reset();
+
+	r2 = test_impls();
+	ret = r2 ? r2 : ret;
+	t_reset();
+
+	t_verbose = 1;
+	r2 = bench_bitmaps();
+	return r2 ? r2 : ret;
 }
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "dkhash.c"
 #include "t-utils.h"
 
@@ -26,9 +27,8 @@ unsigned int dkhash_count_entries(dkhash_table *table)
 {
 	unsigned int i, count = 0;
 
-	for (i = 0; i < table->num_buckets; i++) {
-		dkhash_bucket *bkt;
-		for (bkt = table->buckets[i]; bkt; bkt = bkt->next)
+	for (i = 0; i < table->num_slots; i++) {
+		if (slot_is_live(table, i))
 			count++;
 	}
 
@@ -84,6 +84,155 @@ static int del_matching(void *data)
 	return 0;
 }
 
+#define NUM_HOSTS 50000
+#define SVCS_PER_HOST 20
+#define NUM_KEYS (NUM_HOSTS * SVCS_PER_HOST)
+
+static double tv_delta_usec(const struct timeval *start, const struct timeval *stop)
+{
+	return (stop->tv_sec - start->tv_sec) * 1000000.0 + (stop->tv_usec - start->tv_usec);
+}
+
+/*
+ * Grow a deliberately undersized table through a lot of resizes and
+ * remove half the entries again, checking every key along the way.
+ */
+static int test_resize(void)
+{
+	dkhash_table *t;
+	char (*k1)[16], (*k2)[16];
+	unsigned int i, found = 0, wrong = 0;
+
+	t_start("dkhash resize and churn");
+	k1 = calloc(10000, sizeof(*k1));
+	k2 = calloc(10000, sizeof(*k2));
+	t = dkhash_create(4);
+	for (i = 0; i < 10000; i++) {
+		sprintf(k1[i], "host%u", i / 10);
+		sprintf(k2[i], "service%u", i % 10);
+		if (dkhash_insert(t, k1[i], k2[i], k1[i]) != DKHASH_OK)
+			wrong++;
+	}
+	ok_int(wrong, 0, "10000 inserts into a 4-slot table must all succeed");
+	ok_int(dkhash_num_entries(t), 10000, "all entries must be accounted for");
+	test(dkhash_table_size(t) >= 10000 * 4 / 3, "table must have grown");
+	ok_int(dkhash_insert(t, "host17", "service3", NULL), DKHASH_EDUPE, "duplicates must be refused after resizing");
+
+	for (i = 0; i < 10000; i++) {
+		if (dkhash_get(t, k1[i], k2[i]) == k1[i])
+			found++;
+	}
+	ok_int(found, 10000, "every entry must be found after resizing");
+
+	for (i = 0, found = 0; i < 10000; i += 2) {
+		if (dkhash_remove(t, k1[i], k2[i]) == k1[i])
+			found++;
+	}
+	ok_int(found, 5000, "every other entry must be removable");
+	for (i = 0, found = 0, wrong = 0; i < 10000; i++) {
+		void *p = dkhash_get(t, k1[i], k2[i]);
+		if (i & 1)
+			found += p == k1[i];
+		else
+			wrong += p != NULL;
+	}
+	ok_int(found, 5000, "remaining entries must survive removals");
+	ok_int(wrong, 0, "removed entries must stay removed");
+	test(dkhash_get(t, "host17", NULL) == NULL, "single key must not match a key pair");
+	test(0 == dkhash_check_table(t), "table consistency after churn");
+
+	dkhash_destroy(t);
+	free(k1);
+	free(k2);
+	return t_end();
+}
+
+/*
+ * find_service() style lookups in a table with a million services,
+ * sized the way create_object_tables() would size it.
+ */
+static int bench_lookups(void)
+{
+	dkhash_table *t;
+	char (*hosts)[32], (*svcs)[32];
+	unsigned int i, found = 0;
+	struct timeval start, stop;
+	double usecs;
+
+	t_start("dkhash lookup throughput, %u keys", NUM_KEYS);
+	hosts = calloc(NUM_HOSTS, sizeof(*hosts));
+	svcs = calloc(SVCS_PER_HOST, sizeof(*svcs));
+	for (i = 0; i < NUM_HOSTS; i++)
+		sprintf(hosts[i], "host-%06u", i);
+	for (i = 0; i < SVCS_PER_HOST; i++)
+		sprintf(svcs[i], "Service check %u", i);
+
+	t = dkhash_create(NUM_KEYS * 1.5);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_KEYS; i++)
+		dkhash_insert(t, hosts[i / SVCS_PER_HOST], svcs[i % SVCS_PER_HOST], hosts[i / SVCS_PER_HOST]);
+	gettimeofday(&stop, NULL);
+	usecs = tv_delta_usec(&start, &stop);
+	t_diag("%u inserts: %.0f msec, %.1fM inserts/sec", NUM_KEYS, usecs / 1000, NUM_KEYS / usecs);
+	ok_int(dkhash_num_entries(t), NUM_KEYS, "all keys inserted");
+
+	/*
+	 * look up copies of the keys, since callers rarely hold the very
+	 * pointers that went into the table, and hop between hosts so we
+	 * don't just hit the same cache lines over and over again
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_KEYS; i++) {
+		unsigned int x = (i * 7919) % NUM_KEYS;
+		char hname[32], sdesc[32];
+
+		memcpy(hname, hosts[x / SVCS_PER_HOST], sizeof(hname));
+		memcpy(sdesc, svcs[x % SVCS_PER_HOST], sizeof(sdesc));
+		if (dkhash_get(t, hname, sdesc) == hosts[x / SVCS_PER_HOST])
+			found++;
+	}
+	gettimeofday(&stop, NULL);
+	usecs = tv_delta_usec(&start, &stop);
+	t_diag("%u lookups: %.0f msec, %.1fM lookups/sec", NUM_KEYS, usecs / 1000, NUM_KEYS / usecs);
+	ok_int(found, NUM_KEYS, "every key must be found");
+
+	gettimeofday(&start, NULL);
+	for (i = 0, found = 0; i < NUM_KEYS; i++) {
+		unsigned int x = (i * 7919) % NUM_KEYS;
+		char hname[32];
+
+		memcpy(hname, hosts[x / SVCS_PER_HOST], sizeof(hname));
+		hname[0] = 'H';
+		found += !!dkhash_get(t, hname, svcs[x % SVCS_PER_HOST]);
+	}
+	gettimeofday(&stop, NULL);
+	usecs = tv_delta_usec(&start, &stop);
+	t_diag("%u failed lookups: %.0f msec, %.1fM lookups/sec", NUM_KEYS, usecs / 1000, NUM_KEYS / usecs);
+	ok_int(found, 0, "missing keys must not be found");
+
+	/* external commands and passive results, one in ten for an unknown object */
+	gettimeofday(&start, NULL);
+	for (i = 0, found = 0; i < NUM_KEYS; i++) {
+		unsigned int x = (i * 7919) % NUM_KEYS;
+		char hname[32], sdesc[32];
+
+		memcpy(hname, hosts[x / SVCS_PER_HOST], sizeof(hname));
+		memcpy(sdesc, svcs[x % SVCS_PER_HOST], sizeof(sdesc));
+		if (i % 10 == 0)
+			hname[0] = 'H';
+		found += !!dkhash_get(t, hname, sdesc);
+	}
+	gettimeofday(&stop, NULL);
+	usecs = tv_delta_usec(&start, &stop);
+	t_diag("%u mixed lookups: %.0f msec, %.1fM lookups/sec", NUM_KEYS, usecs / 1000, NUM_KEYS / usecs);
+	ok_int(found, NUM_KEYS - NUM_KEYS / 10, "only the known keys must be found");
+
+	dkhash_destroy(t);
+	free(hosts);
+	free(svcs);
+	return t_end();
+}
+
 int main(int argc, char **argv)
 {
 	dkhash_table *tx, *t;
@@ -190,5 +339,14 @@ int main(int argc, char **argv)
 	dkhash_destroy(t);
 
 	r2 = t_end();
+	ret = r2 ? r2 : ret;
+	t_reset();
+
+	t_verbose = 1;
+	r2 = test_resize();
+	ret = r2 ? r2 : ret;
+	t_reset();
+
+	r2 = bench_lookups();
 	return r2 ? r2 : ret;
 }
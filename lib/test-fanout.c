@@ -1,6 +1,7 @@
 #define _GNU_SOURCE 1
 #include <stdio.h>
 #include <errno.h>
+#include <sys/time.h>
 #include "fanout.c"
 #include "t-utils.h"
 
@@ -70,6 +71,75 @@ static void pdest(void *arg_)
 	destroyed++;
 }
 
+static void test_growth(void)
+{
+	fanout_table *fo;
+	unsigned long k, *vals, found = 0;
+
+	fo = fanout_create(3);
+	ok_int((int)fanout_table_size(fo), 4, "Size must be rounded up to a power of 2");
+
+	vals = calloc(10000, sizeof(*vals));
+	for (k = 0; k < 10000; k++) {
+		vals[k] = k;
+		fanout_add(fo, k << 20, &vals[k]);
+	}
+	ok_int((int)fanout_num_entries(fo), 10000, "All entries must be counted");
+	ok_int(fanout_table_size(fo) >= 10000, 1, "Table must grow with its entries");
+	for (k = 0; k < 10000; k++) {
+		unsigned long *p = fanout_get(fo, k << 20);
+		if (p && *p == k)
+			found++;
+	}
+	ok_int((int)found, 10000, "Every entry must be found after growing");
+	ok_int(fanout_collisions(fo) < 10000 / 2, 1,
+	       "Keys differing only in high bits must not pile up");
+
+	/* duplicate keys must still come back latest first after growing */
+	fanout_destroy(fo, NULL);
+	fo = fanout_create(1);
+	for (k = 0; k < 100; k++) {
+		fanout_add(fo, 7, &vals[k]);
+		fanout_add(fo, k + 100, &vals[k]);
+	}
+	for (k = 100; k; k--) {
+		if (fanout_remove(fo, 7) != &vals[k - 1])
+			break;
+	}
+	ok_int((int)k, 0, "Duplicate keys must keep their order across growth");
+	ok_int((int)fanout_num_entries(fo), 100, "Removed entries must not be counted");
+	fanout_destroy(fo, NULL);
+	free(vals);
+}
+
+/*
+ * Mimic a busy worker's job table: a window of in-flight jobs with
+ * ever-increasing ids, one completing for every new one added.
+ */
+static void bench_churn(void)
+{
+	fanout_table *fo;
+	unsigned long k, in_flight = 2048, ops = 4000000, found = 0;
+	struct timeval start, stop;
+	double usecs;
+
+	fo = fanout_create(64);
+	gettimeofday(&start, NULL);
+	for (k = 0; k < ops; k++) {
+		fanout_add(fo, k, &fo);
+		if (k >= in_flight && fanout_remove(fo, k - in_flight))
+			found++;
+	}
+	gettimeofday(&stop, NULL);
+	usecs = (stop.tv_sec - start.tv_sec) * 1000000.0 + (stop.tv_usec - start.tv_usec);
+	t_diag("%lu add+remove pairs with %lu in flight: %.0f msec, %.1fM pairs/sec",
+	       ops, in_flight, usecs / 1000, ops / usecs);
+	t_diag("table size %lu, %lu collisions", fanout_table_size(fo), fanout_collisions(fo));
+	ok_int((int)found, (int)(ops - in_flight), "Churn must find every job it adds");
+	ok_int((int)fanout_num_entries(fo), (int)in_flight, "Churn must leave the window in flight");
+	fanout_destroy(fo, NULL);
+}
+
 int main(int argc, char **argv)
 {
 	unsigned long k;
@@ -105,5 +175,8 @@ int main(int argc, char **argv)
 	fanout_destroy(fot, pdest);
 	ok_int((int)destroyed, (int)k, "destroy counter while free()'ing");
 
+	test_growth();
+	bench_churn();
+
 	return t_end();
 }
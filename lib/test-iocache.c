@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <sys/time.h>
 #include "iocache.c"
 #include "t-utils.h"
 
@@ -59,6 +60,96 @@ static int test_delimiter(const char *delim, unsigned int delim_len)
 	return 0;
 }
 
+/*
+ * Feed a message and its delimiter one byte at a time, which is the
+ * worst case for remembering where the last search stopped when the
+ * delimiter itself is split between two reads.
+ */
+static int test_trickle(const char *delim, unsigned int delim_len)
+{
+	const char msg[] = "Some output|some=perfdata;1;2;3";
+	unsigned int i, found = 0, early = 0;
+	unsigned long len = 0;
+	char *ptr = NULL;
+	iocache *ioc;
+
+	ioc = iocache_create(64);
+	for (i = 0; i < 2; i++) {
+		unsigned int x;
+		const char *src;
+
+		for (x = 0; x < sizeof(msg) - 1 + delim_len; x++) {
+			src = x < sizeof(msg) - 1 ? &msg[x] : &delim[x - (sizeof(msg) - 1)];
+			iocache_add(ioc, (char *)src, 1);
+			ptr = iocache_use_delim(ioc, delim, delim_len, &len);
+			if (ptr && x < sizeof(msg) - 1 + delim_len - 1)
+				early++;
+			else if (ptr && len == sizeof(msg) - 1 && !memcmp(ptr, msg, len))
+				found++;
+		}
+	}
+	test(found == 2 && !early, "trickled messages are found once complete, delim_len %u", delim_len);
+
+	/* put the last message back and take it again */
+	test(iocache_unuse_size(ioc, len + delim_len) == 0, "unuse_size, delim_len %u", delim_len);
+	ptr = iocache_use_delim(ioc, delim, delim_len, &len);
+	test(ptr && len == sizeof(msg) - 1, "a message that's been put back is found again, delim_len %u", delim_len);
+
+	/* 32 bytes of wrapped-around data must still fit */
+	for (i = 0; i < 32; i++)
+		iocache_add(ioc, "x", 1);
+	test(iocache_capacity(ioc) == 32, "capacity counts the room freed at the start");
+	test(iocache_add(ioc, (char *)msg, 32) == 64, "data fits when it takes moving the unread part");
+	iocache_destroy(ioc);
+	return 0;
+}
+
+static double tv_delta_usec(const struct timeval *start, const struct timeval *stop)
+{
+	return (stop->tv_sec - start->tv_sec) * 1000000.0 + (stop->tv_usec - start->tv_usec);
+}
+
+/*
+ * Push 256MB of newline-terminated messages through a worker-sized
+ * cache in chunks the size of a typical socket read, taking every
+ * complete message out after each chunk, and report the throughput.
+ */
+static void bench_messages(unsigned long msg_size, unsigned long chunk)
+{
+	const unsigned long total = 256 * 1024 * 1024;
+	unsigned long fed = 0, pos = 0, msgs = 0, len;
+	struct timeval start, stop;
+	char *stream;
+	iocache *ioc;
+	double usecs;
+
+	stream = malloc(msg_size * 2);
+	memset(stream, 'x', msg_size * 2);
+	stream[msg_size - 1] = stream[msg_size * 2 - 1] = '\n';
+	ioc = iocache_create(1024 * 1024);
+
+	gettimeofday(&start, NULL);
+	while (fed < total) {
+		unsigned long n = chunk;
+
+		if (pos + n > msg_size * 2)
+			n = msg_size * 2 - pos;
+		if (iocache_add(ioc, stream + pos, n) < 0)
+			break;
+		fed += n;
+		pos = (pos + n) % (msg_size * 2);
+		while (iocache_use_delim(ioc, "\n", 1, &len))
+			msgs++;
+	}
+	gettimeofday(&stop, NULL);
+	usecs = tv_delta_usec(&start, &stop);
+	test(fed >= total && msgs == fed / msg_size, "%lu byte messages in %lu byte chunks: %.0f MB/s",
+	     msg_size, chunk, fed / usecs);
+
+	iocache_destroy(ioc);
+	free(stream);
+}
+
 int main(int argc, char **argv)
 {
 	unsigned int i;
@@ -77,5 +168,18 @@ int main(int argc, char **argv)
 		t_end();
 	}
 
+	t_start("iocache trickle test");
+	for (i = 0; i < ARRAY_SIZE(sc); i++)
+		test_trickle(sc[i].str, sc[i].len);
+	t_end();
+
+	t_start("iocache throughput");
+	t_verbose = 1;
+	bench_messages(128, 4096);
+	bench_messages(128, 65536);
+	bench_messages(256 * 1024, 4096);
+	bench_messages(256 * 1024, 65536);
+	t_end();
+
 	return t_end();
 }
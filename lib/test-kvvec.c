@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <sys/time.h>
 #include "kvvec.c"
 #include "t-utils.h"
 
@@ -70,9 +72,242 @@ static void add_vars(struct kvvec *kvv, const char **ary, int len)
 	}
 }
 
+static double tv_delta_usec(const struct timeval *start, const struct timeval *stop)
+{
+	return (stop->tv_sec - start->tv_sec) * 1000000.0 + (stop->tv_usec - start->tv_usec);
+}
+
+static int test_typed(void)
+{
+	static const long longs[] = { 0, 1, -1, 9, 10, 123456789, -987654321, LONG_MAX, LONG_MIN };
+	static const struct timeval tvs[] = {
+		{ 0, 0 }, { 1, 1 }, { 1234567890, 123456 }, { 1700000000, 999999 }, { 42, 100000 },
+	};
+	struct kvvec *kvv = kvvec_create(1);
+	struct kvvec k = KVVEC_INITIALIZER;
+	char buf[64], key[16];
+	unsigned int i;
+	int bad = 0;
+
+	t_start("typed key/value helpers");
+	for (i = 0; i < ARRAY_SIZE(longs); i++) {
+		struct key_value *kv;
+		long value;
+
+		kvvec_addkv_long(kvv, "long", longs[i]);
+		kv = &kvv->kv[kvv->kv_pairs - 1];
+		sprintf(buf, "%ld", longs[i]);
+		test(!strcmp(kv->value, buf) && kv->value_len == (int)strlen(buf),
+		     "kvvec_addkv_long(%s) formats like printf(): '%s'", buf, kv->value);
+		test(!kvvec_value_long(kv, &value) && value == longs[i], "kvvec_value_long() reads back %s", buf);
+	}
+	for (i = 0; i < ARRAY_SIZE(tvs); i++) {
+		struct key_value *kv;
+		struct timeval tv;
+
+		kvvec_addkv_tv(kvv, "tv", &tvs[i]);
+		kv = &kvv->kv[kvv->kv_pairs - 1];
+		sprintf(buf, "%ld.%06ld", (long)tvs[i].tv_sec, (long)tvs[i].tv_usec);
+		test(!strcmp(kv->value, buf), "kvvec_addkv_tv() formats like printf(): '%s'", kv->value);
+		test(!kvvec_value_tv(kv, &tv) && tv.tv_sec == tvs[i].tv_sec && tv.tv_usec == tvs[i].tv_usec,
+		     "kvvec_value_tv() reads back %s", buf);
+	}
+
+	/* values must survive the vector growing underneath them */
+	for (i = 0; i < 1000; i++) {
+		sprintf(key, "k%u", i);
+		kvvec_addkv(&k, strdup(key), strdup(key));
+		kvvec_addkv_long(&k, strdup(key), i);
+	}
+	for (i = 0; i < 1000; i++) {
+		long value;
+		if (kvvec_value_long(&k.kv[i * 2 + 1], &value) || value != (long)i)
+			bad++;
+	}
+	test(!bad, "typed values survive growing the vector (%d bad)", bad);
+	kvvec_sort(&k);
+	kvvec_free_kvpairs(&k, KVVEC_FREE_ALL);
+	t_pass("freeing all keys and values skips the typed ones, even after sorting");
+	free(k.kv);
+	free(k.numbuf);
+
+	{
+		struct key_value kv = { "x", "12ab", 1, 4 };
+		struct timeval tv;
+		long value;
+
+		test(kvvec_value_long(&kv, &value) < 0 && value == 12, "trailing garbage is an error, leading digits are kept");
+		kv.value = "1.5";
+		kv.value_len = 3;
+		test(!kvvec_value_tv(&kv, &tv) && tv.tv_sec == 1 && tv.tv_usec == 500000, "short fractions are read as fractions");
+		kv.value = "3,000001";
+		kv.value_len = 8;
+		test(!kvvec_value_tv(&kv, &tv) && tv.tv_sec == 3 && tv.tv_usec == 1, "comma works as decimal separator");
+		kv.value = "";
+		kv.value_len = 0;
+		test(kvvec_value_long(&kv, &value) < 0 && kvvec_value_tv(&kv, &tv) < 0, "empty values are errors");
+	}
+
+	kvvec_destroy(kvv, 0);
+	return t_end();
+}
+
+static int test_bufs(void)
+{
+	struct kvvec *kvv = kvvec_create(1);
+	struct kvvec k = KVVEC_INITIALIZER;
+	struct kvvec_buf kvvb = KVVEC_BUF_INITIALIZER, *old;
+	char *first;
+	int ret;
+
+	t_start("reusable buffers");
+	add_vars(kvv, test_data, 1239819);
+	old = kvvec2buf(kvv, KVSEP, PAIRSEP, OVERALLOC);
+	test(!kvvec2buf_prealloc(kvv, &kvvb, KVSEP, PAIRSEP, OVERALLOC), "kvvec2buf_prealloc() succeeds");
+	test(kvvb.bufsize == old->bufsize && kvvb.buflen == old->buflen && !memcmp(kvvb.buf, old->buf, old->bufsize),
+	     "kvvec2buf_prealloc() builds the same buffer as kvvec2buf()");
+	first = kvvb.buf;
+	kvvec_init(kvv, 0);
+	kvvec_addkv(kvv, "short", "message");
+	kvvec2buf_prealloc(kvv, &kvvb, KVSEP, PAIRSEP, OVERALLOC);
+	test(kvvb.buf == first && kvvb.buflen == 14 && !memcmp(kvvb.buf, "short=message\0\0\0", 16),
+	     "smaller messages reuse the buffer");
+
+	/* decoding into a reused vector */
+	ret = buf2kvvec_prealloc(&k, old->buf, old->buflen, KVSEP, PAIRSEP, KVVEC_ASSIGN);
+	test(ret == 7 && k.kv_pairs == 7, "all pairs are parsed (%d)", ret);
+	ret = buf2kvvec_prealloc(&k, kvvb.buf, kvvb.buflen, KVSEP, PAIRSEP, KVVEC_COPY);
+	test(ret == 1 && !strcmp(k.kv[0].key, "short") && !strcmp(k.kv[0].value, "message"), "reusing the vector resets it");
+	ret = buf2kvvec_prealloc(&k, kvvb.buf, kvvb.buflen, KVSEP, PAIRSEP, KVVEC_APPEND | KVVEC_COPY);
+	test(ret == 1 && k.kv_pairs == 2, "KVVEC_APPEND keeps what's there");
+	kvvec_free_kvpairs(&k, KVVEC_FREE_ALL);
+
+	kvvec_buf_destroy(old);
+	free(kvvb.buf);
+	free(k.kv);
+	kvvec_destroy(kvv, 0);
+	return t_end();
+}
+
+/*
+ * A vector that looks like what a worker sends back for every check,
+ * which is what the encoders and decoders spend most of their time on.
+ */
+static void fill_result(struct kvvec *kvv, int typed, long id)
+{
+	static char nums[12][32];
+	struct timeval tv = { 1700000000, 123456 };
+
+	kvvec_init(kvv, 20);
+	kvvec_addkv(kvv, "command", "/usr/lib/nagios/plugins/check_ping -H 10.0.0.1 -w 100,20% -c 500,60%");
+	kvvec_addkv(kvv, "type", "0");
+	if (typed) {
+		kvvec_addkv_long(kvv, "job_id", id);
+		kvvec_addkv_long(kvv, "timeout", 60);
+		kvvec_addkv_long(kvv, "wait_status", 0);
+		kvvec_addkv_tv(kvv, "start", &tv);
+		kvvec_addkv_tv(kvv, "stop", &tv);
+		kvvec_addkv_tv(kvv, "ru_utime", &tv);
+		kvvec_addkv_tv(kvv, "ru_stime", &tv);
+		kvvec_addkv_long(kvv, "ru_minflt", 1234);
+		kvvec_addkv_long(kvv, "ru_majflt", 0);
+		kvvec_addkv_long(kvv, "ru_inblock", 0);
+		kvvec_addkv_long(kvv, "ru_oublock", 8);
+	} else {
+		sprintf(nums[0], "%ld", id);
+		kvvec_addkv(kvv, "job_id", nums[0]);
+		sprintf(nums[1], "%d", 60);
+		kvvec_addkv(kvv, "timeout", nums[1]);
+		sprintf(nums[2], "%d", 0);
+		kvvec_addkv(kvv, "wait_status", nums[2]);
+		sprintf(nums[3], "%ld.%06ld", (long)tv.tv_sec, (long)tv.tv_usec);
+		kvvec_addkv(kvv, "start", nums[3]);
+		sprintf(nums[4], "%ld.%06ld", (long)tv.tv_sec, (long)tv.tv_usec);
+		kvvec_addkv(kvv, "stop", nums[4]);
+		sprintf(nums[5], "%ld.%06ld", (long)tv.tv_sec, (long)tv.tv_usec);
+		kvvec_addkv(kvv, "ru_utime", nums[5]);
+		sprintf(nums[6], "%ld.%06ld", (long)tv.tv_sec, (long)tv.tv_usec);
+		kvvec_addkv(kvv, "ru_stime", nums[6]);
+		sprintf(nums[7], "%d", 1234);
+		kvvec_addkv(kvv, "ru_minflt", nums[7]);
+		sprintf(nums[8], "%d", 0);
+		kvvec_addkv(kvv, "ru_majflt", nums[8]);
+		sprintf(nums[9], "%d", 0);
+		kvvec_addkv(kvv, "ru_inblock", nums[9]);
+		sprintf(nums[10], "%d", 8);
+		kvvec_addkv(kvv, "ru_oublock", nums[10]);
+	}
+	kvvec_addkv(kvv, "exited_ok", "1");
+	kvvec_addkv(kvv, "outerr", "");
+	kvvec_addkv(kvv, "outstd", "PING OK - Packet loss = 0%, RTA = 0.05 ms|rta=0.050000ms;100.000000;500.000000;0.000000 pl=0%;20;60;0");
+}
+
+#define BENCH_MSGS 1000000
+static volatile unsigned long bench_sink;
+
+static int bench_kvvec(void)
+{
+	struct kvvec kvv = KVVEC_INITIALIZER, dec = KVVEC_INITIALIZER;
+	struct kvvec_buf kvvb = KVVEC_BUF_INITIALIZER, *tmp;
+	struct timeval start, stop;
+	unsigned long bytes = 0;
+	char *msg;
+	long i;
+
+	t_start("kvvec encode/decode throughput");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_MSGS; i++) {
+		fill_result(&kvv, 0, i);
+		tmp = kvvec2buf(&kvv, KVSEP, PAIRSEP, 3);
+		bench_sink += tmp->bufsize;
+		kvvec_buf_destroy(tmp);
+	}
+	gettimeofday(&stop, NULL);
+	t_pass("sprintf() + kvvec2buf(): %.0f msgs/sec", BENCH_MSGS / tv_delta_usec(&start, &stop) * 1000000);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_MSGS; i++) {
+		fill_result(&kvv, 1, i);
+		kvvec2buf_prealloc(&kvv, &kvvb, KVSEP, PAIRSEP, 3);
+		bench_sink += kvvb.bufsize;
+	}
+	gettimeofday(&stop, NULL);
+	t_pass("typed adds + kvvec2buf_prealloc(): %.0f msgs/sec", BENCH_MSGS / tv_delta_usec(&start, &stop) * 1000000);
+
+	/* decoding is destructive, so each round parses a fresh copy */
+	msg = malloc(kvvb.bufsize);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_MSGS; i++) {
+		int x;
+
+		memcpy(msg, kvvb.buf, kvvb.bufsize);
+		buf2kvvec_prealloc(&dec, msg, kvvb.buflen, KVSEP, PAIRSEP, KVVEC_ASSIGN);
+		for (x = 0; x < dec.kv_pairs; x++) {
+			struct timeval tv;
+			long value;
+
+			if (kvvec_value_long(&dec.kv[x], &value) < 0)
+				kvvec_value_tv(&dec.kv[x], &tv);
+		}
+		bytes += kvvb.buflen;
+	}
+	gettimeofday(&stop, NULL);
+	bench_sink += dec.kv_pairs;
+	t_pass("buf2kvvec_prealloc() + typed gets: %.0f msgs/sec, %.0f MB/s",
+	       BENCH_MSGS / tv_delta_usec(&start, &stop) * 1000000, bytes / tv_delta_usec(&start, &stop));
+
+	free(msg);
+	free(kvvb.buf);
+	free(kvv.kv);
+	free(kvv.numbuf);
+	free(dec.kv);
+	return t_end();
+}
+
 int main(int argc, char **argv)
 {
-	int i, j;
+	int i, j, ret;
 	const char *value;
 	struct kvvec *kvv, *kvv2, *kvv3;
 	struct kvvec_buf *kvvb, *kvvb2;
@@ -155,6 +390,9 @@ int main(int argc, char **argv)
 		}
 	}
 
-	t_end();
-	return 0;
+	ret = t_end();
+	ret |= test_typed();
+	ret |= test_bufs();
+	ret |= bench_kvvec();
+	return ret;
 }
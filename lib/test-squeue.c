@@ -57,7 +57,7 @@ static int sq_walker(squeue_event *evt, void *arg)
 }
 
 #define EVT_ARY 65101
-static int sq_test_random(squeue_t *sq)
+static int sq_test_random(squeue_t *sq, int bulk)
 {
 	unsigned long size, i;
 	unsigned long long numbers[EVT_ARY], *d, max = 0;
@@ -66,12 +66,16 @@ static int sq_test_random(squeue_t *sq)
 	size = squeue_size(sq);
 	now.tv_sec = time(NULL);
 	srand((int)now.tv_sec);
+	if (bulk)
+		squeue_bulk_begin(sq);
 	for (i = 0; i < EVT_ARY; i++) {
 		now.tv_usec = (time_t)rand();
 		squeue_add_tv(sq, &now, &numbers[i]);
 		numbers[i] = evt_compute_pri(&now);
 		t(squeue_size(sq) == i + 1 + size);
 	}
+	if (bulk)
+		squeue_bulk_end(sq);
 
 	t(pqueue_is_valid(sq));
 
@@ -113,9 +117,13 @@ int main(int argc, char **argv)
 	t(squeue_size(sq) == 0);
 
 	/* we fill and empty the squeue completely once before testing */
-	sq_test_random(sq);
+	sq_test_random(sq, 0);
 	t(squeue_size(sq) == 0, "Size should be 0 after first sq_test_random");
 
+	/* and once more, filling it in bulk */
+	sq_test_random(sq, 1);
+	t(squeue_size(sq) == 0, "Size should be 0 after bulk sq_test_random");
+
 	t((a.evt = squeue_add(sq, time(NULL) + 9, &a)) != NULL);
 	t(squeue_size(sq) == 1);
 	t((b.evt = squeue_add(sq, time(NULL) + 3, &b)) != NULL);
@@ -126,7 +134,8 @@ int main(int argc, char **argv)
 	t(squeue_size(sq) == 4);
 
 	/* add and remove lots. remainder should be what we have above */
-	sq_test_random(sq);
+	sq_test_random(sq, 0);
+	sq_test_random(sq, 1);
 
 	/* testing squeue_peek() */
 	t((x = (sq_test_event *)squeue_peek(sq)) != NULL);
@@ -166,6 +175,16 @@ int main(int argc, char **argv)
 	t(x == &c, "x->id: %lu; c.id: %lu\n", x->id, c.id);
 	t(x->id == c.id, "x->id: %lu; c.id: %lu\n", x->id, c.id);
 
+	/* events removed during a bulk add are gone once it's done */
+	squeue_bulk_begin(sq);
+	t((b.evt = squeue_add(sq, time(NULL) + 1, &b)) != NULL);
+	t((c.evt = squeue_add(sq, time(NULL) + 2, &c)) != NULL);
+	t(squeue_remove(sq, b.evt) == 0);
+	squeue_bulk_end(sq);
+	t(pqueue_is_valid(sq));
+	t(squeue_size(sq) == 3);
+	t((x = squeue_pop(sq)) == &c, "x: %p; &c: %p\n", x, &c);
+
 	/* this should fail gracefully (-1 return from squeue_remove()) */
 	t(squeue_remove(NULL, NULL) == -1);
 	t(squeue_remove(NULL, a.evt) == -1);
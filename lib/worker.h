@@ -93,6 +93,15 @@ extern void enter_worker(int sd, int (*cb)(child_process*));
  */
 extern struct kvvec_buf *build_kvvec_buf(struct kvvec *kvv);
 
+/**
+ * Like build_kvvec_buf(), but builds the buffer in a kvvec_buf that's
+ * reused from one message to the next. See kvvec2buf_prealloc().
+ * @param kvv The key/value vector to build the buffer from
+ * @param kvvb The buffer to build it in
+ * @return 0 on success, < 0 on errors
+ */
+extern int build_kvvec_buf_prealloc(struct kvvec *kvv, struct kvvec_buf *kvvb);
+
 /**
  * Send a key/value vector as a bytestream through a socket
  * @param[in] sd The socket descriptor to send to
@@ -23,7 +23,7 @@ void broker_program_state(int type, int flags, int attr, struct timeval *timesta
 {
 	nebstruct_process_data ds;
 
-	if (!(event_broker_options & BROKER_PROGRAM_STATE))
+	if (!(event_broker_options & BROKER_PROGRAM_STATE) || !neb_has_callbacks(NEBCALLBACK_PROCESS_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -44,7 +44,7 @@ void broker_timed_event(int type, int flags, int attr, timed_event *event, struc
 {
 	nebstruct_timed_event_data ds;
 
-	if (!(event_broker_options & BROKER_TIMED_EVENTS))
+	if (!(event_broker_options & BROKER_TIMED_EVENTS) || !neb_has_callbacks(NEBCALLBACK_TIMED_EVENT_DATA))
 		return;
 
 	if (event == NULL)
@@ -74,7 +74,7 @@ void broker_log_data(int type, int flags, int attr, char *data, unsigned long da
 {
 	nebstruct_log_data ds;
 
-	if (!(event_broker_options & BROKER_LOGGED_DATA))
+	if (!(event_broker_options & BROKER_LOGGED_DATA) || !neb_has_callbacks(NEBCALLBACK_LOG_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -99,7 +99,7 @@ void broker_system_command(int type, int flags, int attr, struct timeval start_t
 {
 	nebstruct_system_command_data ds;
 
-	if (!(event_broker_options & BROKER_SYSTEM_COMMANDS))
+	if (!(event_broker_options & BROKER_SYSTEM_COMMANDS) || !neb_has_callbacks(NEBCALLBACK_SYSTEM_COMMAND_DATA))
 		return;
 
 	if (cmd == NULL)
@@ -138,7 +138,7 @@ int broker_event_handler(int type, int flags, int attr, int eventhandler_type, v
 	nebstruct_event_handler_data ds;
 	int return_code = OK;
 
-	if (!(event_broker_options & BROKER_EVENT_HANDLERS))
+	if (!(event_broker_options & BROKER_EVENT_HANDLERS) || !neb_has_callbacks(NEBCALLBACK_EVENT_HANDLER_DATA))
 		return return_code;
 
 	if (data == NULL)
@@ -199,7 +199,7 @@ int broker_host_check(int type, int flags, int attr, host *hst, int check_type,
 	nebstruct_host_check_data ds;
 	int return_code = OK;
 
-	if (!(event_broker_options & BROKER_HOST_CHECKS))
+	if (!(event_broker_options & BROKER_HOST_CHECKS) || !neb_has_callbacks(NEBCALLBACK_HOST_CHECK_DATA))
 		return OK;
 
 	if (hst == NULL)
@@ -259,7 +259,7 @@ int broker_service_check(int type, int flags, int attr, service *svc, int check_
 	nebstruct_service_check_data ds;
 	int return_code = OK;
 
-	if (!(event_broker_options & BROKER_SERVICE_CHECKS))
+	if (!(event_broker_options & BROKER_SERVICE_CHECKS) || !neb_has_callbacks(NEBCALLBACK_SERVICE_CHECK_DATA))
 		return OK;
 
 	if (svc == NULL)
@@ -316,7 +316,7 @@ void broker_comment_data(int type, int flags, int attr, int comment_type, int en
 {
 	nebstruct_comment_data ds;
 
-	if (!(event_broker_options & BROKER_COMMENT_DATA))
+	if (!(event_broker_options & BROKER_COMMENT_DATA) || !neb_has_callbacks(NEBCALLBACK_COMMENT_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -351,7 +351,7 @@ void broker_downtime_data(int type, int flags, int attr, int downtime_type, char
 {
 	nebstruct_downtime_data ds;
 
-	if (!(event_broker_options & BROKER_DOWNTIME_DATA))
+	if (!(event_broker_options & BROKER_DOWNTIME_DATA) || !neb_has_callbacks(NEBCALLBACK_DOWNTIME_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -388,7 +388,7 @@ void broker_flapping_data(int type, int flags, int attr, int flapping_type, void
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 
-	if (!(event_broker_options & BROKER_FLAPPING_DATA))
+	if (!(event_broker_options & BROKER_FLAPPING_DATA) || !neb_has_callbacks(NEBCALLBACK_FLAPPING_DATA))
 		return;
 
 	if (data == NULL)
@@ -429,7 +429,7 @@ void broker_program_status(int type, int flags, int attr, struct timeval *timest
 {
 	nebstruct_program_status_data ds;
 
-	if (!(event_broker_options & BROKER_STATUS_DATA))
+	if (!(event_broker_options & BROKER_STATUS_DATA) || !neb_has_callbacks(NEBCALLBACK_PROGRAM_STATUS_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -469,7 +469,7 @@ void broker_host_status(int type, int flags, int attr, host *hst, struct timeval
 {
 	nebstruct_host_status_data ds;
 
-	if (!(event_broker_options & BROKER_STATUS_DATA))
+	if (!(event_broker_options & BROKER_STATUS_DATA) || !neb_has_callbacks(NEBCALLBACK_HOST_STATUS_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -492,7 +492,7 @@ void broker_service_status(int type, int flags, int attr, service *svc, struct t
 {
 	nebstruct_service_status_data ds;
 
-	if (!(event_broker_options & BROKER_STATUS_DATA))
+	if (!(event_broker_options & BROKER_STATUS_DATA) || !neb_has_callbacks(NEBCALLBACK_SERVICE_STATUS_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -515,7 +515,7 @@ void broker_contact_status(int type, int flags, int attr, contact *cntct, struct
 {
 	nebstruct_service_status_data ds;
 
-	if (!(event_broker_options & BROKER_STATUS_DATA))
+	if (!(event_broker_options & BROKER_STATUS_DATA) || !neb_has_callbacks(NEBCALLBACK_CONTACT_STATUS_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -541,7 +541,7 @@ int broker_notification_data(int type, int flags, int attr, int notification_typ
 	service *temp_service = NULL;
 	int return_code = OK;
 
-	if (!(event_broker_options & BROKER_NOTIFICATIONS))
+	if (!(event_broker_options & BROKER_NOTIFICATIONS) || !neb_has_callbacks(NEBCALLBACK_NOTIFICATION_DATA))
 		return return_code;
 
 	/* fill struct with relevant data */
@@ -588,7 +588,7 @@ int broker_contact_notification_data(int type, int flags, int attr, int notifica
 	service *temp_service = NULL;
 	int return_code = OK;
 
-	if (!(event_broker_options & BROKER_NOTIFICATIONS))
+	if (!(event_broker_options & BROKER_NOTIFICATIONS) || !neb_has_callbacks(NEBCALLBACK_CONTACT_NOTIFICATION_DATA))
 		return return_code;
 
 	/* fill struct with relevant data */
@@ -639,7 +639,7 @@ int broker_contact_notification_method_data(int type, int flags, int attr, int n
 	char *command_args = NULL;
 	int return_code = OK;
 
-	if (!(event_broker_options & BROKER_NOTIFICATIONS))
+	if (!(event_broker_options & BROKER_NOTIFICATIONS) || !neb_has_callbacks(NEBCALLBACK_CONTACT_NOTIFICATION_METHOD_DATA))
 		return return_code;
 
 	/* get command name/args */
@@ -695,7 +695,7 @@ void broker_adaptive_program_data(int type, int flags, int attr, int command_typ
 {
 	nebstruct_adaptive_program_data ds;
 
-	if (!(event_broker_options & BROKER_ADAPTIVE_DATA))
+	if (!(event_broker_options & BROKER_ADAPTIVE_DATA) || !neb_has_callbacks(NEBCALLBACK_ADAPTIVE_PROGRAM_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -722,7 +722,7 @@ void broker_adaptive_host_data(int type, int flags, int attr, host *hst, int com
 {
 	nebstruct_adaptive_host_data ds;
 
-	if (!(event_broker_options & BROKER_ADAPTIVE_DATA))
+	if (!(event_broker_options & BROKER_ADAPTIVE_DATA) || !neb_has_callbacks(NEBCALLBACK_ADAPTIVE_HOST_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -748,7 +748,7 @@ void broker_adaptive_service_data(int type, int flags, int attr, service *svc, i
 {
 	nebstruct_adaptive_service_data ds;
 
-	if (!(event_broker_options & BROKER_ADAPTIVE_DATA))
+	if (!(event_broker_options & BROKER_ADAPTIVE_DATA) || !neb_has_callbacks(NEBCALLBACK_ADAPTIVE_SERVICE_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -774,7 +774,7 @@ void broker_adaptive_contact_data(int type, int flags, int attr, contact *cntct,
 {
 	nebstruct_adaptive_contact_data ds;
 
-	if (!(event_broker_options & BROKER_ADAPTIVE_DATA))
+	if (!(event_broker_options & BROKER_ADAPTIVE_DATA) || !neb_has_callbacks(NEBCALLBACK_ADAPTIVE_CONTACT_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -804,7 +804,7 @@ void broker_external_command(int type, int flags, int attr, int command_type, ti
 {
 	nebstruct_external_command_data ds;
 
-	if (!(event_broker_options & BROKER_EXTERNALCOMMAND_DATA))
+	if (!(event_broker_options & BROKER_EXTERNALCOMMAND_DATA) || !neb_has_callbacks(NEBCALLBACK_EXTERNAL_COMMAND_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -830,7 +830,7 @@ void broker_aggregated_status_data(int type, int flags, int attr, struct timeval
 {
 	nebstruct_aggregated_status_data ds;
 
-	if (!(event_broker_options & BROKER_STATUS_DATA))
+	if (!(event_broker_options & BROKER_STATUS_DATA) || !neb_has_callbacks(NEBCALLBACK_AGGREGATED_STATUS_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -851,7 +851,7 @@ void broker_retention_data(int type, int flags, int attr, struct timeval *timest
 {
 	nebstruct_retention_data ds;
 
-	if (!(event_broker_options & BROKER_RETENTION_DATA))
+	if (!(event_broker_options & BROKER_RETENTION_DATA) || !neb_has_callbacks(NEBCALLBACK_RETENTION_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -874,7 +874,7 @@ void broker_acknowledgement_data(int type, int flags, int attr, int acknowledgem
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 
-	if (!(event_broker_options & BROKER_ACKNOWLEDGEMENT_DATA))
+	if (!(event_broker_options & BROKER_ACKNOWLEDGEMENT_DATA) || !neb_has_callbacks(NEBCALLBACK_ACKNOWLEDGEMENT_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -916,7 +916,7 @@ void broker_statechange_data(int type, int flags, int attr, int statechange_type
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 
-	if (!(event_broker_options & BROKER_STATECHANGE_DATA))
+	if (!(event_broker_options & BROKER_STATECHANGE_DATA) || !neb_has_callbacks(NEBCALLBACK_STATE_CHANGE_DATA))
 		return;
 
 	/* fill struct with relevant data */
@@ -28,6 +28,29 @@
 
 /* forward declarations */
 static int process_host_check_result(host *hst, int new_state, char *old_plugin_output, char *old_long_plugin_output, int check_options, int reschedule_check, int use_cached_result, unsigned long check_timestamp_horizon, int *alert_recorded);
+static void parse_check_result_output(char *buf, char **short_output, char **long_output, char **perf_data);
+
+/*
+ * hosts and services with check_freshness set, ordered by the time
+ * their check results go stale, so freshness sweeps only have to look
+ * at the objects whose deadline has passed
+ */
+static pqueue_t *service_freshness_queue;
+static pqueue_t *host_freshness_queue;
+struct freshness_stats freshness_stats;
+struct nm_slab_cache check_result_cache = NM_SLAB_CACHE_INIT("check_result", check_result);
+
+/*
+ * dependency results are remembered per object until the state of a
+ * dependency master changes, which bumps the epoch. Timeperiods are
+ * no finer than a minute, so results that depended on a dependency
+ * period are good until the end of the minute they were worked out in
+ */
+static unsigned long dependency_epoch = 1;
+
+/* what a master's dependents see of its state */
+#define dependency_state(o) ((o)->current_state | (o)->last_hard_state << 8 | (o)->state_type << 16)
+
 /******************************************************************/
 /********************** CHECK REAPER FUNCTIONS ********************/
 /******************************************************************/
@@ -53,9 +76,59 @@ int reap_check_results(void)
 /********************* WORKER RESULT CALLBACKS ********************/
 /******************************************************************/
 
+/* a worker never sent back the result of this check, so we reschedule it */
+static void handle_orphaned_check(check_result *cr)
+{
+	service *temp_service = NULL;
+	host *temp_host = NULL;
+	time_t current_time = time(NULL);
+
+	if (cr->object_check_type == SERVICE_CHECK) {
+		temp_service = find_service(cr->host_name, cr->service_description);
+		if (temp_service == NULL || temp_service->is_executing == FALSE || check_orphaned_services == FALSE)
+			return;
+
+		/* log a warning */
+		nm_log(NSLOG_RUNTIME_WARNING, "Warning: The check of service '%s' on host '%s' looks like it was orphaned (results never came back; last_check=%lu; next_check=%lu).  I'm scheduling an immediate check of the service...\n", temp_service->description, temp_service->host_name, temp_service->last_check, temp_service->next_check);
+
+		log_debug_info(DEBUGL_CHECKS, 1, "Service '%s' on host '%s' was orphaned, so we're scheduling an immediate check...\n", temp_service->description, temp_service->host_name);
+
+		/* decrement the number of running service checks */
+		if (currently_running_service_checks > 0)
+			currently_running_service_checks--;
+
+		/* disable the executing flag */
+		temp_service->is_executing = FALSE;
+
+		/* schedule an immediate check of the service */
+		schedule_service_check(temp_service, current_time, CHECK_OPTION_ORPHAN_CHECK);
+	} else {
+		temp_host = find_host(cr->host_name);
+		if (temp_host == NULL || temp_host->is_executing == FALSE || check_orphaned_hosts == FALSE)
+			return;
+
+		/* log a warning */
+		nm_log(NSLOG_RUNTIME_WARNING, "Warning: The check of host '%s' looks like it was orphaned (results never came back).  I'm scheduling an immediate check of the host...\n", temp_host->name);
+
+		log_debug_info(DEBUGL_CHECKS, 1, "Host '%s' was orphaned, so we're scheduling an immediate check...\n", temp_host->name);
+
+		/* decrement the number of running host checks */
+		if (currently_running_host_checks > 0)
+			currently_running_host_checks--;
+
+		/* disable the executing flag */
+		temp_host->is_executing = FALSE;
+
+		/* schedule an immediate check of the host */
+		schedule_host_check(temp_host, current_time, CHECK_OPTION_ORPHAN_CHECK);
+	}
+}
+
 static void handle_worker_check(wproc_result *wpres, void *arg, int flags)
 {
 	check_result *cr = (check_result *)arg;
+	if (!wpres && (flags & WPROC_JOB_ORPHANED))
+		handle_orphaned_check(cr);
 	if(wpres) {
 		memcpy(&cr->rusage, &wpres->rusage, sizeof(wpres->rusage));
 		cr->start_time.tv_sec = wpres->start.tv_sec;
@@ -68,8 +141,12 @@ static void handle_worker_check(wproc_result *wpres, void *arg, int flags)
 			cr->return_code = STATE_UNKNOWN;
 		}
 
+		/*
+		 * stdout is only borrowed from the worker result, which
+		 * outlives the check result, so it's not copied
+		 */
 		if (wpres->outstd && *wpres->outstd) {
-			cr->output = nm_strdup(wpres->outstd);
+			cr->output = wpres->outstd;
 		} else if (wpres->outerr && *wpres->outerr) {
 			nm_asprintf(&cr->output, "(No output on stdout) stderr: %s", wpres->outerr);
 		} else {
@@ -81,9 +158,11 @@ static void handle_worker_check(wproc_result *wpres, void *arg, int flags)
 		cr->engine = NULL;
 		cr->source = wpres->source;
 		process_check_result(cr);
+		if (cr->output == wpres->outstd)
+			cr->output = NULL;
 	}
 	free_check_result(cr);
-	free(cr);
+	nm_slab_free(&check_result_cache, cr);
 }
 
 /******************************************************************/
@@ -235,13 +314,7 @@ int run_async_service_check(service *svc, int check_options, double latency, int
 	/* get the command start time */
 	gettimeofday(&start_time, NULL);
 
-	cr = nm_calloc(1, sizeof(*cr));
-	if (!cr) {
-		clear_volatile_macros_r(&mac);
-		svc->latency = old_latency;
-		nm_free(processed_command);
-		return ERROR;
-	}
+	cr = nm_slab_alloc(&check_result_cache);
 	init_check_result(cr);
 
 	/* save check info */
@@ -269,6 +342,7 @@ int run_async_service_check(service *svc, int check_options, double latency, int
 		clear_volatile_macros_r(&mac);
 		svc->latency = old_latency;
 		free_check_result(cr);
+		nm_slab_free(&check_result_cache, cr);
 		nm_free(processed_command);
 		return OK;
 	}
@@ -315,6 +389,7 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	service *master_service = NULL;
 	int state_changes_use_cached_state = TRUE; /* TODO - 09/23/07 move this to a global variable */
 	int flapping_check_done = FALSE;
+	int old_dependency_state;
 
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "handle_async_service_check_result()\n");
@@ -323,6 +398,8 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	if (temp_service == NULL || queued_check_result == NULL)
 		return ERROR;
 
+	old_dependency_state = dependency_state(temp_service);
+
 	/* get the current time */
 	time(&current_time);
 
@@ -388,15 +465,11 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	/* save the old service status info */
 	temp_service->last_state = temp_service->current_state;
 
-	/* save old plugin output */
-	if (temp_service->plugin_output)
-		old_plugin_output = nm_strdup(temp_service->plugin_output);
-
-	if (temp_service->long_plugin_output)
-		old_long_plugin_output = strdup(temp_service->long_plugin_output);
-	/* clear the old plugin output and perf data buffers */
-	nm_free(temp_service->plugin_output);
-	nm_free(temp_service->long_plugin_output);
+	/* save old plugin output, and clear the perf data buffer */
+	old_plugin_output = temp_service->plugin_output;
+	old_long_plugin_output = temp_service->long_plugin_output;
+	temp_service->plugin_output = NULL;
+	temp_service->long_plugin_output = NULL;
 	nm_free(temp_service->perf_data);
 
 	if (queued_check_result->early_timeout == TRUE) {
@@ -430,7 +503,7 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	else {
 
 		/* parse check output to get: (1) short output, (2) long output, (3) perf data */
-		parse_check_output(queued_check_result->output, &temp_service->plugin_output, &temp_service->long_plugin_output, &temp_service->perf_data, TRUE, FALSE);
+		parse_check_result_output(queued_check_result->output, &temp_service->plugin_output, &temp_service->long_plugin_output, &temp_service->perf_data);
 
 		/* make sure the plugin output isn't null */
 		if (temp_service->plugin_output == NULL)
@@ -961,6 +1034,13 @@ int handle_async_service_check_result(service *temp_service, check_result *queue
 	/* update service performance info */
 	update_service_performance_data(temp_service);
 
+	/* the result may have moved the freshness deadline */
+	update_service_freshness_deadline(temp_service);
+
+	/* services depending on this one may see things differently now */
+	if (temp_service->dependents && dependency_state(temp_service) != old_dependency_state)
+		invalidate_dependency_cache();
+
 	/* free allocated memory */
 	nm_free(temp_plugin_output);
 	nm_free(old_plugin_output);
@@ -1052,7 +1132,7 @@ void schedule_service_check(service *svc, time_t check_time, int options)
 			remove_event(nagios_squeue, temp_event);
 		} else {
 			/* allocate memory for a new event item */
-			temp_event = nm_calloc(1, sizeof(timed_event));
+			temp_event = nm_slab_alloc(&timed_event_cache);
 			if (temp_event == NULL) {
 				nm_log(NSLOG_RUNTIME_WARNING, "Warning: Could not reschedule check of service '%s' on host '%s'!\n", svc->description, svc->host_name);
 				return;
@@ -1164,15 +1244,45 @@ int check_service_check_viability(service *svc, int check_options, int *time_is_
 }
 
 
-/* checks service dependencies */
-int check_service_dependencies(service *svc, int dependency_type)
+/* forgets all remembered dependency results */
+void invalidate_dependency_cache(void)
 {
+	dependency_epoch++;
+}
+
+
+static struct dependency_result *cached_dependency_result(struct dependency_result *cache, int dependency_type, time_t now)
+{
+	struct dependency_result *dr = &cache[dependency_type == NOTIFICATION_DEPENDENCY ? 0 : 1];
+
+	if (dr->epoch == dependency_epoch && (!dr->expires || dr->expires > now))
+		return dr;
+	return NULL;
+}
+
+
+static int remember_dependency_result(struct dependency_result *cache, int dependency_type, int result, time_t until, time_t *expires)
+{
+	struct dependency_result *dr = &cache[dependency_type == NOTIFICATION_DEPENDENCY ? 0 : 1];
+
+	dr->epoch = dependency_epoch;
+	dr->expires = until;
+	dr->result = result;
+	if (until && (!*expires || until < *expires))
+		*expires = until;
+	return result;
+}
+
+
+static int service_dependencies(service *svc, int dependency_type, time_t now, time_t *expires)
+{
+	struct dependency_result *dr;
 	objectlist *list;
 	int state = STATE_OK;
-	time_t current_time = 0L;
+	time_t until = 0;
 
-
-	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_service_dependencies()\n");
+	if ((dr = cached_dependency_result(svc->dependency_cache, dependency_type, now)))
+		return remember_dependency_result(svc->dependency_cache, dependency_type, dr->result, dr->expires, expires);
 
 	/* only check dependencies of the desired type */
 	if (dependency_type == NOTIFICATION_DEPENDENCY)
@@ -1190,9 +1300,11 @@ int check_service_dependencies(service *svc, int dependency_type)
 			continue;
 
 		/* skip this dependency if it has a timeperiod and the current time isn't valid */
-		time(&current_time);
-		if (temp_dependency->dependency_period != NULL && check_time_against_period(current_time, temp_dependency->dependency_period_ptr) == ERROR)
-			return FALSE;
+		if (temp_dependency->dependency_period != NULL) {
+			until = now - now % 60 + 60;
+			if (check_time_against_period(now, temp_dependency->dependency_period_ptr) == ERROR)
+				return remember_dependency_result(svc->dependency_cache, dependency_type, FALSE, until, expires);
+		}
 
 		/* get the status to use (use last hard state if its currently in a soft state) */
 		if (temp_service->state_type == SOFT_STATE && soft_state_dependencies == FALSE)
@@ -1202,67 +1314,50 @@ int check_service_dependencies(service *svc, int dependency_type)
 
 		/* is the service we depend on in state that fails the dependency tests? */
 		if (flag_isset(temp_dependency->failure_options, 1 << state))
-			return DEPENDENCIES_FAILED;
+			return remember_dependency_result(svc->dependency_cache, dependency_type, DEPENDENCIES_FAILED, until, expires);
 
 		/* immediate dependencies ok at this point - check parent dependencies if necessary */
 		if (temp_dependency->inherits_parent == TRUE) {
-			if (check_service_dependencies(temp_service, dependency_type) != DEPENDENCIES_OK)
-				return DEPENDENCIES_FAILED;
+			if (service_dependencies(temp_service, dependency_type, now, &until) != DEPENDENCIES_OK)
+				return remember_dependency_result(svc->dependency_cache, dependency_type, DEPENDENCIES_FAILED, until, expires);
 		}
 	}
 
-	return DEPENDENCIES_OK;
+	return remember_dependency_result(svc->dependency_cache, dependency_type, DEPENDENCIES_OK, until, expires);
 }
 
 
-/* check for services that never returned from a check... */
-void check_for_orphaned_services(void)
+/* checks service dependencies */
+int check_service_dependencies(service *svc, int dependency_type)
 {
-	service *temp_service = NULL;
-	time_t current_time = 0L;
-	time_t expected_time = 0L;
-
-
-	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_for_orphaned_services()\n");
-
-	/* get the current time */
-	time(&current_time);
+	time_t expires = 0;
 
-	/* check all services... */
-	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
-
-		/* skip services that are not currently executing */
-		if (temp_service->is_executing == FALSE)
-			continue;
-
-		/* determine the time at which the check results should have come in (allow 10 minutes slack time) */
-		expected_time = (time_t)(temp_service->next_check + temp_service->latency + service_check_timeout + check_reaper_interval + 600);
-
-		/* this service was supposed to have executed a while ago, but for some reason the results haven't come back in... */
-		if (expected_time < current_time) {
+	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_service_dependencies()\n");
 
-			/* log a warning */
-			nm_log(NSLOG_RUNTIME_WARNING, "Warning: The check of service '%s' on host '%s' looks like it was orphaned (results never came back; last_check=%lu; next_check=%lu).  I'm scheduling an immediate check of the service...\n", temp_service->description, temp_service->host_name, temp_service->last_check, temp_service->next_check);
+	return service_dependencies(svc, dependency_type, time(NULL), &expires);
+}
 
-			log_debug_info(DEBUGL_CHECKS, 1, "Service '%s' on host '%s' was orphaned, so we're scheduling an immediate check...\n", temp_service->description, temp_service->host_name);
-			log_debug_info(DEBUGL_CHECKS, 1, "  next_check=%lu (%s); last_check=%lu (%s);\n",
-			               temp_service->next_check, ctime(&temp_service->next_check),
-			               temp_service->last_check, ctime(&temp_service->last_check));
 
-			/* decrement the number of running service checks */
-			if (currently_running_service_checks > 0)
-				currently_running_service_checks--;
+/* checks whether a service with a passed freshness deadline should be looked at now */
+static int service_freshness_check_is_viable(service *temp_service, time_t current_time)
+{
+	/* skip services that are currently executing (problems here will be caught by orphaned service check) */
+	if (temp_service->is_executing == TRUE)
+		return FALSE;
 
-			/* disable the executing flag */
-			temp_service->is_executing = FALSE;
+	/* skip services that have both active and passive checks disabled */
+	if (temp_service->checks_enabled == FALSE && temp_service->accept_passive_checks == FALSE)
+		return FALSE;
 
-			/* schedule an immediate check of the service */
-			schedule_service_check(temp_service, current_time, CHECK_OPTION_ORPHAN_CHECK);
-		}
+	/* skip services that are already being freshened */
+	if (temp_service->is_being_freshened == TRUE)
+		return FALSE;
 
-	}
+	/* see if the time is right... */
+	if (check_time_against_period(current_time, temp_service->check_period_ptr) == ERROR)
+		return FALSE;
 
-	return;
+	return TRUE;
 }
 
 
@@ -1270,6 +1365,7 @@ void check_for_orphaned_services(void)
 void check_service_result_freshness(void)
 {
 	service *temp_service = NULL;
+	objectlist *requeue = NULL, *list;
 	time_t current_time = 0L;
 
 
@@ -1285,36 +1381,30 @@ void check_service_result_freshness(void)
 	/* get the current time */
 	time(&current_time);
 
-	/* check all services... */
-	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
-
-		/* skip services we shouldn't be checking for freshness */
-		if (temp_service->check_freshness == FALSE)
-			continue;
+	freshness_stats.services_evaluated = 0;
+	freshness_stats.services_stale = 0;
+	if (service_freshness_queue == NULL)
+		return;
 
-		/* skip services that are currently executing (problems here will be caught by orphaned service check) */
-		if (temp_service->is_executing == TRUE)
-			continue;
+	/* check all services whose results may have gone stale... */
+	while ((temp_service = pqueue_peek(service_freshness_queue)) != NULL) {
 
-		/* skip services that have both active and passive checks disabled */
-		if (temp_service->checks_enabled == FALSE && temp_service->accept_passive_checks == FALSE)
-			continue;
+		if (temp_service->freshness_deadline > current_time)
+			break;
+		pqueue_pop(service_freshness_queue);
+		temp_service->freshness_pos = 0;
+		freshness_stats.services_evaluated++;
 
-		/* skip services that are already being freshened */
-		if (temp_service->is_being_freshened == TRUE)
-			continue;
+		if (service_freshness_check_is_viable(temp_service, current_time) == TRUE) {
 
-		/* see if the time is right... */
-		if (check_time_against_period(current_time, temp_service->check_period_ptr) == ERROR)
-			continue;
-
-		/* EXCEPTION */
-		/* don't check freshness of services without regular check intervals if we're using auto-freshness threshold */
-		if (temp_service->check_interval == 0 && temp_service->freshness_threshold == 0)
-			continue;
+			/* still fresh, so move it to its new deadline */
+			if (is_service_result_fresh(temp_service, current_time, TRUE) == TRUE) {
+				update_service_freshness_deadline(temp_service);
+				continue;
+			}
 
-		/* the results for the last check of this service are stale! */
-		if (is_service_result_fresh(temp_service, current_time, TRUE) == FALSE) {
+			/* the results for the last check of this service are stale! */
+			freshness_stats.services_stale++;
 
 			/* set the freshen flag */
 			temp_service->is_being_freshened = TRUE;
@@ -1323,27 +1413,25 @@ void check_service_result_freshness(void)
 			schedule_service_check(temp_service, current_time, CHECK_OPTION_FORCE_EXECUTION | CHECK_OPTION_FRESHNESS_CHECK);
 		}
 
+		/* keep the deadline we passed, so we look at it again next time */
+		prepend_object_to_objectlist(&requeue, temp_service);
 	}
 
+	for (list = requeue; list; list = list->next)
+		pqueue_insert(service_freshness_queue, list->object_ptr);
+	free_objectlist(&requeue);
+
+	log_debug_info(DEBUGL_CHECKS, 1, "Evaluated freshness of %u of %u services, %u were stale.\n", freshness_stats.services_evaluated, pqueue_size(service_freshness_queue), freshness_stats.services_stale);
+
 	return;
 }
 
 
-/* tests whether or not a service's check results are fresh */
-int is_service_result_fresh(service *temp_service, time_t current_time, int log_this)
+/* calculates when a service's check results go stale */
+static time_t service_freshness_expiration(service *temp_service, int *threshold)
 {
 	int freshness_threshold = 0;
 	time_t expiration_time = 0L;
-	int days = 0;
-	int hours = 0;
-	int minutes = 0;
-	int seconds = 0;
-	int tdays = 0;
-	int thours = 0;
-	int tminutes = 0;
-	int tseconds = 0;
-
-	log_debug_info(DEBUGL_CHECKS, 2, "Checking freshness of service '%s' on host '%s'...\n", temp_service->description, temp_service->host_name);
 
 	/* use user-supplied freshness threshold or auto-calculate a freshness threshold to use? */
 	if (temp_service->freshness_threshold == 0) {
@@ -1354,8 +1442,6 @@ int is_service_result_fresh(service *temp_service, time_t current_time, int log_
 	} else
 		freshness_threshold = temp_service->freshness_threshold;
 
-	log_debug_info(DEBUGL_CHECKS, 2, "Freshness thresholds: service=%d, use=%d\n", temp_service->freshness_threshold, freshness_threshold);
-
 	/* calculate expiration time */
 	/*
 	 * CHANGED 11/10/05 EG -
@@ -1403,6 +1489,31 @@ int is_service_result_fresh(service *temp_service, time_t current_time, int log_
 			expiration_time = event_start + freshness_threshold;
 		}
 	}
+
+	*threshold = freshness_threshold;
+	return expiration_time;
+}
+
+
+/* tests whether or not a service's check results are fresh */
+int is_service_result_fresh(service *temp_service, time_t current_time, int log_this)
+{
+	int freshness_threshold = 0;
+	time_t expiration_time = 0L;
+	int days = 0;
+	int hours = 0;
+	int minutes = 0;
+	int seconds = 0;
+	int tdays = 0;
+	int thours = 0;
+	int tminutes = 0;
+	int tseconds = 0;
+
+	log_debug_info(DEBUGL_CHECKS, 2, "Checking freshness of service '%s' on host '%s'...\n", temp_service->description, temp_service->host_name);
+
+	expiration_time = service_freshness_expiration(temp_service, &freshness_threshold);
+
+	log_debug_info(DEBUGL_CHECKS, 2, "Freshness thresholds: service=%d, use=%d\n", temp_service->freshness_threshold, freshness_threshold);
 	log_debug_info(DEBUGL_CHECKS, 2, "HBC: %d, PS: %lu, ES: %lu, LC: %lu, CT: %lu, ET: %lu\n", temp_service->has_been_checked, (unsigned long)program_start, (unsigned long)event_start, (unsigned long)temp_service->last_check, (unsigned long)current_time, (unsigned long)expiration_time);
 
 	/* the results for the last check of this service are stale */
@@ -1514,7 +1625,7 @@ void schedule_host_check(host *hst, time_t check_time, int options)
 		if (temp_event) {
 			remove_event(nagios_squeue, temp_event);
 		}
-		temp_event = nm_calloc(1, sizeof(timed_event));
+		temp_event = nm_slab_alloc(&timed_event_cache);
 
 		/* set the next host check event and time */
 		hst->next_check_event = temp_event;
@@ -1551,17 +1662,17 @@ void schedule_host_check(host *hst, time_t check_time, int options)
 }
 
 
-/* checks host dependencies */
-int check_host_dependencies(host *hst, int dependency_type)
+static int host_dependencies(host *hst, int dependency_type, time_t now, time_t *expires)
 {
+	struct dependency_result *dr;
 	hostdependency *temp_dependency = NULL;
 	objectlist *list;
 	host *temp_host = NULL;
 	int state = STATE_UP;
-	time_t current_time = 0L;
+	time_t until = 0;
 
-
-	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_host_dependencies()\n");
+	if ((dr = cached_dependency_result(hst->dependency_cache, dependency_type, now)))
+		return remember_dependency_result(hst->dependency_cache, dependency_type, dr->result, dr->expires, expires);
 
 	if (dependency_type == NOTIFICATION_DEPENDENCY) {
 		list = hst->notify_deps;
@@ -1578,9 +1689,11 @@ int check_host_dependencies(host *hst, int dependency_type)
 			continue;
 
 		/* skip this dependency if it has a timeperiod and the current time isn't valid */
-		time(&current_time);
-		if (temp_dependency->dependency_period != NULL && check_time_against_period(current_time, temp_dependency->dependency_period_ptr) == ERROR)
-			return FALSE;
+		if (temp_dependency->dependency_period != NULL) {
+			until = now - now % 60 + 60;
+			if (check_time_against_period(now, temp_dependency->dependency_period_ptr) == ERROR)
+				return remember_dependency_result(hst->dependency_cache, dependency_type, FALSE, until, expires);
+		}
 
 		/* get the status to use (use last hard state if its currently in a soft state) */
 		if (temp_host->state_type == SOFT_STATE && soft_state_dependencies == FALSE)
@@ -1590,68 +1703,50 @@ int check_host_dependencies(host *hst, int dependency_type)
 
 		/* is the host we depend on in state that fails the dependency tests? */
 		if (flag_isset(temp_dependency->failure_options, 1 << state))
-			return DEPENDENCIES_FAILED;
+			return remember_dependency_result(hst->dependency_cache, dependency_type, DEPENDENCIES_FAILED, until, expires);
 
 		/* immediate dependencies ok at this point - check parent dependencies if necessary */
 		if (temp_dependency->inherits_parent == TRUE) {
-			if (check_host_dependencies(temp_host, dependency_type) != DEPENDENCIES_OK)
-				return DEPENDENCIES_FAILED;
+			if (host_dependencies(temp_host, dependency_type, now, &until) != DEPENDENCIES_OK)
+				return remember_dependency_result(hst->dependency_cache, dependency_type, DEPENDENCIES_FAILED, until, expires);
 		}
 	}
 
-	return DEPENDENCIES_OK;
+	return remember_dependency_result(hst->dependency_cache, dependency_type, DEPENDENCIES_OK, until, expires);
 }
 
 
-/* check for hosts that never returned from a check... */
-void check_for_orphaned_hosts(void)
+/* checks host dependencies */
+int check_host_dependencies(host *hst, int dependency_type)
 {
-	host *temp_host = NULL;
-	time_t current_time = 0L;
-	time_t expected_time = 0L;
-
-
-	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_for_orphaned_hosts()\n");
+	time_t expires = 0;
 
-	/* get the current time */
-	time(&current_time);
-
-	/* check all hosts... */
-	for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
-
-		/* skip hosts that don't have a set check interval (on-demand checks are missed by the orphan logic) */
-		if (temp_host->next_check == (time_t)0L)
-			continue;
-
-		/* skip hosts that are not currently executing */
-		if (temp_host->is_executing == FALSE)
-			continue;
-
-		/* determine the time at which the check results should have come in (allow 10 minutes slack time) */
-		expected_time = (time_t)(temp_host->next_check + temp_host->latency + host_check_timeout + check_reaper_interval + 600);
-
-		/* this host was supposed to have executed a while ago, but for some reason the results haven't come back in... */
-		if (expected_time < current_time) {
+	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_host_dependencies()\n");
 
-			/* log a warning */
-			nm_log(NSLOG_RUNTIME_WARNING, "Warning: The check of host '%s' looks like it was orphaned (results never came back).  I'm scheduling an immediate check of the host...\n", temp_host->name);
+	return host_dependencies(hst, dependency_type, time(NULL), &expires);
+}
 
-			log_debug_info(DEBUGL_CHECKS, 1, "Host '%s' was orphaned, so we're scheduling an immediate check...\n", temp_host->name);
 
-			/* decrement the number of running host checks */
-			if (currently_running_host_checks > 0)
-				currently_running_host_checks--;
+/* checks whether a host with a passed freshness deadline should be looked at now */
+static int host_freshness_check_is_viable(host *temp_host, time_t current_time)
+{
+	/* skip hosts that have both active and passive checks disabled */
+	if (temp_host->checks_enabled == FALSE && temp_host->accept_passive_checks == FALSE)
+		return FALSE;
 
-			/* disable the executing flag */
-			temp_host->is_executing = FALSE;
+	/* skip hosts that are currently executing (problems here will be caught by orphaned host check) */
+	if (temp_host->is_executing == TRUE)
+		return FALSE;
 
-			/* schedule an immediate check of the host */
-			schedule_host_check(temp_host, current_time, CHECK_OPTION_ORPHAN_CHECK);
-		}
+	/* skip hosts that are already being freshened */
+	if (temp_host->is_being_freshened == TRUE)
+		return FALSE;
 
-	}
+	/* see if the time is right... */
+	if (check_time_against_period(current_time, temp_host->check_period_ptr) == ERROR)
+		return FALSE;
 
-	return;
+	return TRUE;
 }
 
 
@@ -1659,6 +1754,7 @@ void check_for_orphaned_hosts(void)
 void check_host_result_freshness(void)
 {
 	host *temp_host = NULL;
+	objectlist *requeue = NULL, *list;
 	time_t current_time = 0L;
 
 
@@ -1674,31 +1770,30 @@ void check_host_result_freshness(void)
 	/* get the current time */
 	time(&current_time);
 
-	/* check all hosts... */
-	for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
-
-		/* skip hosts we shouldn't be checking for freshness */
-		if (temp_host->check_freshness == FALSE)
-			continue;
+	freshness_stats.hosts_evaluated = 0;
+	freshness_stats.hosts_stale = 0;
+	if (host_freshness_queue == NULL)
+		return;
 
-		/* skip hosts that have both active and passive checks disabled */
-		if (temp_host->checks_enabled == FALSE && temp_host->accept_passive_checks == FALSE)
-			continue;
+	/* check all hosts whose results may have gone stale... */
+	while ((temp_host = pqueue_peek(host_freshness_queue)) != NULL) {
 
-		/* skip hosts that are currently executing (problems here will be caught by orphaned host check) */
-		if (temp_host->is_executing == TRUE)
-			continue;
+		if (temp_host->freshness_deadline > current_time)
+			break;
+		pqueue_pop(host_freshness_queue);
+		temp_host->freshness_pos = 0;
+		freshness_stats.hosts_evaluated++;
 
-		/* skip hosts that are already being freshened */
-		if (temp_host->is_being_freshened == TRUE)
-			continue;
+		if (host_freshness_check_is_viable(temp_host, current_time) == TRUE) {
 
-		/* see if the time is right... */
-		if (check_time_against_period(current_time, temp_host->check_period_ptr) == ERROR)
-			continue;
+			/* still fresh, so move it to its new deadline */
+			if (is_host_result_fresh(temp_host, current_time, TRUE) == TRUE) {
+				update_host_freshness_deadline(temp_host);
+				continue;
+			}
 
-		/* the results for the last check of this host are stale */
-		if (is_host_result_fresh(temp_host, current_time, TRUE) == FALSE) {
+			/* the results for the last check of this host are stale */
+			freshness_stats.hosts_stale++;
 
 			/* set the freshen flag */
 			temp_host->is_being_freshened = TRUE;
@@ -1706,29 +1801,28 @@ void check_host_result_freshness(void)
 			/* schedule an immediate forced check of the host */
 			schedule_host_check(temp_host, current_time, CHECK_OPTION_FORCE_EXECUTION | CHECK_OPTION_FRESHNESS_CHECK);
 		}
+
+		/* keep the deadline we passed, so we look at it again next time */
+		prepend_object_to_objectlist(&requeue, temp_host);
 	}
 
+	for (list = requeue; list; list = list->next)
+		pqueue_insert(host_freshness_queue, list->object_ptr);
+	free_objectlist(&requeue);
+
+	log_debug_info(DEBUGL_CHECKS, 2, "Evaluated freshness of %u of %u hosts, %u were stale.\n", freshness_stats.hosts_evaluated, pqueue_size(host_freshness_queue), freshness_stats.hosts_stale);
+
 	return;
 }
 
 
-/* checks to see if a hosts's check results are fresh */
-int is_host_result_fresh(host *temp_host, time_t current_time, int log_this)
+/* calculates when a host's check results go stale */
+static time_t host_freshness_expiration(host *temp_host, int *threshold)
 {
 	time_t expiration_time = 0L;
 	int freshness_threshold = 0;
-	int days = 0;
-	int hours = 0;
-	int minutes = 0;
-	int seconds = 0;
-	int tdays = 0;
-	int thours = 0;
-	int tminutes = 0;
-	int tseconds = 0;
 	double interval = 0;
 
-	log_debug_info(DEBUGL_CHECKS, 2, "Checking freshness of host '%s'...\n", temp_host->name);
-
 	/* use user-supplied freshness threshold or auto-calculate a freshness threshold to use? */
 	if (temp_host->freshness_threshold == 0) {
 		if (temp_host->state_type == HARD_STATE || temp_host->current_state == STATE_OK) {
@@ -1740,8 +1834,6 @@ int is_host_result_fresh(host *temp_host, time_t current_time, int log_this)
 	} else
 		freshness_threshold = temp_host->freshness_threshold;
 
-	log_debug_info(DEBUGL_CHECKS, 2, "Freshness thresholds: host=%d, use=%d\n", temp_host->freshness_threshold, freshness_threshold);
-
 	/* calculate expiration time */
 	/*
 	 * CHANGED 11/10/05 EG:
@@ -1780,6 +1872,30 @@ int is_host_result_fresh(host *temp_host, time_t current_time, int log_this)
 		}
 	}
 
+	*threshold = freshness_threshold;
+	return expiration_time;
+}
+
+
+/* checks to see if a hosts's check results are fresh */
+int is_host_result_fresh(host *temp_host, time_t current_time, int log_this)
+{
+	time_t expiration_time = 0L;
+	int freshness_threshold = 0;
+	int days = 0;
+	int hours = 0;
+	int minutes = 0;
+	int seconds = 0;
+	int tdays = 0;
+	int thours = 0;
+	int tminutes = 0;
+	int tseconds = 0;
+
+	log_debug_info(DEBUGL_CHECKS, 2, "Checking freshness of host '%s'...\n", temp_host->name);
+
+	expiration_time = host_freshness_expiration(temp_host, &freshness_threshold);
+
+	log_debug_info(DEBUGL_CHECKS, 2, "Freshness thresholds: host=%d, use=%d\n", temp_host->freshness_threshold, freshness_threshold);
 	log_debug_info(DEBUGL_CHECKS, 2, "HBC: %d, PS: %lu, ES: %lu, LC: %lu, CT: %lu, ET: %lu\n", temp_host->has_been_checked, (unsigned long)program_start, (unsigned long)event_start, (unsigned long)temp_host->last_check, (unsigned long)current_time, (unsigned long)expiration_time);
 
 	/* the results for the last check of this host are stale */
@@ -1802,6 +1918,175 @@ int is_host_result_fresh(host *temp_host, time_t current_time, int log_this)
 }
 
 
+/******************************************************************/
+/****************** FRESHNESS DEADLINE FUNCTIONS ******************/
+/******************************************************************/
+
+static int freshness_cmp_pri(pqueue_pri_t next, pqueue_pri_t cur)
+{
+	return next > cur;
+}
+
+static pqueue_pri_t service_freshness_get_pri(void *a)
+{
+	return ((service *)a)->freshness_deadline;
+}
+
+static void service_freshness_set_pri(void *a, pqueue_pri_t pri)
+{
+	((service *)a)->freshness_deadline = pri;
+}
+
+static unsigned int service_freshness_get_pos(void *a)
+{
+	return ((service *)a)->freshness_pos;
+}
+
+static void service_freshness_set_pos(void *a, unsigned int pos)
+{
+	((service *)a)->freshness_pos = pos;
+}
+
+static pqueue_pri_t host_freshness_get_pri(void *a)
+{
+	return ((host *)a)->freshness_deadline;
+}
+
+static void host_freshness_set_pri(void *a, pqueue_pri_t pri)
+{
+	((host *)a)->freshness_deadline = pri;
+}
+
+static unsigned int host_freshness_get_pos(void *a)
+{
+	return ((host *)a)->freshness_pos;
+}
+
+static void host_freshness_set_pos(void *a, unsigned int pos)
+{
+	((host *)a)->freshness_pos = pos;
+}
+
+
+/*
+ * (re)computes when a service's check results go stale and moves it
+ * accordingly in the freshness queue. This must be called whenever
+ * something that may bring the deadline closer changes, such as a
+ * check result being handled or its check interval being modified.
+ */
+void update_service_freshness_deadline(service *svc)
+{
+	int freshness_threshold;
+	time_t deadline;
+
+	/* don't check freshness of services without regular check intervals if we're using auto-freshness threshold */
+	if (svc->check_freshness == FALSE || (svc->check_interval == 0 && svc->freshness_threshold == 0)) {
+		if (svc->freshness_pos) {
+			pqueue_remove(service_freshness_queue, svc);
+			svc->freshness_pos = 0;
+		}
+		return;
+	}
+
+	if (service_freshness_queue == NULL) {
+		service_freshness_queue = pqueue_init(num_objects.services, freshness_cmp_pri, service_freshness_get_pri, service_freshness_set_pri, service_freshness_get_pos, service_freshness_set_pos);
+		if (service_freshness_queue == NULL) {
+			nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to create service freshness queue\n");
+			return;
+		}
+	}
+
+	/* results are stale once the expiration time has passed */
+	deadline = service_freshness_expiration(svc, &freshness_threshold) + 1;
+
+	if (svc->freshness_pos)
+		pqueue_change_priority(service_freshness_queue, deadline, svc);
+	else {
+		svc->freshness_deadline = deadline;
+		pqueue_insert(service_freshness_queue, svc);
+	}
+}
+
+
+/* the host equivalent of update_service_freshness_deadline() */
+void update_host_freshness_deadline(host *hst)
+{
+	int freshness_threshold;
+	time_t deadline;
+
+	if (hst->check_freshness == FALSE) {
+		if (hst->freshness_pos) {
+			pqueue_remove(host_freshness_queue, hst);
+			hst->freshness_pos = 0;
+		}
+		return;
+	}
+
+	if (host_freshness_queue == NULL) {
+		host_freshness_queue = pqueue_init(num_objects.hosts, freshness_cmp_pri, host_freshness_get_pri, host_freshness_set_pri, host_freshness_get_pos, host_freshness_set_pos);
+		if (host_freshness_queue == NULL) {
+			nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to create host freshness queue\n");
+			return;
+		}
+	}
+
+	/* results are stale once the expiration time has passed */
+	deadline = host_freshness_expiration(hst, &freshness_threshold) + 1;
+
+	if (hst->freshness_pos)
+		pqueue_change_priority(host_freshness_queue, deadline, hst);
+	else {
+		hst->freshness_deadline = deadline;
+		pqueue_insert(host_freshness_queue, hst);
+	}
+}
+
+
+/* (re)builds the freshness queues from scratch */
+void init_freshness_deadlines(void)
+{
+	service *temp_service;
+	host *temp_host;
+
+	free_freshness_deadlines();
+
+	for (temp_service = service_list; temp_service; temp_service = temp_service->next)
+		update_service_freshness_deadline(temp_service);
+	for (temp_host = host_list; temp_host; temp_host = temp_host->next)
+		update_host_freshness_deadline(temp_host);
+}
+
+
+/* releases the freshness queues. objects may be freed after this */
+void free_freshness_deadlines(void)
+{
+	service *temp_service;
+	host *temp_host;
+
+	if (service_freshness_queue) {
+		for (temp_service = service_list; temp_service; temp_service = temp_service->next)
+			temp_service->freshness_pos = 0;
+		pqueue_free(service_freshness_queue);
+		service_freshness_queue = NULL;
+	}
+	if (host_freshness_queue) {
+		for (temp_host = host_list; temp_host; temp_host = temp_host->next)
+			temp_host->freshness_pos = 0;
+		pqueue_free(host_freshness_queue);
+		host_freshness_queue = NULL;
+	}
+}
+
+
+/* number of services and hosts currently tracked for freshness */
+unsigned int freshness_queue_size(int service_queue)
+{
+	pqueue_t *q = service_queue ? service_freshness_queue : host_freshness_queue;
+
+	return q ? pqueue_size(q) : 0;
+}
+
+
 /* run a scheduled host check asynchronously */
 int run_scheduled_host_check(host *hst, int check_options, double latency)
 {
@@ -1966,13 +2251,7 @@ int run_async_host_check(host *hst, int check_options, double latency, int sched
 	/* get the command start time */
 	gettimeofday(&start_time, NULL);
 
-	cr = nm_calloc(1, sizeof(*cr));
-	if (!cr) {
-		log_debug_info(DEBUGL_CHECKS, 0, "Failed to allocate checkresult struct\n");
-		clear_volatile_macros_r(&mac);
-		clear_host_macros_r(&mac);
-		return ERROR;
-	}
+	cr = nm_slab_alloc(&check_result_cache);
 	init_check_result(cr);
 
 	/* save check info */
@@ -2002,6 +2281,7 @@ int run_async_host_check(host *hst, int check_options, double latency, int sched
 	if (neb_result == NEBERROR_CALLBACKOVERRIDE) {
 		clear_volatile_macros_r(&mac);
 		free_check_result(cr);
+		nm_slab_free(&check_result_cache, cr);
 		nm_free(processed_command);
 		return OK;
 	}
@@ -2039,6 +2319,7 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	struct timeval end_time_hires;
 	int alert_recorded = NEBATTR_NONE;
 	int first_recorded_state = NEBATTR_NONE;
+	int old_dependency_state;
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "handle_async_host_check_result(%s ...)\n", temp_host ? temp_host->name : "(NULL host!)");
 
@@ -2046,6 +2327,8 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	if (temp_host == NULL || queued_check_result == NULL)
 		return ERROR;
 
+	old_dependency_state = dependency_state(temp_host);
+
 	time(&current_time);
 
 	log_debug_info(DEBUGL_CHECKS, 1, "** Handling async check result for host '%s' from '%s'...\n", temp_host->name, check_result_source(queued_check_result));
@@ -2127,20 +2410,15 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 	if (temp_host->state_type == HARD_STATE)
 		temp_host->last_hard_state = temp_host->current_state;
 
-	/* save old plugin output */
-	if (temp_host->plugin_output)
-		old_plugin_output = nm_strdup(temp_host->plugin_output);
-
-	if (temp_host->long_plugin_output)
-		old_long_plugin_output = nm_strdup(temp_host->long_plugin_output);
-
-	/* clear the old plugin output and perf data buffers */
-	nm_free(temp_host->plugin_output);
-	nm_free(temp_host->long_plugin_output);
+	/* save old plugin output, and clear the perf data buffer */
+	old_plugin_output = temp_host->plugin_output;
+	old_long_plugin_output = temp_host->long_plugin_output;
+	temp_host->plugin_output = NULL;
+	temp_host->long_plugin_output = NULL;
 	nm_free(temp_host->perf_data);
 
 	/* parse check output to get: (1) short output, (2) long output, (3) perf data */
-	parse_check_output(queued_check_result->output, &temp_host->plugin_output, &temp_host->long_plugin_output, &temp_host->perf_data, TRUE, FALSE);
+	parse_check_result_output(queued_check_result->output, &temp_host->plugin_output, &temp_host->long_plugin_output, &temp_host->perf_data);
 
 	/* make sure we have some data */
 	if (temp_host->plugin_output == NULL) {
@@ -2237,6 +2515,13 @@ int handle_async_host_check_result(host *temp_host, check_result *queued_check_r
 
 	log_debug_info(DEBUGL_CHECKS, 1, "** Async check result for host '%s' handled: new state=%d\n", temp_host->name, temp_host->current_state);
 
+	/* the result may have moved the freshness deadline */
+	update_host_freshness_deadline(temp_host);
+
+	/* hosts depending on this one may see things differently now */
+	if (temp_host->dependents && dependency_state(temp_host) != old_dependency_state)
+		invalidate_dependency_cache();
+
 	/* high resolution start time for event broker */
 	start_time_hires = queued_check_result->start_time;
 
@@ -2828,26 +3113,12 @@ int handle_host_state(host *hst, int *alert_recorded)
 	return OK;
 }
 
-/**
- * Parse check output, long output and performance data from a buffer
- * into a struct.
- *
- * @param buf Buffer from which to parse check output
- * @param check_output Where to store the parsed output
- * @return Pointer to the populated check_output struct, or NULL on error
- */
-struct check_output *parse_output(const char *buf, struct check_output *check_output) {
-	char *saveptr = NULL, *tmpbuf = NULL;
-	char *p = NULL, *tmp = NULL;
+/* does the actual parsing for parse_output(), chopping up tmpbuf as it goes */
+static struct check_output *parse_output_buf(char *tmpbuf, struct check_output *check_output) {
+	char *saveptr = NULL;
+	char *p = NULL, *tmp = NULL, *first_perf_data = NULL;
 	dbuf perf_data_dbuf;
 
-	check_output->perf_data = NULL;
-	check_output->long_output = NULL;
-	check_output->short_output = NULL;
-	if(!buf || !*buf)
-		return check_output;
-	tmpbuf = nm_strdup(buf);
-
 	dbuf_init(&perf_data_dbuf, 1024);
 	tmp = strtok_r(tmpbuf, "\n", &saveptr);
 	p = tmp ? strpbrk((const char *) tmp, "|") : NULL;
@@ -2869,7 +3140,8 @@ struct check_output *parse_output(const char *buf, struct check_output *check_ou
 		else {
 			check_output->short_output = nm_strdup("");
 		}
-		dbuf_strcat(&perf_data_dbuf, tmp+(p-tmp)+1);
+		/* only copied into the buffer if more perf data follows */
+		first_perf_data = p + 1;
 	}
 
 	/*
@@ -2895,6 +3167,10 @@ struct check_output *parse_output(const char *buf, struct check_output *check_ou
 			 * perf data - we're not interested in those.
 			 * */
 			tmp = strtok_r(p+1, "\n", &saveptr);
+			if (tmp && first_perf_data) {
+				dbuf_strcat(&perf_data_dbuf, first_perf_data);
+				first_perf_data = NULL;
+			}
 			while (tmp) {
 
 				/* Backwards compatibility
@@ -2914,21 +3190,64 @@ struct check_output *parse_output(const char *buf, struct check_output *check_ou
 		}
 	}
 
-	check_output->perf_data = perf_data_dbuf.buf != NULL ? nm_strdup(perf_data_dbuf.buf) : NULL;
+	if (perf_data_dbuf.buf != NULL)
+		check_output->perf_data = nm_strdup(perf_data_dbuf.buf);
+	else if (first_perf_data != NULL)
+		check_output->perf_data = nm_strdup(first_perf_data);
 	dbuf_free(&perf_data_dbuf);
-	free(tmpbuf);
 	return check_output;
 }
 
+/**
+ * Parse check output, long output and performance data from a buffer
+ * into a struct.
+ *
+ * @param buf Buffer from which to parse check output
+ * @param check_output Where to store the parsed output
+ * @return Pointer to the populated check_output struct, or NULL on error
+ */
+struct check_output *parse_output(const char *buf, struct check_output *check_output) {
+	char *tmpbuf;
+
+	check_output->perf_data = NULL;
+	check_output->long_output = NULL;
+	check_output->short_output = NULL;
+	if(!buf || !*buf)
+		return check_output;
+	tmpbuf = nm_strdup(buf);
+	parse_output_buf(tmpbuf, check_output);
+	nm_free(tmpbuf);
+	return check_output;
+}
+
+/*
+ * parse_check_output() for check results handled by the event loop,
+ * which can make its working copy of the output on the scratch arena
+ */
+static void parse_check_result_output(char *buf, char **short_output, char **long_output, char **perf_data)
+{
+	struct check_output check_output;
+
+	check_output.perf_data = NULL;
+	check_output.long_output = NULL;
+	check_output.short_output = NULL;
+	if (buf && *buf)
+		parse_output_buf(nm_scratch_strdup(buf), &check_output);
+	*short_output = check_output.short_output;
+	*long_output = check_output.long_output;
+	*perf_data = check_output.perf_data;
+	strip(*short_output);
+	strip(*perf_data);
+}
+
 /* parse raw plugin output and return: short and long output, perf data */
 int parse_check_output(char *buf, char **short_output, char **long_output, char **perf_data, int escape_newlines_please, int newlines_are_escaped)
 {
-	struct check_output *check_output = nm_malloc(sizeof(struct check_output));
-	check_output = parse_output(buf, check_output);
-	*short_output = check_output->short_output;
-	*long_output = check_output->long_output;
-	*perf_data = check_output->perf_data;
-	free(check_output);
+	struct check_output check_output;
+	parse_output(buf, &check_output);
+	*short_output = check_output.short_output;
+	*long_output = check_output.long_output;
+	*perf_data = check_output.perf_data;
 	strip(*short_output);
 	strip(*perf_data);
 	return OK;
@@ -27,6 +27,18 @@
 
 NAGIOS_BEGIN_DECL
 
+/* work done by the most recent freshness sweeps */
+struct freshness_stats {
+	unsigned int services_evaluated; /* services whose deadline had passed */
+	unsigned int services_stale;     /* ... and which got a freshness check */
+	unsigned int hosts_evaluated;
+	unsigned int hosts_stale;
+};
+extern struct freshness_stats freshness_stats;
+
+/* check results handed to the workers come from here */
+extern struct nm_slab_cache check_result_cache;
+
 static inline int _next_check_time(time_t last_check, time_t window)
 {
 	time_t now = time(NULL);
@@ -46,12 +58,16 @@ int parse_check_output(char *, char **, char **, char **, int, int);
 struct check_output *parse_output(const char *, struct check_output *);
 int check_service_dependencies(service *, int);          	/* checks service dependencies */
 int check_host_dependencies(host *, int);                	/* checks host dependencies */
-void check_for_orphaned_services(void);				/* checks for orphaned services */
-void check_for_orphaned_hosts(void);				/* checks for orphaned hosts */
+void invalidate_dependency_cache(void);			/* forgets remembered dependency results */
 void check_service_result_freshness(void);              	/* checks the "freshness" of service check results */
 int is_service_result_fresh(service *, time_t, int);            /* determines if a service's check results are fresh */
 void check_host_result_freshness(void);                 	/* checks the "freshness" of host check results */
 int is_host_result_fresh(host *, time_t, int);                  /* determines if a host's check results are fresh */
+void update_service_freshness_deadline(service *);		/* (re)computes when a service's check results go stale */
+void update_host_freshness_deadline(host *);			/* (re)computes when a host's check results go stale */
+void init_freshness_deadlines(void);
+void free_freshness_deadlines(void);
+unsigned int freshness_queue_size(int service_queue);
 
 int check_host_check_viability(host *, int, int *, time_t *);
 int adjust_host_check_attempt(host *, int);
@@ -1637,6 +1637,7 @@ static int host_command_handler(const struct external_command *ext_command, time
 		case CMD_CHANGE_NORMAL_HOST_CHECK_INTERVAL:
 			old_interval = target_host->check_interval;
 			target_host->check_interval = GV_TIMESTAMP("check_interval");
+			update_host_freshness_deadline(target_host);
 
 			/*
 			 * no real change means we're done. This also means we
@@ -1726,6 +1727,7 @@ static int host_command_handler(const struct external_command *ext_command, time
 			return OK;
 		case CMD_CHANGE_RETRY_HOST_CHECK_INTERVAL:
 			target_host->retry_interval = GV_TIMESTAMP("check_interval");
+			update_host_freshness_deadline(target_host);
 			target_host->modified_attributes |= MODATTR_RETRY_CHECK_INTERVAL;
 #ifdef USE_EVENT_BROKER
 			/* send data to event broker */
@@ -1950,6 +1952,7 @@ static int service_command_handler(const struct external_command *ext_command, t
 			/* schedule a service check if previous interval was 0 (checks were not regularly scheduled) */
 			old_interval = target_service->check_interval;
 			target_service->check_interval = GV_TIMESTAMP("check_interval");
+			update_service_freshness_deadline(target_service);
 			if(old_interval == 0 && target_service->checks_enabled == TRUE && target_service->check_interval != 0) {
 				target_service->should_be_scheduled = TRUE;
 				time(&preferred_time);
@@ -1974,6 +1977,7 @@ static int service_command_handler(const struct external_command *ext_command, t
 		case CMD_CHANGE_RETRY_SVC_CHECK_INTERVAL:
 
 			target_service->retry_interval = GV_TIMESTAMP("check_interval");
+			update_service_freshness_deadline(target_service);
 			/* set the modified service attribute */
 			target_service->modified_attributes |= MODATTR_RETRY_CHECK_INTERVAL;
 
@@ -3254,6 +3258,7 @@ void disable_service_checks(service *svc)
 	/* disable the service check... */
 	svc->checks_enabled = FALSE;
 	svc->should_be_scheduled = FALSE;
+	update_service_freshness_deadline(svc);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -3284,6 +3289,7 @@ void enable_service_checks(service *svc)
 
 	/* enable the service check... */
 	svc->checks_enabled = TRUE;
+	update_service_freshness_deadline(svc);
 	/* checks with no interval shouldn't be scheduled */
 	if (svc->check_interval == 0)
 		return;
@@ -4324,6 +4330,7 @@ void disable_host_checks(host *hst)
 	/* set the host check flag */
 	hst->checks_enabled = FALSE;
 	hst->should_be_scheduled = FALSE;
+	update_host_freshness_deadline(hst);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -4354,6 +4361,7 @@ void enable_host_checks(host *hst)
 
 	/* set the host check flag */
 	hst->checks_enabled = TRUE;
+	update_host_freshness_deadline(hst);
 
 	if (hst->check_interval == 0)
 		return;
@@ -6,11 +6,13 @@
 #include "broker.h"
 #include "events.h"
 #include "globals.h"
+#include "logging.h"
 #include "nm_alloc.h"
 
 comment *comment_list = NULL;
 int defer_comment_sorting = 0;
-comment **comment_hashlist = NULL;
+static comment *comment_list_tail = NULL;
+static fanout_table *comment_fanout = NULL;
 
 
 /******************************************************************/
@@ -38,6 +40,73 @@ int initialize_comment_data(void)
 }
 
 
+/******************************************************************/
+/****************** PER-OBJECT LIST FUNCTIONS *********************/
+/******************************************************************/
+
+/*
+ * links a comment into the list of comments on the host or service
+ * it belongs to. Comments for objects that don't exist (anymore) are
+ * only kept in the global list and the id index.
+ */
+static void link_comment_to_object(comment *new_comment)
+{
+	comment **head;
+	int *count;
+
+	if (new_comment->comment_type == SERVICE_COMMENT) {
+		new_comment->service_ptr = find_service(new_comment->host_name, new_comment->service_description);
+		if (new_comment->service_ptr == NULL)
+			return;
+		new_comment->host_ptr = new_comment->service_ptr->host_ptr;
+		head = &new_comment->service_ptr->comments;
+		count = &new_comment->service_ptr->num_comments;
+	} else {
+		new_comment->host_ptr = find_host(new_comment->host_name);
+		if (new_comment->host_ptr == NULL)
+			return;
+		head = &new_comment->host_ptr->comments;
+		count = &new_comment->host_ptr->num_comments;
+	}
+
+	new_comment->prevhash = NULL;
+	new_comment->nexthash = *head;
+	if (*head)
+		(*head)->prevhash = new_comment;
+	*head = new_comment;
+	(*count)++;
+}
+
+
+static void unlink_comment_from_object(comment *this_comment)
+{
+	comment **head;
+	int *count;
+
+	if (this_comment->comment_type == SERVICE_COMMENT) {
+		if (this_comment->service_ptr == NULL)
+			return;
+		head = &this_comment->service_ptr->comments;
+		count = &this_comment->service_ptr->num_comments;
+	} else {
+		if (this_comment->host_ptr == NULL)
+			return;
+		head = &this_comment->host_ptr->comments;
+		count = &this_comment->host_ptr->num_comments;
+	}
+
+	if (this_comment->prevhash)
+		this_comment->prevhash->nexthash = this_comment->nexthash;
+	else
+		*head = this_comment->nexthash;
+	if (this_comment->nexthash)
+		this_comment->nexthash->prevhash = this_comment->prevhash;
+	(*count)--;
+
+	this_comment->nexthash = this_comment->prevhash = NULL;
+}
+
+
 /******************************************************************/
 /****************** COMMENT OUTPUT FUNCTIONS **********************/
 /******************************************************************/
@@ -52,10 +121,6 @@ int add_new_comment(int type, int entry_type, char *host_name, char *svc_descrip
 	else
 		result = add_new_service_comment(entry_type, host_name, svc_description, entry_time, author_name, comment_data, persistent, source, expires, expire_time, comment_id);
 
-	/* add an event to expire comment data if necessary... */
-	if (expires == TRUE)
-		schedule_new_event(EVENT_EXPIRE_COMMENT, FALSE, expire_time, FALSE, 0, NULL, TRUE, (void *)comment_id, NULL, 0);
-
 	return result;
 }
 
@@ -124,23 +189,9 @@ int add_new_service_comment(int entry_type, char *host_name, char *svc_descripti
 int delete_comment(int type, unsigned long comment_id)
 {
 	comment *this_comment = NULL;
-	comment *last_comment = NULL;
-	comment *next_comment = NULL;
-	int hashslot = 0;
-	comment *this_hash = NULL;
-	comment *last_hash = NULL;
 
 	/* find the comment we should remove */
-	for (this_comment = comment_list, last_comment = comment_list; this_comment != NULL; this_comment = next_comment) {
-		next_comment = this_comment->next;
-
-		/* we found the comment we should delete */
-		if (this_comment->comment_id == comment_id && this_comment->comment_type == type)
-			break;
-
-		last_comment = this_comment;
-	}
-
+	this_comment = find_comment(comment_id, type);
 	if (this_comment == NULL)
 		return ERROR;
 
@@ -150,29 +201,25 @@ int delete_comment(int type, unsigned long comment_id)
 	broker_comment_data(NEBTYPE_COMMENT_DELETE, NEBFLAG_NONE, NEBATTR_NONE, type, this_comment->entry_type, this_comment->host_name, this_comment->service_description, this_comment->entry_time, this_comment->author, this_comment->comment_data, this_comment->persistent, this_comment->source, this_comment->expires, this_comment->expire_time, comment_id, NULL);
 #endif
 
-	/* first remove from chained hash list */
-	hashslot = hashfunc(this_comment->host_name, NULL, COMMENT_HASHSLOTS);
-	last_hash = NULL;
-	for (this_hash = comment_hashlist[hashslot]; this_hash; this_hash = this_hash->nexthash) {
-		if (this_hash == this_comment) {
-			if (last_hash)
-				last_hash->nexthash = this_hash->nexthash;
-			else {
-				if (this_hash->nexthash)
-					comment_hashlist[hashslot] = this_hash->nexthash;
-				else
-					comment_hashlist[hashslot] = NULL;
-			}
-			break;
-		}
-		last_hash = this_hash;
+	/* an expire event must not outlive the comment it points to */
+	if (this_comment->expire_event) {
+		remove_event(nagios_squeue, this_comment->expire_event);
+		nm_slab_free(&timed_event_cache, this_comment->expire_event);
 	}
 
+	/* first remove from the id index and the object's own list */
+	fanout_remove(comment_fanout, comment_id);
+	unlink_comment_from_object(this_comment);
+
 	/* then removed from linked list */
-	if (comment_list == this_comment)
+	if (this_comment->prev)
+		this_comment->prev->next = this_comment->next;
+	else
 		comment_list = this_comment->next;
+	if (this_comment->next)
+		this_comment->next->prev = this_comment->prev;
 	else
-		last_comment->next = next_comment;
+		comment_list_tail = this_comment->prev;
 
 	nm_free(this_comment->host_name);
 	nm_free(this_comment->service_description);
@@ -225,28 +272,29 @@ int delete_all_comments(int type, char *host_name, char *svc_description)
 /* deletes all comments for a particular host */
 int delete_all_host_comments(char *host_name)
 {
-	int result = OK;
 	comment *temp_comment = NULL;
 	comment *next_comment = NULL;
+	host *hst = NULL;
 
 	if (host_name == NULL)
 		return ERROR;
 
+	if ((hst = find_host(host_name)) == NULL)
+		return OK;
+
 	/* delete host comments from memory */
-	for (temp_comment = get_first_comment_by_host(host_name); temp_comment != NULL; temp_comment = next_comment) {
-		next_comment = get_next_comment_by_host(host_name, temp_comment);
-		if (temp_comment->comment_type == HOST_COMMENT)
-			delete_comment(HOST_COMMENT, temp_comment->comment_id);
+	for (temp_comment = hst->comments; temp_comment != NULL; temp_comment = next_comment) {
+		next_comment = temp_comment->nexthash;
+		delete_comment(HOST_COMMENT, temp_comment->comment_id);
 	}
 
-	return result;
+	return OK;
 }
 
 
 /* deletes all non-persistent acknowledgement comments for a particular host */
 int delete_host_acknowledgement_comments(host *hst)
 {
-	int result = OK;
 	comment *temp_comment = NULL;
 	comment *next_comment = NULL;
 
@@ -254,44 +302,42 @@ int delete_host_acknowledgement_comments(host *hst)
 		return ERROR;
 
 	/* delete comments from memory */
-	temp_comment = get_first_comment_by_host(hst->name);
-	while (temp_comment) {
-		next_comment = get_next_comment_by_host(hst->name, temp_comment);
-		if (temp_comment->comment_type == HOST_COMMENT && temp_comment->entry_type == ACKNOWLEDGEMENT_COMMENT && temp_comment->persistent == FALSE) {
+	for (temp_comment = hst->comments; temp_comment != NULL; temp_comment = next_comment) {
+		next_comment = temp_comment->nexthash;
+		if (temp_comment->entry_type == ACKNOWLEDGEMENT_COMMENT && temp_comment->persistent == FALSE)
 			delete_comment(HOST_COMMENT, temp_comment->comment_id);
-		}
-		temp_comment = next_comment;
 	}
 
-	return result;
+	return OK;
 }
 
 
 /* deletes all comments for a particular service */
 int delete_all_service_comments(char *host_name, char *svc_description)
 {
-	int result = OK;
 	comment *temp_comment = NULL;
 	comment *next_comment = NULL;
+	service *svc = NULL;
 
 	if (host_name == NULL || svc_description == NULL)
 		return ERROR;
 
+	if ((svc = find_service(host_name, svc_description)) == NULL)
+		return OK;
+
 	/* delete service comments from memory */
-	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = next_comment) {
-		next_comment = temp_comment->next;
-		if (temp_comment->comment_type == SERVICE_COMMENT && !strcmp(temp_comment->host_name, host_name) && !strcmp(temp_comment->service_description, svc_description))
-			delete_comment(SERVICE_COMMENT, temp_comment->comment_id);
+	for (temp_comment = svc->comments; temp_comment != NULL; temp_comment = next_comment) {
+		next_comment = temp_comment->nexthash;
+		delete_comment(SERVICE_COMMENT, temp_comment->comment_id);
 	}
 
-	return result;
+	return OK;
 }
 
 
 /* deletes all non-persistent acknowledgement comments for a particular service */
 int delete_service_acknowledgement_comments(service *svc)
 {
-	int result = OK;
 	comment *temp_comment = NULL;
 	comment *next_comment = NULL;
 
@@ -299,75 +345,38 @@ int delete_service_acknowledgement_comments(service *svc)
 		return ERROR;
 
 	/* delete comments from memory */
-	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = next_comment) {
-		next_comment = temp_comment->next;
-		if (temp_comment->comment_type == SERVICE_COMMENT && !strcmp(temp_comment->host_name, svc->host_name) && !strcmp(temp_comment->service_description, svc->description)  && temp_comment->entry_type == ACKNOWLEDGEMENT_COMMENT && temp_comment->persistent == FALSE)
+	for (temp_comment = svc->comments; temp_comment != NULL; temp_comment = next_comment) {
+		next_comment = temp_comment->nexthash;
+		if (temp_comment->entry_type == ACKNOWLEDGEMENT_COMMENT && temp_comment->persistent == FALSE)
 			delete_comment(SERVICE_COMMENT, temp_comment->comment_id);
 	}
 
-	return result;
-}
-
-
-/* checks for an expired comment (and removes it) */
-int check_for_expired_comment(unsigned long comment_id)
-{
-	comment *temp_comment = NULL;
-
-	/* check all comments */
-	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = temp_comment->next) {
-
-		/* delete the now expired comment */
-		if (temp_comment->comment_id == comment_id && temp_comment->expires == TRUE && temp_comment->expire_time < time(NULL)) {
-			delete_comment(temp_comment->comment_type, comment_id);
-			break;
-		}
-	}
-
 	return OK;
 }
 
 
-/******************************************************************/
-/****************** CHAINED HASH FUNCTIONS ************************/
-/******************************************************************/
-
-/* adds comment to hash list in memory */
-int add_comment_to_hashlist(comment *new_comment)
+/*
+ * checks for an expired comment (and removes it). This is run from
+ * the comment's own expire event, so only that comment is looked at.
+ */
+int check_for_expired_comment(unsigned long comment_id)
 {
 	comment *temp_comment = NULL;
-	comment *lastpointer = NULL;
-	int hashslot = 0;
 
-	/* initialize hash list */
-	if (comment_hashlist == NULL) {
-		int i;
-
-		comment_hashlist = nm_malloc(sizeof(comment *) * COMMENT_HASHSLOTS);
-
-		for (i = 0; i < COMMENT_HASHSLOTS; i++)
-			comment_hashlist[i] = NULL;
-	}
-
-	if (!new_comment)
-		return 0;
+	temp_comment = find_comment(comment_id, HOST_COMMENT | SERVICE_COMMENT);
+	if (temp_comment == NULL || temp_comment->expires == FALSE)
+		return OK;
 
-	hashslot = hashfunc(new_comment->host_name, NULL, COMMENT_HASHSLOTS);
-	lastpointer = NULL;
-	for (temp_comment = comment_hashlist[hashslot]; temp_comment && compare_hashdata(temp_comment->host_name, NULL, new_comment->host_name, NULL) < 0; temp_comment = temp_comment->nexthash) {
-		if (compare_hashdata(temp_comment->host_name, NULL, new_comment->host_name, NULL) >= 0)
-			break;
-		lastpointer = temp_comment;
-	}
+	/* the calling function, handle_timed_event(), frees the event */
+	temp_comment->expire_event = NULL;
 
-	/* multiples are allowed */
-	if (lastpointer)
-		lastpointer->nexthash = new_comment;
+	/* delete the now expired comment */
+	if (temp_comment->expire_time <= time(NULL))
+		delete_comment(temp_comment->comment_type, comment_id);
 	else
-		comment_hashlist[hashslot] = new_comment;
-	new_comment->nexthash = temp_comment;
+		temp_comment->expire_event = schedule_new_event(EVENT_EXPIRE_COMMENT, FALSE, temp_comment->expire_time, FALSE, 0, NULL, TRUE, (void *)comment_id, NULL, 0);
 
-	return 1;
+	return OK;
 }
 
 
@@ -401,7 +410,6 @@ int add_service_comment(int entry_type, char *host_name, char *svc_description,
 int add_comment(int comment_type, int entry_type, char *host_name, char *svc_description, time_t entry_time, char *author, char *comment_data, unsigned long comment_id, int persistent, int expires, time_t expire_time, int source)
 {
 	comment *new_comment = NULL;
-	comment *last_comment = NULL;
 	comment *temp_comment = NULL;
 	int result = OK;
 
@@ -429,10 +437,14 @@ int add_comment(int comment_type, int entry_type, char *host_name, char *svc_des
 	new_comment->expires = (expires == TRUE) ? TRUE : FALSE;
 	new_comment->expire_time = expire_time;
 
-	/* add comment to hash list */
-	if (result == OK) {
-		if (!add_comment_to_hashlist(new_comment))
-			result = ERROR;
+	/* add comment to the id index */
+	if (comment_fanout == NULL)
+		comment_fanout = fanout_create(16384);
+	if (find_comment(comment_id, HOST_COMMENT | SERVICE_COMMENT) != NULL) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to add comment %lu for host '%s': comment id is already in use\n", comment_id, host_name);
+		result = ERROR;
+	} else if (fanout_add(comment_fanout, comment_id, new_comment) < 0) {
+		result = ERROR;
 	}
 
 	/* handle errors */
@@ -445,32 +457,40 @@ int add_comment(int comment_type, int entry_type, char *host_name, char *svc_des
 		return ERROR;
 	}
 
+	link_comment_to_object(new_comment);
+
 	if (defer_comment_sorting) {
 		new_comment->next = comment_list;
+		if (comment_list)
+			comment_list->prev = new_comment;
 		comment_list = new_comment;
+	} else if (comment_list_tail == NULL || comment_list_tail->comment_id < new_comment->comment_id) {
+		/* new comments have the highest id, so this is the common case */
+		new_comment->prev = comment_list_tail;
+		if (comment_list_tail)
+			comment_list_tail->next = new_comment;
+		else
+			comment_list = new_comment;
+		comment_list_tail = new_comment;
 	} else {
 		/* add new comment to comment list, sorted by comment id */
-		last_comment = comment_list;
 		for (temp_comment = comment_list; temp_comment != NULL; temp_comment = temp_comment->next) {
-			if (new_comment->comment_id < temp_comment->comment_id) {
-				new_comment->next = temp_comment;
-				if (temp_comment == comment_list)
-					comment_list = new_comment;
-				else
-					last_comment->next = new_comment;
+			if (new_comment->comment_id < temp_comment->comment_id)
 				break;
-			} else
-				last_comment = temp_comment;
 		}
-		if (comment_list == NULL) {
-			new_comment->next = NULL;
+		new_comment->next = temp_comment;
+		new_comment->prev = temp_comment->prev;
+		if (temp_comment->prev)
+			temp_comment->prev->next = new_comment;
+		else
 			comment_list = new_comment;
-		} else if (temp_comment == NULL) {
-			new_comment->next = NULL;
-			last_comment->next = new_comment;
-		}
+		temp_comment->prev = new_comment;
 	}
 
+	/* schedule the comment's expiry, so we never have to go looking for it */
+	if (new_comment->expires == TRUE)
+		new_comment->expire_event = schedule_new_event(EVENT_EXPIRE_COMMENT, FALSE, expire_time, FALSE, 0, NULL, TRUE, (void *)comment_id, NULL, 0);
+
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
 	broker_comment_data(NEBTYPE_COMMENT_LOAD, NEBFLAG_NONE, NEBATTR_NONE, comment_type, entry_type, host_name, svc_description, entry_time, author, comment_data, persistent, source, expires, expire_time, comment_id, NULL);
@@ -514,11 +534,14 @@ int sort_comments(void)
 
 	qsort((void *)array, i, sizeof(*array), comment_compar);
 	comment_list = temp_comment = array[0];
+	temp_comment->prev = NULL;
 	for (i = 1; i < unsorted_comments; i++) {
 		temp_comment->next = array[i];
 		temp_comment = temp_comment->next;
+		temp_comment->prev = array[i - 1];
 	}
 	temp_comment->next = NULL;
+	comment_list_tail = temp_comment;
 	nm_free(array);
 	return OK;
 }
@@ -537,6 +560,10 @@ void free_comment_data(void)
 	/* free memory for the comment list */
 	for (this_comment = comment_list; this_comment != NULL; this_comment = next_comment) {
 		next_comment = this_comment->next;
+		if (this_comment->expire_event && nagios_squeue) {
+			remove_event(nagios_squeue, this_comment->expire_event);
+			nm_slab_free(&timed_event_cache, this_comment->expire_event);
+		}
 		nm_free(this_comment->host_name);
 		nm_free(this_comment->service_description);
 		nm_free(this_comment->author);
@@ -544,10 +571,11 @@ void free_comment_data(void)
 		nm_free(this_comment);
 	}
 
-	/* free hash list and reset list pointer */
-	nm_free(comment_hashlist);
-	comment_hashlist = NULL;
+	/* free the id index and reset list pointers */
+	fanout_destroy(comment_fanout, NULL);
+	comment_fanout = NULL;
 	comment_list = NULL;
+	comment_list_tail = NULL;
 
 	return;
 }
@@ -560,36 +588,27 @@ void free_comment_data(void)
 /* get the number of comments associated with a particular host */
 int number_of_host_comments(char *host_name)
 {
-	comment *temp_comment = NULL;
-	int total_comments = 0;
+	host *hst = NULL;
 
-	if (host_name == NULL)
+	if (host_name == NULL || (hst = find_host(host_name)) == NULL)
 		return 0;
 
-	for (temp_comment = get_first_comment_by_host(host_name); temp_comment != NULL; temp_comment = get_next_comment_by_host(host_name, temp_comment)) {
-		if (temp_comment->comment_type == HOST_COMMENT)
-			total_comments++;
-	}
-
-	return total_comments;
+	return hst->num_comments;
 }
 
 
 /* get the number of comments associated with a particular service */
 int number_of_service_comments(char *host_name, char *svc_description)
 {
-	comment *temp_comment = NULL;
-	int total_comments = 0;
+	service *svc = NULL;
 
 	if (host_name == NULL || svc_description == NULL)
 		return 0;
 
-	for (temp_comment = get_first_comment_by_host(host_name); temp_comment != NULL; temp_comment = get_next_comment_by_host(host_name, temp_comment)) {
-		if (temp_comment->comment_type == SERVICE_COMMENT && !strcmp(temp_comment->service_description, svc_description))
-			total_comments++;
-	}
+	if ((svc = find_service(host_name, svc_description)) == NULL)
+		return 0;
 
-	return total_comments;
+	return svc->num_comments;
 }
 
 
@@ -597,6 +616,17 @@ int number_of_service_comments(char *host_name, char *svc_description)
 /********************* TRAVERSAL FUNCTIONS ************************/
 /******************************************************************/
 
+/* returns the first comment on any of the services in the list */
+static comment *first_service_comment(servicesmember *sm)
+{
+	for (; sm; sm = sm->next) {
+		if (sm->service_ptr && sm->service_ptr->comments)
+			return sm->service_ptr->comments;
+	}
+	return NULL;
+}
+
+
 comment *get_first_comment_by_host(char *host_name)
 {
 
@@ -604,24 +634,38 @@ comment *get_first_comment_by_host(char *host_name)
 }
 
 
+/*
+ * walks all comments for a host, its own comments first and then
+ * the ones for each of its services. Each service knows its entry in
+ * the host's service list, so moving on to the next service doesn't
+ * need a search through that list.
+ */
 comment *get_next_comment_by_host(char *host_name, comment *start)
 {
-	comment *temp_comment = NULL;
+	host *hst = NULL;
+	service *svc = NULL;
+
+	if (start == NULL) {
+		if (host_name == NULL || (hst = find_host(host_name)) == NULL)
+			return NULL;
+		if (hst->comments)
+			return hst->comments;
+		return first_service_comment(hst->services);
+	}
 
-	if (host_name == NULL || comment_hashlist == NULL)
-		return NULL;
+	if (start->nexthash)
+		return start->nexthash;
 
-	if (start == NULL)
-		temp_comment = comment_hashlist[hashfunc(host_name, NULL, COMMENT_HASHSLOTS)];
-	else
-		temp_comment = start->nexthash;
+	if ((hst = start->host_ptr) == NULL)
+		return NULL;
 
-	for (; temp_comment && compare_hashdata(temp_comment->host_name, NULL, host_name, NULL) < 0; temp_comment = temp_comment->nexthash);
+	if (start->comment_type == HOST_COMMENT)
+		return first_service_comment(hst->services);
 
-	if (temp_comment && compare_hashdata(temp_comment->host_name, NULL, host_name, NULL) == 0)
-		return temp_comment;
+	if ((svc = start->service_ptr) == NULL || svc->host_link == NULL)
+		return NULL;
 
-	return NULL;
+	return first_service_comment(svc->host_link->next);
 }
 
 
@@ -648,10 +692,9 @@ comment *find_comment(unsigned long comment_id, int comment_type)
 {
 	comment *temp_comment = NULL;
 
-	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = temp_comment->next) {
-		if (temp_comment->comment_id == comment_id && (temp_comment->comment_type & comment_type))
-			return temp_comment;
-	}
+	temp_comment = fanout_get(comment_fanout, comment_id);
+	if (temp_comment && (temp_comment->comment_type & comment_type))
+		return temp_comment;
 
 	return NULL;
 }
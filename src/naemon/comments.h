@@ -26,10 +26,6 @@
 #define ACKNOWLEDGEMENT_COMMENT         4
 
 
-/*************************** CHAINED HASH LIMITS ***************************/
-#define COMMENT_HASHSLOTS      1024
-
-
 /**************************** DATA STRUCTURES ******************************/
 
 NAGIOS_BEGIN_DECL
@@ -49,7 +45,12 @@ typedef struct comment {
 	char 	*author;
 	char 	*comment_data;
 	struct 	comment *next;
-	struct 	comment *nexthash;
+	struct 	comment *nexthash;	/* next comment on the same host or service */
+	struct	timed_event *expire_event;
+	struct	comment *prev;
+	struct	comment *prevhash;
+	struct	host *host_ptr;
+	struct	service *service_ptr;
 } comment;
 
 extern struct comment *comment_list;
@@ -84,8 +85,6 @@ int sort_comments(void);
 int add_host_comment(int, char *, time_t, char *, char *, unsigned long, int, int, time_t, int);   /* adds a host comment */
 int add_service_comment(int, char *, char *, time_t, char *, char *, unsigned long, int, int, time_t, int); /* adds a service comment */
 
-int add_comment_to_hashlist(struct comment *);
-
 void free_comment_data(void);                                             /* frees memory allocated to the comment list */
 
 NAGIOS_END_DECL
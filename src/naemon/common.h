@@ -469,6 +469,13 @@ NAGIOS_END_DECL
 #define DATE_FORMAT_STRICT_ISO8601      3       /* ISO8601 (YYYY-MM-DDTHH:MM:SS) */
 
 
+/********************* INITIAL CHECK SCHEDULING *************************/
+
+#define CHECK_SCHEDULING_RANDOM         0       /* at a random time within the check interval */
+#define CHECK_SCHEDULING_EVEN           1       /* spread evenly over the check interval */
+#define CHECK_SCHEDULING_INTERLEAVED    2       /* spread evenly, taking turns between hosts */
+
+
 /************************** MISC DEFINITIONS ****************************/
 
 #define MAX_FILENAME_LENGTH			256	/* max length of path/filename that Nagios will process */
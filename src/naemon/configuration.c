@@ -661,6 +661,16 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 			}
 		}
 
+		else if (!strcmp(variable, "max_check_rate")) {
+
+			max_check_rate = strtod(value, NULL);
+			if (max_check_rate < 0.0) {
+				nm_asprintf(&error_message, "Illegal value for max_check_rate");
+				error = TRUE;
+				break;
+			}
+		}
+
 		else if (!strcmp(variable, "check_result_reaper_frequency") || !strcmp(variable, "service_reaper_frequency")) {
 
 			check_reaper_interval = atoi(value);
@@ -855,6 +865,21 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 			}
 		}
 
+		else if (!strcmp(variable, "initial_check_scheduling")) {
+
+			if (!strcmp(value, "random"))
+				initial_check_scheduling = CHECK_SCHEDULING_RANDOM;
+			else if (!strcmp(value, "even"))
+				initial_check_scheduling = CHECK_SCHEDULING_EVEN;
+			else if (!strcmp(value, "interleaved"))
+				initial_check_scheduling = CHECK_SCHEDULING_INTERLEAVED;
+			else {
+				nm_asprintf(&error_message, "Illegal value for initial_check_scheduling");
+				error = TRUE;
+				break;
+			}
+		}
+
 		else if (!strcmp(variable, "date_format")) {
 
 			if (!strcmp(value, "euro"))
@@ -880,6 +905,18 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 				event_broker_options = strtoul(value, NULL, 0);
 		}
 
+		else if (!strcmp(variable, "neb_callback_profiling"))
+			neb_callback_profiling = (atoi(value) > 0) ? TRUE : FALSE;
+
+		else if (!strcmp(variable, "neb_async_queue_size")) {
+			if (atoi(value) < 1) {
+				nm_asprintf(&error_message, "Illegal value for neb_async_queue_size");
+				error = TRUE;
+				break;
+			}
+			neb_async_queue_size = (unsigned int)atoi(value);
+		}
+
 		else if (!strcmp(variable, "illegal_object_name_chars"))
 			illegal_object_chars = nm_strdup(value);
 
@@ -1007,6 +1044,14 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 			host_perfdata_process_empty_results = (atoi(value) > 0) ? TRUE : FALSE;
 		else if (!strcmp(variable, "service_perfdata_process_empty_results"))
 			service_perfdata_process_empty_results = (atoi(value) > 0) ? TRUE : FALSE;
+		else if (!strcmp(variable, "perfdata_file_buffer_size"))
+			perfdata_file_buffer_size = strtoul(value, NULL, 0);
+		else if (!strcmp(variable, "perfdata_file_flush_interval"))
+			perfdata_file_flush_interval = strtoul(value, NULL, 0);
+		else if (!strcmp(variable, "host_perfdata_file_rotation_size"))
+			host_perfdata_file_rotation_size = strtoul(value, NULL, 0);
+		else if (!strcmp(variable, "service_perfdata_file_rotation_size"))
+			service_perfdata_file_rotation_size = strtoul(value, NULL, 0);
 		/*** END perfdata variables */
 
 		else if (!strcmp(variable, "cfg_file")) {
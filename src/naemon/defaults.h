@@ -22,8 +22,10 @@
 #define DEFAULT_MAX_REAPER_TIME                 		30      /* maximum number of seconds to spend reaping service checks before we break out for a while */
 #define DEFAULT_MAX_CHECK_RESULT_AGE				3600    /* maximum number of seconds that a check result file is considered to be valid */
 #define DEFAULT_MAX_PARALLEL_SERVICE_CHECKS 			0	/* maximum number of service checks we can have running at any given time (0=unlimited) */
+#define DEFAULT_MAX_CHECK_RATE				0.0	/* maximum number of checks we start per second (0=unlimited) */
 #define DEFAULT_RETENTION_UPDATE_INTERVAL			60	/* minutes between auto-save of retention data */
 #define DEFAULT_RETENTION_SCHEDULING_HORIZON    		900     /* max seconds between program restarts that we will preserve scheduling information */
+#define DEFAULT_INITIAL_CHECK_SCHEDULING			CHECK_SCHEDULING_RANDOM /* how checks are scheduled at startup */
 #define DEFAULT_STATUS_UPDATE_INTERVAL				60	/* seconds between aggregated status data updates */
 #define DEFAULT_FRESHNESS_CHECK_INTERVAL        		60      /* seconds between service result freshness checks */
 #define DEFAULT_ORPHAN_CHECK_INTERVAL           		60      /* seconds between checks for orphaned hosts and services */
@@ -56,6 +58,8 @@
 #define DEFAULT_CHECK_ORPHANED_SERVICES				1	/* check for orphaned services */
 #define DEFAULT_CHECK_ORPHANED_HOSTS            		1       /* check for orphaned hosts */
 #define DEFAULT_ENABLE_FLAP_DETECTION           		0       /* don't enable flap detection */
+#define DEFAULT_NEB_CALLBACK_PROFILING				1	/* time event broker module callbacks */
+#define DEFAULT_NEB_ASYNC_QUEUE_SIZE				16384	/* events buffered per module for asynchronous callbacks */
 #define DEFAULT_PROCESS_PERFORMANCE_DATA        		0       /* don't process performance data */
 #define DEFAULT_CHECK_SERVICE_FRESHNESS         		1       /* check service result freshness */
 #define DEFAULT_CHECK_HOST_FRESHNESS            		0       /* don't check host result freshness */
@@ -90,6 +94,8 @@
 #define DEFAULT_SERVICE_PERFDATA_FILE_TEMPLATE "[SERVICEPERFDATA]\t$TIMET$\t$HOSTNAME$\t$SERVICEDESC$\t$SERVICEEXECUTIONTIME$\t$SERVICELATENCY$\t$SERVICEOUTPUT$\t$SERVICEPERFDATA$"
 #define DEFAULT_HOST_PERFDATA_PROCESS_EMPTY_RESULTS 1
 #define DEFAULT_SERVICE_PERFDATA_PROCESS_EMPTY_RESULTS 1
+#define DEFAULT_PERFDATA_FILE_BUFFER_SIZE 65536 /* bytes of perfdata buffered before they're written to file */
+#define DEFAULT_PERFDATA_FILE_FLUSH_INTERVAL 1 /* max time in seconds perfdata is kept buffered */
 
 
 /* Legacy way to find out default locations - do not go near these, as they
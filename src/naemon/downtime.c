@@ -324,11 +324,13 @@ int unschedule_downtime(int type, unsigned long downtime_id)
 	/* remove scheduled entries from event queue */
 	if (temp_downtime->start_event) {
 		remove_event(nagios_squeue, temp_downtime->start_event);
-		nm_free(temp_downtime->start_event);
+		nm_slab_free(&timed_event_cache, temp_downtime->start_event);
+		temp_downtime->start_event = NULL;
 	}
 	if (temp_downtime->stop_event) {
 		remove_event(nagios_squeue, temp_downtime->stop_event);
-		nm_free(temp_downtime->stop_event);
+		nm_slab_free(&timed_event_cache, temp_downtime->stop_event);
+		temp_downtime->stop_event = NULL;
 	}
 
 	/* delete downtime entry */
@@ -494,7 +496,14 @@ int register_downtime(int type, unsigned long downtime_id)
 			case the event is never triggered. The expire event will NOT cancel
 			a downtime event that is in effect */
 		log_debug_info(DEBUGL_DOWNTIME, 1, "Scheduling downtime expire event in case flexible downtime is never triggered\n");
-		temp_downtime->stop_event = schedule_new_event(EVENT_EXPIRE_DOWNTIME, TRUE, (temp_downtime->end_time + 1), FALSE, 0, NULL, FALSE, NULL, NULL, 0);
+		temp_downtime->stop_event = schedule_new_event(EVENT_EXPIRE_DOWNTIME, TRUE, (temp_downtime->end_time + 1), FALSE, 0, NULL, FALSE, (void *)temp_downtime->downtime_id, NULL, 0);
+	}
+
+	/* Triggered downtime whose trigger never starts would otherwise
+		linger forever, so it gets an expire event of its own too */
+	if (temp_downtime->triggered_by != 0 && temp_downtime->stop_event == NULL) {
+		log_debug_info(DEBUGL_DOWNTIME, 1, "Scheduling downtime expire event in case triggered downtime is never triggered\n");
+		temp_downtime->stop_event = schedule_new_event(EVENT_EXPIRE_DOWNTIME, TRUE, (temp_downtime->end_time + 1), FALSE, 0, NULL, FALSE, (void *)temp_downtime->downtime_id, NULL, 0);
 	}
 
 	return OK;
@@ -827,14 +836,87 @@ int check_pending_flex_service_downtime(service *svc)
 }
 
 
+/* sends the end notification for and removes an expired downtime entry */
+static int expire_downtime(scheduled_downtime *temp_downtime)
+{
+	service *svc = NULL;
+	host *hst = NULL;
+
+	log_debug_info(DEBUGL_DOWNTIME, 0, "Expiring %s downtime (id=%lu)...\n", (temp_downtime->type == HOST_DOWNTIME) ? "host" : "service", temp_downtime->downtime_id);
+
+	/* find the host or service associated with this downtime */
+	if (temp_downtime->type == HOST_DOWNTIME) {
+		if ((hst = find_host(temp_downtime->host_name)) == NULL) {
+			log_debug_info(DEBUGL_DOWNTIME, 1,
+			               "Unable to find host (%s) for downtime\n",
+			               temp_downtime->host_name);
+			return ERROR;
+		}
+
+		/* send a notification */
+		host_notification(hst, NOTIFICATION_DOWNTIMEEND,
+		                  temp_downtime->author, temp_downtime->comment,
+		                  NOTIFICATION_OPTION_NONE);
+	} else {
+		if ((svc = find_service(temp_downtime->host_name,
+		                        temp_downtime->service_description)) == NULL) {
+			log_debug_info(DEBUGL_DOWNTIME, 1,
+			               "Unable to find service (%s) host (%s) for downtime\n",
+			               temp_downtime->service_description,
+			               temp_downtime->host_name);
+			return ERROR;
+		}
+
+		/* send a notification */
+		service_notification(svc, NOTIFICATION_DOWNTIMEEND,
+		                     temp_downtime->author, temp_downtime->comment,
+		                     NOTIFICATION_OPTION_NONE);
+	}
+
+	/* delete the downtime entry */
+	if (temp_downtime->type == HOST_DOWNTIME)
+		delete_host_downtime(temp_downtime->downtime_id);
+	else
+		delete_service_downtime(temp_downtime->downtime_id);
+
+	return OK;
+}
+
+
+/*
+ * expires a single downtime entry (id passed from timed event queue).
+ * Each flexible downtime gets its own expire event when it's
+ * registered, so we only ever have to look at the one entry.
+ */
+int handle_expired_downtime_by_id(unsigned long downtime_id)
+{
+	scheduled_downtime *temp_downtime = NULL;
+
+	log_debug_info(DEBUGL_FUNCTIONS, 0, "handle_expired_downtime_by_id()\n");
+
+	if ((temp_downtime = find_downtime(ANY_DOWNTIME, downtime_id)) == NULL) {
+		log_debug_info(DEBUGL_DOWNTIME, 1, "Downtime id %lu is already gone; nothing to expire\n",
+		               downtime_id);
+		return OK;
+	}
+
+	/* the calling function, handle_timed_event(), frees the event */
+	temp_downtime->stop_event = NULL;
+
+	/* flexible downtime that got triggered ends by itself */
+	if (temp_downtime->is_in_effect == TRUE)
+		return OK;
+
+	return expire_downtime(temp_downtime);
+}
+
+
 /* checks for (and removes) expired downtime entries */
 int check_for_expired_downtime(void)
 {
 	scheduled_downtime *temp_downtime = NULL;
 	scheduled_downtime *next_downtime = NULL;
 	time_t current_time = 0L;
-	service *svc = NULL;
-	host *hst = NULL;
 
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "check_for_expired_downtime()\n");
@@ -848,43 +930,8 @@ int check_for_expired_downtime(void)
 
 		/* this entry should be removed */
 		if (temp_downtime->is_in_effect == FALSE && temp_downtime->end_time <= current_time) {
-
-			log_debug_info(DEBUGL_DOWNTIME, 0, "Expiring %s downtime (id=%lu)...\n", (temp_downtime->type == HOST_DOWNTIME) ? "host" : "service", temp_downtime->downtime_id);
-
-			/* find the host or service associated with this downtime */
-			if (temp_downtime->type == HOST_DOWNTIME) {
-				if ((hst = find_host(temp_downtime->host_name)) == NULL) {
-					log_debug_info(DEBUGL_DOWNTIME, 1,
-					               "Unable to find host (%s) for downtime\n",
-					               temp_downtime->host_name);
-					return ERROR;
-				}
-
-				/* send a notification */
-				host_notification(hst, NOTIFICATION_DOWNTIMEEND,
-				                  temp_downtime->author, temp_downtime->comment,
-				                  NOTIFICATION_OPTION_NONE);
-			} else {
-				if ((svc = find_service(temp_downtime->host_name,
-				                        temp_downtime->service_description)) == NULL) {
-					log_debug_info(DEBUGL_DOWNTIME, 1,
-					               "Unable to find service (%s) host (%s) for downtime\n",
-					               temp_downtime->service_description,
-					               temp_downtime->host_name);
-					return ERROR;
-				}
-
-				/* send a notification */
-				service_notification(svc, NOTIFICATION_DOWNTIMEEND,
-				                     temp_downtime->author, temp_downtime->comment,
-				                     NOTIFICATION_OPTION_NONE);
-			}
-
-			/* delete the downtime entry */
-			if (temp_downtime->type == HOST_DOWNTIME)
-				delete_host_downtime(temp_downtime->downtime_id);
-			else
-				delete_service_downtime(temp_downtime->downtime_id);
+			if (expire_downtime(temp_downtime) != OK)
+				return ERROR;
 		}
 	}
 
@@ -997,6 +1044,13 @@ int delete_downtime(int type, unsigned long downtime_id)
 
 	downtime_remove(this_downtime);
 
+	/* a pending expire event must not outlive the entry it points to */
+	if (this_downtime->stop_event) {
+		remove_event(nagios_squeue, this_downtime->stop_event);
+		nm_slab_free(&timed_event_cache, this_downtime->stop_event);
+		this_downtime->stop_event = NULL;
+	}
+
 	/* first remove the comment associated with this downtime */
 	if (this_downtime->type == HOST_DOWNTIME)
 		delete_host_comment(this_downtime->comment_id);
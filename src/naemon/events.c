@@ -21,9 +21,18 @@
 
 /* the event we're currently processing */
 static timed_event *current_event;
+struct nm_slab_cache timed_event_cache = NM_SLAB_CACHE_INIT("timed_event", timed_event);
 
 static unsigned int event_count[EVENT_USER_FUNCTION + 1];
 
+/* check dispatch rate limiting (max_check_rate) */
+static struct {
+	double tokens;
+	struct timeval last_refill;
+	double next_slot; /* when the last check we held back gets to run */
+	unsigned long throttled, nudged;
+} dispatch;
+
 /******************************************************************/
 /************ EVENT SCHEDULING/HANDLING FUNCTIONS *****************/
 /******************************************************************/
@@ -31,6 +40,8 @@ static unsigned int event_count[EVENT_USER_FUNCTION + 1];
 int dump_event_stats(int sd)
 {
 	unsigned int i;
+	struct timeval now;
+	double backlog;
 
 	for (i = 0; i < ARRAY_SIZE(event_count); i++) {
 		nsock_printf(sd, "%s=%u;", EVENT_TYPE_STR(i), event_count[i]);
@@ -42,6 +53,11 @@ int dump_event_stats(int sd)
 		if (i == 16)
 			i = 97;
 	}
+	gettimeofday(&now, NULL);
+	backlog = dispatch.next_slot - (now.tv_sec + now.tv_usec / 1000000.0);
+	nsock_printf(sd, "CHECKS_THROTTLED=%lu;CHECKS_NUDGED=%lu;", dispatch.throttled, dispatch.nudged);
+	nsock_printf(sd, "CHECK_RATE_LIMIT=%.2f;CHECK_TOKENS=%.2f;CHECK_BACKLOG=%.1f;",
+	             max_check_rate, dispatch.tokens, backlog > 0 ? backlog : 0.0);
 	nsock_printf_nul(sd, "SQUEUE_ENTRIES=%u", squeue_size(nagios_squeue));
 
 	return OK;
@@ -59,6 +75,104 @@ static void track_events(unsigned int type, int add)
 }
 
 
+/* a check waiting to be given its first check time */
+struct check_slot {
+	time_t *next_check;
+	time_t window;
+	unsigned int rank; /* turn of this check among its host's */
+	unsigned int idx;
+};
+
+static int check_slot_cmp(const void *a_, const void *b_)
+{
+	const struct check_slot *a = (const struct check_slot *)a_;
+	const struct check_slot *b = (const struct check_slot *)b_;
+
+	if (a->window != b->window)
+		return a->window < b->window ? -1 : 1;
+	if (a->rank != b->rank)
+		return a->rank < b->rank ? -1 : 1;
+	return a->idx < b->idx ? -1 : a->idx > b->idx;
+}
+
+/*
+ * Checks sharing a check window are given evenly spaced check times
+ * across it, so every second of the window sees the same number of
+ * checks (give or take one), rather than however many a random pick
+ * happens to land on it. Ranking a host's checks 0, 1, 2... and
+ * sorting on that first has every host get its turn before any host
+ * gets its second one.
+ */
+static void spread_checks(struct check_slot *slots, unsigned int n, time_t start)
+{
+	unsigned int i, j, k;
+
+	qsort(slots, n, sizeof(*slots), check_slot_cmp);
+	for (i = 0; i < n; i = j) {
+		for (j = i; j < n && slots[j].window == slots[i].window; j++)
+			; /* empty loop */
+		for (k = i; k < j; k++)
+			*slots[k].next_check = start + (time_t)((unsigned long long)(k - i) * slots[i].window / (j - i));
+	}
+}
+
+/* checks with a retained check time inside their window keep it */
+#define has_retained_check(o, now) \
+	((o)->next_check >= (now) && (o)->next_check <= (now) + check_window(o))
+
+static void spread_service_checks(time_t current_time)
+{
+	struct check_slot *slots;
+	unsigned int *host_turn = NULL, n = 0;
+	service *temp_service;
+
+	if (!scheduling_info.total_scheduled_services)
+		return;
+
+	slots = nm_malloc(sizeof(*slots) * scheduling_info.total_scheduled_services);
+	if (initial_check_scheduling == CHECK_SCHEDULING_INTERLEAVED)
+		host_turn = nm_calloc(num_objects.hosts, sizeof(*host_turn));
+
+	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
+		if (temp_service->should_be_scheduled == FALSE || has_retained_check(temp_service, current_time))
+			continue;
+		slots[n].next_check = &temp_service->next_check;
+		slots[n].window = check_window(temp_service);
+		slots[n].rank = host_turn ? host_turn[temp_service->host_ptr->id]++ : 0;
+		slots[n].idx = n;
+		n++;
+	}
+
+	spread_checks(slots, n, current_time);
+	nm_free(host_turn);
+	nm_free(slots);
+}
+
+static void spread_host_checks(time_t current_time)
+{
+	struct check_slot *slots;
+	unsigned int n = 0;
+	host *temp_host;
+
+	if (!scheduling_info.total_scheduled_hosts)
+		return;
+
+	slots = nm_malloc(sizeof(*slots) * scheduling_info.total_scheduled_hosts);
+	for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
+		if (temp_host->should_be_scheduled == FALSE || has_retained_check(temp_host, current_time))
+			continue;
+		slots[n].next_check = &temp_host->next_check;
+		slots[n].window = check_window(temp_host);
+		slots[n].rank = 0;
+		slots[n].idx = n;
+		n++;
+	}
+
+	spread_checks(slots, n, current_time);
+	nm_free(slots);
+}
+
+
 /* initialize the event timing loop before we start monitoring */
 void init_timing_loop(void)
 {
@@ -134,6 +248,12 @@ void init_timing_loop(void)
 
 	log_debug_info(DEBUGL_EVENTS, 2, "Scheduling service checks...");
 
+	/* all events are ordered at once when we're done */
+	squeue_bulk_begin(nagios_squeue);
+
+	if (initial_check_scheduling != CHECK_SCHEDULING_RANDOM)
+		spread_service_checks(current_time);
+
 	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
 		log_debug_info(DEBUGL_EVENTS, 2, "Service '%s' on host '%s'\n", temp_service->description, temp_service->host_name);
 		/* skip this service if it shouldn't be scheduled */
@@ -141,7 +261,8 @@ void init_timing_loop(void)
 			continue;
 		}
 
-		temp_service->next_check = current_time + ranged_urand(0, check_window(temp_service));
+		if (initial_check_scheduling == CHECK_SCHEDULING_RANDOM)
+			temp_service->next_check = current_time + ranged_urand(0, check_window(temp_service));
 
 		if (scheduling_info.last_service_check < temp_service->next_check)
 			scheduling_info.last_service_check = temp_service->next_check;
@@ -185,6 +306,9 @@ void init_timing_loop(void)
 	log_debug_info(DEBUGL_EVENTS, 2, "Scheduling host checks...");
 
 	/* determine check times for host checks */
+	if (initial_check_scheduling != CHECK_SCHEDULING_RANDOM)
+		spread_host_checks(current_time);
+
 	for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
 
 		log_debug_info(DEBUGL_EVENTS, 2, "Host '%s'\n", temp_host->name);
@@ -194,7 +318,8 @@ void init_timing_loop(void)
 			continue;
 		}
 
-		temp_host->next_check = current_time + ranged_urand(0, check_window(temp_host));
+		if (initial_check_scheduling == CHECK_SCHEDULING_RANDOM)
+			temp_host->next_check = current_time + ranged_urand(0, check_window(temp_host));
 
 		log_debug_info(DEBUGL_EVENTS, 2, "Check Time: %lu --> %s", (unsigned long)temp_host->next_check, ctime(&temp_host->next_check));
 		if (temp_host->next_check > scheduling_info.last_host_check)
@@ -233,9 +358,8 @@ void init_timing_loop(void)
 	/* add a check result reaper event */
 	schedule_new_event(EVENT_CHECK_REAPER, TRUE, current_time + check_reaper_interval, TRUE, check_reaper_interval, NULL, TRUE, NULL, NULL, 0);
 
-	/* add an orphaned check event */
-	if (check_orphaned_services == TRUE || check_orphaned_hosts == TRUE)
-		schedule_new_event(EVENT_ORPHAN_CHECK, TRUE, current_time + DEFAULT_ORPHAN_CHECK_INTERVAL, TRUE, DEFAULT_ORPHAN_CHECK_INTERVAL, NULL, TRUE, NULL, NULL, 0);
+	/* figure out when host and service results go stale */
+	init_freshness_deadlines();
 
 	/* add a service result "freshness" check event */
 	if (check_service_freshness == TRUE)
@@ -252,6 +376,8 @@ void init_timing_loop(void)
 	if (retain_state_information == TRUE && retention_update_interval > 0)
 		schedule_new_event(EVENT_RETENTION_SAVE, TRUE, current_time + (retention_update_interval * 60), TRUE, (retention_update_interval * 60), NULL, TRUE, NULL, NULL, 0);
 
+	squeue_bulk_end(nagios_squeue);
+
 	if (test_scheduling == TRUE) {
 
 		runtime[0] = (double)((double)(tv[1].tv_sec - tv[0].tv_sec) + (double)((tv[1].tv_usec - tv[0].tv_usec) / 1000.0) / 1000.0);
@@ -286,6 +412,88 @@ void init_timing_loop(void)
 }
 
 
+#define HISTOGRAM_ROWS 60
+#define HISTOGRAM_WIDTH 50
+
+/* shows how many checks are started every second after startup */
+static void display_check_histogram(void)
+{
+	host *temp_host;
+	service *temp_service;
+	time_t first = 0, last = 0, t;
+	unsigned int *checks, span, i, secs_per_row, rows, max = 0, min = ~0U, idle = 0;
+	unsigned long total = 0, row_max = 0;
+
+	/* the first and last check times of both hosts and services */
+	for (i = 0; i < 2; i++) {
+		t = i ? scheduling_info.first_host_check : scheduling_info.first_service_check;
+		if (t && (!first || t < first))
+			first = t;
+		t = i ? scheduling_info.last_host_check : scheduling_info.last_service_check;
+		if (t > last)
+			last = t;
+	}
+	if (!first || last < first)
+		return;
+
+	span = (unsigned int)(last - first) + 1;
+	checks = nm_calloc(span, sizeof(*checks));
+	for (temp_host = host_list; temp_host; temp_host = temp_host->next) {
+		if (temp_host->should_be_scheduled && temp_host->next_check >= first && temp_host->next_check <= last)
+			checks[temp_host->next_check - first]++;
+	}
+	for (temp_service = service_list; temp_service; temp_service = temp_service->next) {
+		if (temp_service->should_be_scheduled && temp_service->next_check >= first && temp_service->next_check <= last)
+			checks[temp_service->next_check - first]++;
+	}
+
+	for (i = 0; i < span; i++) {
+		total += checks[i];
+		if (checks[i] > max)
+			max = checks[i];
+		if (checks[i] < min)
+			min = checks[i];
+		if (!checks[i])
+			idle++;
+	}
+
+	secs_per_row = (span + HISTOGRAM_ROWS - 1) / HISTOGRAM_ROWS;
+	rows = (span + secs_per_row - 1) / secs_per_row;
+	for (i = 0; i < span; i += secs_per_row) {
+		unsigned int x;
+		unsigned long sum = 0;
+
+		for (x = i; x < i + secs_per_row && x < span; x++)
+			sum += checks[x];
+		if (sum > row_max)
+			row_max = sum;
+	}
+
+	printf("INITIAL CHECK DISTRIBUTION\n");
+	printf("--------------------------\n");
+	printf("Scheduling mode:                 %s\n",
+	       initial_check_scheduling == CHECK_SCHEDULING_EVEN ? "even" :
+	       initial_check_scheduling == CHECK_SCHEDULING_INTERLEAVED ? "interleaved" : "random");
+	printf("Checks per second:               %u min, %.2f avg, %u max\n", min, (double)total / span, max);
+	printf("Seconds without checks:          %u of %u\n", idle, span);
+	printf("\n");
+	printf("  Offset   Checks (%u second%s per row)\n", secs_per_row, secs_per_row == 1 ? "" : "s");
+	for (i = 0; i < rows; i++) {
+		unsigned int x, bar;
+		unsigned long sum = 0;
+
+		for (x = i * secs_per_row; x < (i + 1) * secs_per_row && x < span; x++)
+			sum += checks[x];
+		bar = row_max ? (unsigned int)(sum * HISTOGRAM_WIDTH / row_max) : 0;
+		printf("  %5us  %7lu  %.*s\n", i * secs_per_row, sum, (int)bar,
+		       "##################################################");
+	}
+	printf("\n\n");
+
+	nm_free(checks);
+}
+
+
 /* displays service check scheduling information */
 void display_scheduling_info(void)
 {
@@ -317,6 +525,8 @@ void display_scheduling_info(void)
 	printf("Last scheduled check:               %s", ctime(&scheduling_info.last_service_check));
 	printf("\n\n");
 
+	display_check_histogram();
+
 	/***** MINIMUM CONCURRENT CHECKS RECOMMENDATION *****/
 	minimum_concurrent_checks = ceil((((scheduling_info.total_scheduled_services / scheduling_info.average_service_check_interval)
 	                                   + (scheduling_info.total_scheduled_hosts / scheduling_info.average_host_check_interval))
@@ -421,7 +631,7 @@ timed_event *schedule_new_event(int event_type, int high_priority, time_t run_ti
 	log_debug_info(DEBUGL_EVENTS, 0, " Event Options:              %d\n",
 	               event_options);
 
-	new_event = nm_calloc(1, sizeof(timed_event));
+	new_event = nm_slab_alloc(&timed_event_cache);
 	if (new_event != NULL) {
 		new_event->event_type = event_type;
 		new_event->event_data = event_data;
@@ -551,10 +761,64 @@ void remove_event(squeue_t *sq, timed_event *event)
 }
 
 
+/*
+ * Refills the check dispatch bucket, which holds at most one second's
+ * worth of checks and refills at max_check_rate, and tells if there's
+ * a token left for another check. The token is only spent once the
+ * check has actually been handed to a worker.
+ */
+static int check_token_available(const struct timeval *now)
+{
+	double burst;
+
+	if (max_check_rate <= 0)
+		return TRUE;
+
+	burst = max_check_rate < 1.0 ? 1.0 : max_check_rate;
+	if (!dispatch.last_refill.tv_sec)
+		dispatch.tokens = burst;
+	else
+		dispatch.tokens += tv_delta_f(&dispatch.last_refill, now) * max_check_rate;
+	if (dispatch.tokens > burst)
+		dispatch.tokens = burst;
+	dispatch.last_refill = *now;
+
+	return dispatch.tokens >= 1.0;
+}
+
+static void spend_check_token(void)
+{
+	if (max_check_rate > 0 && dispatch.tokens >= 1.0)
+		dispatch.tokens -= 1.0;
+}
+
+/*
+ * Returns the time a check we can't run right now should be retried.
+ * With a rate limit, held back checks are lined up one after the other
+ * at that rate, so a backlog after an outage drains evenly instead of
+ * everything coming back due at the same time. Without one we've no
+ * idea how fast the backlog drains, so we just nudge the check a bit.
+ */
+static time_t next_dispatch_slot(const struct timeval *now)
+{
+	double t = now->tv_sec + now->tv_usec / 1000000.0;
+
+	if (max_check_rate <= 0)
+		return now->tv_sec + ranged_urand(5, 17);
+
+	/* never retry within the second we're in, or we'd just spin */
+	dispatch.next_slot += 1.0 / max_check_rate;
+	if (dispatch.next_slot < t + 1.0)
+		dispatch.next_slot = t + 1.0;
+
+	return (time_t)dispatch.next_slot;
+}
+
 static int should_run_event(timed_event *temp_event)
 {
 	int run_event = TRUE;	/* default action is to execute the event */
-	int nudge_seconds = 0;
+	time_t retry_at = 0;
+	struct timeval now;
 
 	/* we only care about jobs that cause processes to run */
 	if (temp_event->event_type != EVENT_HOST_CHECK &&
@@ -568,6 +832,8 @@ static int should_run_event(timed_event *temp_event)
 		return FALSE;
 	}
 
+	gettimeofday(&now, NULL);
+
 	/* run a few checks before executing a service check... */
 	if (temp_event->event_type == EVENT_SERVICE_CHECK) {
 		service *temp_service = (service *)temp_event->event_data;
@@ -576,16 +842,25 @@ static int should_run_event(timed_event *temp_event)
 		if ((temp_service->check_options & CHECK_OPTION_FORCE_EXECUTION))
 			return TRUE;
 
+		/* don't run a service check if active checks are disabled */
+		if (execute_service_checks == FALSE) {
+			log_debug_info(DEBUGL_EVENTS | DEBUGL_CHECKS, 1, "We're not executing service checks right now, so we'll skip check event for service '%s;%s'.\n", temp_service->host_name, temp_service->description);
+			run_event = FALSE;
+		}
+
 		/* don't run a service check if we're already maxed out on the number of parallel service checks...  */
-		if (max_parallel_service_checks != 0 && (currently_running_service_checks >= max_parallel_service_checks)) {
-			nudge_seconds = ranged_urand(5, 17);
-			nm_log(NSLOG_RUNTIME_WARNING, "\tMax concurrent service checks (%d) has been reached.  Nudging %s:%s by %d seconds...\n", max_parallel_service_checks, temp_service->host_name, temp_service->description, nudge_seconds);
+		else if (max_parallel_service_checks != 0 && (currently_running_service_checks >= max_parallel_service_checks)) {
+			retry_at = next_dispatch_slot(&now);
+			dispatch.nudged++;
+			nm_log(NSLOG_RUNTIME_WARNING, "\tMax concurrent service checks (%d) has been reached.  Nudging %s:%s by %d seconds...\n", max_parallel_service_checks, temp_service->host_name, temp_service->description, (int)(retry_at - now.tv_sec));
 			run_event = FALSE;
 		}
 
-		/* don't run a service check if active checks are disabled */
-		if (execute_service_checks == FALSE) {
-			log_debug_info(DEBUGL_EVENTS | DEBUGL_CHECKS, 1, "We're not executing service checks right now, so we'll skip check event for service '%s;%s'.\n", temp_service->host_name, temp_service->description);
+		/* ...or if we've run all the checks we may this second */
+		else if (!check_token_available(&now)) {
+			retry_at = next_dispatch_slot(&now);
+			dispatch.throttled++;
+			log_debug_info(DEBUGL_EVENTS | DEBUGL_CHECKS, 1, "Check rate limit (%.2f/s) reached. Delaying check of service '%s;%s' by %d seconds.\n", max_check_rate, temp_service->host_name, temp_service->description, (int)(retry_at - now.tv_sec));
 			run_event = FALSE;
 		}
 
@@ -593,9 +868,8 @@ static int should_run_event(timed_event *temp_event)
 		if (run_event == FALSE) {
 			remove_event(nagios_squeue, temp_event);
 
-			if (nudge_seconds) {
-				/* We nudge the next check time when it is due to too many concurrent service checks */
-				temp_service->next_check = (time_t)(temp_service->next_check + nudge_seconds);
+			if (retry_at) {
+				temp_service->next_check = retry_at;
 			} else {
 				temp_service->next_check += check_window(temp_service);
 			}
@@ -621,10 +895,20 @@ static int should_run_event(timed_event *temp_event)
 			run_event = FALSE;
 		}
 
+		else if (!check_token_available(&now)) {
+			retry_at = next_dispatch_slot(&now);
+			dispatch.throttled++;
+			log_debug_info(DEBUGL_EVENTS | DEBUGL_CHECKS, 1, "Check rate limit (%.2f/s) reached. Delaying check of host '%s' by %d seconds.\n", max_check_rate, temp_host->name, (int)(retry_at - now.tv_sec));
+			run_event = FALSE;
+		}
+
 		/* reschedule the host check if we can't run it right now */
 		if (run_event == FALSE) {
 			remove_event(nagios_squeue, temp_event);
-			temp_host->next_check += check_window(temp_host);
+			if (retry_at)
+				temp_host->next_check = retry_at;
+			else
+				temp_host->next_check += check_window(temp_host);
 			temp_event->run_time = temp_host->next_check;
 			reschedule_event(nagios_squeue, temp_event);
 			update_host_status(temp_host, FALSE);
@@ -654,6 +938,9 @@ int event_execution_loop(void)
 		const struct timeval *event_runtime;
 		int inputs;
 
+		/* whatever the last iteration put in the scratch arena is dead now */
+		nm_scratch_reset();
+
 		/* super-priority (hardcoded) events come first */
 
 		/* see if we should exit or restart (a signal was encountered) */
@@ -723,6 +1010,9 @@ int event_execution_loop(void)
 
 		log_debug_info(DEBUGL_IPC, 2, "## %d descriptors had input\n", inputs);
 
+		/* give up on jobs whose results should have been back by now */
+		wproc_check_orphaned_jobs();
+
 		/*
 		 * if the event we peaked was removed from the queue from
 		 * one of the I/O operations, we must take care not to
@@ -758,7 +1048,7 @@ int event_execution_loop(void)
 
 		/* else free memory associated with the event */
 		else
-			nm_free(temp_event);
+			nm_slab_free(&timed_event_cache, temp_event);
 	}
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "event_execution_loop() end\n");
@@ -776,6 +1066,7 @@ int handle_timed_event(timed_event *event)
 	struct timeval tv;
 	const struct timeval *event_runtime;
 	double latency;
+	int running, forced;
 
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "handle_timed_event() start\n");
@@ -803,8 +1094,12 @@ int handle_timed_event(timed_event *event)
 
 		log_debug_info(DEBUGL_EVENTS, 0, "** Service Check Event ==> Host: '%s', Service: '%s', Options: %d, Latency: %f sec\n", temp_service->host_name, temp_service->description, event->event_options, latency);
 
-		/* run the service check */
+		/* run the service check, and pay for it if a worker got it */
+		running = currently_running_service_checks;
+		forced = temp_service->check_options & CHECK_OPTION_FORCE_EXECUTION;
 		run_scheduled_service_check(temp_service, event->event_options, latency);
+		if (!forced && currently_running_service_checks > running)
+			spend_check_token();
 		break;
 
 	case EVENT_HOST_CHECK:
@@ -813,8 +1108,12 @@ int handle_timed_event(timed_event *event)
 
 		log_debug_info(DEBUGL_EVENTS, 0, "** Host Check Event ==> Host: '%s', Options: %d, Latency: %f sec\n", temp_host->name, event->event_options, latency);
 
-		/* run the host check */
+		/* run the host check, and pay for it if a worker got it */
+		running = currently_running_host_checks;
+		forced = temp_host->check_options & CHECK_OPTION_FORCE_EXECUTION;
 		run_scheduled_host_check(temp_host, event->event_options, latency);
+		if (!forced && currently_running_host_checks > running)
+			spend_check_token();
 		break;
 
 	case EVENT_PROGRAM_SHUTDOWN:
@@ -847,17 +1146,6 @@ int handle_timed_event(timed_event *event)
 		reap_check_results();
 		break;
 
-	case EVENT_ORPHAN_CHECK:
-
-		log_debug_info(DEBUGL_EVENTS, 0, "** Orphaned Host and Service Check Event. Latency: %.3fs\n", latency);
-
-		/* check for orphaned hosts and services */
-		if (check_orphaned_hosts == TRUE)
-			check_for_orphaned_hosts();
-		if (check_orphaned_services == TRUE)
-			check_for_orphaned_services();
-		break;
-
 	case EVENT_RETENTION_SAVE:
 
 		log_debug_info(DEBUGL_EVENTS, 0, "** Retention Data Save Event. Latency: %.3fs\n", latency);
@@ -906,8 +1194,11 @@ int handle_timed_event(timed_event *event)
 
 		log_debug_info(DEBUGL_EVENTS, 0, "** Expire Downtime Event. Latency: %.3fs\n", latency);
 
-		/* check for expired scheduled downtime entries */
-		check_for_expired_downtime();
+		/* expire the downtime entry this event was scheduled for */
+		if (event->event_data)
+			handle_expired_downtime_by_id((unsigned long)event->event_data);
+		else
+			check_for_expired_downtime();
 		break;
 
 	case EVENT_EXPIRE_COMMENT:
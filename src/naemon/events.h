@@ -58,6 +58,9 @@
 
 NAGIOS_BEGIN_DECL
 
+/* every timed_event is allocated from, and returned to, this cache */
+extern struct nm_slab_cache timed_event_cache;
+
 int dump_event_stats(int sd);
 void init_timing_loop(void);                         		/* setup the initial scheduling queue */
 void display_scheduling_info(void);				/* displays service check scheduling information */
@@ -15,32 +15,96 @@
 /******************** FLAP DETECTION FUNCTIONS ********************/
 /******************************************************************/
 
-static double flapping_pct(int *history, int idx, int len)
+/*
+ * Flap detection only cares about which neighbouring entries in the
+ * state history differ, so next to the history we keep a bitset of
+ * those transitions, oldest first: bit k is set if entry k and k + 1
+ * differ. Recording a state shifts out the oldest transition and adds
+ * one for the new state, so that's constant work.
+ *
+ * Each transition weighs more the more recent it is. The percentage
+ * has always been the sum of those weights added oldest first, and it
+ * must stay the same double, so we can't keep a running sum that we
+ * add to and subtract from. Instead the sums for the oldest
+ * FLAP_TABLE_BITS transitions are looked up, which leaves at most
+ * a handful of recent ones to add. The newest transition has never
+ * counted, and still doesn't.
+ */
+#if MAX_STATE_HISTORY_ENTRIES - 1 > 32
+#error "The state history transitions don't fit in state_history_changes"
+#endif
+#define FLAP_WEIGHTS (MAX_STATE_HISTORY_ENTRIES - 2)
+#define FLAP_TABLE_BITS 10
+static double flap_weights[FLAP_WEIGHTS];
+static double flap_sums[1 << FLAP_TABLE_BITS];
+static int flap_tables_ready = FALSE;
+
+static void init_flap_tables(void)
 {
 	double low_curve_value = 0.75;
 	double high_curve_value = 1.25;
-	double curved_changes = 0.0, curved_percent_change;
-	int last = 0, x, y;
+	unsigned int i, k;
+
+	for (k = 0; k < FLAP_WEIGHTS; k++)
+		flap_weights[k] = (((double)(k + 1) * (high_curve_value - low_curve_value)) / ((double)(MAX_STATE_HISTORY_ENTRIES - 2))) + low_curve_value;
+
+	for (i = 0; i < 1 << FLAP_TABLE_BITS; i++) {
+		flap_sums[i] = 0.0;
+		for (k = 0; k < FLAP_TABLE_BITS; k++) {
+			if (i & (1 << k))
+				flap_sums[i] += flap_weights[k];
+		}
+	}
+	flap_tables_ready = TRUE;
+}
 
-	last = history[idx];
-	y = idx < len ? idx : 0;
+static double flapping_pct(unsigned int changes)
+{
+	double curved_changes;
+	unsigned int recent;
 
-	/* calculate overall and curved percent state changes */
-	for (x = 1; x < MAX_STATE_HISTORY_ENTRIES; x++) {
-		if (last != history[y])
-			curved_changes += (((double)(x - 1) * (high_curve_value - low_curve_value)) / ((double)(MAX_STATE_HISTORY_ENTRIES - 2))) + low_curve_value;
+	if (flap_tables_ready == FALSE)
+		init_flap_tables();
 
-		last = history[y];
+	changes &= (1U << FLAP_WEIGHTS) - 1;
+	if (!changes)
+		return 0.0;
 
-		y++;
-		if (y >= MAX_STATE_HISTORY_ENTRIES)
-			y = 0;
-	}
+	curved_changes = flap_sums[changes & ((1 << FLAP_TABLE_BITS) - 1)];
+	for (recent = changes >> FLAP_TABLE_BITS; recent; recent &= recent - 1)
+		curved_changes += flap_weights[FLAP_TABLE_BITS + __builtin_ctz(recent)];
 
 	/* calculate overall percent change in state */
-	curved_percent_change = (double)(((double)curved_changes * 100.0) / (double)(MAX_STATE_HISTORY_ENTRIES - 1));
+	return (double)(((double)curved_changes * 100.0) / (double)(MAX_STATE_HISTORY_ENTRIES - 1));
+}
 
-	return curved_percent_change;
+/* adds a state to the history, retiring the oldest one */
+static void record_state_history(int *history, int *idx, unsigned int *changes, int state)
+{
+	int newest = history[(*idx + MAX_STATE_HISTORY_ENTRIES - 1) % MAX_STATE_HISTORY_ENTRIES];
+
+	*changes >>= 1;
+	if (state != newest)
+		*changes |= 1U << (MAX_STATE_HISTORY_ENTRIES - 2);
+
+	history[*idx] = state;
+	(*idx)++;
+	if (*idx >= MAX_STATE_HISTORY_ENTRIES)
+		*idx = 0;
+}
+
+/* packs the transitions in a state history, starting at its oldest entry */
+unsigned int pack_state_history(const int *history, int idx)
+{
+	unsigned int changes = 0;
+	int k, y;
+
+	for (k = 0; k < MAX_STATE_HISTORY_ENTRIES - 1; k++) {
+		y = (idx + k) % MAX_STATE_HISTORY_ENTRIES;
+		if (history[y] != history[(y + 1) % MAX_STATE_HISTORY_ENTRIES])
+			changes |= 1U << k;
+	}
+	return changes;
 }
 
 /* detects service flapping */
@@ -74,15 +138,10 @@ void check_for_service_flapping(service *svc, int update, int allow_flapstart_no
 	high_threshold = (svc->high_flap_threshold <= 0.0) ? high_service_flap_threshold : svc->high_flap_threshold;
 
 	/* record the current state in the state history */
-	svc->state_history[svc->state_history_index] = svc->current_state;
+	record_state_history(svc->state_history, &svc->state_history_index,
+	                     &svc->state_history_changes, svc->current_state);
 
-	/* increment state history index to next available slot */
-	svc->state_history_index++;
-	if (svc->state_history_index >= MAX_STATE_HISTORY_ENTRIES)
-		svc->state_history_index = 0;
-
-	svc->percent_state_change = flapping_pct(svc->state_history, svc->state_history_index,
-		                                     MAX_STATE_HISTORY_ENTRIES);
+	svc->percent_state_change = flapping_pct(svc->state_history_changes);
 
 	log_debug_info(DEBUGL_FLAPPING, 2, "LFT=%.2f, HFT=%.2f, CPC=%.2f, PSC=%.2f%%\n", low_threshold, high_threshold, svc->percent_state_change, svc->percent_state_change);
 
@@ -161,15 +220,10 @@ void check_for_host_flapping(host *hst, int update, int actual_check, int allow_
 	hst->last_state_history_update = current_time;
 
 	/* record the current state in the state history */
-	hst->state_history[hst->state_history_index] = hst->current_state;
-
-	/* increment state history index to next available slot */
-	hst->state_history_index++;
-	if (hst->state_history_index >= MAX_STATE_HISTORY_ENTRIES)
-		hst->state_history_index = 0;
+	record_state_history(hst->state_history, &hst->state_history_index,
+	                     &hst->state_history_changes, hst->current_state);
 
-	hst->percent_state_change = flapping_pct(hst->state_history, hst->state_history_index,
-	                                         MAX_STATE_HISTORY_ENTRIES);
+	hst->percent_state_change = flapping_pct(hst->state_history_changes);
 
 	log_debug_info(DEBUGL_FLAPPING, 2, "LFT=%.2f, HFT=%.2f, CPC=%.2f, PSC=%.2f%%\n", low_threshold, high_threshold, hst->percent_state_change, hst->percent_state_change);
 
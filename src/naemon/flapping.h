@@ -27,6 +27,7 @@ void enable_service_flap_detection(service *);			/* enables flap detection for a
 void disable_service_flap_detection(service *);			/* disables flap detection for a particular service */
 void handle_host_flap_detection_disabled(host *);		/* handles the details when flap detection is disabled globally or on a per-host basis */
 void handle_service_flap_detection_disabled(service *);		/* handles the details when flap detection is disabled globally or on a per-service basis */
+unsigned int pack_state_history(const int *, int);		/* packs the state transitions in a state history, oldest entry first */
 
 NAGIOS_END_DECL
 
@@ -85,6 +85,7 @@ extern int use_precached_objects;
 extern sched_info scheduling_info;
 
 extern int max_parallel_service_checks;
+extern double max_check_rate;
 
 extern int check_reaper_interval;
 extern int max_check_reaper_time;
@@ -121,6 +122,7 @@ extern int retention_update_interval;
 extern int use_retained_program_state;
 extern int use_retained_scheduling_info;
 extern int retention_scheduling_horizon;
+extern int initial_check_scheduling;
 extern char *retention_file;
 extern unsigned long retained_host_attribute_mask;
 extern unsigned long retained_service_attribute_mask;
@@ -137,6 +139,8 @@ extern int status_update_interval;
 extern int time_change_threshold;
 
 extern unsigned long event_broker_options;
+extern int neb_callback_profiling;
+extern unsigned int neb_async_queue_size;
 
 extern double low_service_flap_threshold;
 extern double high_service_flap_threshold;
@@ -198,6 +202,10 @@ extern char    *host_perfdata_file_processing_command;
 extern char    *service_perfdata_file_processing_command;
 extern int     host_perfdata_process_empty_results;
 extern int     service_perfdata_process_empty_results;
+extern unsigned long perfdata_file_buffer_size;
+extern unsigned long perfdata_file_flush_interval;
+extern unsigned long host_perfdata_file_rotation_size;
+extern unsigned long service_perfdata_file_rotation_size;
 /*** end perfdata variables */
 
 extern struct notify_list *notification_list;
@@ -19,11 +19,19 @@ struct load_control {
 	time_t last_change; /* last time we changed settings */
 	time_t check_interval; /* seconds between load checks */
 	double load[3];      /* system load, as reported by getloadavg() */
+	double pressure[2];  /* cpu and memory pressure (PSI "some avg10"), -1 if unknown */
+	double latency;      /* moving average of job overhead, in msecs */
+	float pressure_limit;  /* back off when pressure exceeds this (percent) */
+	float rampup_pressure; /* ramp up when pressure is below this (percent) */
+	unsigned int latency_limit; /* back off when latency exceeds this (msecs) */
+	float backoff_factor; /* scale jobs_limit by this when backing off on pressure or latency */
 	float backoff_limit; /* limit we must reach before we back off */
 	float rampup_limit;  /* limit we must reach before we ramp back up */
 	unsigned int backoff_change; /* backoff by this much */
 	unsigned int rampup_change;  /* ramp up by this much */
 	unsigned int changes;  /* number of times we've changed settings */
+	unsigned int backoffs; /* ...of which were backoffs */
+	char decision[96];     /* what we did on the last load check, and why */
 	unsigned int jobs_max;   /* upper setting for jobs_limit */
 	unsigned int jobs_limit; /* current limit */
 	unsigned int jobs_min;   /* lower setting for jobs_limit */
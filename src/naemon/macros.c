@@ -76,6 +76,14 @@ static const struct macro_key_code *find_macro_key(const char *name)
 	return NULL;
 }
 
+/* returns the code of the named "x" macro, or -1 if there's none */
+int find_macrox_code(const char *name)
+{
+	const struct macro_key_code *mkey = find_macro_key(name);
+
+	return mkey ? mkey->code : -1;
+}
+
 
 /*
  * replace macros in notification commands with their values,
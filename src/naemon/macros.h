@@ -251,6 +251,7 @@ int grab_contact_macros_r(nagios_macros *mac, contact *);
 
 int grab_macro_value_r(nagios_macros *mac, char *, char **, int *, int *);
 int grab_macrox_value_r(nagios_macros *mac, int, char *, char *, char **, int *);
+int find_macrox_code(const char *name);
 int grab_custom_macro_value_r(nagios_macros *mac, char *, char *, char *, char **);
 int grab_datetime_macro_r(nagios_macros *mac, int, char *, char *, char **);
 int grab_standard_host_macro_r(nagios_macros *mac, int, host *, char **, int *);
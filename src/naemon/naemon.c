@@ -67,8 +67,21 @@ static void set_loadctl_defaults(void)
 		loadctl.backoff_change = loadctl.jobs_limit * 0.3;
 	if (!loadctl.rampup_change)
 		loadctl.rampup_change = loadctl.backoff_change * 0.25;
+	/* small limits mustn't leave us unable to ramp up again */
+	if (!loadctl.backoff_change)
+		loadctl.backoff_change = 1;
+	if (!loadctl.rampup_change)
+		loadctl.rampup_change = 1;
 	if (!loadctl.check_interval)
-		loadctl.check_interval = 60;
+		loadctl.check_interval = 5;
+	if (!loadctl.pressure_limit)
+		loadctl.pressure_limit = 40.0;
+	if (!loadctl.rampup_pressure)
+		loadctl.rampup_pressure = 10.0;
+	if (!loadctl.latency_limit)
+		loadctl.latency_limit = 1000;
+	if (!loadctl.backoff_factor)
+		loadctl.backoff_factor = 0.7;
 	if (!loadctl.jobs_min)
 		loadctl.jobs_min = online_cpus() * 20; /* pessimistic */
 }
@@ -738,6 +751,10 @@ int main(int argc, char **argv)
 		init_check_stats();
 		timing_point("check stats initialized\n");
 
+		/* initialize the status aggregates (with retained information) */
+		init_status_aggregates();
+		timing_point("Status aggregates initialized\n");
+
 		/* update all status data (with retained information) */
 		update_all_status_data();
 		timing_point("Status data updated\n");
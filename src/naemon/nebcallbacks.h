@@ -45,6 +45,18 @@ NAGIOS_BEGIN_DECL
 
 int neb_register_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *));
 int neb_deregister_callback(int callback_type, int (*callback_func)(int, void *));
+
+/*
+ * Like neb_register_callback(), but the callback is run on a thread
+ * owned by the module rather than in the main loop. The event data
+ * is copied when the event happens, strings included, but pointers
+ * to core objects are NULL in the copy since the core may change or
+ * free them at any time. The return value of an asynchronous callback
+ * is ignored, so it can't cancel or override anything. Callback types
+ * whose data is nothing but such a pointer are refused with
+ * NEBERROR_CALLBACKNOTASYNC.
+ */
+int neb_register_async_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *));
 int neb_deregister_module_callbacks(nebmodule *);
 
 NAGIOS_END_DECL
@@ -27,6 +27,7 @@
 #define NEBERROR_BADMODULEHANDLE    205     /* bad module handle */
 #define NEBERROR_CALLBACKOVERRIDE   206     /* module wants to override default Nagios handling of event */
 #define NEBERROR_CALLBACKCANCEL     207     /* module wants to cancel callbacks to other modules */
+#define NEBERROR_CALLBACKNOTASYNC   208     /* callback type can not be delivered asynchronously */
 
 
 /***** MODULE ERRORS *****/
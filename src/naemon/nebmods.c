@@ -2,15 +2,38 @@
 #include "common.h"
 #include "nebmods.h"
 #include "neberrors.h"
+#include "nebstructs.h"
 #include "logging.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "lib/libnaemon.h"
 #include <string.h>
+#include <stddef.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #ifdef USE_EVENT_BROKER
 
 static nebmodule *neb_module_list;
 static nebcallback **neb_callback_list;
+unsigned int neb_callback_mask;
+
+static const char *neb_callback_names[NEBCALLBACK_NUMITEMS] = {
+	"process_data", "timed_event_data", "log_data", "system_command_data",
+	"event_handler_data", "notification_data", "service_check_data",
+	"host_check_data", "comment_data", "downtime_data", "flapping_data",
+	"program_status_data", "host_status_data", "service_status_data",
+	"adaptive_program_data", "adaptive_host_data", "adaptive_service_data",
+	"external_command_data", "aggregated_status_data", "retention_data",
+	"contact_notification_data", "contact_notification_method_data",
+	"acknowledgement_data", "state_change_data", "contact_status_data",
+	"adaptive_contact_data",
+};
+
+static void neb_async_stop(struct neb_async_queue *q);
+static int neb_async_start(struct neb_async_queue *q);
+static void neb_async_destroy(struct neb_async_queue *q);
 
 /* compat stuff for USE_LTDL */
 #ifndef HAVE_DLFCN_H
@@ -270,6 +293,9 @@ int neb_unload_module(nebmodule *mod, int flags, int reason)
 		nm_free(mod->dl_file);
 	}
 
+	/* deliver whatever is queued for the module while it's still initialized */
+	neb_async_stop(mod->async_queue);
+
 	/* call the de-initialization function if available (and the module was initialized) */
 	if (mod->deinit_func && reason != NEBMODULE_ERROR_BAD_INIT) {
 
@@ -279,12 +305,16 @@ int neb_unload_module(nebmodule *mod, int flags, int reason)
 		result = (*deinitfunc)(flags, reason);
 
 		/* if module doesn't want to be unloaded, exit with error (unless its being forced) */
-		if (result != OK && !(flags & NEBMODULE_FORCE_UNLOAD))
+		if (result != OK && !(flags & NEBMODULE_FORCE_UNLOAD)) {
+			neb_async_start(mod->async_queue);
 			return ERROR;
+		}
 	}
 
 	/* deregister all of the module's callbacks */
 	neb_deregister_module_callbacks(mod);
+	neb_async_destroy(mod->async_queue);
+	mod->async_queue = NULL;
 
 	if (mod->core_module == FALSE) {
 
@@ -346,14 +376,320 @@ int neb_set_module_info(void *handle, int type, char *data)
 
 
 
+/****************************************************************************/
+/****************************************************************************/
+/* ASYNCHRONOUS CALLBACKS                                                   */
+/****************************************************************************/
+/****************************************************************************/
+
+/*
+ * Modules that ship events off somewhere can register callbacks that
+ * run on a thread of their own. The main loop copies the event into a
+ * bounded ring and moves on; the module's thread takes events off the
+ * other end. There's exactly one producer (the main loop) and one
+ * consumer per ring, so head and tail need nothing but acquire/release
+ * ordering. The mutex and condition variable are only used to wake the
+ * consumer up when it has run out of events.
+ *
+ * When the ring is full the event is dropped and counted rather than
+ * stalling the main loop.
+ */
+struct neb_async_event {
+	int type;
+	int (*func)(int, void *);
+	void *data;
+};
+
+struct neb_async_queue {
+	struct neb_async_event *ring;
+	unsigned long mask; /* ring size - 1, ring size is a power of 2 */
+	unsigned long head; /* next event to deliver, moved by the module thread */
+	unsigned long tail; /* next free slot, moved by the main loop */
+	unsigned long queued, dropped;
+	unsigned long delivered;
+	int waiting, stopping, running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/*
+ * How to copy the event data of each callback type: the size of the
+ * struct, the offsets of its strings, which are copied along with it,
+ * and the offsets of its pointers to core objects, which are cleared.
+ * Both lists end at the first 0, which is never a valid offset since
+ * every struct starts with its type. Types without a size only carry
+ * an object pointer and can't be delivered asynchronously.
+ */
+#define NEB_ASYNC_MAX_STRINGS 10
+#define NEB_ASYNC_MAX_POINTERS 3
+static const struct neb_async_type {
+	size_t size;
+	size_t strings[NEB_ASYNC_MAX_STRINGS];
+	size_t pointers[NEB_ASYNC_MAX_POINTERS];
+} neb_async_types[NEBCALLBACK_NUMITEMS] = {
+#define S(name) sizeof(nebstruct_##name##_data)
+#define O(name, member) offsetof(nebstruct_##name##_data, member)
+	[NEBCALLBACK_PROCESS_DATA] = { S(process) },
+	[NEBCALLBACK_TIMED_EVENT_DATA] = { S(timed_event), { 0 },
+		{ O(timed_event, event_data), O(timed_event, event_ptr) } },
+	[NEBCALLBACK_LOG_DATA] = { S(log), { O(log, data) } },
+	[NEBCALLBACK_SYSTEM_COMMAND_DATA] = { S(system_command),
+		{ O(system_command, command_line), O(system_command, output) } },
+	[NEBCALLBACK_EVENT_HANDLER_DATA] = { S(event_handler),
+		{ O(event_handler, host_name), O(event_handler, service_description),
+		  O(event_handler, command_name), O(event_handler, command_args),
+		  O(event_handler, command_line), O(event_handler, output) },
+		{ O(event_handler, object_ptr) } },
+	[NEBCALLBACK_NOTIFICATION_DATA] = { S(notification),
+		{ O(notification, host_name), O(notification, service_description),
+		  O(notification, output), O(notification, ack_author), O(notification, ack_data) },
+		{ O(notification, object_ptr) } },
+	[NEBCALLBACK_SERVICE_CHECK_DATA] = { S(service_check),
+		{ O(service_check, host_name), O(service_check, service_description),
+		  O(service_check, command_name), O(service_check, command_args),
+		  O(service_check, command_line), O(service_check, output),
+		  O(service_check, long_output), O(service_check, perf_data) },
+		{ O(service_check, check_result_ptr), O(service_check, object_ptr) } },
+	[NEBCALLBACK_HOST_CHECK_DATA] = { S(host_check),
+		{ O(host_check, host_name), O(host_check, command_name),
+		  O(host_check, command_args), O(host_check, command_line),
+		  O(host_check, output), O(host_check, long_output), O(host_check, perf_data) },
+		{ O(host_check, check_result_ptr), O(host_check, object_ptr) } },
+	[NEBCALLBACK_COMMENT_DATA] = { S(comment),
+		{ O(comment, host_name), O(comment, service_description),
+		  O(comment, author_name), O(comment, comment_data) },
+		{ O(comment, object_ptr) } },
+	[NEBCALLBACK_DOWNTIME_DATA] = { S(downtime),
+		{ O(downtime, host_name), O(downtime, service_description),
+		  O(downtime, author_name), O(downtime, comment_data) },
+		{ O(downtime, object_ptr) } },
+	[NEBCALLBACK_FLAPPING_DATA] = { S(flapping),
+		{ O(flapping, host_name), O(flapping, service_description) },
+		{ O(flapping, object_ptr) } },
+	[NEBCALLBACK_PROGRAM_STATUS_DATA] = { S(program_status),
+		{ O(program_status, global_host_event_handler),
+		  O(program_status, global_service_event_handler) } },
+	[NEBCALLBACK_ADAPTIVE_PROGRAM_DATA] = { S(adaptive_program) },
+	[NEBCALLBACK_ADAPTIVE_HOST_DATA] = { S(adaptive_host), { 0 },
+		{ O(adaptive_host, object_ptr) } },
+	[NEBCALLBACK_ADAPTIVE_SERVICE_DATA] = { S(adaptive_service), { 0 },
+		{ O(adaptive_service, object_ptr) } },
+	[NEBCALLBACK_EXTERNAL_COMMAND_DATA] = { S(external_command),
+		{ O(external_command, command_string), O(external_command, command_args) } },
+	[NEBCALLBACK_AGGREGATED_STATUS_DATA] = { S(aggregated_status) },
+	[NEBCALLBACK_RETENTION_DATA] = { S(retention) },
+	[NEBCALLBACK_CONTACT_NOTIFICATION_DATA] = { S(contact_notification),
+		{ O(contact_notification, host_name), O(contact_notification, service_description),
+		  O(contact_notification, contact_name), O(contact_notification, output),
+		  O(contact_notification, ack_author), O(contact_notification, ack_data) },
+		{ O(contact_notification, object_ptr), O(contact_notification, contact_ptr) } },
+	[NEBCALLBACK_CONTACT_NOTIFICATION_METHOD_DATA] = { S(contact_notification_method),
+		{ O(contact_notification_method, host_name),
+		  O(contact_notification_method, service_description),
+		  O(contact_notification_method, contact_name),
+		  O(contact_notification_method, command_name),
+		  O(contact_notification_method, command_args),
+		  O(contact_notification_method, output),
+		  O(contact_notification_method, ack_author),
+		  O(contact_notification_method, ack_data) },
+		{ O(contact_notification_method, object_ptr),
+		  O(contact_notification_method, contact_ptr) } },
+	[NEBCALLBACK_ACKNOWLEDGEMENT_DATA] = { S(acknowledgement),
+		{ O(acknowledgement, host_name), O(acknowledgement, service_description),
+		  O(acknowledgement, author_name), O(acknowledgement, comment_data) },
+		{ O(acknowledgement, object_ptr) } },
+	[NEBCALLBACK_STATE_CHANGE_DATA] = { S(statechange),
+		{ O(statechange, host_name), O(statechange, service_description),
+		  O(statechange, output) },
+		{ O(statechange, object_ptr) } },
+	[NEBCALLBACK_ADAPTIVE_CONTACT_DATA] = { S(adaptive_contact), { 0 },
+		{ O(adaptive_contact, object_ptr) } },
+#undef S
+#undef O
+};
+
+/* copy the event data and its strings into a single allocation */
+static void *neb_async_copy(int callback_type, void *data)
+{
+	const struct neb_async_type *t = &neb_async_types[callback_type];
+	size_t len = t->size, slen[NEB_ASYNC_MAX_STRINGS];
+	char *copy, *p;
+	int i;
+
+	for (i = 0; i < NEB_ASYNC_MAX_STRINGS && t->strings[i]; i++) {
+		char *str = *(char **)((char *)data + t->strings[i]);
+		slen[i] = str ? strlen(str) + 1 : 0;
+		len += slen[i];
+	}
+
+	copy = nm_malloc(len);
+	memcpy(copy, data, t->size);
+	p = copy + t->size;
+	for (i = 0; i < NEB_ASYNC_MAX_STRINGS && t->strings[i]; i++) {
+		char **str = (char **)(copy + t->strings[i]);
+		if (!slen[i])
+			continue;
+		memcpy(p, *str, slen[i]);
+		*str = p;
+		p += slen[i];
+	}
+	for (i = 0; i < NEB_ASYNC_MAX_POINTERS && t->pointers[i]; i++)
+		*(void **)(copy + t->pointers[i]) = NULL;
+
+	return copy;
+}
+
+/* called from the main loop only */
+static int neb_async_push(struct neb_async_queue *q, int callback_type, int (*func)(int, void *), void *data)
+{
+	struct neb_async_event *ev;
+	unsigned long tail = q->tail;
+
+	if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask) {
+		q->dropped++;
+		return OK;
+	}
+
+	ev = &q->ring[tail & q->mask];
+	ev->type = callback_type;
+	ev->func = func;
+	ev->data = neb_async_copy(callback_type, data);
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	q->queued++;
+
+	/* pairs with the fence in neb_async_wait(), so a wakeup is never missed */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->waiting, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_signal(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	return OK;
+}
+
+static void neb_async_wait(struct neb_async_queue *q, unsigned long head)
+{
+	struct timespec deadline;
+
+	pthread_mutex_lock(&q->lock);
+	__atomic_store_n(&q->waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) && !__atomic_load_n(&q->stopping, __ATOMIC_ACQUIRE)) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec++;
+		pthread_cond_timedwait(&q->cond, &q->lock, &deadline);
+	}
+	__atomic_store_n(&q->waiting, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* the module thread; only stops once everything queued has been delivered */
+static void *neb_async_thread(void *arg)
+{
+	struct neb_async_queue *q = arg;
+
+	for (;;) {
+		unsigned long head = q->head;
+		struct neb_async_event *ev;
+
+		if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&q->stopping, __ATOMIC_ACQUIRE))
+				break;
+			neb_async_wait(q, head);
+			continue;
+		}
+
+		ev = &q->ring[head & q->mask];
+		ev->func(ev->type, ev->data);
+		free(ev->data);
+		__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&q->delivered, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static int neb_async_start(struct neb_async_queue *q)
+{
+	sigset_t all, old;
+	int ret;
+
+	if (!q || q->running)
+		return OK;
+
+	/* signals are for the main loop to handle */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	q->stopping = 0;
+	ret = pthread_create(&q->thread, NULL, neb_async_thread, q);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to start event broker module thread: %s\n", strerror(ret));
+		return ERROR;
+	}
+	q->running = 1;
+	return OK;
+}
+
+static void neb_async_stop(struct neb_async_queue *q)
+{
+	if (!q || !q->running)
+		return;
+
+	pthread_mutex_lock(&q->lock);
+	__atomic_store_n(&q->stopping, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread, NULL);
+	q->running = 0;
+}
+
+static struct neb_async_queue *neb_async_create(void)
+{
+	struct neb_async_queue *q;
+	unsigned long size = 1;
+
+	while (size < neb_async_queue_size)
+		size <<= 1;
+
+	q = nm_calloc(1, sizeof(*q));
+	q->ring = nm_calloc(size, sizeof(*q->ring));
+	q->mask = size - 1;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	if (neb_async_start(q) != OK) {
+		neb_async_destroy(q);
+		return NULL;
+	}
+	return q;
+}
+
+static void neb_async_destroy(struct neb_async_queue *q)
+{
+	if (!q)
+		return;
+
+	neb_async_stop(q);
+	/* left behind by events that happened while the module was unloading */
+	for (; q->head != q->tail; q->head++)
+		free(q->ring[q->head & q->mask].data);
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->cond);
+	nm_free(q->ring);
+	nm_free(q);
+}
+
+
+
 /****************************************************************************/
 /****************************************************************************/
 /* CALLBACK FUNCTIONS                                                       */
 /****************************************************************************/
 /****************************************************************************/
 
-/* allows a module to register a callback function */
-int neb_register_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *))
+static int neb_add_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *), int async)
 {
 	nebmodule *temp_module = NULL;
 	nebcallback *new_callback = NULL;
@@ -381,11 +717,20 @@ int neb_register_callback(int callback_type, void *mod_handle, int priority, int
 	if (temp_module == NULL)
 		return NEBERROR_BADMODULEHANDLE;
 
+	if (async) {
+		if (!neb_async_types[callback_type].size)
+			return NEBERROR_CALLBACKNOTASYNC;
+		if (!temp_module->async_queue && !(temp_module->async_queue = neb_async_create()))
+			return NEBERROR_NOMEM;
+	}
+
 	/* allocate memory */
-	new_callback = nm_malloc(sizeof(nebcallback));
+	new_callback = nm_calloc(1, sizeof(nebcallback));
 	new_callback->priority = priority;
 	new_callback->module_handle = mod_handle;
 	new_callback->callback_func = callback_func;
+	if (async)
+		new_callback->async_queue = temp_module->async_queue;
 
 	/* add new function to callback list, sorted by priority (first come, first served for same priority) */
 	new_callback->next = NULL;
@@ -409,10 +754,23 @@ int neb_register_callback(int callback_type, void *mod_handle, int priority, int
 			}
 		}
 	}
+	neb_callback_mask |= 1U << callback_type;
 
 	return OK;
 }
 
+/* allows a module to register a callback function */
+int neb_register_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *))
+{
+	return neb_add_callback(callback_type, mod_handle, priority, callback_func, FALSE);
+}
+
+/* same as above, but the callback runs on the module's own thread */
+int neb_register_async_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *))
+{
+	return neb_add_callback(callback_type, mod_handle, priority, callback_func, TRUE);
+}
+
 
 
 /* dregisters all callback functions for a given module */
@@ -474,12 +832,22 @@ int neb_deregister_callback(int callback_type, int (*callback_func)(int, void *)
 		return NEBERROR_CALLBACKNOTFOUND;
 
 	else {
-		/* only one item in the list */
+		/* first item in the list */
 		if (temp_callback != last_callback->next)
-			neb_callback_list[callback_type] = NULL;
+			neb_callback_list[callback_type] = next_callback;
 		else
 			last_callback->next = next_callback;
-		nm_free(temp_callback);
+
+		/*
+		 * a callback deregistering itself is still running, so
+		 * leave it to neb_make_callbacks() to free it afterwards
+		 */
+		if (temp_callback->running)
+			temp_callback->callback_func = NULL;
+		else
+			nm_free(temp_callback);
+		if (!neb_callback_list[callback_type])
+			neb_callback_mask &= ~(1U << callback_type);
 	}
 
 	return OK;
@@ -487,13 +855,63 @@ int neb_deregister_callback(int callback_type, int (*callback_func)(int, void *)
 
 
 
+/* rounds of callbacks made per callback type, to pick the ones to time */
+static unsigned int neb_profile_rounds[NEBCALLBACK_NUMITEMS];
+
+/* account one call to cb */
+static void neb_count_callback(nebcallback *cb, int cbresult)
+{
+	cb->calls++;
+	if (cbresult == NEBERROR_CALLBACKCANCEL)
+		cb->cancels++;
+	else if (cbresult == NEBERROR_CALLBACKOVERRIDE)
+		cb->overrides++;
+}
+
+/*
+ * account the time of a sampled call to cb, which started at *start.
+ * *start is moved to the time the call ended, so a chain of callbacks
+ * costs a single gettimeofday() per call
+ */
+static void neb_time_callback(nebcallback *cb, struct timeval *start)
+{
+	struct timeval stop;
+	unsigned long usec, limit;
+	long long delta;
+	int i;
+
+	gettimeofday(&stop, NULL);
+	delta = (stop.tv_sec - start->tv_sec) * 1000000LL + (stop.tv_usec - start->tv_usec);
+	usec = delta > 0 ? (unsigned long)delta : 0; /* clock stepped backwards */
+
+	cb->timed++;
+	cb->total_usec += usec;
+	if (usec > cb->max_usec)
+		cb->max_usec = usec;
+
+	for (i = 0, limit = 10; i < NEB_LATENCY_BUCKETS - 1 && usec >= limit; i++)
+		limit *= 10;
+	cb->latency[i]++;
+	*start = stop;
+}
+
+static inline int neb_run_callback(nebcallback *cb, int callback_type, void *data)
+{
+	int (*callbackfunc)(int, void *) = cb->callback_func;
+
+	if (cb->async_queue)
+		return neb_async_push(cb->async_queue, callback_type, callbackfunc, data);
+	return callbackfunc(callback_type, data);
+}
+
 /* make callbacks to modules */
 int neb_make_callbacks(int callback_type, void *data)
 {
 	nebcallback *temp_callback, *next_callback;
-	int (*callbackfunc)(int, void *);
 	register int cbresult = 0;
 	int total_callbacks = 0;
+	struct timeval start;
+	int timed = FALSE;
 
 	/* make sure callback list is initialized */
 	if (neb_callback_list == NULL)
@@ -505,11 +923,31 @@ int neb_make_callbacks(int callback_type, void *data)
 
 	log_debug_info(DEBUGL_EVENTBROKER, 1, "Making callbacks (type %d)...\n", callback_type);
 
+	/*
+	 * timing every call costs more than a trivial callback does, so
+	 * only a sample of the rounds is timed. Calls are always counted
+	 */
+	if (neb_callback_profiling && neb_profile_rounds[callback_type]++ % NEB_PROFILE_SAMPLE == 0) {
+		timed = TRUE;
+		gettimeofday(&start, NULL);
+	}
+
 	/* make the callbacks... */
 	for (temp_callback = neb_callback_list[callback_type]; temp_callback; temp_callback = next_callback) {
 		next_callback = temp_callback->next;
-		callbackfunc = temp_callback->callback_func;
-		cbresult = callbackfunc(callback_type, data);
+		if (neb_callback_profiling) {
+			temp_callback->running++;
+			cbresult = neb_run_callback(temp_callback, callback_type, data);
+			temp_callback->running--;
+			neb_count_callback(temp_callback, cbresult);
+			if (timed)
+				neb_time_callback(temp_callback, &start);
+			/* deregistered while we were in it */
+			if (!temp_callback->callback_func && !temp_callback->running)
+				nm_free(temp_callback);
+		} else {
+			cbresult = neb_run_callback(temp_callback, callback_type, data);
+		}
 		temp_callback = next_callback;
 
 		total_callbacks++;
@@ -567,7 +1005,130 @@ int neb_free_callback_list(void)
 	}
 
 	nm_free(neb_callback_list);
+	neb_callback_mask = 0;
 
 	return OK;
 }
+
+
+/****************************************************************************/
+/****************************************************************************/
+/* QUERY HANDLER                                                            */
+/****************************************************************************/
+/****************************************************************************/
+
+static const char *neb_module_name(void *module_handle)
+{
+	nebmodule *mod;
+
+	for (mod = neb_module_list; mod; mod = mod->next) {
+		if (mod->module_handle == module_handle)
+			return mod->filename ? mod->filename : "(unnamed)";
+	}
+	return "(unknown)";
+}
+
+static void neb_print_callback_stats(int sd)
+{
+	nebcallback *cb;
+	int x, i;
+
+	nsock_printf(sd, "profiling=%s\n", neb_callback_profiling ? "on" : "off");
+	if (neb_callback_list == NULL)
+		return;
+
+	for (x = 0; x < NEBCALLBACK_NUMITEMS; x++) {
+		for (cb = neb_callback_list[x]; cb; cb = cb->next) {
+			unsigned long limit = 10;
+
+			nsock_printf(sd, "module=%s;callback=%s;priority=%d;calls=%lu;cancels=%lu;overrides=%lu;"
+			             "timed=%lu;total_usec=%llu;max_usec=%lu;avg_usec=%.2f",
+			             neb_module_name(cb->module_handle), neb_callback_names[x],
+			             cb->priority, cb->calls, cb->cancels, cb->overrides,
+			             cb->timed, cb->total_usec, cb->max_usec,
+			             cb->timed ? (double)cb->total_usec / cb->timed : 0.0);
+			for (i = 0; i < NEB_LATENCY_BUCKETS - 1; i++, limit *= 10) {
+				if (limit < 1000)
+					nsock_printf(sd, ";lt_%luus=%lu", limit, cb->latency[i]);
+				else if (limit < 1000000)
+					nsock_printf(sd, ";lt_%lums=%lu", limit / 1000, cb->latency[i]);
+				else
+					nsock_printf(sd, ";lt_%lus=%lu", limit / 1000000, cb->latency[i]);
+			}
+			nsock_printf(sd, ";ge_1s=%lu\n", cb->latency[NEB_LATENCY_BUCKETS - 1]);
+		}
+	}
+}
+
+static void neb_print_async_stats(int sd)
+{
+	nebmodule *mod;
+
+	for (mod = neb_module_list; mod; mod = mod->next) {
+		struct neb_async_queue *q = mod->async_queue;
+		unsigned long delivered;
+
+		if (!q)
+			continue;
+		delivered = __atomic_load_n(&q->delivered, __ATOMIC_RELAXED);
+		nsock_printf(sd, "module=%s;capacity=%lu;queued=%lu;delivered=%lu;dropped=%lu;pending=%lu\n",
+		             mod->filename ? mod->filename : "(unnamed)", q->mask + 1,
+		             q->queued, delivered, q->dropped, q->queued - delivered);
+	}
+}
+
+static void neb_reset_callback_stats(void)
+{
+	nebcallback *cb;
+	int x;
+
+	memset(neb_profile_rounds, 0, sizeof(neb_profile_rounds));
+	if (neb_callback_list == NULL)
+		return;
+
+	for (x = 0; x < NEBCALLBACK_NUMITEMS; x++) {
+		for (cb = neb_callback_list[x]; cb; cb = cb->next) {
+			cb->calls = cb->cancels = cb->overrides = cb->timed = 0;
+			cb->total_usec = 0;
+			cb->max_usec = 0;
+			memset(cb->latency, 0, sizeof(cb->latency));
+		}
+	}
+}
+
+int neb_qh_handler(int sd, char *buf, unsigned int len)
+{
+	if (!*buf || !strcmp(buf, "help")) {
+		nsock_printf_nul(sd, "Event broker module callback profiling and queues.\n"
+		                 "Valid commands:\n"
+		                 "  callbacks   Print call count, cancellations, overrides and\n"
+		                 "              latency histogram per module and callback type.\n"
+		                 "              Timings come from a sample of the calls\n"
+		                 "  async       Print queue counters for modules with asynchronous\n"
+		                 "              callbacks\n"
+		                 "  reset       Reset all callback statistics\n"
+		                 "  enable      Start timing callbacks\n"
+		                 "  disable     Stop timing callbacks");
+		return 0;
+	}
+
+	if (!strcmp(buf, "callbacks")) {
+		neb_print_callback_stats(sd);
+		return 0;
+	}
+	if (!strcmp(buf, "async")) {
+		neb_print_async_stats(sd);
+		return 0;
+	}
+	if (!strcmp(buf, "reset")) {
+		neb_reset_callback_stats();
+		return 200;
+	}
+	if (!strcmp(buf, "enable") || !strcmp(buf, "disable")) {
+		neb_callback_profiling = *buf == 'e';
+		return 200;
+	}
+
+	return 400;
+}
 #endif
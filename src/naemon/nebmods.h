@@ -12,12 +12,27 @@ NAGIOS_BEGIN_DECL
 
 /***** MODULE STRUCTURES *****/
 
+/* callback latency histogram buckets: <10us, <100us, <1ms, <10ms, <100ms, <1s, >=1s */
+#define NEB_LATENCY_BUCKETS 7
+/* with profiling on, one round of callbacks in this many per callback type is timed */
+#define NEB_PROFILE_SAMPLE 16
+
 /* NEB module callback list struct */
 typedef struct nebcallback_struct {
 	void            *callback_func;
 	void            *module_handle;
 	int             priority;
 	struct nebcallback_struct *next;
+	/* profiling data, collected when neb_callback_profiling is set */
+	unsigned int    running; /* nesting depth of calls in progress */
+	unsigned long   calls;
+	unsigned long   timed; /* calls that were sampled for the timings below */
+	unsigned long   cancels;
+	unsigned long   overrides;
+	unsigned long long total_usec;
+	unsigned long   max_usec;
+	unsigned long   latency[NEB_LATENCY_BUCKETS];
+	struct neb_async_queue *async_queue; /* set for asynchronous callbacks */
 } nebcallback;
 
 
@@ -34,9 +49,17 @@ int neb_add_core_module(nebmodule *mod);
 
 
 /***** CALLBACK FUNCTIONS *****/
+/*
+ * Bit N is set while at least one callback of type N is registered,
+ * so the broker can skip building event data nobody will look at.
+ */
+extern unsigned int neb_callback_mask;
+#define neb_has_callbacks(callback_type) (neb_callback_mask & (1U << (callback_type)))
+
 int neb_init_callback_list(void);
 int neb_free_callback_list(void);
 int neb_make_callbacks(int, void *);
+int neb_qh_handler(int, char *, unsigned int);
 
 NAGIOS_END_DECL
 #endif
@@ -37,6 +37,8 @@ NAGIOS_BEGIN_DECL
 
 
 /***** MODULE STRUCTURES *****/
+struct neb_async_queue;
+
 /* NEB module structure */
 typedef struct nebmodule_struct {
 	char            *filename;
@@ -56,6 +58,7 @@ typedef struct nebmodule_struct {
 	void            *deinit_func;
 #endif
 	struct nebmodule_struct *next;
+	struct neb_async_queue *async_queue; /* events for asynchronous callbacks */
 } nebmodule;
 
 
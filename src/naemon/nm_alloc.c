@@ -22,28 +22,40 @@
 	}											\
 	return _ptr;
 
+#define COUNT(_what) \
+	if (alloc_counting) \
+		__atomic_fetch_add(&alloc_stats._what, 1, __ATOMIC_RELAXED)
+
+static int alloc_counting;
+static struct nm_alloc_stats alloc_stats;
+
 void *nm_malloc(size_t size) {
 	void *ptr = malloc(size);
+	COUNT(malloc);
 	CHECK_AND_RETURN(ptr);
 }
 
 void *nm_realloc(void *ptr, size_t size)  {
 	void *new_ptr = realloc(ptr, size);
+	COUNT(realloc);
 	CHECK_AND_RETURN(new_ptr);
 }
 
 void *nm_calloc(size_t count, size_t size) {
 	void *ptr = calloc(count, size);
+	COUNT(calloc);
 	CHECK_AND_RETURN(ptr);
 }
 
 void *nm_strdup(const char *s) {
 	char *str = strdup(s);
+	COUNT(strdup);
 	CHECK_AND_RETURN(str);
 }
 
 void *nm_strndup(const char *s, size_t size) {
 	char *str = strndup(s, size);
+	COUNT(strdup);
 	CHECK_AND_RETURN(str);
 }
 
@@ -54,5 +66,214 @@ void nm_asprintf(char **strp, const char *fmt, ...) {
 		log_vasprintf_error();
 		exit(2);
 	}
+	COUNT(asprintf);
 	va_end(ap);
 }
+
+void nm_alloc_count(int enable) {
+	if (enable && !alloc_counting)
+		memset(&alloc_stats, 0, sizeof(alloc_stats));
+	alloc_counting = !!enable;
+}
+
+int nm_alloc_counting(void) {
+	return alloc_counting;
+}
+
+unsigned long long nm_alloc_total(const struct nm_alloc_stats *stats) {
+	return stats->malloc + stats->calloc + stats->realloc + stats->strdup + stats->asprintf;
+}
+
+void nm_alloc_get_stats(struct nm_alloc_stats *stats) {
+	*stats = alloc_stats;
+}
+
+/* everything handed out below is aligned like malloc() would */
+#define NM_ALIGN 16
+#define nm_align(_size) (((_size) + NM_ALIGN - 1) & ~((size_t)NM_ALIGN - 1))
+
+/* number of objects carved out of each slab */
+#define NM_SLAB_OBJECTS 64
+
+struct nm_slab {
+	struct nm_slab *next;
+};
+
+static struct nm_slab_cache *slab_caches;
+
+static void nm_slab_grow(struct nm_slab_cache *cache) {
+	struct nm_slab *slab;
+	size_t size = nm_align(cache->size ? cache->size : 1);
+	char *obj;
+	int i;
+
+	/* the cache registers itself when it gets its first slab */
+	if (!cache->objects) {
+		cache->next = slab_caches;
+		slab_caches = cache;
+	}
+
+	slab = nm_malloc(nm_align(sizeof(*slab)) + size * NM_SLAB_OBJECTS);
+	slab->next = cache->slabs;
+	cache->slabs = slab;
+	cache->objects += NM_SLAB_OBJECTS;
+
+	obj = (char *)slab + nm_align(sizeof(*slab));
+	for (i = 0; i < NM_SLAB_OBJECTS; i++, obj += size) {
+		*(void **)obj = cache->free_list;
+		cache->free_list = obj;
+	}
+}
+
+void *nm_slab_alloc(struct nm_slab_cache *cache) {
+	void *ptr;
+
+	if (!cache->free_list)
+		nm_slab_grow(cache);
+
+	ptr = cache->free_list;
+	cache->free_list = *(void **)ptr;
+	memset(ptr, 0, cache->size);
+	cache->allocs++;
+	if (++cache->in_use > cache->peak)
+		cache->peak = cache->in_use;
+	return ptr;
+}
+
+void nm_slab_free(struct nm_slab_cache *cache, void *ptr) {
+	if (!ptr)
+		return;
+
+	*(void **)ptr = cache->free_list;
+	cache->free_list = ptr;
+	cache->in_use--;
+}
+
+/* releases all memory held by the cache, including objects in use */
+void nm_slab_cache_destroy(struct nm_slab_cache *cache) {
+	struct nm_slab *slab, *next;
+	struct nm_slab_cache **pp;
+
+	if (!cache->objects)
+		return;
+
+	for (pp = &slab_caches; *pp; pp = &(*pp)->next) {
+		if (*pp == cache) {
+			*pp = cache->next;
+			break;
+		}
+	}
+	for (slab = cache->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+	cache->slabs = NULL;
+	cache->free_list = NULL;
+	cache->next = NULL;
+	cache->in_use = cache->objects = 0;
+}
+
+struct nm_slab_cache *nm_slab_caches(void) {
+	return slab_caches;
+}
+
+/*
+ * Scratch memory comes from a list of chunks that are kept across
+ * iterations, so once the arena has grown to fit the busiest
+ * iteration it stops allocating altogether. Requests too large to
+ * fit comfortably in a chunk get a block of their own, which is
+ * released on reset.
+ */
+#define NM_SCRATCH_CHUNK (64 * 1024)
+
+struct nm_scratch_chunk {
+	struct nm_scratch_chunk *next;
+	size_t size, used;
+};
+
+static struct nm_scratch_chunk *scratch_chunks, *scratch_cur, *scratch_large;
+static struct nm_scratch_stats scratch_stats;
+
+#define scratch_data(_chunk) ((char *)(_chunk) + nm_align(sizeof(struct nm_scratch_chunk)))
+
+static struct nm_scratch_chunk *nm_scratch_chunk_new(size_t size) {
+	struct nm_scratch_chunk *chunk;
+
+	chunk = nm_malloc(nm_align(sizeof(*chunk)) + size);
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	scratch_stats.reserved += size;
+	return chunk;
+}
+
+void *nm_scratch_alloc(size_t size) {
+	struct nm_scratch_chunk *chunk;
+	void *ptr;
+
+	size = nm_align(size ? size : 1);
+	scratch_stats.allocs++;
+	scratch_stats.used += size;
+	if (scratch_stats.used > scratch_stats.peak)
+		scratch_stats.peak = scratch_stats.used;
+
+	if (size > NM_SCRATCH_CHUNK / 4) {
+		chunk = nm_scratch_chunk_new(size);
+		chunk->next = scratch_large;
+		scratch_large = chunk;
+		return scratch_data(chunk);
+	}
+
+	/* chunks past the current one are all unused since the last reset */
+	while (scratch_cur && scratch_cur->used + size > scratch_cur->size) {
+		if (!scratch_cur->next)
+			scratch_cur->next = nm_scratch_chunk_new(NM_SCRATCH_CHUNK);
+		scratch_cur = scratch_cur->next;
+	}
+	if (!scratch_cur)
+		scratch_cur = scratch_chunks = nm_scratch_chunk_new(NM_SCRATCH_CHUNK);
+
+	ptr = scratch_data(scratch_cur) + scratch_cur->used;
+	scratch_cur->used += size;
+	return ptr;
+}
+
+char *nm_scratch_strndup(const char *s, size_t size) {
+	char *str;
+	size_t len;
+
+	for (len = 0; len < size && s[len]; len++)
+		; /* empty loop */
+	str = nm_scratch_alloc(len + 1);
+	memcpy(str, s, len);
+	str[len] = 0;
+	return str;
+}
+
+char *nm_scratch_strdup(const char *s) {
+	size_t len = strlen(s) + 1;
+	return memcpy(nm_scratch_alloc(len), s, len);
+}
+
+void nm_scratch_reset(void) {
+	struct nm_scratch_chunk *chunk, *next;
+
+	if (!scratch_stats.used)
+		return;
+
+	for (chunk = scratch_large; chunk; chunk = next) {
+		next = chunk->next;
+		scratch_stats.reserved -= chunk->size;
+		free(chunk);
+	}
+	scratch_large = NULL;
+	for (chunk = scratch_chunks; chunk && chunk->used; chunk = chunk->next)
+		chunk->used = 0;
+	scratch_cur = scratch_chunks;
+	scratch_stats.used = 0;
+	scratch_stats.resets++;
+}
+
+void nm_scratch_get_stats(struct nm_scratch_stats *stats) {
+	*stats = scratch_stats;
+}
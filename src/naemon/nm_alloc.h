@@ -5,6 +5,8 @@
 #error "Only <naemon/naemon.h> can be included directly."
 #endif
 
+#include <stddef.h>
+
 void *nm_malloc(size_t size);
 void *nm_realloc(void *ptr, size_t size);
 void *nm_calloc(size_t count, size_t size);
@@ -12,4 +14,73 @@ void *nm_strdup(const char *s);
 void *nm_strndup(const char *s, size_t size);
 void nm_asprintf(char **strp, const char *fmt, ...);
 #define nm_free(ptr) do { if(ptr) { free(ptr); ptr = NULL; } } while(0)
+
+/*
+ * Slab caches hand out fixed-size objects carved from larger blocks
+ * and keep released objects on a free-list, so objects that come and
+ * go at a steady rate (check results, timed events, worker jobs) stop
+ * hitting malloc() once the cache has grown to its peak. Objects are
+ * zeroed on allocation and must be released with nm_slab_free() on
+ * the cache they came from, never with free(). Caches are not
+ * thread-safe; they belong to the main thread.
+ */
+struct nm_slab;
+struct nm_slab_cache {
+	const char *name;
+	size_t size;
+	void *free_list;
+	struct nm_slab *slabs;
+	struct nm_slab_cache *next; /* list of caches, for stats */
+	unsigned long in_use, peak, objects;
+	unsigned long long allocs;
+};
+
+/* static initializer for a cache of objects of type 'type' */
+#define NM_SLAB_CACHE_INIT(cache_name, type) { .name = cache_name, .size = sizeof(type) }
+
+void *nm_slab_alloc(struct nm_slab_cache *cache);
+void nm_slab_free(struct nm_slab_cache *cache, void *ptr);
+void nm_slab_cache_destroy(struct nm_slab_cache *cache);
+struct nm_slab_cache *nm_slab_caches(void);
+
+/*
+ * The scratch arena is a bump allocator for strings and buffers that
+ * only need to live until the current event loop iteration is done.
+ * Nothing allocated from it is ever freed on its own; all of it goes
+ * away at once when the event loop calls nm_scratch_reset(), so
+ * scratch memory must never be stored anywhere that outlives the
+ * event being handled.
+ *
+ * The arena is a plain global with no locking, and nothing but the
+ * event loop ever resets it. It's for code run by the event loop in
+ * the main thread only. Functions that modules or other threads may
+ * call, or that run before the loop starts, must not use it.
+ */
+void *nm_scratch_alloc(size_t size);
+char *nm_scratch_strdup(const char *s);
+char *nm_scratch_strndup(const char *s, size_t size);
+void nm_scratch_reset(void);
+
+struct nm_scratch_stats {
+	unsigned long long resets;
+	unsigned long long allocs;
+	size_t used, peak;   /* bytes handed out this iteration, and at most */
+	size_t reserved;     /* bytes held in chunks between iterations */
+};
+void nm_scratch_get_stats(struct nm_scratch_stats *stats);
+
+/*
+ * Allocation counting. While enabled, every call to the nm_* heap
+ * allocators above is counted, so the number of allocations per
+ * check result (or any other unit of work) can be measured on a
+ * running core. Enabling it resets the counters, disabling it keeps
+ * them around for inspection.
+ */
+struct nm_alloc_stats {
+	unsigned long long malloc, calloc, realloc, strdup, asprintf;
+};
+void nm_alloc_count(int enable);
+int nm_alloc_counting(void);
+unsigned long long nm_alloc_total(const struct nm_alloc_stats *stats);
+void nm_alloc_get_stats(struct nm_alloc_stats *stats);
 #endif
@@ -20,6 +20,8 @@ struct notification_job {
 	contact *ctc;
 };
 
+static void set_notification_recipients(nagios_macros *mac);
+
 /*** silly helpers ****/
 static contact *find_contact_by_name_or_alias(const char *name)
 {
@@ -291,7 +293,7 @@ int service_notification(service *svc, int type, char *not_author, char *not_dat
 		nm_free(mac.x[MACRO_SERVICEACKAUTHOR]);
 		nm_free(mac.x[MACRO_SERVICEACKCOMMENT]);
 
-		/* this gets set in add_notification() */
+		/* this gets set in create_notification_list_from_*() */
 		nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
 
 		/*
@@ -1021,6 +1023,8 @@ int create_notification_list_from_service(nagios_macros *mac, service *svc, int
 		}
 	}
 
+	set_notification_recipients(mac);
+
 	return OK;
 }
 
@@ -1193,7 +1197,7 @@ int host_notification(host *hst, int type, char *not_author, char *not_data, int
 		nm_free(mac.x[MACRO_HOSTACKAUTHORALIAS]);
 		nm_free(mac.x[MACRO_HOSTACKAUTHOR]);
 		nm_free(mac.x[MACRO_HOSTACKCOMMENT]);
-		/* this gets set in add_notification() */
+		/* this gets set in create_notification_list_from_*() */
 		nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
 
 		/*
@@ -1895,6 +1899,8 @@ int create_notification_list_from_host(nagios_macros *mac, host *hst, int option
 		}
 	}
 
+	set_notification_recipients(mac);
+
 	return OK;
 }
 
@@ -2026,6 +2032,49 @@ time_t get_next_host_notification_time(host *hst, time_t offset)
 /***************** NOTIFICATION OBJECT FUNCTIONS ******************/
 /******************************************************************/
 
+/*
+ * Contacts already on the notification list, indexed by contact->id.
+ * Escalations and overlapping contactgroups tend to name the same
+ * contacts over and over, so duplicate checks must not walk the list.
+ */
+static bitmap *notified_contacts;
+
+/* the NOTIFICATIONRECIPIENTS macro, built while the list is populated */
+static dbuf notification_recipients = { NULL, 0, 0, 256 };
+
+/* free a notification list that was created */
+void free_notification_list(void)
+{
+	notification *temp_notification = NULL;
+	notification *next_notification = NULL;
+
+	temp_notification = notification_list;
+	while (temp_notification != NULL) {
+		next_notification = temp_notification->next;
+		nm_free(temp_notification);
+		temp_notification = next_notification;
+	}
+
+	/* reset notification list pointer */
+	notification_list = NULL;
+
+	bitmap_clear(notified_contacts);
+	dbuf_free(&notification_recipients);
+
+	return;
+}
+
+
+/* hand the recipients gathered by add_notification() over to the macro */
+static void set_notification_recipients(nagios_macros *mac)
+{
+	nm_free(mac->x[MACRO_NOTIFICATIONRECIPIENTS]);
+	mac->x[MACRO_NOTIFICATIONRECIPIENTS] = notification_recipients.buf;
+	notification_recipients.buf = NULL;
+	dbuf_free(&notification_recipients);
+}
+
+
 /* given a contact name, find the notification entry for them for the list in memory */
 notification *find_notification(contact *cntct)
 {
@@ -2036,6 +2085,9 @@ notification *find_notification(contact *cntct)
 	if (cntct == NULL)
 		return NULL;
 
+	if (!bitmap_isset(notified_contacts, cntct->id))
+		return NULL;
+
 	for (temp_notification = notification_list; temp_notification != NULL; temp_notification = temp_notification->next) {
 		if (temp_notification->contact == cntct)
 			return temp_notification;
@@ -2046,11 +2098,14 @@ notification *find_notification(contact *cntct)
 }
 
 
-/* add a new notification to the list in memory */
+/*
+ * add a new notification to the list in memory.
+ * The recipient is appended to the NOTIFICATIONRECIPIENTS macro
+ * once the list is complete, in create_notification_list_from_*()
+ */
 int add_notification(nagios_macros *mac, contact *cntct)
 {
 	notification *new_notification = NULL;
-	notification *temp_notification = NULL;
 
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "add_notification() start\n");
 
@@ -2059,9 +2114,15 @@ int add_notification(nagios_macros *mac, contact *cntct)
 
 	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding contact '%s' to notification list.\n", cntct->name);
 
+	if (notified_contacts == NULL)
+		notified_contacts = bitmap_create(num_objects.contacts > cntct->id ? num_objects.contacts : cntct->id + 1);
+	else if (bitmap_cardinality(notified_contacts) <= cntct->id)
+		bitmap_resize(notified_contacts, cntct->id + 1);
+
 	/* don't add anything if this contact is already on the notification list */
-	if ((temp_notification = find_notification(cntct)) != NULL)
+	if (bitmap_isset(notified_contacts, cntct->id))
 		return OK;
+	bitmap_set(notified_contacts, cntct->id);
 
 	/* allocate memory for a new contact in the notification list */
 	new_notification = nm_malloc(sizeof(notification));
@@ -2073,14 +2134,10 @@ int add_notification(nagios_macros *mac, contact *cntct)
 	new_notification->next = notification_list;
 	notification_list = new_notification;
 
-	/* add contact to notification recipients macro */
-	if (mac->x[MACRO_NOTIFICATIONRECIPIENTS] == NULL)
-		mac->x[MACRO_NOTIFICATIONRECIPIENTS] = nm_strdup(cntct->name);
-	else {
-		mac->x[MACRO_NOTIFICATIONRECIPIENTS] = nm_realloc(mac->x[MACRO_NOTIFICATIONRECIPIENTS], strlen(mac->x[MACRO_NOTIFICATIONRECIPIENTS]) + strlen(cntct->name) + 2);
-		strcat(mac->x[MACRO_NOTIFICATIONRECIPIENTS], ",");
-		strcat(mac->x[MACRO_NOTIFICATIONRECIPIENTS], cntct->name);
-	}
+	/* add contact to notification recipients */
+	if (notification_recipients.used_size)
+		dbuf_strcat(&notification_recipients, ",");
+	dbuf_strcat(&notification_recipients, cntct->name);
 
 	return OK;
 }
@@ -781,6 +781,7 @@ servicesmember *add_service_link_to_host(host *hst, service *service_ptr)
 	new_servicesmember->next = hst->services;
 	hst->services = new_servicesmember;
 	hst->hourly_value += service_ptr->hourly_value;
+	service_ptr->host_link = new_servicesmember;
 
 	return new_servicesmember;
 }
@@ -1651,6 +1652,7 @@ servicedependency *add_service_dependency(char *dependent_host_name, char *depen
 
 	new_servicedependency->dependent_service_ptr = child;
 	new_servicedependency->master_service_ptr = parent;
+	parent->dependents++;
 	new_servicedependency->dependency_period_ptr = tp;
 
 	/* assign vars. object names are immutable, so no need to copy */
@@ -1718,6 +1720,7 @@ hostdependency *add_host_dependency(char *dependent_host_name, char *host_name,
 	new_hostdependency = nm_calloc(1, sizeof(*new_hostdependency));
 	new_hostdependency->dependent_host_ptr = child;
 	new_hostdependency->master_host_ptr = parent;
+	parent->dependents++;
 	new_hostdependency->dependency_period_ptr = tp;
 
 	/* assign vars. Objects are immutable, so no need to copy */
@@ -225,6 +225,14 @@ typedef struct objectlist {
 } objectlist;
 
 
+/* a remembered check_*_dependencies() result */
+struct dependency_result {
+	unsigned long epoch; /* dependency cache epoch it was worked out in, 0 if never */
+	time_t expires;      /* when a dependency period may change it, 0 if never */
+	int result;
+};
+
+
 /* TIMERANGE structure */
 typedef struct timerange {
 	unsigned long range_start;
@@ -483,6 +491,7 @@ struct host {
 	int     pending_flex_downtime;
 	int     state_history[MAX_STATE_HISTORY_ENTRIES];    /* flap detection */
 	int     state_history_index;
+	unsigned int state_history_changes; /* transitions in state_history, see flapping.c */
 	time_t  last_state_history_update;
 	int     is_flapping;
 	unsigned long flapping_comment_id;
@@ -500,6 +509,12 @@ struct host {
 	struct objectlist *escalation_list;
 	struct  host *next;
 	struct timed_event *next_check_event;
+	struct comment *comments; /* host comments, linked through nexthash */
+	int     num_comments;
+	time_t  freshness_deadline; /* when check results go stale, if check_freshness is set */
+	unsigned int freshness_pos; /* position in the freshness queue, 0 if not queued */
+	unsigned int dependents; /* number of dependencies on this object */
+	struct dependency_result dependency_cache[2]; /* notification and execution dependencies */
 };
 
 
@@ -604,6 +619,7 @@ struct service {
 	int     pending_flex_downtime;
 	int     state_history[MAX_STATE_HISTORY_ENTRIES];    /* flap detection */
 	int     state_history_index;
+	unsigned int state_history_changes; /* transitions in state_history, see flapping.c */
 	int     is_flapping;
 	unsigned long flapping_comment_id;
 	double  percent_state_change;
@@ -620,6 +636,13 @@ struct service {
 	struct objectlist *escalation_list;
 	struct service *next;
 	struct timed_event *next_check_event;
+	struct comment *comments; /* service comments, linked through nexthash */
+	int     num_comments;
+	time_t  freshness_deadline; /* when check results go stale, if check_freshness is set */
+	unsigned int freshness_pos; /* position in the freshness queue, 0 if not queued */
+	unsigned int dependents; /* number of dependencies on this object */
+	struct dependency_result dependency_cache[2]; /* notification and execution dependencies */
+	struct servicesmember *host_link; /* our entry in host_ptr->services */
 };
 
 
@@ -8,12 +8,18 @@
 #include "loadctl.h"
 #include "globals.h"
 #include "commands.h"
+#include "checks.h"
+#include "nebmods.h"
 #include "nm_alloc.h"
+#include "xpddefault.h"
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 /* A registered handler */
 struct query_handler {
@@ -106,103 +112,264 @@ void qh_error(int sd, int code, const char *fmt, ...)
 	free(msg);
 }
 
-static int qh_input(int sd, int events, void *ioc_)
+/*
+ * A connected client. Everything a handler writes to the client's
+ * socket while serving its request ends up in 'out' (see qh_output_hook())
+ * and is sent with as few writes as possible once the handler returns.
+ * Whatever the client isn't ready to receive stays there, and the
+ * socket is watched for writability instead of input until it has all
+ * been sent, so a client that doesn't read its responses only holds
+ * up itself, and never the core.
+ */
+struct qh_client {
+	int sd;
+	unsigned int flags;
+	iocache *in, *out;
+};
+#define QH_CLIENT_CLOSE  (1 << 0) /* close once all output is sent */
+#define QH_CLIENT_OUTPUT (1 << 1) /* waiting for the socket to be writable */
+
+/* accept at most this many connections per wakeup */
+#define QH_ACCEPT_BATCH 64
+/* requests are small, so start small and grow as needed */
+#define QH_INPUT_SIZE 1024
+#define QH_MAX_REQUEST (1024 * 1024)
+#define QH_OUTPUT_SIZE 4096
+/* try to send output while a handler is still producing it past this */
+#define QH_OUTPUT_FLUSH (64 * 1024)
+/* drop clients that leave more than this unread */
+#define QH_MAX_OUTPUT (16 * 1024 * 1024)
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+static fanout_table *qh_clients;
+static struct qh_client *qh_current; /* the client whose request is being handled */
+static unsigned int qh_blocked; /* clients waiting for their socket to become writable */
+
+static struct {
+	unsigned long long accepted, rejected, dropped;
+	unsigned long long requests, errors;
+	unsigned long long bytes_in, bytes_out;
+	unsigned long long output_queued;
+	unsigned long long latency_usec;
+	unsigned long latency_max_usec;
+	unsigned int accept_batch_max;
+} qh_stats;
+
+static int qh_input(int sd, int events, void *arg);
+static int qh_output(int sd, int events, void *arg);
+
+static void qh_client_free(void *arg)
 {
-	iocache *ioc = (iocache *)ioc_;
-
-	/* input on main socket, so accept one */
-	if (sd == qh_listen_sock) {
-		struct sockaddr sa;
-		socklen_t slen = 0;
-		int nsd;
-
-		memset(&sa, 0, sizeof(sa)); /* shut valgrind up */
-		nsd = accept(sd, &sa, &slen);
-		if (qh_max_running && qh_running >= qh_max_running) {
-			nsock_printf(nsd, "503: Server full");
-			close(nsd);
-			return 0;
-		}
+	struct qh_client *c = (struct qh_client *)arg;
 
-		if (!(ioc = iocache_create(16384))) {
-			nm_log(NSLOG_RUNTIME_ERROR, "qh: Failed to create iocache for inbound request\n");
-			nsock_printf(nsd, "500: Internal server error");
-			close(nsd);
-			return 0;
-		}
+	iocache_destroy(c->in);
+	iocache_destroy(c->out);
+	free(c);
+}
 
-		/*
-		 * @todo: Stash the iocache and the socket in some
-		 * addressable list so we can release them on deinit
-		 */
-		if (iobroker_register(nagios_iobs, nsd, ioc, qh_input) < 0) {
-			nm_log(NSLOG_RUNTIME_ERROR, "qh: Failed to register input socket %d with I/O broker: %s\n", nsd, strerror(errno));
-			iocache_destroy(ioc);
-			close(nsd);
-			return 0;
-		}
+static void qh_client_destroy(struct qh_client *c)
+{
+	fanout_remove(qh_clients, c->sd);
+	if (c->flags & QH_CLIENT_OUTPUT)
+		qh_blocked--;
+	qh_client_free(c);
+	qh_running--;
+}
 
-		/* make it non-blocking, but leave kernel buffers unchanged */
-		worker_set_sockopts(nsd, 0);
-		qh_running++;
+static void qh_client_close(struct qh_client *c)
+{
+	iobroker_close(nagios_iobs, c->sd);
+	qh_client_destroy(c);
+}
+
+static int qh_client_queue(struct qh_client *c, const void *buf, size_t len)
+{
+	unsigned long size;
+
+	if (!c->out && !(c->out = iocache_create(QH_OUTPUT_SIZE)))
+		return -1;
+
+	if (iocache_capacity(c->out) < len) {
+		for (size = iocache_size(c->out) * 2; size - iocache_available(c->out) < len; size *= 2)
+			; /* empty loop */
+		if (iocache_resize(c->out, size) < 0)
+			return -1;
+	}
+
+	return iocache_add(c->out, (char *)buf, len);
+}
+
+/* send as much as the socket will take without blocking */
+static int qh_client_send(struct qh_client *c)
+{
+	int ret;
+
+	if (!iocache_available(c->out))
 		return 0;
+
+	ret = iocache_send(c->out, c->sd, NULL, 0, MSG_NOSIGNAL);
+	if (ret < 0)
+		return ret;
+
+	qh_stats.bytes_out += ret;
+	return iocache_available(c->out) ? 1 : 0;
+}
+
+/* listen for input or for writability, but never both at once */
+static int qh_client_watch(struct qh_client *c, int output)
+{
+	int ret;
+
+	iobroker_unregister(nagios_iobs, c->sd);
+	if (output) {
+		ret = iobroker_register_out(nagios_iobs, c->sd, c, qh_output);
+		c->flags |= QH_CLIENT_OUTPUT;
+		qh_blocked++;
 	} else {
-		int result;
-		unsigned long len;
-		unsigned int query_len = 0;
-		char *buf, *space;
-		struct query_handler *qh;
-		char *handler = NULL, *query = NULL;
-
-		result = iocache_read(ioc, sd);
-		/* disconnect? */
-		if (result == 0 || (result < 0 && errno == EPIPE)) {
-			iocache_destroy(ioc);
-			iobroker_close(nagios_iobs, sd);
-			qh_running--;
-			return 0;
-		}
+		ret = iobroker_register(nagios_iobs, c->sd, c, qh_input);
+		c->flags &= ~QH_CLIENT_OUTPUT;
+		qh_blocked--;
+	}
+	if (ret < 0) {
+		nm_log(NSLOG_RUNTIME_ERROR, "qh: Failed to register socket %d with I/O broker: %s\n",
+		       c->sd, iobroker_strerror(ret));
+	}
+	return ret;
+}
 
-		/*
-		 * A request looks like this: '[@|#]<qh>[<SP>][<query>]\0'.
-		 * That is, optional '#' (oneshot) or '@' (keepalive),
-		 * followed by the name of a registered handler, followed by
-		 * an optional space and an optional query. If the handler
-		 * has no "default" handler, a query is required or an error
-		 * will be thrown.
-		 */
-
-		/* Use data up to the first nul byte */
-		buf = iocache_use_delim(ioc, "\0", 1, &len);
-		if (!buf)
-			return 0;
+/*
+ * Send pending output and pick what to wait for next.
+ * Returns -1 if the client is gone once we're done.
+ */
+static int qh_client_update(struct qh_client *c)
+{
+	int pending = qh_client_send(c);
 
-		/* Identify handler part and any magic query bytes */
-		if (*buf == '@' || *buf == '#') {
-			handler = buf + 1;
-		} else {
-			handler = buf;
-		}
+	if (pending < 0) {
+		qh_client_close(c);
+		return -1;
+	}
 
-		/* Locate query (if any) */
-		if ((space = strchr(buf, ' '))) {
-			*space = 0;
-			query = space + 1;
-			query_len = len - ((unsigned long)query - (unsigned long)buf);
-		} else {
-			query = "";
-			query_len = 0;
+	if (!pending) {
+		if (c->flags & QH_CLIENT_CLOSE) {
+			qh_client_close(c);
+			return -1;
+		}
+		/* don't hang on to the buffer for one huge response */
+		if (iocache_size(c->out) > QH_OUTPUT_SIZE * 16) {
+			iocache_destroy(c->out);
+			c->out = NULL;
+		}
+		if ((c->flags & QH_CLIENT_OUTPUT) && qh_client_watch(c, 0) < 0) {
+			qh_client_close(c);
+			return -1;
 		}
+		return 0;
+	}
 
-		/* locate the handler */
-		if (!(qh = qh_find_handler(handler))) {
-			/* not found. that's a 404 */
-			nsock_printf(sd, "404: %s: No such handler", handler);
-			iobroker_close(nagios_iobs, sd);
-			iocache_destroy(ioc);
-			return 0;
+	if (iocache_available(c->out) > QH_MAX_OUTPUT) {
+		nm_log(NSLOG_RUNTIME_WARNING, "qh: Dropping client on socket %d, which left %lu bytes unread\n",
+		       c->sd, iocache_available(c->out));
+		qh_stats.dropped++;
+		qh_client_close(c);
+		return -1;
+	}
+
+	if (!(c->flags & QH_CLIENT_OUTPUT)) {
+		qh_stats.output_queued++;
+		if (qh_client_watch(c, 1) < 0) {
+			qh_client_close(c);
+			return -1;
 		}
+	}
+	return 0;
+}
+
+static int qh_output_hook(int sd, const void *buf, size_t len)
+{
+	struct qh_client *c = qh_current;
+
+	if (!c || c->sd != sd)
+		return -1;
 
+	if (qh_client_queue(c, buf, len) < 0)
+		return -1;
+
+	/* keep memory use in check for handlers with lots to say */
+	if (iocache_available(c->out) >= QH_OUTPUT_FLUSH)
+		qh_client_send(c);
+
+	return 0;
+}
+
+/*
+ * A handler taking over the socket registers its own input handler
+ * for it, so we can't wait for it to become writable. Whatever it
+ * said before taking over is still short, so just send it the old
+ * way and forget about the client.
+ */
+static void qh_client_release(struct qh_client *c)
+{
+	unsigned long len = iocache_available(c->out);
+
+	if (len) {
+		nsock_write_all(c->sd, iocache_use_size(c->out, len), len);
+		qh_stats.bytes_out += len;
+	}
+	qh_client_destroy(c);
+}
+
+/*
+ * Handle a single request. A request looks like this:
+ * '[@|#]<qh>[<SP>][<query>]\0'.
+ * That is, optional '#' (oneshot) or '@' (keepalive), followed by
+ * the name of a registered handler, followed by an optional space
+ * and an optional query. If the handler has no "default" handler,
+ * a query is required or an error will be thrown.
+ *
+ * Returns -1 if the client is gone once we're done.
+ */
+static int qh_request(struct qh_client *c, char *buf, unsigned long len)
+{
+	struct timeval start, stop;
+	long usecs;
+	unsigned int query_len = 0;
+	char *space, *handler, *query;
+	struct query_handler *qh;
+	int result, sd = c->sd;
+
+	gettimeofday(&start, NULL);
+	qh_stats.requests++;
+	qh_stats.bytes_in += len + 1;
+
+	/* Identify handler part and any magic query bytes */
+	if (*buf == '@' || *buf == '#') {
+		handler = buf + 1;
+	} else {
+		handler = buf;
+	}
+
+	/* Locate query (if any) */
+	if ((space = strchr(buf, ' '))) {
+		*space = 0;
+		query = space + 1;
+		query_len = len - ((unsigned long)query - (unsigned long)buf);
+	} else {
+		query = "";
+		query_len = 0;
+	}
+
+	qh_current = c;
+
+	/* locate the handler */
+	if (!(qh = qh_find_handler(handler))) {
+		/* not found. that's a 404 */
+		nsock_printf(sd, "404: %s: No such handler", handler);
+		result = 404;
+	} else {
 		/* strip trailing newlines */
 		while (query_len > 0 && (query[query_len - 1] == 0 || query[query_len - 1] == '\n'))
 			query[--query_len] = 0;
@@ -211,26 +378,169 @@ static int qh_input(int sd, int events, void *ioc_)
 		if ((result = qh->handler(sd, query, query_len)) >= 100) {
 			nsock_printf_nul(sd, "%d: %s", result, qh_strerror(result));
 		}
+	}
 
-		if (result >= 300 || *buf != '@') {
-			/* error code or one-shot query */
-			iobroker_close(nagios_iobs, sd);
-			iocache_destroy(ioc);
-			return 0;
-		}
+	qh_current = NULL;
+
+	if (result >= 300 || result == -1)
+		qh_stats.errors++;
 
+	if (result >= 300 || *buf != '@') {
+		/* error code or one-shot query */
+		c->flags |= QH_CLIENT_CLOSE;
+	} else {
 		/* check for magic handler codes */
 		switch (result) {
 		case QH_CLOSE: /* oneshot handler */
 		case -1:       /* general error */
-			iobroker_close(nagios_iobs, sd);
-			/* fallthrough */
+			c->flags |= QH_CLIENT_CLOSE;
+			break;
 		case QH_TAKEOVER: /* handler takes over */
 		case 101:         /* switch protocol (takeover + message) */
-			iocache_destroy(ioc);
+			qh_client_release(c);
+			c = NULL;
+			break;
+		}
+	}
+
+	if (c)
+		result = qh_client_update(c);
+	else
+		result = -1;
+
+	gettimeofday(&stop, NULL);
+	usecs = (stop.tv_sec - start.tv_sec) * 1000000L + (stop.tv_usec - start.tv_usec);
+	if (usecs < 0)
+		usecs = 0; /* clock went backwards */
+	qh_stats.latency_usec += usecs;
+	if ((unsigned long)usecs > qh_stats.latency_max_usec)
+		qh_stats.latency_max_usec = usecs;
+
+	return result;
+}
+
+/* handle all complete requests we have, until we have to wait for output */
+static void qh_client_process(struct qh_client *c)
+{
+	unsigned long len;
+	char *buf;
+
+	while (!(c->flags & (QH_CLIENT_CLOSE | QH_CLIENT_OUTPUT))) {
+		if (!(buf = iocache_use_delim(c->in, "\0", 1, &len)))
+			return;
+		if (qh_request(c, buf, len) < 0)
+			return;
+	}
+}
+
+static int qh_output(int sd, int events, void *arg)
+{
+	struct qh_client *c = (struct qh_client *)arg;
+
+	if (qh_client_update(c) < 0)
+		return 0;
+
+	/* all sent, so go on with anything else the client asked for */
+	qh_client_process(c);
+	return 0;
+}
+
+static int qh_input(int sd, int events, void *arg)
+{
+	struct qh_client *c = (struct qh_client *)arg;
+	int result;
+
+	/* make room for large requests, but not for arbitrarily large ones */
+	if (!iocache_capacity(c->in)) {
+		if (iocache_size(c->in) >= QH_MAX_REQUEST || iocache_grow(c->in, iocache_size(c->in)) < 0) {
+			nsock_write_all(sd, "413: Request too large", 23);
+			qh_stats.errors++;
+			qh_client_close(c);
+			return 0;
+		}
+	}
+
+	result = iocache_read(c->in, sd);
+	/* disconnect? */
+	if (result == 0 || (result < 0 && errno != EAGAIN && errno != EINTR)) {
+		qh_client_close(c);
+		return 0;
+	}
+
+	qh_client_process(c);
+	return 0;
+}
+
+static void qh_accept_one(int nsd)
+{
+	struct qh_client *c;
+
+	if (qh_max_running && qh_running >= qh_max_running) {
+		qh_stats.rejected++;
+		nsock_printf(nsd, "503: Server full");
+		close(nsd);
+		return;
+	}
+
+	/*
+	 * A handler that closed one of our clients behind our back
+	 * leaves the client lingering here until its descriptor is
+	 * reused, so get rid of it now.
+	 */
+	if ((c = fanout_get(qh_clients, nsd)))
+		qh_client_destroy(c);
+
+	c = nm_calloc(1, sizeof(*c));
+	c->sd = nsd;
+	if (!(c->in = iocache_create(QH_INPUT_SIZE))) {
+		nm_log(NSLOG_RUNTIME_ERROR, "qh: Failed to create iocache for inbound request\n");
+		nsock_printf(nsd, "500: Internal server error");
+		close(nsd);
+		free(c);
+		return;
+	}
+
+	if (iobroker_register(nagios_iobs, nsd, c, qh_input) < 0) {
+		nm_log(NSLOG_RUNTIME_ERROR, "qh: Failed to register input socket %d with I/O broker: %s\n", nsd, strerror(errno));
+		iocache_destroy(c->in);
+		close(nsd);
+		free(c);
+		return;
+	}
+
+	fanout_add(qh_clients, nsd, c);
+	qh_stats.accepted++;
+	qh_running++;
+}
+
+/* input on main socket, so accept everyone who's waiting */
+static int qh_accept(int sd, int events, void *arg)
+{
+	unsigned int i;
+	int nsd;
+
+	for (i = 0; i < QH_ACCEPT_BATCH; i++) {
+#ifdef SOCK_NONBLOCK
+		nsd = accept4(sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		nsd = accept(sd, NULL, NULL);
+		/* make it non-blocking, but leave kernel buffers unchanged */
+		if (nsd >= 0)
+			worker_set_sockopts(nsd, 0);
+#endif
+		if (nsd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				nm_log(NSLOG_RUNTIME_ERROR, "qh: Failed to accept connection: %s\n", strerror(errno));
 			break;
 		}
+		qh_accept_one(nsd);
 	}
+
+	if (i > qh_stats.accept_batch_max)
+		qh_stats.accept_batch_max = i;
+
 	return 0;
 }
 
@@ -312,6 +622,17 @@ void qh_deinit(const char *path)
 	qh_table = NULL;
 	qhandlers = NULL;
 
+	/*
+	 * Clients stay connected across restarts, but not across
+	 * shutdowns. Their sockets are closed along with the I/O broker.
+	 */
+	if (sigshutdown == TRUE) {
+		fanout_destroy(qh_clients, qh_client_free);
+		qh_clients = NULL;
+		qh_running = qh_blocked = 0;
+		nsock_set_output_hook(NULL);
+	}
+
 	if (!path)
 		return;
 
@@ -374,6 +695,35 @@ static int qh_command(int sd, char *buf, unsigned int len)
 	return 404;
 }
 
+/* check results allocated before allocation counting was last enabled */
+static unsigned long long alloc_count_base;
+
+static int dump_alloc_stats(int sd)
+{
+	struct nm_alloc_stats as;
+	struct nm_scratch_stats ss;
+	struct nm_slab_cache *cache;
+	unsigned long long allocs, results;
+
+	nm_alloc_get_stats(&as);
+	nm_scratch_get_stats(&ss);
+	allocs = nm_alloc_total(&as);
+	results = check_result_cache.allocs - alloc_count_base;
+
+	nsock_printf(sd, "counting=%d;malloc=%llu;calloc=%llu;realloc=%llu;strdup=%llu;asprintf=%llu;"
+	             "check_results=%llu;allocs_per_check_result=%.2f;",
+	             nm_alloc_counting(), as.malloc, as.calloc, as.realloc, as.strdup, as.asprintf,
+	             results, results ? (double)allocs / results : 0.0);
+	for (cache = nm_slab_caches(); cache; cache = cache->next) {
+		nsock_printf(sd, "%s_in_use=%lu;%s_peak=%lu;%s_objects=%lu;%s_allocs=%llu;",
+		             cache->name, cache->in_use, cache->name, cache->peak,
+		             cache->name, cache->objects, cache->name, cache->allocs);
+	}
+	nsock_printf_nul(sd, "scratch_allocs=%llu;scratch_resets=%llu;scratch_peak=%lu;scratch_reserved=%lu;",
+	                 ss.allocs, ss.resets, (unsigned long)ss.peak, (unsigned long)ss.reserved);
+	return 0;
+}
+
 static int qh_core(int sd, char *buf, unsigned int len)
 {
 	char *space;
@@ -386,6 +736,16 @@ static int qh_core(int sd, char *buf, unsigned int len)
 		                 "                    The options are the same parameters and format as\n"
 		                 "                    returned above.\n"
 		                 "  squeuestats       scheduling queue statistics\n"
+		                 "  freshness         Print how many hosts and services the last\n"
+		                 "                    freshness sweeps evaluated and found stale\n"
+		                 "  allocstats        Print slab cache and scratch arena usage, and\n"
+		                 "                    allocation counts while counting is enabled\n"
+		                 "  allocstats <start|stop>\n"
+		                 "                    Start (and reset) or stop counting allocations\n"
+		                 "  qhstats           Print query handler connection, request and\n"
+		                 "                    latency statistics\n"
+		                 "  perfdatastats     Print how often and for how long the perfdata\n"
+		                 "                    file processing commands ran\n"
 		                );
 		return 0;
 	}
@@ -396,28 +756,79 @@ static int qh_core(int sd, char *buf, unsigned int len)
 		(sd, "jobs_max=%u;jobs_min=%u;"
 		 "jobs_running=%u;jobs_limit=%u;"
 		 "load=%.2f;"
+		 "cpu_pressure=%.2f;memory_pressure=%.2f;"
+		 "pressure_limit=%.2f;rampup_pressure=%.2f;"
+		 "latency=%.1f;latency_limit=%u;backoff_factor=%.2f;"
 		 "backoff_limit=%.2f;backoff_change=%u;"
 		 "rampup_limit=%.2f;rampup_change=%u;"
 		 "nproc_limit=%u;nofile_limit=%u;"
-		 "options=%u;changes=%u;",
+		 "check_interval=%lu;last_check=%lu;last_change=%lu;"
+		 "options=%u;changes=%u;backoffs=%u;decision=%s;",
 		 loadctl.jobs_max, loadctl.jobs_min,
 		 loadctl.jobs_running, loadctl.jobs_limit,
 		 loadctl.load[0],
+		 loadctl.pressure[0], loadctl.pressure[1],
+		 loadctl.pressure_limit, loadctl.rampup_pressure,
+		 loadctl.latency, loadctl.latency_limit, loadctl.backoff_factor,
 		 loadctl.backoff_limit, loadctl.backoff_change,
 		 loadctl.rampup_limit, loadctl.rampup_change,
 		 loadctl.nproc_limit, loadctl.nofile_limit,
-		 loadctl.options, loadctl.changes);
+		 (unsigned long)loadctl.check_interval, (unsigned long)loadctl.last_check,
+		 (unsigned long)loadctl.last_change,
+		 loadctl.options, loadctl.changes, loadctl.backoffs, loadctl.decision);
 		return 0;
 	}
 
 	if (!space && !strcmp(buf, "squeuestats"))
 		return dump_event_stats(sd);
 
+	if (!space && !strcmp(buf, "allocstats"))
+		return dump_alloc_stats(sd);
+
+	if (!space && !strcmp(buf, "perfdatastats"))
+		return xpddefault_dump_processing_stats(sd);
+
+	if (!space && !strcmp(buf, "qhstats")) {
+		nsock_printf_nul
+		(sd, "clients=%u;clients_blocked=%u;accepted=%llu;rejected=%llu;dropped=%llu;"
+		 "accept_batch_max=%u;requests=%llu;errors=%llu;bytes_in=%llu;bytes_out=%llu;"
+		 "output_queued=%llu;latency_avg_usec=%.1f;latency_max_usec=%lu;",
+		 qh_running, qh_blocked, qh_stats.accepted, qh_stats.rejected, qh_stats.dropped,
+		 qh_stats.accept_batch_max, qh_stats.requests, qh_stats.errors,
+		 qh_stats.bytes_in, qh_stats.bytes_out, qh_stats.output_queued,
+		 qh_stats.requests ? (double)qh_stats.latency_usec / qh_stats.requests : 0.0,
+		 qh_stats.latency_max_usec);
+		return 0;
+	}
+
+	if (!space && !strcmp(buf, "freshness")) {
+		nsock_printf_nul
+		(sd, "services_queued=%u;services_evaluated=%u;services_stale=%u;"
+		 "hosts_queued=%u;hosts_evaluated=%u;hosts_stale=%u;",
+		 freshness_queue_size(TRUE), freshness_stats.services_evaluated,
+		 freshness_stats.services_stale,
+		 freshness_queue_size(FALSE), freshness_stats.hosts_evaluated,
+		 freshness_stats.hosts_stale);
+		return 0;
+	}
+
 	if (space) {
 		len -= (unsigned long)space - (unsigned long)buf;
 		if (!strcmp(buf, "loadctl")) {
 			return set_loadctl_options(space, len) == OK ? 200 : 400;
 		}
+		if (!strcmp(buf, "allocstats")) {
+			if (!strcmp(space, "start")) {
+				alloc_count_base = check_result_cache.allocs;
+				nm_alloc_count(TRUE);
+				return 200;
+			}
+			if (!strcmp(space, "stop")) {
+				nm_alloc_count(FALSE);
+				return 200;
+			}
+			return 400;
+		}
 	}
 
 	/* No matching command found */
@@ -456,8 +867,17 @@ int qh_init(const char *path)
 		return ERROR;
 	}
 
+	/* clients stay connected across restarts, so this may exist already */
+	if (!qh_clients && !(qh_clients = fanout_create(128))) {
+		nm_log(NSLOG_RUNTIME_ERROR, "qh: Failed to create client table\n");
+		dkhash_destroy(qh_table);
+		close(qh_listen_sock);
+		return ERROR;
+	}
+	nsock_set_output_hook(qh_output_hook);
+
 	errno = 0;
-	result = iobroker_register(nagios_iobs, qh_listen_sock, NULL, qh_input);
+	result = iobroker_register(nagios_iobs, qh_listen_sock, NULL, qh_accept);
 	if (result < 0) {
 		dkhash_destroy(qh_table);
 		close(qh_listen_sock);
@@ -473,6 +893,9 @@ int qh_init(const char *path)
 	qh_register_handler("command", "Naemon external commands interface", 0, qh_command);
 	qh_register_handler("echo", "The Echo Service - What You Put Is What You Get", 0, qh_echo);
 	qh_register_handler("help", "Help for the query handler", 0, qh_help);
+#ifdef USE_EVENT_BROKER
+	qh_register_handler("neb", "Event broker module callback statistics", 0, neb_qh_handler);
+#endif
 
 	return 0;
 }
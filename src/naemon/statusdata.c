@@ -4,6 +4,379 @@
 #include "statusdata.h"
 #include "xsddefault.h"
 #include "broker.h"
+#include "globals.h"
+#include "logging.h"
+#include "utils.h"
+#include "query-handler.h"
+#include "nm_alloc.h"
+#include "lib/libnaemon.h"
+#include <string.h>
+
+
+/******************************************************************/
+/********************* STATUS AGGREGATES **************************/
+/******************************************************************/
+
+/*
+ * Running totals of what naemonstats otherwise works out by reading
+ * all of status.dat: state counts, latency, execution time and state
+ * change, and how many objects were checked recently. Each status
+ * update takes out what the object added the last time it was seen
+ * and adds what it looks like now, so keeping them costs the same
+ * for every check result no matter how many objects there are.
+ *
+ * Counts and sums are exact. A min or max can't be taken back out,
+ * so when the object holding one changes we only note that it has
+ * to be looked for again, which the next query does.
+ */
+
+#define STATS_WINDOW 3600 /* longest "checked in the last N seconds" we report */
+
+/* what an object adds to the aggregates */
+struct stats_entry {
+	char valid;
+	char active;         /* check_type is CHECK_TYPE_ACTIVE */
+	char flapping;
+	char downtime;       /* scheduled_downtime_depth > 0 */
+	char checked;
+	char scheduled;
+	int state;
+	double latency;
+	double execution_time;
+	double state_change;
+	time_t last_check;   /* 0 unless it's counted in the checked ring */
+};
+
+/* count, sum, min and max of one value */
+struct stats_value {
+	unsigned int count;
+	double sum, min, max;
+};
+
+/* how many objects were last checked in each of the past STATS_WINDOW seconds */
+struct stats_ring {
+	time_t when[STATS_WINDOW + 1];
+	unsigned int count[STATS_WINDOW + 1];
+};
+
+struct stats_check_type {
+	unsigned int count;
+	struct stats_value latency, execution_time, state_change;
+	struct stats_ring checked;
+};
+
+struct stats_class {
+	struct stats_entry *entry; /* indexed by object id */
+	unsigned int size;
+	unsigned int entries, checked, scheduled, flapping, in_downtime;
+	unsigned int state[4];
+	struct stats_value state_change;
+	struct stats_check_type type[2]; /* indexed by stats_entry.active */
+	int stale; /* some min or max may be gone */
+};
+
+static struct stats_class *host_stats, *service_stats;
+
+static const char *check_stats_names[MAX_CHECK_STATS_TYPES] = {
+	"active_scheduled_service_check_stats",
+	"active_ondemand_service_check_stats",
+	"passive_service_check_stats",
+	"active_scheduled_host_check_stats",
+	"active_ondemand_host_check_stats",
+	"passive_host_check_stats",
+	"cached_host_check_stats",
+	"cached_service_check_stats",
+	"external_command_stats",
+	"parallel_host_check_stats",
+	"serial_host_check_stats",
+};
+
+static void stats_value_add(struct stats_value *v, double x)
+{
+	if (!v->count++ || x < v->min)
+		v->min = x;
+	if (v->count == 1 || x > v->max)
+		v->max = x;
+	v->sum += x;
+}
+
+static void stats_value_remove(struct stats_class *sc, struct stats_value *v, double x)
+{
+	if (!--v->count) {
+		v->sum = v->min = v->max = 0.0;
+		return;
+	}
+	v->sum -= x;
+	if (x <= v->min || x >= v->max)
+		sc->stale = TRUE;
+}
+
+/* returns the time the entry is counted under, 0 if it isn't */
+static time_t stats_ring_add(struct stats_ring *r, time_t when, time_t now)
+{
+	unsigned int slot;
+
+	if (when <= 0 || when > now || now - when > STATS_WINDOW)
+		return 0;
+	slot = when % (STATS_WINDOW + 1);
+	if (r->when[slot] != when) {
+		/* whatever was here is more than STATS_WINDOW seconds old */
+		r->when[slot] = when;
+		r->count[slot] = 0;
+	}
+	r->count[slot]++;
+	return when;
+}
+
+static void stats_ring_remove(struct stats_ring *r, time_t when)
+{
+	unsigned int slot = when % (STATS_WINDOW + 1);
+
+	if (when && r->when[slot] == when && r->count[slot])
+		r->count[slot]--;
+}
+
+/* counts the entries checked at most 1, 5, 15 and 60 minutes ago */
+static void stats_ring_count(struct stats_ring *r, time_t now, unsigned int counts[4])
+{
+	static const unsigned int ages[4] = { 60, 300, 900, 3600 };
+	unsigned int age, sum = 0, i = 0;
+
+	for (age = 0; age <= STATS_WINDOW; age++) {
+		unsigned int slot = (now - age) % (STATS_WINDOW + 1);
+		if (r->when[slot] == now - (time_t)age)
+			sum += r->count[slot];
+		while (i < 4 && ages[i] == age)
+			counts[i++] = sum;
+	}
+}
+
+static void stats_add(struct stats_class *sc, struct stats_entry *e, time_t now)
+{
+	struct stats_check_type *t = &sc->type[(int)e->active];
+
+	sc->entries++;
+	sc->checked += e->checked;
+	sc->scheduled += e->scheduled;
+	sc->flapping += e->flapping;
+	sc->in_downtime += e->downtime;
+	if (e->state >= 0 && e->state < 4)
+		sc->state[e->state]++;
+	stats_value_add(&sc->state_change, e->state_change);
+	t->count++;
+	stats_value_add(&t->latency, e->latency);
+	stats_value_add(&t->execution_time, e->execution_time);
+	stats_value_add(&t->state_change, e->state_change);
+	e->last_check = stats_ring_add(&t->checked, e->last_check, now);
+}
+
+static void stats_remove(struct stats_class *sc, struct stats_entry *e)
+{
+	struct stats_check_type *t = &sc->type[(int)e->active];
+
+	sc->entries--;
+	sc->checked -= e->checked;
+	sc->scheduled -= e->scheduled;
+	sc->flapping -= e->flapping;
+	sc->in_downtime -= e->downtime;
+	if (e->state >= 0 && e->state < 4)
+		sc->state[e->state]--;
+	stats_value_remove(sc, &sc->state_change, e->state_change);
+	t->count--;
+	stats_value_remove(sc, &t->latency, e->latency);
+	stats_value_remove(sc, &t->execution_time, e->execution_time);
+	stats_value_remove(sc, &t->state_change, e->state_change);
+	stats_ring_remove(&t->checked, e->last_check);
+}
+
+static void stats_update(struct stats_class *sc, unsigned int id, struct stats_entry *e)
+{
+	if (sc == NULL || id >= sc->size)
+		return;
+	if (sc->entry[id].valid)
+		stats_remove(sc, &sc->entry[id]);
+	e->valid = TRUE;
+	stats_add(sc, e, time(NULL));
+	sc->entry[id] = *e;
+}
+
+static void update_host_stats(host *hst)
+{
+	struct stats_entry e;
+
+	e.active = hst->check_type == CHECK_TYPE_ACTIVE;
+	e.flapping = hst->is_flapping > 0;
+	e.downtime = hst->scheduled_downtime_depth > 0;
+	e.checked = hst->has_been_checked > 0;
+	e.scheduled = hst->should_be_scheduled > 0;
+	e.state = hst->current_state;
+	e.latency = hst->latency;
+	e.execution_time = hst->execution_time;
+	e.state_change = hst->percent_state_change;
+	e.last_check = hst->last_check;
+	stats_update(host_stats, hst->id, &e);
+}
+
+static void update_service_stats(service *svc)
+{
+	struct stats_entry e;
+
+	e.active = svc->check_type == CHECK_TYPE_ACTIVE;
+	e.flapping = svc->is_flapping > 0;
+	e.downtime = svc->scheduled_downtime_depth > 0;
+	e.checked = svc->has_been_checked > 0;
+	e.scheduled = svc->should_be_scheduled > 0;
+	e.state = svc->current_state;
+	e.latency = svc->latency;
+	e.execution_time = svc->execution_time;
+	e.state_change = svc->percent_state_change;
+	e.last_check = svc->last_check;
+	stats_update(service_stats, svc->id, &e);
+}
+
+/* finds the min and max again, and the sums while we're at it */
+static void stats_rescan(struct stats_class *sc)
+{
+	unsigned int i;
+
+	memset(&sc->state_change, 0, sizeof(sc->state_change));
+	for (i = 0; i < 2; i++) {
+		memset(&sc->type[i].latency, 0, sizeof(sc->type[i].latency));
+		memset(&sc->type[i].execution_time, 0, sizeof(sc->type[i].execution_time));
+		memset(&sc->type[i].state_change, 0, sizeof(sc->type[i].state_change));
+	}
+	for (i = 0; i < sc->size; i++) {
+		struct stats_entry *e = &sc->entry[i];
+		struct stats_check_type *t = &sc->type[(int)e->active];
+		if (!e->valid)
+			continue;
+		stats_value_add(&sc->state_change, e->state_change);
+		stats_value_add(&t->latency, e->latency);
+		stats_value_add(&t->execution_time, e->execution_time);
+		stats_value_add(&t->state_change, e->state_change);
+	}
+	sc->stale = FALSE;
+}
+
+static void stats_print_value(int sd, const char *prefix, const char *name, struct stats_value *v)
+{
+	nsock_printf(sd, "min_%s_%s=%f\nmax_%s_%s=%f\naverage_%s_%s=%f\n",
+	             prefix, name, v->min, prefix, name, v->max,
+	             prefix, name, v->count ? v->sum / v->count : 0.0);
+}
+
+static void stats_print_class(int sd, struct stats_class *sc, time_t now, const char *noun, const char *states[4])
+{
+	static const char *types[2] = { "passive", "active" };
+	unsigned int counts[4];
+	char prefix[32];
+	int i;
+
+	if (sc->stale)
+		stats_rescan(sc);
+
+	nsock_printf(sd, "status_%s_entries=%u\n%ss_checked=%u\n%ss_scheduled=%u\n"
+	             "%ss_flapping=%u\n%ss_in_downtime=%u\n",
+	             noun, sc->entries, noun, sc->checked, noun, sc->scheduled,
+	             noun, sc->flapping, noun, sc->in_downtime);
+	for (i = 0; i < 4; i++) {
+		if (states[i])
+			nsock_printf(sd, "%ss_%s=%u\n", noun, states[i], sc->state[i]);
+	}
+	stats_print_value(sd, noun, "state_change", &sc->state_change);
+	for (i = 0; i < 2; i++) {
+		struct stats_check_type *t = &sc->type[i];
+		snprintf(prefix, sizeof(prefix), "%s_%s", types[i], noun);
+		nsock_printf(sd, "%s_checks=%u\n", prefix, t->count);
+		stats_print_value(sd, prefix, "latency", &t->latency);
+		/* passive checks have nothing to execute */
+		if (i)
+			stats_print_value(sd, prefix, "execution_time", &t->execution_time);
+		stats_print_value(sd, prefix, "state_change", &t->state_change);
+		stats_ring_count(&t->checked, now, counts);
+		nsock_printf(sd, "%s_%ss_checked_last_1min=%u\n%s_%ss_checked_last_5min=%u\n"
+		             "%s_%ss_checked_last_15min=%u\n%s_%ss_checked_last_1hour=%u\n",
+		             types[i], noun, counts[0], types[i], noun, counts[1],
+		             types[i], noun, counts[2], types[i], noun, counts[3]);
+	}
+}
+
+static int stats_qh_handler(int sd, char *buf, unsigned int len)
+{
+	static const char *host_states[4] = { "up", "down", "unreachable", NULL };
+	static const char *service_states[4] = { "ok", "warning", "critical", "unknown" };
+	time_t now;
+	int i;
+
+	if (!strcmp(buf, "help")) {
+		nsock_printf_nul(sd, "Host and service status aggregates, as naemonstats shows them.\n"
+		                 "Send an empty query to get them as key=value lines.\n");
+		return 0;
+	}
+	if (*buf)
+		return 400;
+	if (host_stats == NULL || service_stats == NULL)
+		return 503;
+
+	now = time(NULL);
+	generate_check_stats();
+	nsock_printf(sd, "created=%lu\nversion=" VERSION "\nnagios_pid=%d\nprogram_start=%lu\n",
+	             (unsigned long)now, nagios_pid, (unsigned long)program_start);
+	for (i = 0; i < MAX_CHECK_STATS_TYPES; i++) {
+		nsock_printf(sd, "%s=%d,%d,%d\n", check_stats_names[i],
+		             check_statistics[i].minute_stats[0], check_statistics[i].minute_stats[1],
+		             check_statistics[i].minute_stats[2]);
+	}
+	stats_print_class(sd, host_stats, now, "host", host_states);
+	stats_print_class(sd, service_stats, now, "service", service_states);
+	nsock_write_all(sd, "", 1);
+	return 0;
+}
+
+static struct stats_class *stats_class_create(unsigned int size)
+{
+	struct stats_class *sc = nm_calloc(1, sizeof(*sc));
+
+	sc->size = size;
+	sc->entry = nm_calloc(size ? size : 1, sizeof(*sc->entry));
+	return sc;
+}
+
+static void stats_class_destroy(struct stats_class *sc)
+{
+	if (sc == NULL)
+		return;
+	nm_free(sc->entry);
+	nm_free(sc);
+}
+
+/* sets up the aggregates for the objects we have and starts serving them */
+int init_status_aggregates(void)
+{
+	host *hst;
+	service *svc;
+
+	free_status_aggregates();
+	host_stats = stats_class_create(num_objects.hosts);
+	service_stats = stats_class_create(num_objects.services);
+	for (hst = host_list; hst; hst = hst->next)
+		update_host_stats(hst);
+	for (svc = service_list; svc; svc = svc->next)
+		update_service_stats(svc);
+
+	if (qh_register_handler("stats", "Host and service status aggregates", 0, stats_qh_handler) < 0) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to register 'stats' query handler\n");
+		return ERROR;
+	}
+	return OK;
+}
+
+void free_status_aggregates(void)
+{
+	stats_class_destroy(host_stats);
+	stats_class_destroy(service_stats);
+	host_stats = service_stats = NULL;
+}
 
 
 /******************************************************************/
@@ -21,6 +394,16 @@ int initialize_status_data(const char *cfgfile)
 int update_all_status_data(void)
 {
 	int result = OK;
+	host *hst;
+	service *svc;
+
+	/* catch up with anything that changed without a status update */
+	if (host_stats) {
+		for (hst = host_list; hst; hst = hst->next)
+			update_host_stats(hst);
+		for (svc = service_list; svc; svc = svc->next)
+			update_service_stats(svc);
+	}
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker */
@@ -61,6 +444,7 @@ int update_program_status(int aggregated_dump)
 /* updates host status info */
 int update_host_status(host *hst, int aggregated_dump)
 {
+	update_host_stats(hst);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker (non-aggregated dumps only) */
@@ -75,6 +459,7 @@ int update_host_status(host *hst, int aggregated_dump)
 /* updates service status info */
 int update_service_status(service *svc, int aggregated_dump)
 {
+	update_service_stats(svc);
 
 #ifdef USE_EVENT_BROKER
 	/* send data to event broker (non-aggregated dumps only) */
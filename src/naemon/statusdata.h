@@ -26,6 +26,8 @@ int update_program_status(int);                         /* updates program statu
 int update_host_status(host *, int);                    /* updates host status data */
 int update_service_status(service *, int);              /* updates service status data */
 int update_contact_status(contact *, int);              /* updates contact status data */
+int init_status_aggregates(void);                       /* starts keeping the totals the "stats" query handler serves */
+void free_status_aggregates(void);
 
 NAGIOS_END_DECL
 #endif
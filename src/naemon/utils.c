@@ -118,6 +118,7 @@ int retention_update_interval = DEFAULT_RETENTION_UPDATE_INTERVAL;
 int use_retained_program_state = TRUE;
 int use_retained_scheduling_info = FALSE;
 int retention_scheduling_horizon = DEFAULT_RETENTION_SCHEDULING_HORIZON;
+int initial_check_scheduling = DEFAULT_INITIAL_CHECK_SCHEDULING;
 char *retention_file = NULL;
 
 unsigned long modified_process_attributes = MODATTR_NONE;
@@ -149,6 +150,7 @@ volatile sig_atomic_t sig_id = 0;
 int daemon_dumps_core = TRUE;
 
 int max_parallel_service_checks = DEFAULT_MAX_PARALLEL_SERVICE_CHECKS;
+double max_check_rate = DEFAULT_MAX_CHECK_RATE;
 int currently_running_service_checks = 0;
 int currently_running_host_checks = 0;
 
@@ -162,6 +164,8 @@ int status_update_interval = DEFAULT_STATUS_UPDATE_INTERVAL;
 int time_change_threshold = DEFAULT_TIME_CHANGE_THRESHOLD;
 
 unsigned long   event_broker_options = BROKER_NOTHING;
+int neb_callback_profiling = DEFAULT_NEB_CALLBACK_PROFILING;
+unsigned int neb_async_queue_size = DEFAULT_NEB_ASYNC_QUEUE_SIZE;
 
 double low_service_flap_threshold = DEFAULT_LOW_SERVICE_FLAP_THRESHOLD;
 double high_service_flap_threshold = DEFAULT_HIGH_SERVICE_FLAP_THRESHOLD;
@@ -195,6 +199,10 @@ char    *host_perfdata_file_processing_command = NULL;
 char    *service_perfdata_file_processing_command = NULL;
 int     host_perfdata_process_empty_results = DEFAULT_HOST_PERFDATA_PROCESS_EMPTY_RESULTS;
 int     service_perfdata_process_empty_results = DEFAULT_SERVICE_PERFDATA_PROCESS_EMPTY_RESULTS;
+unsigned long perfdata_file_buffer_size = DEFAULT_PERFDATA_FILE_BUFFER_SIZE;
+unsigned long perfdata_file_flush_interval = DEFAULT_PERFDATA_FILE_FLUSH_INTERVAL;
+unsigned long host_perfdata_file_rotation_size = 0L;
+unsigned long service_perfdata_file_rotation_size = 0L;
 /*** end perfdata variables */
 
 static long long check_file_size(char *, unsigned long, struct rlimit);
@@ -286,18 +294,32 @@ int set_loadctl_options(char *opts, unsigned int len)
 			loadctl.backoff_change = atoi(kv->value);
 		} else if (!strcmp(kv->key, "rampup_change")) {
 			loadctl.rampup_change = atoi(kv->value);
+		} else if (!strcmp(kv->key, "pressure_limit")) {
+			loadctl.pressure_limit = strtod(kv->value, NULL);
+		} else if (!strcmp(kv->key, "rampup_pressure")) {
+			loadctl.rampup_pressure = strtod(kv->value, NULL);
+		} else if (!strcmp(kv->key, "latency_limit")) {
+			loadctl.latency_limit = strtoul(kv->value, NULL, 10);
+		} else if (!strcmp(kv->key, "backoff_factor")) {
+			loadctl.backoff_factor = strtod(kv->value, NULL);
 		} else {
 			nm_log(NSLOG_CONFIG_ERROR, "Error: Bad loadctl option; %s = %s\n", kv->key, kv->value);
 			return 400;
 		}
 	}
 
+	if (loadctl.backoff_factor < 0 || loadctl.backoff_factor >= 1) {
+		nm_log(NSLOG_CONFIG_ERROR, "Error: loadctl backoff_factor must be at least 0 and below 1\n");
+		loadctl.backoff_factor = 0.7;
+	}
+
 	/* precedence order is "jobs_min -> jobs_max -> jobs_limit" */
 	if (loadctl.jobs_max < loadctl.jobs_min)
 		loadctl.jobs_max = loadctl.jobs_min;
 	if (loadctl.jobs_limit > loadctl.jobs_max)
 		loadctl.jobs_limit = loadctl.jobs_max;
-	if (loadctl.jobs_limit < loadctl.jobs_min)
+	/* an unset jobs_limit starts out at jobs_max */
+	if (loadctl.jobs_limit && loadctl.jobs_limit < loadctl.jobs_min)
 		loadctl.jobs_limit = loadctl.jobs_min;
 	kvvec_destroy(kvv, 0);
 	return 0;
@@ -2499,7 +2521,7 @@ int dbuf_strcat(dbuf *db, const char *buf)
 	}
 
 	/* append the new string */
-	strcat(db->buf, buf);
+	memcpy(db->buf + db->used_size, buf, buflen + 1);
 
 	/* update size allocated */
 	db->used_size += buflen;
@@ -2801,6 +2823,12 @@ void free_memory(nagios_macros *mac)
 	int i;
 	objectlist *entry, *next;
 
+	/* the freshness queues point to hosts and services */
+	free_freshness_deadlines();
+
+	/* the status aggregates are indexed by object id */
+	free_status_aggregates();
+
 	/* free all allocated memory for the object definitions */
 	free_object_data();
 
@@ -2808,8 +2836,14 @@ void free_memory(nagios_macros *mac)
 	free_comment_data();
 
 	/* free event queue data */
-	squeue_destroy(nagios_squeue, SQUEUE_FREE_DATA);
-	nagios_squeue = NULL;
+	if (nagios_squeue) {
+		timed_event *event;
+
+		while ((event = squeue_pop(nagios_squeue)))
+			nm_slab_free(&timed_event_cache, event);
+		squeue_destroy(nagios_squeue, 0);
+		nagios_squeue = NULL;
+	}
 
 	nm_free(global_host_event_handler);
 	nm_free(global_service_event_handler);
@@ -2887,26 +2921,6 @@ void free_memory(nagios_macros *mac)
 }
 
 
-/* free a notification list that was created */
-void free_notification_list(void)
-{
-	notification *temp_notification = NULL;
-	notification *next_notification = NULL;
-
-	temp_notification = notification_list;
-	while (temp_notification != NULL) {
-		next_notification = temp_notification->next;
-		nm_free(temp_notification);
-		temp_notification = next_notification;
-	}
-
-	/* reset notification list pointer */
-	notification_list = NULL;
-
-	return;
-}
-
-
 /* reset all system-wide variables, so when we've receive a SIGHUP we can restart cleanly */
 int reset_variables(void)
 {
@@ -2968,6 +2982,7 @@ int reset_variables(void)
 	use_retained_program_state = TRUE;
 	use_retained_scheduling_info = FALSE;
 	retention_scheduling_horizon = DEFAULT_RETENTION_SCHEDULING_HORIZON;
+	initial_check_scheduling = DEFAULT_INITIAL_CHECK_SCHEDULING;
 	modified_host_process_attributes = MODATTR_NONE;
 	modified_service_process_attributes = MODATTR_NONE;
 	retained_host_attribute_mask = 0L;
@@ -2994,6 +3009,7 @@ int reset_variables(void)
 	last_log_rotation = 0L;
 
 	max_parallel_service_checks = DEFAULT_MAX_PARALLEL_SERVICE_CHECKS;
+	max_check_rate = DEFAULT_MAX_CHECK_RATE;
 	currently_running_service_checks = 0;
 
 	enable_notifications = TRUE;
@@ -3013,6 +3029,8 @@ int reset_variables(void)
 	status_update_interval = DEFAULT_STATUS_UPDATE_INTERVAL;
 
 	event_broker_options = BROKER_NOTHING;
+	neb_callback_profiling = DEFAULT_NEB_CALLBACK_PROFILING;
+	neb_async_queue_size = DEFAULT_NEB_ASYNC_QUEUE_SIZE;
 
 	time_change_threshold = DEFAULT_TIME_CHANGE_THRESHOLD;
 
@@ -10,6 +10,7 @@
 #include "workers.h"
 #include "config.h"
 #include <string.h>
+#include <fcntl.h>
 #include "query-handler.h"
 #include "utils.h"
 #include "logging.h"
@@ -24,6 +25,14 @@
 
 struct wproc_worker;
 
+/*
+ * A job whose result hasn't come back this many seconds after its
+ * timeout has passed is considered orphaned. Workers kill jobs on
+ * their timeout themselves, so this only needs to cover delays in
+ * shipping the result back to us.
+ */
+#define WPROC_JOB_SLACK 60
+
 struct wproc_job {
 	unsigned int id;
 	unsigned int timeout;
@@ -31,8 +40,14 @@ struct wproc_job {
 	void (*callback)(struct wproc_result *, void *, int);
 	void *data;
 	struct wproc_worker *wp;
+	time_t start;		/**< when the job was handed to its worker */
+	struct timeval sent;	/**< ...and the same thing, more precisely */
+	time_t deadline;	/**< when we give up on its result */
+	unsigned int pos;	/**< position in job_deadlines, 0 if not queued */
 };
 
+static struct nm_slab_cache wproc_job_cache = NM_SLAB_CACHE_INIT("wproc_job", struct wproc_job);
+
 struct wproc_list;
 
 struct wproc_worker {
@@ -59,6 +74,10 @@ static struct wproc_list workers = {0, 0, NULL};
 static dkhash_table *specialized_workers;
 static struct wproc_list *to_remove = NULL;
 
+/* jobs handed to a worker, ordered by when we give up on them */
+static pqueue_t *job_deadlines;
+static unsigned long wproc_jobs_orphaned;
+
 unsigned int wproc_num_workers_online = 0, wproc_num_workers_desired = 0;
 unsigned int wproc_num_workers_spawned = 0;
 
@@ -98,9 +117,123 @@ void wproc_reap(int jobs, int msecs)
 	} while (jobs > 0 && start + (msecs * 1000) <= now);
 }
 
+/* returns the "some avg10" figure from a PSI file, or -1 if there isn't one */
+static double read_pressure(const char *path)
+{
+	char buf[256], *p;
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1.0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1.0;
+	buf[len] = 0;
+	if (!(p = strstr(buf, "some avg10=")))
+		return -1.0;
+	return strtod(p + 11, NULL);
+}
+
+/*
+ * Adjusts jobs_limit to how loaded the system is. Where the kernel
+ * has pressure stall information we use that, and job latency, to
+ * do additive increase/multiplicative decrease: stalls and slow
+ * jobs show up within seconds of us overloading the box, which the
+ * load average won't. Without PSI we go by the load average, the
+ * way we always have, and job latency is left out of it.
+ */
+static void loadctl_check(struct load_control *lc)
+{
+	unsigned int old = lc->jobs_limit, floor;
+	double pressure;
+	const char *what = "cpu";
+
+	lc->pressure[0] = read_pressure("/proc/pressure/cpu");
+	lc->pressure[1] = read_pressure("/proc/pressure/memory");
+	pressure = lc->pressure[0];
+	if (lc->pressure[1] > pressure) {
+		pressure = lc->pressure[1];
+		what = "memory";
+	}
+	if (getloadavg(lc->load, 3) < 0)
+		lc->load[0] = -1.0;
+
+	if (pressure >= 0 && (lc->latency > lc->latency_limit || pressure > lc->pressure_limit)) {
+		lc->jobs_limit = lc->jobs_limit * lc->backoff_factor;
+		if (lc->jobs_limit == old && old)
+			lc->jobs_limit--;
+		if (lc->latency > lc->latency_limit)
+			snprintf(lc->decision, sizeof(lc->decision), "backoff: job latency %.0fms over %ums",
+			         lc->latency, lc->latency_limit);
+		else
+			snprintf(lc->decision, sizeof(lc->decision), "backoff: %s pressure %.1f%% over %.1f%%",
+			         what, pressure, lc->pressure_limit);
+	} else if (pressure >= 0) {
+		if (pressure < lc->rampup_pressure) {
+			lc->jobs_limit += lc->rampup_change;
+			snprintf(lc->decision, sizeof(lc->decision), "rampup: %s pressure %.1f%% under %.1f%%",
+			         what, pressure, lc->rampup_pressure);
+		} else {
+			snprintf(lc->decision, sizeof(lc->decision), "hold: %s pressure %.1f%%", what, pressure);
+		}
+	} else if (lc->load[0] < 0) {
+		snprintf(lc->decision, sizeof(lc->decision), "hold: no pressure or load information");
+	} else if (lc->load[0] > lc->backoff_limit) {
+		lc->jobs_limit = lc->jobs_limit > lc->backoff_change ? lc->jobs_limit - lc->backoff_change : 0;
+		snprintf(lc->decision, sizeof(lc->decision), "backoff: load %.2f over %.2f",
+		         lc->load[0], lc->backoff_limit);
+	} else if (lc->load[0] < lc->rampup_limit) {
+		lc->jobs_limit += lc->rampup_change;
+		snprintf(lc->decision, sizeof(lc->decision), "rampup: load %.2f under %.2f",
+		         lc->load[0], lc->rampup_limit);
+	} else {
+		snprintf(lc->decision, sizeof(lc->decision), "hold: load %.2f", lc->load[0]);
+	}
+
+	floor = lc->jobs_min;
+	if (lc->jobs_limit > lc->jobs_max) {
+		lc->jobs_limit = lc->jobs_max;
+	} else if (lc->jobs_limit < floor) {
+		/* only warn the first time we hit the floor */
+		if (old != floor)
+			nm_log(NSLOG_RUNTIME_WARNING, "Warning: Tried to set jobs_limit to %u, below jobs_min (%u)\n",
+			       lc->jobs_limit, floor);
+		lc->jobs_limit = floor;
+	}
+
+	if (old != lc->jobs_limit) {
+		lc->changes++;
+		lc->last_change = lc->last_check;
+		if (lc->jobs_limit < old) {
+			lc->backoffs++;
+			nm_log(NSLOG_RUNTIME_WARNING, "Warning: loadctl.jobs_limit changed from %u to %u (%s)\n", old, lc->jobs_limit, lc->decision);
+		} else {
+			nm_log(NSLOG_INFO_MESSAGE, "wproc: loadctl.jobs_limit changed from %u to %u (%s)\n", old, lc->jobs_limit, lc->decision);
+		}
+	}
+}
+
+/* feeds the time a job spent anywhere but running into loadctl.latency */
+static void loadctl_job_done(const struct wproc_job *job, const wproc_result *wpres)
+{
+	struct timeval now;
+	double overhead;
+
+	if (!job->sent.tv_sec || !wpres->start.tv_sec)
+		return;
+
+	gettimeofday(&now, NULL);
+	overhead = (tv_delta_f(&job->sent, &now) - tv_delta_f(&wpres->start, &wpres->stop)) * 1000;
+	if (overhead < 0)
+		overhead = 0;
+	/* same smoothing as TCP's round-trip time estimate */
+	loadctl.latency += (overhead - loadctl.latency) / 8;
+}
+
 int wproc_can_spawn(struct load_control *lc)
 {
-	unsigned int old = 0;
 	time_t now;
 
 	/* if no load control is enabled, we can safely run this job */
@@ -108,38 +241,61 @@ int wproc_can_spawn(struct load_control *lc)
 		return 1;
 
 	now = time(NULL);
-	if (lc->last_check + lc->check_interval > now) {
+	if (lc->last_check + lc->check_interval <= now) {
 		lc->last_check = now;
+		loadctl_check(lc);
+	}
 
-		if (getloadavg(lc->load, 3) < 0)
-			return lc->jobs_limit > lc->jobs_running;
+	return lc->jobs_limit > lc->jobs_running;
+}
 
-		if (lc->load[0] > lc->backoff_limit) {
-			old = lc->jobs_limit;
-			lc->jobs_limit -= lc->backoff_change;
-		} else if (lc->load[0] < lc->rampup_limit) {
-			old = lc->jobs_limit;
-			lc->jobs_limit += lc->rampup_change;
-		}
+static int job_deadline_cmp(pqueue_pri_t next, pqueue_pri_t cur)
+{
+	return next > cur;
+}
 
-		if (lc->jobs_limit > lc->jobs_max) {
-			lc->jobs_limit = lc->jobs_max;
-		} else if (lc->jobs_limit < lc->jobs_min) {
-			nm_log(NSLOG_RUNTIME_WARNING, "Warning: Tried to set jobs_limit to %u, below jobs_min (%u)\n",
-			       lc->jobs_limit, lc->jobs_min);
-			lc->jobs_limit = lc->jobs_min;
-		}
+static pqueue_pri_t job_deadline_get(void *a)
+{
+	return ((struct wproc_job *)a)->deadline;
+}
 
-		if (old && old != lc->jobs_limit) {
-			if (lc->jobs_limit < old) {
-				nm_log(NSLOG_RUNTIME_WARNING, "Warning: loadctl.jobs_limit changed from %u to %u\n", old, lc->jobs_limit);
-			} else {
-				nm_log(NSLOG_INFO_MESSAGE, "wproc: loadctl.jobs_limit changed from %u to %u\n", old, lc->jobs_limit);
-			}
+static void job_deadline_set(void *a, pqueue_pri_t pri)
+{
+	((struct wproc_job *)a)->deadline = pri;
+}
+
+static unsigned int job_pos_get(void *a)
+{
+	return ((struct wproc_job *)a)->pos;
+}
+
+static void job_pos_set(void *a, unsigned int pos)
+{
+	((struct wproc_job *)a)->pos = pos;
+}
+
+static void dequeue_job(struct wproc_job *job)
+{
+	if (!job->pos)
+		return;
+	pqueue_remove(job_deadlines, job);
+	job->pos = 0;
+}
+
+static void enqueue_job(struct wproc_job *job)
+{
+	if (!job_deadlines) {
+		job_deadlines = pqueue_init(1024, job_deadline_cmp, job_deadline_get, job_deadline_set, job_pos_get, job_pos_set);
+		if (!job_deadlines) {
+			nm_log(NSLOG_RUNTIME_ERROR, "wproc: Failed to create job deadline queue\n");
+			return;
 		}
 	}
 
-	return lc->jobs_limit > lc->jobs_running;
+	dequeue_job(job);
+	job->start = time(NULL);
+	job->deadline = job->start + job->timeout + WPROC_JOB_SLACK;
+	pqueue_insert(job_deadlines, job);
 }
 
 static int get_job_id(struct wproc_worker *wp)
@@ -213,6 +369,7 @@ static void destroy_job(struct wproc_job *job)
 	/* call with NULL result to make callback clean things up */
 	run_job_callback(job, NULL, 0);
 
+	dequeue_job(job);
 	nm_free(job->command);
 	if (job->wp) {
 		fanout_remove(job->wp->jobs, job->id);
@@ -220,7 +377,7 @@ static void destroy_job(struct wproc_job *job)
 	}
 	loadctl.jobs_running--;
 
-	free(job);
+	nm_slab_free(&wproc_job_cache, job);
 }
 
 static void fo_destroy_job(void *job)
@@ -328,6 +485,10 @@ void free_worker_memory(int flags)
 
 		free(workers.wps);
 	}
+	if (job_deadlines) {
+		pqueue_free(job_deadlines);
+		job_deadlines = NULL;
+	}
 	to_remove = NULL;
 	dkhash_walk_data(specialized_workers, remove_specialized);
 	dkhash_destroy(specialized_workers);
@@ -336,20 +497,13 @@ void free_worker_memory(int flags)
 	workers.idx = 0;
 }
 
-static int str2timeval(char *str, struct timeval *tv)
+/* the numbers in worker results are all ints */
+static inline int kv_int(const struct key_value *kv)
 {
-	char *ptr, *ptr2;
+	long value;
 
-	tv->tv_sec = strtoul(str, &ptr, 10);
-	if (ptr == str) {
-		tv->tv_sec = tv->tv_usec = 0;
-		return -1;
-	}
-	if (*ptr == '.' || *ptr == ',') {
-		ptr2 = ptr + 1;
-		tv->tv_usec = strtoul(ptr2, &ptr, 10);
-	}
-	return 0;
+	kvvec_value_long(kv, &value);
+	return (int)value;
 }
 
 /*
@@ -362,10 +516,11 @@ static int parse_worker_result(wproc_result *wpres, struct kvvec *kvv)
 	int i;
 
 	for (i = 0; i < kvv->kv_pairs; i++) {
+		struct key_value *kv = &kvv->kv[i];
 		struct wpres_key *k;
 		char *key, *value;
-		key = kvv->kv[i].key;
-		value = kvv->kv[i].value;
+		key = kv->key;
+		value = kv->value;
 
 		k = wpres_get_key(key, kvv->kv[i].key_len);
 		if (!k) {
@@ -374,22 +529,22 @@ static int parse_worker_result(wproc_result *wpres, struct kvvec *kvv)
 		}
 		switch (k->code) {
 		case WPRES_job_id:
-			wpres->job_id = atoi(value);
+			wpres->job_id = kv_int(kv);
 			break;
 		case WPRES_command:
 			wpres->command = value;
 			break;
 		case WPRES_timeout:
-			wpres->timeout = atoi(value);
+			wpres->timeout = kv_int(kv);
 			break;
 		case WPRES_wait_status:
-			wpres->wait_status = atoi(value);
+			wpres->wait_status = kv_int(kv);
 			break;
 		case WPRES_start:
-			str2timeval(value, &wpres->start);
+			kvvec_value_tv(kv, &wpres->start);
 			break;
 		case WPRES_stop:
-			str2timeval(value, &wpres->stop);
+			kvvec_value_tv(kv, &wpres->stop);
 			break;
 		case WPRES_type:
 			/* Keep for backward compatibility of nagios special purpose workers */
@@ -401,7 +556,7 @@ static int parse_worker_result(wproc_result *wpres, struct kvvec *kvv)
 			wpres->outerr = value;
 			break;
 		case WPRES_exited_ok:
-			wpres->exited_ok = atoi(value);
+			wpres->exited_ok = kv_int(kv);
 			break;
 		case WPRES_error_msg:
 			wpres->exited_ok = FALSE;
@@ -409,46 +564,46 @@ static int parse_worker_result(wproc_result *wpres, struct kvvec *kvv)
 			break;
 		case WPRES_error_code:
 			wpres->exited_ok = FALSE;
-			wpres->error_code = atoi(value);
+			wpres->error_code = kv_int(kv);
 			break;
 		case WPRES_runtime:
 			/* ignored */
 			break;
 		case WPRES_ru_utime:
-			str2timeval(value, &wpres->rusage.ru_utime);
+			kvvec_value_tv(kv, &wpres->rusage.ru_utime);
 			break;
 		case WPRES_ru_stime:
-			str2timeval(value, &wpres->rusage.ru_stime);
+			kvvec_value_tv(kv, &wpres->rusage.ru_stime);
 			break;
 		case WPRES_ru_minflt:
-			wpres->rusage.ru_minflt = atoi(value);
+			wpres->rusage.ru_minflt = kv_int(kv);
 			break;
 		case WPRES_ru_majflt:
-			wpres->rusage.ru_majflt = atoi(value);
+			wpres->rusage.ru_majflt = kv_int(kv);
 			break;
 		case WPRES_ru_nswap:
-			wpres->rusage.ru_nswap = atoi(value);
+			wpres->rusage.ru_nswap = kv_int(kv);
 			break;
 		case WPRES_ru_inblock:
-			wpres->rusage.ru_inblock = atoi(value);
+			wpres->rusage.ru_inblock = kv_int(kv);
 			break;
 		case WPRES_ru_oublock:
-			wpres->rusage.ru_oublock = atoi(value);
+			wpres->rusage.ru_oublock = kv_int(kv);
 			break;
 		case WPRES_ru_msgsnd:
-			wpres->rusage.ru_msgsnd = atoi(value);
+			wpres->rusage.ru_msgsnd = kv_int(kv);
 			break;
 		case WPRES_ru_msgrcv:
-			wpres->rusage.ru_msgrcv = atoi(value);
+			wpres->rusage.ru_msgrcv = kv_int(kv);
 			break;
 		case WPRES_ru_nsignals:
-			wpres->rusage.ru_nsignals = atoi(value);
+			wpres->rusage.ru_nsignals = kv_int(kv);
 			break;
 		case WPRES_ru_nvcsw:
-			wpres->rusage.ru_nsignals = atoi(value);
+			wpres->rusage.ru_nvcsw = kv_int(kv);
 			break;
 		case WPRES_ru_nivcsw:
-			wpres->rusage.ru_nsignals = atoi(value);
+			wpres->rusage.ru_nivcsw = kv_int(kv);
 			break;
 
 		default:
@@ -460,11 +615,48 @@ static int parse_worker_result(wproc_result *wpres, struct kvvec *kvv)
 }
 
 static int wproc_run_job(struct wproc_job *job, nagios_macros *mac);
+
+/* gives up on a job, letting its callback know it's never coming back */
+static void orphan_job(struct wproc_job *job)
+{
+	wproc_jobs_orphaned++;
+	run_job_callback(job, NULL, WPROC_JOB_ORPHANED);
+	destroy_job(job);
+}
+
+void wproc_check_orphaned_jobs(void)
+{
+	struct wproc_job *job;
+	time_t now = time(NULL);
+
+	while ((job = pqueue_peek(job_deadlines)) && job->deadline <= now) {
+		nm_log(NSLOG_RUNTIME_WARNING, "wproc: Job %u on worker %s was orphaned; no result %lus after its %us timeout. Command: %s\n",
+		       job->id, job->wp ? job->wp->name : "(none)",
+		       (unsigned long)(now - job->start - job->timeout), job->timeout, job->command);
+		orphan_job(job);
+	}
+}
 static void fo_reassign_wproc_job(void *job_)
 {
 	struct wproc_job *job = (struct wproc_job *)job_;
+
+	/* the job is counted again once it's handed to its new worker */
+	loadctl.jobs_running--;
+
 	job->wp = get_worker(job->command);
+	if (!job->wp) {
+		/* nobody left to run it, so it will never come back */
+		loadctl.jobs_running++;
+		orphan_job(job);
+		return;
+	}
 	job->id = get_job_id(job->wp);
+	if (fanout_add(job->wp->jobs, job->id, job) < 0) {
+		loadctl.jobs_running++;
+		job->wp = NULL;
+		orphan_job(job);
+		return;
+	}
 	/* macros aren't used right now anyways */
 	wproc_run_job(job, NULL);
 }
@@ -542,6 +734,8 @@ static int handle_worker_result(int sd, int events, void *arg)
 			wpres.early_timeout = TRUE;
 		}
 
+		loadctl_job_done(job, &wpres);
+
 		if (wpres.early_timeout) {
 			nm_asprintf(&error_reason, "timed out after %.2fs", tv_delta_f(&wpres.start, &wpres.stop));
 		} else if (WIFSIGNALED(wpres.wait_status)) {
@@ -655,6 +849,21 @@ static int register_worker(int sd, char *buf, unsigned int len)
 	return QH_TAKEOVER;
 }
 
+/* the start of the oldest job, of one worker's or of them all */
+struct job_age {
+	struct wproc_worker *wp;
+	time_t oldest;
+};
+
+static void find_oldest_job(void *d, void *arg)
+{
+	struct wproc_job *job = (struct wproc_job *)d;
+	struct job_age *age = (struct job_age *)arg;
+
+	if ((!age->wp || job->wp == age->wp) && job->start < age->oldest)
+		age->oldest = job->start;
+}
+
 static int wproc_query_handler(int sd, char *buf, unsigned int len)
 {
 	char *space, *rbuf = NULL;
@@ -662,7 +871,10 @@ static int wproc_query_handler(int sd, char *buf, unsigned int len)
 	if (!*buf || !strcmp(buf, "help")) {
 		nsock_printf_nul(sd, "Control worker processes.\n"
 		                 "Valid commands:\n"
-		                 "  wpstats              Print general job information\n"
+		                 "  wpstats              Print general job information, including the size\n"
+		                 "                       and collision count of each worker's job table\n"
+		                 "  jobs                 Print jobs currently handed to workers, in total\n"
+		                 "                       and per worker, along with the age of the oldest one\n"
 		                 "  register <options>   Register a new worker\n"
 		                 "                       <options> can be name, pid, max_jobs and/or plugin.\n"
 		                 "                       There can be many plugin args.");
@@ -682,9 +894,36 @@ static int wproc_query_handler(int sd, char *buf, unsigned int len)
 
 		for (i = 0; i < workers.len; i++) {
 			struct wproc_worker *wp = workers.wps[i];
-			nsock_printf(sd, "name=%s;pid=%d;jobs_running=%u;jobs_started=%u\n",
+			nsock_printf(sd, "name=%s;pid=%d;jobs_running=%u;jobs_started=%u;"
+			             "job_table_entries=%lu;job_table_size=%lu;job_table_collisions=%lu\n",
 			             wp->name, wp->pid,
-			             wp->jobs_running, wp->jobs_started);
+			             wp->jobs_running, wp->jobs_started,
+			             fanout_num_entries(wp->jobs), fanout_table_size(wp->jobs),
+			             fanout_collisions(wp->jobs));
+		}
+		return 0;
+	}
+	if (!strcmp(buf, "jobs")) {
+		struct job_age age;
+		unsigned int w;
+		time_t now = time(NULL);
+
+		age.wp = NULL;
+		age.oldest = now;
+		pqueue_walk(job_deadlines, find_oldest_job, &age);
+		nsock_printf(sd, "jobs_running=%u;jobs_orphaned=%lu;oldest_age=%lu\n",
+		             job_deadlines ? pqueue_size(job_deadlines) : 0,
+		             wproc_jobs_orphaned, (unsigned long)(now - age.oldest));
+
+		for (w = 0; w < workers.len; w++) {
+			struct wproc_worker *wp = workers.wps[w];
+
+			age.wp = wp;
+			age.oldest = now;
+			pqueue_walk(job_deadlines, find_oldest_job, &age);
+			nsock_printf(sd, "name=%s;pid=%d;jobs_running=%u;oldest_age=%lu\n",
+			             wp->name, wp->pid, wp->jobs_running,
+			             (unsigned long)(now - age.oldest));
 		}
 		return 0;
 	}
@@ -762,14 +1001,14 @@ static struct wproc_job *create_job(void (*callback)(struct wproc_result *, void
 	if (!wp)
 		return NULL;
 
-	job = nm_calloc(1, sizeof(*job));
+	job = nm_slab_alloc(&wproc_job_cache);
 	job->wp = wp;
 	job->id = get_job_id(wp);
 	job->callback = callback;
 	job->data = data;
 	job->timeout = timeout;
 	if (fanout_add(wp->jobs, job->id, job) < 0 || !(job->command = nm_strdup(cmd))) {
-		free(job);
+		nm_slab_free(&wproc_job_cache, job);
 		return NULL;
 	}
 
@@ -784,7 +1023,7 @@ static struct wproc_job *create_job(void (*callback)(struct wproc_result *, void
 static int wproc_run_job(struct wproc_job *job, nagios_macros *mac)
 {
 	static struct kvvec kvv = KVVEC_INITIALIZER;
-	struct kvvec_buf *kvvb;
+	static struct kvvec_buf kvvb = KVVEC_BUF_INITIALIZER;
 	struct wproc_worker *wp;
 	int ret, result = OK;
 
@@ -803,15 +1042,16 @@ static int wproc_run_job(struct wproc_job *job, nagios_macros *mac)
 	if (!kvvec_init(&kvv, 4))	/* job_id, command and timeout */
 		return ERROR;
 
-	kvvec_addkv(&kvv, "job_id", (char *)mkstr("%d", job->id));
+	kvvec_addkv_long(&kvv, "job_id", job->id);
 	kvvec_addkv(&kvv, "type", "0");
 	kvvec_addkv(&kvv, "command", job->command);
-	kvvec_addkv(&kvv, "timeout", (char *)mkstr("%u", job->timeout));
-	kvvb = build_kvvec_buf(&kvv);
-	ret = write(wp->sd, kvvb->buf, kvvb->bufsize);
-	if (ret != (int)kvvb->bufsize) {
+	kvvec_addkv_long(&kvv, "timeout", job->timeout);
+	if (build_kvvec_buf_prealloc(&kvv, &kvvb) < 0)
+		return ERROR;
+	ret = write(wp->sd, kvvb.buf, kvvb.bufsize);
+	if (ret != (int)kvvb.bufsize) {
 		nm_log(NSLOG_RUNTIME_ERROR, "wproc: '%s' seems to be choked. ret = %d; bufsize = %lu: errno = %d (%s)\n",
-		       wp->name, ret, kvvb->bufsize, errno, strerror(errno));
+		       wp->name, ret, kvvb.bufsize, errno, strerror(errno));
 		// these two will be decremented by destroy_job, so preemptively increment them
 		wp->jobs_running++;
 		loadctl.jobs_running++;
@@ -821,9 +1061,9 @@ static int wproc_run_job(struct wproc_job *job, nagios_macros *mac)
 		wp->jobs_running++;
 		wp->jobs_started++;
 		loadctl.jobs_running++;
+		gettimeofday(&job->sent, NULL);
+		enqueue_job(job);
 	}
-	free(kvvb->buf);
-	free(kvvb);
 
 	return result;
 }
@@ -10,6 +10,9 @@
 
 #define WPROC_FORCE  (1 << 0)
 
+/* passed to job callbacks, along with a NULL result, for jobs we gave up on */
+#define WPROC_JOB_ORPHANED  (1 << 0)
+
 NAGIOS_BEGIN_DECL;
 
 typedef struct wproc_result {
@@ -42,6 +45,7 @@ int wproc_can_spawn(struct load_control *lc);
 void free_worker_memory(int flags);
 int workers_alive(void);
 int init_workers(int desired_workers);
+void wproc_check_orphaned_jobs(void);
 
 int wproc_run_callback(char *cmt, int timeout, void (*cb)(struct wproc_result *, void *, int), void *data, nagios_macros *mac);
 
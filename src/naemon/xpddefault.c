@@ -14,16 +14,115 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "lib/nsock.h"
 
 
 static command *host_perfdata_command_ptr = NULL;
 static command *service_perfdata_command_ptr = NULL;
 static command *host_perfdata_file_processing_command_ptr = NULL;
 static command *service_perfdata_file_processing_command_ptr = NULL;
-static FILE    *host_perfdata_fp = NULL;
-static FILE    *service_perfdata_fp = NULL;
-static int     host_perfdata_fd = -1;
-static int     service_perfdata_fd = -1;
+
+/*
+ * A file template is split up once, at startup, into its plain text
+ * and its macros, so writing a line is a matter of looking up each
+ * macro and appending its value, rather than parsing the template
+ * all over again for every single check result.
+ */
+struct perfdata_template_part {
+	char *str; /* the text, or the name of the macro */
+	size_t len;
+	int is_macro;
+	int code; /* the "x" macro code, or -1 to look it up by name */
+	int terminated; /* FALSE if the template ends in the middle of it */
+};
+
+/* a buffered performance data file */
+struct perfdata_file {
+	const char *name;
+	char **path, **template;
+	int *pipe, *append;
+	unsigned long *rotation_size;
+	int pipe_flags;
+	int fd;
+	struct perfdata_template_part *parts;
+	unsigned int num_parts;
+	char *buf;
+	size_t len, alloc;
+	unsigned long long size; /* bytes in the file on disk */
+	int held; /* closed while a processing command works on it */
+	time_t last_flush;
+	unsigned long long lines, writes, bytes, dropped;
+	unsigned long rotations;
+};
+
+static struct perfdata_file host_perfdata = {
+	.name = "host",
+	.path = &host_perfdata_file,
+	.template = &host_perfdata_file_template,
+	.pipe = &host_perfdata_file_pipe,
+	.append = &host_perfdata_file_append,
+	.rotation_size = &host_perfdata_file_rotation_size,
+	.pipe_flags = O_CREAT,
+	.fd = -1,
+};
+
+static struct perfdata_file service_perfdata = {
+	.name = "service",
+	.path = &service_perfdata_file,
+	.template = &service_perfdata_file_template,
+	.pipe = &service_perfdata_file_pipe,
+	.append = &service_perfdata_file_append,
+	.rotation_size = &service_perfdata_file_rotation_size,
+	.fd = -1,
+};
+
+static void xpddefault_compile_file_template(struct perfdata_file *pf);
+static void xpddefault_free_file_template(struct perfdata_file *pf);
+
+/* state and statistics of a perfdata file processing command */
+struct perfdata_processor {
+	const char *name, *macro_prefix;
+	int macro;
+	char **file, **command;
+	int *pipe;
+	command **command_ptr;
+	int (*open)(void);
+	int (*close)(void);
+	struct perfdata_file *perfdata;
+	int running;
+	char *rotated; /* the file the running command is processing */
+	unsigned long runs, skipped, timeouts, failures;
+	double runtime_last, runtime_max, runtime_total;
+};
+
+static struct perfdata_processor host_processor = {
+	.name = "host",
+	.macro_prefix = "HOST",
+	.macro = MACRO_HOSTPERFDATAFILE,
+	.file = &host_perfdata_file,
+	.command = &host_perfdata_file_processing_command,
+	.pipe = &host_perfdata_file_pipe,
+	.command_ptr = &host_perfdata_file_processing_command_ptr,
+	.open = xpddefault_open_host_perfdata_file,
+	.close = xpddefault_close_host_perfdata_file,
+	.perfdata = &host_perfdata,
+};
+
+static struct perfdata_processor service_processor = {
+	.name = "service",
+	.macro_prefix = "SERVICE",
+	.macro = MACRO_SERVICEPERFDATAFILE,
+	.file = &service_perfdata_file,
+	.command = &service_perfdata_file_processing_command,
+	.pipe = &service_perfdata_file_pipe,
+	.command_ptr = &service_perfdata_file_processing_command_ptr,
+	.open = xpddefault_open_service_perfdata_file,
+	.close = xpddefault_close_service_perfdata_file,
+	.perfdata = &service_perfdata,
+};
 
 
 /******************************************************************/
@@ -66,6 +165,8 @@ int xpddefault_initialize_performance_data(const char *cfgfile)
 	/* process special chars in templates */
 	xpddefault_preprocess_file_templates(host_perfdata_file_template);
 	xpddefault_preprocess_file_templates(service_perfdata_file_template);
+	xpddefault_compile_file_template(&host_perfdata);
+	xpddefault_compile_file_template(&service_perfdata);
 
 	/* open the performance data files */
 	xpddefault_open_host_perfdata_file();
@@ -130,6 +231,10 @@ int xpddefault_initialize_performance_data(const char *cfgfile)
 	if (service_perfdata_file_processing_interval > 0 && service_perfdata_file_processing_command != NULL)
 		schedule_new_event(EVENT_USER_FUNCTION, TRUE, current_time + service_perfdata_file_processing_interval, TRUE, service_perfdata_file_processing_interval, NULL, TRUE, (void *)xpddefault_process_service_perfdata_file, NULL, 0);
 
+	/* make sure buffered perfdata makes it to the files even when things are quiet */
+	if (perfdata_file_buffer_size > 0 && perfdata_file_flush_interval > 0 && (host_perfdata_file != NULL || service_perfdata_file != NULL))
+		schedule_new_event(EVENT_USER_FUNCTION, TRUE, current_time + perfdata_file_flush_interval, TRUE, perfdata_file_flush_interval, NULL, TRUE, (void *)xpddefault_flush_perfdata_files, NULL, 0);
+
 	/* save the host perf data file macro */
 	nm_free(mac->x[MACRO_HOSTPERFDATAFILE]);
 	if (host_perfdata_file != NULL) {
@@ -164,10 +269,16 @@ int xpddefault_cleanup_performance_data(void)
 	nm_free(host_perfdata_file_processing_command);
 	nm_free(service_perfdata_file_processing_command);
 
-	/* close the files */
+	/* close the files, writing out what's still buffered */
 	xpddefault_close_host_perfdata_file();
 	xpddefault_close_service_perfdata_file();
 
+	xpddefault_free_file_template(&host_perfdata);
+	xpddefault_free_file_template(&service_perfdata);
+	nm_free(host_perfdata.buf);
+	nm_free(service_perfdata.buf);
+	host_perfdata.alloc = service_perfdata.alloc = 0;
+
 	return OK;
 }
 
@@ -192,7 +303,7 @@ int xpddefault_update_service_performance_data(service *svc)
 		if (!svc || !svc->perf_data || !*svc->perf_data) {
 			return OK;
 		}
-		if ((!service_perfdata_fp || !service_perfdata_file_template) && !service_perfdata_command) {
+		if ((service_perfdata.fd < 0 || !service_perfdata_file_template) && !service_perfdata_command) {
 			return OK;
 		}
 
@@ -238,7 +349,7 @@ int xpddefault_update_host_performance_data(host *hst)
 		if (!hst || !hst->perf_data || !*hst->perf_data) {
 			return OK;
 		}
-		if ((!host_perfdata_fp || !host_perfdata_file_template) && !host_perfdata_command) {
+		if ((host_perfdata.fd < 0 || !host_perfdata_file_template) && !host_perfdata_command) {
 			return OK;
 		}
 	}
@@ -353,85 +464,183 @@ int xpddefault_run_host_performance_data_command(nagios_macros *mac, host *hst)
 /**************** FILE PERFORMANCE DATA FUNCTIONS *****************/
 /******************************************************************/
 
-/* open the host performance data file for writing */
-int xpddefault_open_host_perfdata_file(void)
+/* returns a name to rotate a perfdata file to that isn't in use yet */
+static char *xpddefault_rotated_name(const char *path)
 {
+	unsigned long now = (unsigned long)time(NULL);
+	char *name = NULL;
+	int i;
+
+	nm_asprintf(&name, "%s.%lu", path, now);
+	for (i = 1; !access(name, F_OK); i++) {
+		nm_free(name);
+		nm_asprintf(&name, "%s.%lu.%d", path, now, i);
+	}
 
-	if (host_perfdata_file != NULL) {
+	return name;
+}
 
-		if (host_perfdata_file_pipe == TRUE) {
-			/* must open read-write to avoid failure if the other end isn't ready yet */
-			host_perfdata_fd = open(host_perfdata_file, O_NONBLOCK | O_RDWR | O_CREAT, 0644);
-			host_perfdata_fp = fdopen(host_perfdata_fd, "w");
-		} else
-			host_perfdata_fp = fopen(host_perfdata_file, (host_perfdata_file_append == TRUE) ? "a" : "w");
 
-		if (host_perfdata_fp == NULL) {
+static int xpddefault_open_perfdata_file(struct perfdata_file *pf)
+{
+	struct stat st;
 
-			nm_log(NSLOG_RUNTIME_WARNING, "Warning: File '%s' could not be opened - host performance data will not be written to file!\n", host_perfdata_file);
+	if (*pf->path == NULL)
+		return OK;
 
-			return ERROR;
-		}
+	if (*pf->pipe == TRUE) {
+		/* must open read-write to avoid failure if the other end isn't ready yet */
+		pf->fd = open(*pf->path, O_NONBLOCK | O_RDWR | pf->pipe_flags, 0644);
+	} else {
+		pf->fd = open(*pf->path, O_WRONLY | O_CREAT | (*pf->append == TRUE ? O_APPEND : O_TRUNC), 0666);
 	}
 
+	if (pf->fd < 0) {
+		nm_log(NSLOG_RUNTIME_WARNING, "Warning: File '%s' could not be opened - %s performance data will not be written to file!\n", *pf->path, pf->name);
+		return ERROR;
+	}
+
+	pf->size = 0;
+	if (*pf->pipe == FALSE && !fstat(pf->fd, &st))
+		pf->size = st.st_size;
+	pf->last_flush = time(NULL);
+
 	return OK;
 }
 
 
-/* open the service performance data file for writing */
-int xpddefault_open_service_perfdata_file(void)
+static void xpddefault_rotate_perfdata_file(struct perfdata_file *pf)
+{
+	char *rotated = xpddefault_rotated_name(*pf->path);
+
+	close(pf->fd);
+	pf->fd = -1;
+	if (rename(*pf->path, rotated) < 0) {
+		nm_log(NSLOG_RUNTIME_WARNING, "Warning: Failed to rotate %s performance data file '%s' to '%s': %s\n", pf->name, *pf->path, rotated, strerror(errno));
+	} else {
+		pf->rotations++;
+		log_debug_info(DEBUGL_PERFDATA, 1, "Rotated %s performance data file to '%s' at %llu bytes\n", pf->name, rotated, pf->size);
+	}
+	nm_free(rotated);
+	xpddefault_open_perfdata_file(pf);
+}
+
+
+/*
+ * Writes out whatever is buffered. A pipe nobody reads from is left
+ * to fill up and what doesn't fit is kept for the next attempt, but
+ * only up to a point, after which it's dropped rather than letting
+ * the buffer grow without bounds.
+ */
+static int xpddefault_flush_perfdata_file(struct perfdata_file *pf)
 {
+	size_t done = 0, backlog;
+	ssize_t ret;
+	int error = 0;
 
-	if (service_perfdata_file != NULL) {
-		if (service_perfdata_file_pipe == TRUE) {
-			/* must open read-write to avoid failure if the other end isn't ready yet */
-			service_perfdata_fd = open(service_perfdata_file, O_NONBLOCK | O_RDWR);
-			service_perfdata_fp = fdopen(service_perfdata_fd, "w");
-		} else
-			service_perfdata_fp = fopen(service_perfdata_file, (service_perfdata_file_append == TRUE) ? "a" : "w");
+	pf->last_flush = time(NULL);
+	if (!pf->len)
+		return OK;
 
-		if (service_perfdata_fp == NULL) {
+	backlog = perfdata_file_buffer_size * 4;
+	if (backlog < 1024 * 1024)
+		backlog = 1024 * 1024;
 
-			nm_log(NSLOG_RUNTIME_WARNING, "Warning: File '%s' could not be opened - service performance data will not be written to file!\n", service_perfdata_file);
+	/* lines are kept until the processing command lets go of the file */
+	if (pf->held && pf->len <= backlog)
+		return OK;
 
-			return ERROR;
+	while (pf->fd >= 0 && done < pf->len) {
+		ret = write(pf->fd, pf->buf + done, pf->len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			error = errno;
+			break;
 		}
+		pf->writes++;
+		done += ret;
 	}
+	pf->bytes += done;
+	pf->size += done;
 
-	return OK;
+	if (done < pf->len) {
+		if (pf->fd >= 0 && error == EAGAIN && pf->len - done <= backlog) {
+			memmove(pf->buf, pf->buf + done, pf->len - done);
+			pf->len -= done;
+			return OK;
+		}
+		log_debug_info(DEBUGL_PERFDATA, 0, "Dropping %lu bytes of %s performance data: %s\n",
+		               (unsigned long)(pf->len - done), pf->name, pf->fd < 0 ? "file not open" : strerror(error));
+		pf->dropped += pf->len - done;
+	}
+	pf->len = 0;
+
+	if (pf->fd >= 0 && *pf->pipe == FALSE && *pf->rotation_size && pf->size >= *pf->rotation_size)
+		xpddefault_rotate_perfdata_file(pf);
+
+	return error ? ERROR : OK;
 }
 
 
-/* close the host performance data file */
-int xpddefault_close_host_perfdata_file(void)
+static int xpddefault_close_perfdata_file(struct perfdata_file *pf)
 {
+	pf->held = FALSE;
+	xpddefault_flush_perfdata_file(pf);
 
-	if (host_perfdata_fp != NULL)
-		fclose(host_perfdata_fp);
-	if (host_perfdata_fd >= 0) {
-		close(host_perfdata_fd);
-		host_perfdata_fd = -1;
+	/* a pipe whose reader never showed up may still have some left */
+	if (pf->len) {
+		pf->dropped += pf->len;
+		pf->len = 0;
+	}
+
+	if (pf->fd >= 0) {
+		close(pf->fd);
+		pf->fd = -1;
 	}
 
 	return OK;
 }
 
 
-/* close the service performance data file */
-int xpddefault_close_service_perfdata_file(void)
+/* flushes perfdata that's been buffered for too long */
+int xpddefault_flush_perfdata_files(void)
 {
-
-	if (service_perfdata_fp != NULL)
-		fclose(service_perfdata_fp);
-	if (service_perfdata_fd >= 0) {
-		close(service_perfdata_fd);
-		service_perfdata_fd = -1;
-	}
+	xpddefault_flush_perfdata_file(&host_perfdata);
+	xpddefault_flush_perfdata_file(&service_perfdata);
 
 	return OK;
 }
 
 
+/* open the host performance data file for writing */
+int xpddefault_open_host_perfdata_file(void)
+{
+	return xpddefault_open_perfdata_file(&host_perfdata);
+}
+
+
+/* open the service performance data file for writing */
+int xpddefault_open_service_perfdata_file(void)
+{
+	return xpddefault_open_perfdata_file(&service_perfdata);
+}
+
+
+/* close the host performance data file */
+int xpddefault_close_host_perfdata_file(void)
+{
+	return xpddefault_close_perfdata_file(&host_perfdata);
+}
+
+
+/* close the service performance data file */
+int xpddefault_close_service_perfdata_file(void)
+{
+	return xpddefault_close_perfdata_file(&service_perfdata);
+}
+
+
 /* processes delimiter characters in templates */
 int xpddefault_preprocess_file_templates(char *template)
 {
@@ -470,201 +679,380 @@ int xpddefault_preprocess_file_templates(char *template)
 }
 
 
-/* updates service performance data file */
-int xpddefault_update_service_performance_data_file(nagios_macros *mac, service *svc)
+static void xpddefault_free_file_template(struct perfdata_file *pf)
 {
-	char *raw_output = NULL;
-	char *processed_output = NULL;
-	int result = OK;
+	unsigned int i;
 
-	log_debug_info(DEBUGL_FUNCTIONS, 0, "update_service_performance_data_file()\n");
+	for (i = 0; i < pf->num_parts; i++)
+		nm_free(pf->parts[i].str);
+	nm_free(pf->parts);
+	pf->num_parts = 0;
+}
 
-	if (svc == NULL)
-		return ERROR;
 
-	/* we don't have a file to write to*/
-	if (service_perfdata_fp == NULL || service_perfdata_file_template == NULL)
-		return OK;
+static void xpddefault_add_template_part(struct perfdata_file *pf, const char *str, size_t len, int is_macro, int terminated)
+{
+	struct perfdata_template_part *part;
+
+	/* runs of plain text, such as an escaped $, are kept as one part */
+	if (!is_macro && pf->num_parts && !pf->parts[pf->num_parts - 1].is_macro) {
+		part = &pf->parts[pf->num_parts - 1];
+		part->str = nm_realloc(part->str, part->len + len + 1);
+		memcpy(part->str + part->len, str, len);
+		part->len += len;
+		part->str[part->len] = 0;
+		return;
+	}
 
-	/* get the raw line to write */
-	raw_output = nm_strdup(service_perfdata_file_template);
+	pf->parts = nm_realloc(pf->parts, (pf->num_parts + 1) * sizeof(*pf->parts));
+	part = &pf->parts[pf->num_parts++];
+	part->str = nm_strndup(str, len);
+	part->len = len;
+	part->is_macro = is_macro;
+	part->terminated = terminated;
+	part->code = -1;
 
-	log_debug_info(DEBUGL_PERFDATA, 2, "Raw service performance data file output: %s\n", raw_output);
+	/*
+	 * plain "x" macros are resolved right away. Those with arguments,
+	 * and the ones grab_macro_value_r() has shortcuts for, are left
+	 * to it, just as process_macros_r() would.
+	 */
+	if (is_macro && !strchr(part->str, ':') && strncmp(part->str, "ARG", 3) &&
+	    strncmp(part->str, "USER", 4) && strcmp(part->str, "HOSTADDRESS"))
+	{
+		part->code = find_macrox_code(part->str);
+	}
+}
 
-	/* process any macros in the raw output line */
-	process_macros_r(mac, raw_output, &processed_output, 0);
-	if (processed_output == NULL)
-		return ERROR;
 
-	log_debug_info(DEBUGL_PERFDATA, 2, "Processed service performance data file output: %s\n", processed_output);
+/*
+ * Splits a file template the same way process_macros_r() does, so
+ * the lines we write come out exactly as they did when the template
+ * was run through it for every line.
+ */
+static void xpddefault_compile_file_template(struct perfdata_file *pf)
+{
+	const char *p, *delim;
+	size_t len;
+	int in_macro = FALSE;
+
+	xpddefault_free_file_template(pf);
+	if (*pf->template == NULL)
+		return;
+
+	for (p = *pf->template; p; in_macro = !in_macro) {
+		if ((delim = strchr(p, '$'))) {
+			len = delim - p;
+		} else {
+			len = strlen(p);
+		}
 
-	/* write to host performance data file */
-	fputs(processed_output, service_perfdata_fp);
-	fputc('\n', service_perfdata_fp);
-	fflush(service_perfdata_fp);
+		if (in_macro == FALSE) {
+			if (len)
+				xpddefault_add_template_part(pf, p, len, FALSE, FALSE);
+		} else if (!len) {
+			/* an escaped $ is done by specifying two $$ next to each other */
+			xpddefault_add_template_part(pf, "$", 1, FALSE, FALSE);
+		} else {
+			xpddefault_add_template_part(pf, p, len, TRUE, delim != NULL);
+		}
 
-	nm_free(raw_output);
-	nm_free(processed_output);
+		p = delim ? delim + 1 : NULL;
+	}
+}
 
-	return result;
+
+static inline void xpddefault_buffer_append(struct perfdata_file *pf, const char *str, size_t len)
+{
+	if (pf->len + len > pf->alloc) {
+		pf->alloc = pf->alloc ? pf->alloc : 4096;
+		while (pf->len + len > pf->alloc)
+			pf->alloc *= 2;
+		pf->buf = nm_realloc(pf->buf, pf->alloc);
+	}
+	memcpy(pf->buf + pf->len, str, len);
+	pf->len += len;
+}
+
+
+/* adds a line to a performance data file */
+static int xpddefault_update_perfdata_file(struct perfdata_file *pf, nagios_macros *mac)
+{
+	struct perfdata_template_part *part;
+	size_t start = pf->len;
+	unsigned int i;
+
+	for (i = 0; i < pf->num_parts; i++) {
+		char *value = NULL;
+		int free_macro = FALSE, result;
+
+		part = &pf->parts[i];
+		if (!part->is_macro) {
+			xpddefault_buffer_append(pf, part->str, part->len);
+			continue;
+		}
+
+		if (part->code >= 0)
+			result = grab_macrox_value_r(mac, part->code, NULL, NULL, &value, &free_macro);
+		else
+			result = grab_macro_value_r(mac, part->str, &value, NULL, &free_macro);
+
+		/* macros that don't exist are left as they are */
+		if (result != OK) {
+			xpddefault_buffer_append(pf, "$", 1);
+			xpddefault_buffer_append(pf, part->str, part->len);
+			if (part->terminated)
+				xpddefault_buffer_append(pf, "$", 1);
+		} else if (value) {
+			xpddefault_buffer_append(pf, value, strlen(value));
+		}
+
+		if (free_macro == TRUE)
+			nm_free(value);
+	}
+
+	log_debug_info(DEBUGL_PERFDATA, 2, "Processed %s performance data file output: %.*s\n",
+	               pf->name, (int)(pf->len - start), pf->buf + start);
+
+	xpddefault_buffer_append(pf, "\n", 1);
+	pf->lines++;
+
+	if (pf->len >= perfdata_file_buffer_size ||
+	    (perfdata_file_flush_interval && time(NULL) >= pf->last_flush + (time_t)perfdata_file_flush_interval))
+	{
+		return xpddefault_flush_perfdata_file(pf);
+	}
+
+	return OK;
+}
+
+
+/* updates service performance data file */
+int xpddefault_update_service_performance_data_file(nagios_macros *mac, service *svc)
+{
+	log_debug_info(DEBUGL_FUNCTIONS, 0, "update_service_performance_data_file()\n");
+
+	if (svc == NULL)
+		return ERROR;
+
+	/* we don't have a file to write to*/
+	if ((service_perfdata.fd < 0 && !service_perfdata.held) || service_perfdata_file_template == NULL)
+		return OK;
+
+	return xpddefault_update_perfdata_file(&service_perfdata, mac);
 }
 
 
 /* updates host performance data file */
 int xpddefault_update_host_performance_data_file(nagios_macros *mac, host *hst)
 {
-	char *raw_output = NULL;
-	char *processed_output = NULL;
-	int result = OK;
-
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "update_host_performance_data_file()\n");
 
 	if (hst == NULL)
 		return ERROR;
 
 	/* we don't have a host perfdata file */
-	if (host_perfdata_fp == NULL || host_perfdata_file_template == NULL)
+	if ((host_perfdata.fd < 0 && !host_perfdata.held) || host_perfdata_file_template == NULL)
 		return OK;
 
-	/* get the raw output */
-	raw_output = nm_strdup(host_perfdata_file_template);
-
-	log_debug_info(DEBUGL_PERFDATA, 2, "Raw host performance file output: %s\n", raw_output);
+	return xpddefault_update_perfdata_file(&host_perfdata, mac);
+}
 
-	/* process any macros in the raw output */
-	process_macros_r(mac, raw_output, &processed_output, 0);
-	if (processed_output == NULL)
-		return ERROR;
 
-	log_debug_info(DEBUGL_PERFDATA, 2, "Processed host performance data file output: %s\n", processed_output);
+/*
+ * Processing a perfdata file is left to a worker, so the core never
+ * waits for it. A command that's told which file to process through
+ * $HOSTPERFDATAFILE$ or $SERVICEPERFDATAFILE$ gets the file renamed
+ * out of the way first, with a new one opened in its place right
+ * away, so checks keep writing to the new file while the command
+ * works on the old one and the two never touch the same file.
+ *
+ * Commands that have the file's path hardcoded instead (moving it to
+ * a spool directory, say) would never see the renamed file. For those
+ * the file is closed until the command is done, and lines are kept in
+ * the write buffer meanwhile.
+ */
+static void xpddefault_perfdata_file_job_handler(struct wproc_result *wpres, void *data, int flags)
+{
+	struct perfdata_processor *proc = (struct perfdata_processor *)data;
+	struct perfdata_file *pf = proc->perfdata;
+	double runtime;
+
+	proc->running = FALSE;
+
+	/* NULL means the job is being discarded */
+	if (wpres) {
+		runtime = tv_delta_f(&wpres->start, &wpres->stop);
+		proc->runs++;
+		proc->runtime_last = runtime;
+		proc->runtime_total += runtime;
+		if (runtime > proc->runtime_max)
+			proc->runtime_max = runtime;
+
+		if (wpres->early_timeout) {
+			proc->timeouts++;
+			nm_log(NSLOG_RUNTIME_WARNING, "Warning: %s performance data file processing command '%s' timed out after %d seconds\n",
+			       proc->name, wpres->command, perfdata_timeout);
+		} else if (!wpres->exited_ok || !WIFEXITED(wpres->wait_status) || WEXITSTATUS(wpres->wait_status)) {
+			proc->failures++;
+			log_debug_info(DEBUGL_PERFDATA, 0, "%s performance data file processing command '%s' failed (wait status %d)\n",
+			               proc->name, wpres->command, wpres->wait_status);
+		}
 
-	/* write to host performance data file */
-	fputs(processed_output, host_perfdata_fp);
-	fputc('\n', host_perfdata_fp);
-	fflush(host_perfdata_fp);
+		if (proc->rotated && !access(proc->rotated, F_OK)) {
+			nm_log(NSLOG_RUNTIME_WARNING, "Warning: %s performance data file processing command left '%s' behind. "
+			       "Use $%sPERFDATAFILE$ to refer to the file it should process.\n",
+			       proc->name, proc->rotated, proc->macro_prefix);
+		}
+	}
 
-	nm_free(raw_output);
-	nm_free(processed_output);
+	nm_free(proc->rotated);
 
-	return result;
+	/* let go of the file and write out what piled up meanwhile */
+	if (pf->held) {
+		pf->held = FALSE;
+		proc->open();
+		xpddefault_flush_perfdata_file(pf);
+	}
 }
 
+/* tells if a command is given the file to process through its macro */
+static int xpddefault_names_perfdata_file(struct perfdata_processor *proc, nagios_macros *mac, const char *raw_command_line)
+{
+	char macro[32];
+	int i;
+
+	snprintf(macro, sizeof(macro), "$%sPERFDATAFILE$", proc->macro_prefix);
+	if (strstr(raw_command_line, macro))
+		return TRUE;
+	for (i = 0; i < MAX_COMMAND_ARGUMENTS; i++) {
+		if (mac->argv[i] && strstr(mac->argv[i], macro))
+			return TRUE;
+	}
+	return FALSE;
+}
 
-/* periodically process the host perf data file */
-int xpddefault_process_host_perfdata_file(void)
+static int xpddefault_process_perfdata_file(struct perfdata_processor *proc)
 {
+	nagios_macros mac, *global_mac = get_global_macros();
+	struct perfdata_file *pf = proc->perfdata;
 	char *raw_command_line = NULL;
 	char *processed_command_line = NULL;
-	int early_timeout = FALSE;
-	double exectime = 0.0;
-	int result = OK;
+	char *saved_macro = NULL;
 	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
-	nagios_macros mac;
-
-	log_debug_info(DEBUGL_FUNCTIONS, 0, "process_host_perfdata_file()\n");
+	int result;
 
 	/* we don't have a command */
-	if (host_perfdata_file_processing_command == NULL)
+	if (*proc->command == NULL)
 		return OK;
 
+	/* let the last run finish rather than pile more of them up */
+	if (proc->running) {
+		proc->skipped++;
+		log_debug_info(DEBUGL_PERFDATA, 1, "%s performance data file processing command still running. Skipping this run\n", proc->name);
+		return OK;
+	}
+
 	/* init macros */
 	memset(&mac, 0, sizeof(mac));
 
 	/* get the raw command line */
-	get_raw_command_line_r(&mac, host_perfdata_file_processing_command_ptr, host_perfdata_file_processing_command, &raw_command_line, macro_options);
+	get_raw_command_line_r(&mac, *proc->command_ptr, *proc->command, &raw_command_line, macro_options);
 	if (raw_command_line == NULL) {
 		clear_volatile_macros_r(&mac);
 		return ERROR;
 	}
 
-	log_debug_info(DEBUGL_PERFDATA, 2, "Raw host performance data file processing command line: %s\n", raw_command_line);
+	log_debug_info(DEBUGL_PERFDATA, 2, "Raw %s performance data file processing command line: %s\n", proc->name, raw_command_line);
+
+	/* hand the file over, unless it's a pipe */
+	if (*proc->file && !*proc->pipe) {
+		proc->close();
+		if (xpddefault_names_perfdata_file(proc, &mac, raw_command_line)) {
+			proc->rotated = xpddefault_rotated_name(*proc->file);
+			if (rename(*proc->file, proc->rotated) < 0) {
+				log_debug_info(DEBUGL_PERFDATA, 1, "Failed to rename '%s' to '%s': %s\n", *proc->file, proc->rotated, strerror(errno));
+				nm_free(proc->rotated);
+			}
+			proc->open();
+		} else {
+			log_debug_info(DEBUGL_PERFDATA, 1, "%s performance data file processing command has the path hardcoded. Holding on to new lines until it's done\n", proc->name);
+			pf->held = TRUE;
+		}
+	}
 
 	/* process any macros in the raw command line */
+	if (proc->rotated) {
+		saved_macro = global_mac->x[proc->macro];
+		global_mac->x[proc->macro] = proc->rotated;
+	}
 	process_macros_r(&mac, raw_command_line, &processed_command_line, macro_options);
+	if (proc->rotated)
+		global_mac->x[proc->macro] = saved_macro;
 	nm_free(raw_command_line);
-	if (processed_command_line == NULL) {
-		clear_volatile_macros_r(&mac);
-		return ERROR;
-	}
 
-	log_debug_info(DEBUGL_PERFDATA, 2, "Processed host performance data file processing command line: %s\n", processed_command_line);
-
-	/* close the performance data file */
-	xpddefault_close_host_perfdata_file();
+	log_debug_info(DEBUGL_PERFDATA, 2, "Processed %s performance data file processing command line: %s\n", proc->name, processed_command_line ? processed_command_line : "(null)");
 
 	/* run the command */
-	my_system_r(&mac, processed_command_line, perfdata_timeout, &early_timeout, &exectime, NULL, 0);
-	clear_volatile_macros_r(&mac);
+	result = processed_command_line ? wproc_run_callback(processed_command_line, perfdata_timeout, xpddefault_perfdata_file_job_handler, proc, &mac) : ERROR;
+	if (result == OK) {
+		proc->running = TRUE;
+	} else {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to run %s performance data file processing command '%s'\n", proc->name, processed_command_line ? processed_command_line : *proc->command);
+		xpddefault_perfdata_file_job_handler(NULL, proc, 0);
+	}
 
-	/* re-open the performance data file */
-	xpddefault_open_host_perfdata_file();
+	clear_volatile_macros_r(&mac);
+	nm_free(processed_command_line);
 
-	/* check to see if the command timed out */
-	if (early_timeout == TRUE)
-		nm_log(NSLOG_RUNTIME_WARNING, "Warning: Host performance data file processing command '%s' timed out after %d seconds\n", processed_command_line, perfdata_timeout);
+	return result == OK ? OK : ERROR;
+}
 
 
-	nm_free(processed_command_line);
+/* periodically process the host perf data file */
+int xpddefault_process_host_perfdata_file(void)
+{
+	log_debug_info(DEBUGL_FUNCTIONS, 0, "process_host_perfdata_file()\n");
 
-	return result;
+	return xpddefault_process_perfdata_file(&host_processor);
 }
 
 
 /* periodically process the service perf data file */
 int xpddefault_process_service_perfdata_file(void)
 {
-	char *raw_command_line = NULL;
-	char *processed_command_line = NULL;
-	int early_timeout = FALSE;
-	double exectime = 0.0;
-	int result = OK;
-	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
-	nagios_macros mac;
-
 	log_debug_info(DEBUGL_FUNCTIONS, 0, "process_service_perfdata_file()\n");
 
-	/* we don't have a command */
-	if (service_perfdata_file_processing_command == NULL)
-		return OK;
+	return xpddefault_process_perfdata_file(&service_processor);
+}
 
-	/* init macros */
-	memset(&mac, 0, sizeof(mac));
 
-	/* get the raw command line */
-	get_raw_command_line_r(&mac, service_perfdata_file_processing_command_ptr, service_perfdata_file_processing_command, &raw_command_line, macro_options);
-	if (raw_command_line == NULL) {
-		clear_volatile_macros_r(&mac);
-		return ERROR;
-	}
+/* prints perfdata file writing and processing statistics */
+int xpddefault_dump_processing_stats(int sd)
+{
+	struct perfdata_processor *procs[] = { &host_processor, &service_processor };
+	struct perfdata_file *files[] = { &host_perfdata, &service_perfdata };
+	unsigned int i;
 
-	log_debug_info(DEBUGL_PERFDATA, 2, "Raw service performance data file processing command line: %s\n", raw_command_line);
+	for (i = 0; i < ARRAY_SIZE(files); i++) {
+		struct perfdata_file *pf = files[i];
 
-	/* process any macros in the raw command line */
-	process_macros_r(&mac, raw_command_line, &processed_command_line, macro_options);
-	nm_free(raw_command_line);
-	if (processed_command_line == NULL) {
-		clear_volatile_macros_r(&mac);
-		return ERROR;
+		nsock_printf(sd, "%s_file_lines=%llu;%s_file_writes=%llu;%s_file_bytes=%llu;%s_file_buffered=%lu;"
+		             "%s_file_rotations=%lu;%s_file_dropped=%llu;",
+		             pf->name, pf->lines, pf->name, pf->writes, pf->name, pf->bytes,
+		             pf->name, (unsigned long)pf->len, pf->name, pf->rotations, pf->name, pf->dropped);
 	}
 
-	log_debug_info(DEBUGL_PERFDATA, 2, "Processed service performance data file processing command line: %s\n", processed_command_line);
-
-	/* close the performance data file */
-	xpddefault_close_service_perfdata_file();
-
-	/* run the command */
-	my_system_r(&mac, processed_command_line, perfdata_timeout, &early_timeout, &exectime, NULL, 0);
-
-	/* re-open the performance data file */
-	xpddefault_open_service_perfdata_file();
-
-	clear_volatile_macros_r(&mac);
-
-	/* check to see if the command timed out */
-	if (early_timeout == TRUE)
-		nm_log(NSLOG_RUNTIME_WARNING, "Warning: Service performance data file processing command '%s' timed out after %d seconds\n", processed_command_line, perfdata_timeout);
-
-	nm_free(processed_command_line);
+	for (i = 0; i < ARRAY_SIZE(procs); i++) {
+		struct perfdata_processor *proc = procs[i];
 
-	return result;
+		nsock_printf(sd, "%s_running=%d;%s_runs=%lu;%s_skipped=%lu;%s_timeouts=%lu;%s_failures=%lu;"
+		             "%s_runtime_last=%.3f;%s_runtime_max=%.3f;%s_runtime_avg=%.3f;",
+		             proc->name, proc->running, proc->name, proc->runs, proc->name, proc->skipped,
+		             proc->name, proc->timeouts, proc->name, proc->failures,
+		             proc->name, proc->runtime_last, proc->name, proc->runtime_max,
+		             proc->name, proc->runs ? proc->runtime_total / proc->runs : 0.0);
+	}
+	nsock_printf(sd, "%c", 0);
+	return 0;
 }
@@ -27,9 +27,11 @@ int xpddefault_open_host_perfdata_file(void);
 int xpddefault_open_service_perfdata_file(void);
 int xpddefault_close_host_perfdata_file(void);
 int xpddefault_close_service_perfdata_file(void);
+int xpddefault_flush_perfdata_files(void);
 
 int xpddefault_process_host_perfdata_file(void);
 int xpddefault_process_service_perfdata_file(void);
+int xpddefault_dump_processing_stats(int sd);
 
 NAGIOS_END_DECL
 
@@ -1076,6 +1076,7 @@ int xrddefault_read_state_information(void)
 									break;
 							}
 							temp_host->state_history_index = 0;
+							temp_host->state_history_changes = pack_state_history(temp_host->state_history, 0);
 						} else
 							found_directive = FALSE;
 					}
@@ -1337,6 +1338,7 @@ int xrddefault_read_state_information(void)
 									break;
 							}
 							temp_service->state_history_index = 0;
+							temp_service->state_history_changes = pack_state_history(temp_service->state_history, 0);
 						} else
 							found_directive = FALSE;
 					}
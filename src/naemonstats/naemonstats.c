@@ -4,8 +4,11 @@
 
 #include <getopt.h>
 #include <string.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include "lib/nspath.h"
+#include "lib/nsock.h"
 #include "config.h"
 #include <naemon/common.h>
 #include <naemon/defaults.h>
@@ -19,6 +22,8 @@
 
 static char *main_config_file = NULL;
 char *status_file = NULL;
+static char *query_socket = NULL;
+static int live_data = FALSE;
 static char *mrtg_variables = NULL;
 static const char *mrtg_delimiter = "\n";
 
@@ -172,10 +177,95 @@ static int external_commands_last_1min = 0;
 static int external_commands_last_5min = 0;
 static int external_commands_last_15min = 0;
 
+/* what the core's "stats" query handler tells us, and where it goes */
+static const struct live_variable {
+	const char *name;
+	int *int_value;
+	double *double_value;
+} live_variables[] = {
+	{ "status_host_entries", &status_host_entries, NULL },
+	{ "hosts_checked", &hosts_checked, NULL },
+	{ "hosts_scheduled", &hosts_scheduled, NULL },
+	{ "hosts_flapping", &hosts_flapping, NULL },
+	{ "hosts_in_downtime", &hosts_in_downtime, NULL },
+	{ "hosts_up", &hosts_up, NULL },
+	{ "hosts_down", &hosts_down, NULL },
+	{ "hosts_unreachable", &hosts_unreachable, NULL },
+	{ "min_host_state_change", NULL, &min_host_state_change },
+	{ "max_host_state_change", NULL, &max_host_state_change },
+	{ "average_host_state_change", NULL, &average_host_state_change },
+	{ "passive_host_checks", &passive_host_checks, NULL },
+	{ "min_passive_host_latency", NULL, &min_passive_host_latency },
+	{ "max_passive_host_latency", NULL, &max_passive_host_latency },
+	{ "average_passive_host_latency", NULL, &average_passive_host_latency },
+	{ "min_passive_host_state_change", NULL, &min_passive_host_state_change },
+	{ "max_passive_host_state_change", NULL, &max_passive_host_state_change },
+	{ "average_passive_host_state_change", NULL, &average_passive_host_state_change },
+	{ "passive_hosts_checked_last_1min", &passive_hosts_checked_last_1min, NULL },
+	{ "passive_hosts_checked_last_5min", &passive_hosts_checked_last_5min, NULL },
+	{ "passive_hosts_checked_last_15min", &passive_hosts_checked_last_15min, NULL },
+	{ "passive_hosts_checked_last_1hour", &passive_hosts_checked_last_1hour, NULL },
+	{ "active_host_checks", &active_host_checks, NULL },
+	{ "min_active_host_latency", NULL, &min_active_host_latency },
+	{ "max_active_host_latency", NULL, &max_active_host_latency },
+	{ "average_active_host_latency", NULL, &average_active_host_latency },
+	{ "min_active_host_execution_time", NULL, &min_active_host_execution_time },
+	{ "max_active_host_execution_time", NULL, &max_active_host_execution_time },
+	{ "average_active_host_execution_time", NULL, &average_active_host_execution_time },
+	{ "min_active_host_state_change", NULL, &min_active_host_state_change },
+	{ "max_active_host_state_change", NULL, &max_active_host_state_change },
+	{ "average_active_host_state_change", NULL, &average_active_host_state_change },
+	{ "active_hosts_checked_last_1min", &active_hosts_checked_last_1min, NULL },
+	{ "active_hosts_checked_last_5min", &active_hosts_checked_last_5min, NULL },
+	{ "active_hosts_checked_last_15min", &active_hosts_checked_last_15min, NULL },
+	{ "active_hosts_checked_last_1hour", &active_hosts_checked_last_1hour, NULL },
+	{ "status_service_entries", &status_service_entries, NULL },
+	{ "services_checked", &services_checked, NULL },
+	{ "services_scheduled", &services_scheduled, NULL },
+	{ "services_flapping", &services_flapping, NULL },
+	{ "services_in_downtime", &services_in_downtime, NULL },
+	{ "services_ok", &services_ok, NULL },
+	{ "services_warning", &services_warning, NULL },
+	{ "services_critical", &services_critical, NULL },
+	{ "services_unknown", &services_unknown, NULL },
+	{ "min_service_state_change", NULL, &min_service_state_change },
+	{ "max_service_state_change", NULL, &max_service_state_change },
+	{ "average_service_state_change", NULL, &average_service_state_change },
+	{ "passive_service_checks", &passive_service_checks, NULL },
+	{ "min_passive_service_latency", NULL, &min_passive_service_latency },
+	{ "max_passive_service_latency", NULL, &max_passive_service_latency },
+	{ "average_passive_service_latency", NULL, &average_passive_service_latency },
+	{ "min_passive_service_state_change", NULL, &min_passive_service_state_change },
+	{ "max_passive_service_state_change", NULL, &max_passive_service_state_change },
+	{ "average_passive_service_state_change", NULL, &average_passive_service_state_change },
+	{ "passive_services_checked_last_1min", &passive_services_checked_last_1min, NULL },
+	{ "passive_services_checked_last_5min", &passive_services_checked_last_5min, NULL },
+	{ "passive_services_checked_last_15min", &passive_services_checked_last_15min, NULL },
+	{ "passive_services_checked_last_1hour", &passive_services_checked_last_1hour, NULL },
+	{ "active_service_checks", &active_service_checks, NULL },
+	{ "min_active_service_latency", NULL, &min_active_service_latency },
+	{ "max_active_service_latency", NULL, &max_active_service_latency },
+	{ "average_active_service_latency", NULL, &average_active_service_latency },
+	{ "min_active_service_execution_time", NULL, &min_active_service_execution_time },
+	{ "max_active_service_execution_time", NULL, &max_active_service_execution_time },
+	{ "average_active_service_execution_time", NULL, &average_active_service_execution_time },
+	{ "min_active_service_state_change", NULL, &min_active_service_state_change },
+	{ "max_active_service_state_change", NULL, &max_active_service_state_change },
+	{ "average_active_service_state_change", NULL, &average_active_service_state_change },
+	{ "active_services_checked_last_1min", &active_services_checked_last_1min, NULL },
+	{ "active_services_checked_last_5min", &active_services_checked_last_5min, NULL },
+	{ "active_services_checked_last_15min", &active_services_checked_last_15min, NULL },
+	{ "active_services_checked_last_1hour", &active_services_checked_last_1hour, NULL },
+	{ NULL, NULL, NULL }
+};
+
 static int display_mrtg_values(void);
 static int display_stats(void);
 static int read_config_file(void);
 static int read_status_file(void);
+static int read_query_socket(void);
+static void read_program_variable(char *var, char *val);
+static void sum_check_stats(void);
 
 
 int main(int argc, char **argv)
@@ -194,6 +284,7 @@ int main(int argc, char **argv)
 		{"license", no_argument, NULL, 'L'},
 		{"config", required_argument, NULL, 'c'},
 		{"statsfile", required_argument, NULL, 's'},
+		{"query-socket", required_argument, NULL, 'q'},
 		{"mrtg", no_argument, NULL, 'm'},
 		{"data", required_argument, NULL, 'd'},
 		{"delimiter", required_argument, NULL, 'D'},
@@ -208,7 +299,7 @@ int main(int argc, char **argv)
 	/* get all command line arguments */
 	while (1) {
 
-		c = getopt(argc, argv, "+hVLc:ms:d:D:");
+		c = getopt(argc, argv, "+hVLc:ms:q:d:D:");
 
 		if (c == -1 || c == EOF)
 			break;
@@ -233,6 +324,9 @@ int main(int argc, char **argv)
 		case 's':
 			status_file = strdup(optarg);
 			break;
+		case 'q':
+			query_socket = strdup(optarg);
+			break;
 		case 'm':
 			mrtg_mode = TRUE;
 			break;
@@ -286,6 +380,9 @@ int main(int argc, char **argv)
 		printf(" -c, --config=FILE  specifies location of main Naemon config file.\n");
 		printf(" -s, --statsfile=FILE  specifies alternate location of file to read Naemon\n");
 		printf("                       performance data from.\n");
+		printf(" -q, --query-socket=FILE  specifies the query handler socket of a running\n");
+		printf("                          Naemon to ask for the data first. Defaults to the\n");
+		printf("                          query_socket in the main config file.\n");
 		printf("\n");
 		printf("Output:\n");
 		printf(" -m, --mrtg         display output in MRTG compatible format.\n");
@@ -373,8 +470,12 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* a running core has it all added up already, so ask it first */
+	result = read_query_socket();
+
 	/* read status file */
-	result = read_status_file();
+	if (result != OK)
+		result = read_status_file();
 	if (result == ERROR && mrtg_mode == FALSE) {
 		printf("Error reading status file '%s': %s\n", status_file, strerror(errno));
 		return 1;
@@ -727,11 +828,17 @@ static int display_stats(void)
 
 	printf("CURRENT STATUS DATA\n");
 	printf("------------------------------------------------------\n");
-	printf("Status File:                            %s\n", status_file);
 	time_difference = (current_time - status_creation_date);
 	get_time_breakdown(time_difference, &days, &hours, &minutes, &seconds);
-	printf("Status File Age:                        %dd %dh %dm %ds\n", days, hours, minutes, seconds);
-	printf("Status File Version:                    %s\n", status_version);
+	if (live_data == TRUE) {
+		printf("Query Socket:                           %s\n", query_socket);
+		printf("Status Data Age:                        %dd %dh %dm %ds\n", days, hours, minutes, seconds);
+		printf("Naemon Version:                         %s\n", status_version);
+	} else {
+		printf("Status File:                            %s\n", status_file);
+		printf("Status File Age:                        %dd %dh %dm %ds\n", days, hours, minutes, seconds);
+		printf("Status File Version:                    %s\n", status_version);
+	}
 	printf("\n");
 	time_difference = (current_time - program_start);
 	get_time_breakdown(time_difference, &days, &hours, &minutes, &seconds);
@@ -814,6 +921,7 @@ static int read_config_file(void)
 	char *val;
 	char *main_cfg_dir = NULL;
 	char *slash = NULL;
+	int have_query_socket = (query_socket != NULL);
 
 
 	main_cfg_dir = nspath_absolute(main_config_file, NULL);
@@ -843,11 +951,19 @@ static int read_config_file(void)
 				free(status_file);
 			status_file = nspath_absolute(val, main_cfg_dir);
 		}
+		else if (!strcmp(var, "query_socket") && have_query_socket == FALSE) {
+			if (query_socket)
+				free(query_socket);
+			query_socket = nspath_absolute(val, main_cfg_dir);
+		}
 
 	}
 
 	fclose(fp);
 
+	if (query_socket == NULL)
+		query_socket = strdup(DEFAULT_QUERY_SOCKET);
+
 	return OK;
 }
 
@@ -859,7 +975,6 @@ static int read_status_file(void)
 	int data_type = STATUS_NO_DATA;
 	char *var = NULL;
 	char *val = NULL;
-	char *temp_ptr = NULL;
 	time_t current_time;
 	unsigned long time_difference = 0L;
 
@@ -912,15 +1027,7 @@ static int read_status_file(void)
 				break;
 
 			case STATUS_PROGRAM_DATA:
-				/* 02-15-2008 exclude cached host checks from total (they were ondemand checks that never actually executed) */
-				active_host_checks_last_1min = active_scheduled_host_checks_last_1min + active_ondemand_host_checks_last_1min;
-				active_host_checks_last_5min = active_scheduled_host_checks_last_5min + active_ondemand_host_checks_last_5min;
-				active_host_checks_last_15min = active_scheduled_host_checks_last_15min + active_ondemand_host_checks_last_15min;
-
-				/* 02-15-2008 exclude cached service checks from total (they were ondemand checks that never actually executed) */
-				active_service_checks_last_1min = active_scheduled_service_checks_last_1min + active_ondemand_service_checks_last_1min;
-				active_service_checks_last_5min = active_scheduled_service_checks_last_5min + active_ondemand_service_checks_last_5min;
-				active_service_checks_last_15min = active_scheduled_service_checks_last_15min + active_ondemand_service_checks_last_15min;
+				sum_check_stats();
 				break;
 
 			case STATUS_HOST_DATA:
@@ -1165,88 +1272,7 @@ static int read_status_file(void)
 				break;
 
 			case STATUS_PROGRAM_DATA:
-				if (!strcmp(var, "program_start"))
-					program_start = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "nagios_pid"))
-					nagios_pid = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "active_scheduled_host_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						active_scheduled_host_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_scheduled_host_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_scheduled_host_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "active_ondemand_host_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						active_ondemand_host_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_ondemand_host_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_ondemand_host_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "cached_host_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						active_cached_host_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_cached_host_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_cached_host_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "passive_host_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						passive_host_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						passive_host_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						passive_host_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "active_scheduled_service_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						active_scheduled_service_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_scheduled_service_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_scheduled_service_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "active_ondemand_service_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						active_ondemand_service_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_ondemand_service_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_ondemand_service_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "cached_service_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						active_cached_service_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_cached_service_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						active_cached_service_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "passive_service_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						passive_service_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						passive_service_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						passive_service_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "external_command_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						external_commands_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						external_commands_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						external_commands_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "parallel_host_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						parallel_host_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						parallel_host_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						parallel_host_checks_last_15min = atoi(temp_ptr);
-				} else if (!strcmp(var, "serial_host_check_stats")) {
-					if ((temp_ptr = strtok(val, ",")))
-						serial_host_checks_last_1min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						serial_host_checks_last_5min = atoi(temp_ptr);
-					if ((temp_ptr = strtok(NULL, ",")))
-						serial_host_checks_last_15min = atoi(temp_ptr);
-				}
+				read_program_variable(var, val);
 				break;
 
 			case STATUS_HOST_DATA:
@@ -1308,6 +1334,191 @@ static int read_status_file(void)
 }
 
 
+/* reads one of the program-wide variables, which look the same in the status file and from the query handler */
+static void read_program_variable(char *var, char *val)
+{
+	char *temp_ptr = NULL;
+
+	if (!strcmp(var, "program_start"))
+		program_start = strtoul(val, NULL, 10);
+	else if (!strcmp(var, "nagios_pid"))
+		nagios_pid = strtoul(val, NULL, 10);
+	else if (!strcmp(var, "active_scheduled_host_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			active_scheduled_host_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_scheduled_host_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_scheduled_host_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "active_ondemand_host_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			active_ondemand_host_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_ondemand_host_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_ondemand_host_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "cached_host_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			active_cached_host_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_cached_host_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_cached_host_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "passive_host_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			passive_host_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			passive_host_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			passive_host_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "active_scheduled_service_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			active_scheduled_service_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_scheduled_service_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_scheduled_service_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "active_ondemand_service_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			active_ondemand_service_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_ondemand_service_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_ondemand_service_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "cached_service_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			active_cached_service_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_cached_service_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			active_cached_service_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "passive_service_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			passive_service_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			passive_service_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			passive_service_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "external_command_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			external_commands_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			external_commands_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			external_commands_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "parallel_host_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			parallel_host_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			parallel_host_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			parallel_host_checks_last_15min = atoi(temp_ptr);
+	} else if (!strcmp(var, "serial_host_check_stats")) {
+		if ((temp_ptr = strtok(val, ",")))
+			serial_host_checks_last_1min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			serial_host_checks_last_5min = atoi(temp_ptr);
+		if ((temp_ptr = strtok(NULL, ",")))
+			serial_host_checks_last_15min = atoi(temp_ptr);
+	}
+}
+
+
+/* the totals of the check statistics we read */
+static void sum_check_stats(void)
+{
+	/* 02-15-2008 exclude cached host checks from total (they were ondemand checks that never actually executed) */
+	active_host_checks_last_1min = active_scheduled_host_checks_last_1min + active_ondemand_host_checks_last_1min;
+	active_host_checks_last_5min = active_scheduled_host_checks_last_5min + active_ondemand_host_checks_last_5min;
+	active_host_checks_last_15min = active_scheduled_host_checks_last_15min + active_ondemand_host_checks_last_15min;
+
+	/* 02-15-2008 exclude cached service checks from total (they were ondemand checks that never actually executed) */
+	active_service_checks_last_1min = active_scheduled_service_checks_last_1min + active_ondemand_service_checks_last_1min;
+	active_service_checks_last_5min = active_scheduled_service_checks_last_5min + active_ondemand_service_checks_last_5min;
+	active_service_checks_last_15min = active_scheduled_service_checks_last_15min + active_ondemand_service_checks_last_15min;
+}
+
+
+/* asks a running core for its status aggregates. Returns OK if it answered */
+static int read_query_socket(void)
+{
+	char *buf = NULL, *new_buf, *line, *next, *val;
+	size_t len = 0, size = 0;
+	struct pollfd pfd;
+	ssize_t got;
+	int sd, found = FALSE;
+	const struct live_variable *lv;
+
+	if (query_socket == NULL)
+		return ERROR;
+
+	sd = nsock_unix(query_socket, NSOCK_TCP | NSOCK_CONNECT);
+	if (sd < 0)
+		return ERROR;
+
+	/* the response ends with a nul byte, or the core hangs up after it */
+	if (nsock_write_all(sd, "#stats", 7) == 0) {
+		pfd.fd = sd;
+		pfd.events = POLLIN;
+		for (;;) {
+			if (len + 1 >= size) {
+				size = size ? size * 2 : 8192;
+				if (!(new_buf = realloc(buf, size)))
+					break;
+				buf = new_buf;
+			}
+			if (poll(&pfd, 1, 10000) <= 0)
+				break;
+			got = read(sd, buf + len, size - len - 1);
+			if (got <= 0)
+				break;
+			len += got;
+			if (memchr(buf + len - got, 0, got))
+				break;
+		}
+	}
+	close(sd);
+	if (buf == NULL)
+		return ERROR;
+	buf[len] = 0;
+
+	for (line = buf; line && *line; line = next) {
+		if ((next = strchr(line, '\n')))
+			*next++ = 0;
+		if (!(val = strchr(line, '=')))
+			continue;
+		*val++ = 0;
+
+		if (!strcmp(line, "created"))
+			status_creation_date = strtoul(val, NULL, 10);
+		else if (!strcmp(line, "version"))
+			status_version = strdup(val);
+		else
+			read_program_variable(line, val);
+
+		for (lv = live_variables; lv->name; lv++) {
+			if (strcmp(line, lv->name))
+				continue;
+			if (lv->int_value)
+				*lv->int_value = atoi(val);
+			else
+				*lv->double_value = strtod(val, NULL);
+			found = TRUE;
+			break;
+		}
+	}
+	free(buf);
+
+	/* an older core, or something else entirely, answered */
+	if (found == FALSE)
+		return ERROR;
+
+	sum_check_stats();
+	live_data = TRUE;
+	return OK;
+}
+
+
 /* strip newline, carriage return, and tab characters from beginning and end of a string */
 void strip(char *buffer)
 {
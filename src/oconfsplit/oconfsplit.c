@@ -25,9 +25,11 @@
 #include <naemon/workers.h>
 #include <naemon/nm_alloc.h>
 #include <string.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <sys/wait.h>
 
 static struct {
 	bitmap *hosts;
@@ -353,6 +355,414 @@ static int nsplit_cache_stuff(const char *orig_groups)
 	return 0;
 }
 
+/*
+ * Balanced partitioning.
+ *
+ * Hosts tied together by host or service dependencies, or by service
+ * parents, form "atoms" that are never split, since a poller can't
+ * evaluate a dependency on an object it doesn't have. Parent/child
+ * relations group atoms further into trees, which are kept whole
+ * when they fit in a partition. Trees that don't are cut into pieces
+ * along a depth-first walk, so that subtrees stay together and few
+ * parent edges get cut. The pieces are then handed out biggest first,
+ * each to the least loaded partition.
+ *
+ * Load is the number of active checks per second a host and its
+ * services are scheduled to run. If nothing has active checks, we
+ * balance the number of hosts instead.
+ */
+struct nsplit_edge {
+	unsigned int a, b;
+};
+
+static struct {
+	unsigned int nparts;
+	bitmap *universe;       /* hosts we partition */
+	double *weight;         /* per host */
+	unsigned int *part;     /* partition of each host */
+	struct nsplit_edge *deps, *parents;
+	unsigned int ndeps, nparents, deps_alloc, parents_alloc;
+} pm;
+
+struct nsplit_piece {
+	double weight;
+	unsigned int *hosts, nhosts;
+};
+
+static unsigned int uf_find(unsigned int *uf, unsigned int x)
+{
+	while (uf[x] != x) {
+		uf[x] = uf[uf[x]];
+		x = uf[x];
+	}
+	return x;
+}
+
+static void uf_union(unsigned int *uf, unsigned int a, unsigned int b)
+{
+	a = uf_find(uf, a);
+	b = uf_find(uf, b);
+	if (a != b)
+		uf[a > b ? a : b] = a > b ? b : a;
+}
+
+static double checks_per_second(int checks_enabled, double check_interval)
+{
+	if (!checks_enabled || check_interval <= 0 || interval_length <= 0)
+		return 0;
+	return 1.0 / (check_interval * interval_length);
+}
+
+static void add_edge(struct nsplit_edge **ary, unsigned int *n, unsigned int *alloc, struct host *a, struct host *b)
+{
+	if (a == b || !bitmap_isset(pm.universe, a->id) || !bitmap_isset(pm.universe, b->id))
+		return;
+	if (*n == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 64;
+		*ary = nm_realloc(*ary, *alloc * sizeof(**ary));
+	}
+	(*ary)[*n].a = a->id;
+	(*ary)[*n].b = b->id;
+	(*n)++;
+}
+#define add_dependency_edge(a, b) add_edge(&pm.deps, &pm.ndeps, &pm.deps_alloc, a, b)
+#define add_parent_edge(a, b) add_edge(&pm.parents, &pm.nparents, &pm.parents_alloc, a, b)
+
+static void add_dependency_edges(struct host *h, objectlist *olist, int services)
+{
+	for (; olist; olist = olist->next) {
+		if (services)
+			add_dependency_edge(h, ((struct servicedependency *)olist->object_ptr)->master_service_ptr->host_ptr);
+		else
+			add_dependency_edge(h, ((struct hostdependency *)olist->object_ptr)->master_host_ptr);
+	}
+}
+
+/* collects weights and the edges we care about */
+static double nsplit_map_load(void)
+{
+	unsigned int i;
+	double total = 0;
+
+	pm.weight = nm_calloc(num_objects.hosts, sizeof(double));
+	for (i = 0; i < num_objects.hosts; i++) {
+		struct host *h = host_ary[i];
+		struct hostsmember *parent;
+		struct servicesmember *sm, *sp;
+
+		if (!bitmap_isset(pm.universe, i))
+			continue;
+		pm.weight[i] = checks_per_second(h->checks_enabled, h->check_interval);
+		for (parent = h->parent_hosts; parent; parent = parent->next)
+			add_parent_edge(h, parent->host_ptr);
+		add_dependency_edges(h, h->exec_deps, 0);
+		add_dependency_edges(h, h->notify_deps, 0);
+		for (sm = h->services; sm; sm = sm->next) {
+			struct service *s = sm->service_ptr;
+			pm.weight[i] += checks_per_second(s->checks_enabled, s->check_interval);
+			add_dependency_edges(h, s->exec_deps, 1);
+			add_dependency_edges(h, s->notify_deps, 1);
+			for (sp = s->parents; sp; sp = sp->next)
+				add_dependency_edge(h, sp->service_ptr->host_ptr);
+		}
+		total += pm.weight[i];
+	}
+
+	/* nothing to balance on. Spread the hosts evenly instead */
+	if (total <= 0) {
+		for (i = 0; i < num_objects.hosts; i++) {
+			if (bitmap_isset(pm.universe, i))
+				pm.weight[i] = 1;
+		}
+		total = bitmap_count_set_bits(pm.universe);
+	}
+	return total;
+}
+
+static int piece_cmp(const void *a_, const void *b_)
+{
+	const struct nsplit_piece *a = a_, *b = b_;
+	if (a->weight != b->weight)
+		return a->weight < b->weight ? 1 : -1;
+	return (int)b->nhosts - (int)a->nhosts;
+}
+
+/*
+ * cuts the universe into pieces no heavier than 'cap', unless a
+ * single atom is heavier than that on its own
+ */
+static struct nsplit_piece *nsplit_pieces(double cap, unsigned int *npieces)
+{
+	unsigned int nhosts = num_objects.hosts, i, j, k;
+	unsigned int *atom, *tree, *atom_first, *atom_next, *adj_start, *adj, *stack, *order;
+	unsigned int nstack, norder, npiece = 0;
+	double *atom_weight, piece_weight;
+	struct nsplit_piece *pieces;
+	bitmap *seen;
+
+	/* atoms, by dependencies. Linked lists of their hosts */
+	atom = nm_malloc(nhosts * sizeof(unsigned int));
+	for (i = 0; i < nhosts; i++)
+		atom[i] = i;
+	for (i = 0; i < pm.ndeps; i++)
+		uf_union(atom, pm.deps[i].a, pm.deps[i].b);
+	atom_first = nm_malloc(nhosts * sizeof(unsigned int));
+	atom_next = nm_malloc(nhosts * sizeof(unsigned int));
+	atom_weight = nm_calloc(nhosts, sizeof(double));
+	for (i = 0; i < nhosts; i++)
+		atom_first[i] = UINT_MAX;
+	for (i = nhosts; i-- > 0;) {
+		if (!bitmap_isset(pm.universe, i))
+			continue;
+		atom[i] = uf_find(atom, i);
+		atom_next[i] = atom_first[atom[i]];
+		atom_first[atom[i]] = i;
+		atom_weight[atom[i]] += pm.weight[i];
+	}
+
+	/* parent edges between atoms, both ways */
+	adj_start = nm_calloc(nhosts + 1, sizeof(unsigned int));
+	adj = nm_malloc((2 * pm.nparents + 1) * sizeof(unsigned int));
+	for (i = 0; i < pm.nparents; i++) {
+		adj_start[atom[pm.parents[i].a] + 1]++;
+		adj_start[atom[pm.parents[i].b] + 1]++;
+	}
+	for (i = 0; i < nhosts; i++)
+		adj_start[i + 1] += adj_start[i];
+	stack = nm_malloc(nhosts * sizeof(unsigned int));
+	memcpy(stack, adj_start, nhosts * sizeof(unsigned int));
+	for (i = 0; i < pm.nparents; i++) {
+		unsigned int a = atom[pm.parents[i].a], b = atom[pm.parents[i].b];
+		adj[stack[a]++] = b;
+		adj[stack[b]++] = a;
+	}
+
+	/* trees of atoms */
+	tree = nm_malloc(nhosts * sizeof(unsigned int));
+	for (i = 0; i < nhosts; i++)
+		tree[i] = i;
+	for (i = 0; i < pm.nparents; i++)
+		uf_union(tree, atom[pm.parents[i].a], atom[pm.parents[i].b]);
+
+	/*
+	 * Walk each tree depth first from its lowest numbered atom.
+	 * Pieces are consecutive stretches of that walk.
+	 */
+	pieces = nm_calloc(nhosts, sizeof(*pieces));
+	order = nm_malloc(nhosts * sizeof(unsigned int));
+	seen = bitmap_create(nhosts);
+	for (i = 0; i < nhosts; i++) {
+		unsigned int root;
+		if (atom_first[i] == UINT_MAX || bitmap_isset(seen, i))
+			continue;
+		root = uf_find(tree, i);
+		nstack = norder = 0;
+		stack[nstack++] = root;
+		bitmap_set(seen, root);
+		while (nstack) {
+			unsigned int a = stack[--nstack];
+			order[norder++] = a;
+			for (k = adj_start[a]; k < adj_start[a + 1]; k++) {
+				if (!bitmap_isset(seen, adj[k])) {
+					bitmap_set(seen, adj[k]);
+					stack[nstack++] = adj[k];
+				}
+			}
+		}
+
+		piece_weight = 0;
+		for (j = 0; j < norder; j++) {
+			unsigned int a = order[j], h;
+			struct nsplit_piece *p = &pieces[npiece];
+			if (p->nhosts && piece_weight + atom_weight[a] > cap) {
+				npiece++;
+				p = &pieces[npiece];
+				piece_weight = 0;
+			}
+			for (h = atom_first[a]; h != UINT_MAX; h = atom_next[h]) {
+				p->hosts = nm_realloc(p->hosts, (p->nhosts + 1) * sizeof(unsigned int));
+				p->hosts[p->nhosts++] = h;
+			}
+			piece_weight += atom_weight[a];
+			p->weight = piece_weight;
+		}
+		npiece++;
+	}
+
+	bitmap_destroy(seen);
+	free(order);
+	free(tree);
+	free(stack);
+	free(adj);
+	free(adj_start);
+	free(atom_weight);
+	free(atom_next);
+	free(atom_first);
+	free(atom);
+	*npieces = npiece;
+	return pieces;
+}
+
+/* assigns every host in the universe to one of pm.nparts partitions */
+static void nsplit_partition(double total)
+{
+	struct nsplit_piece *pieces;
+	unsigned int npieces, i, j, best, *nhosts;
+	double *load;
+
+	pieces = nsplit_pieces(total / pm.nparts, &npieces);
+	qsort(pieces, npieces, sizeof(*pieces), piece_cmp);
+	timing_point("%u pieces to place in %u partitions\n", npieces, pm.nparts);
+
+	load = nm_calloc(pm.nparts, sizeof(double));
+	nhosts = nm_calloc(pm.nparts, sizeof(unsigned int));
+	pm.part = nm_calloc(num_objects.hosts, sizeof(unsigned int));
+	for (i = 0; i < npieces; i++) {
+		for (best = 0, j = 1; j < pm.nparts; j++) {
+			if (load[j] < load[best] || (load[j] == load[best] && nhosts[j] < nhosts[best]))
+				best = j;
+		}
+		load[best] += pieces[i].weight;
+		nhosts[best] += pieces[i].nhosts;
+		for (j = 0; j < pieces[i].nhosts; j++)
+			pm.part[pieces[i].hosts[j]] = best;
+		free(pieces[i].hosts);
+	}
+	free(pieces);
+	free(load);
+	free(nhosts);
+}
+
+static unsigned int count_cut_edges(struct nsplit_edge *edges, unsigned int n)
+{
+	unsigned int i, cut = 0;
+	for (i = 0; i < n; i++) {
+		if (pm.part[edges[i].a] != pm.part[edges[i].b])
+			cut++;
+	}
+	return cut;
+}
+
+/*
+ * writes one partition. Caching a host modifies the objects it
+ * refers to, so each partition is written from a copy of the
+ * process, where the next one can't see what we removed.
+ */
+static int nsplit_write_partition(unsigned int part, const char *path)
+{
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	if ((pid = fork()) < 0) {
+		printf("Failed to fork: %m\n");
+		return -1;
+	}
+	if (pid) {
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			return -1;
+		return 0;
+	}
+
+	if (!(fp = fopen(path, "w"))) {
+		printf("Failed to open '%s' for writing: %m\n", path);
+		_exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < num_objects.hosts; i++) {
+		if (bitmap_isset(pm.universe, i) && pm.part[i] == part)
+			bitmap_set(map.hosts, i);
+	}
+	nsplit_cache_command(ochp_command_ptr);
+	nsplit_cache_command(ocsp_command_ptr);
+	nsplit_cache_command(global_host_event_handler_ptr);
+	nsplit_cache_command(global_service_event_handler_ptr);
+	nsplit_cache_command(find_command(host_perfdata_command));
+	nsplit_cache_command(find_command(service_perfdata_command));
+	nsplit_cache_command(find_command(host_perfdata_file_processing_command));
+	nsplit_cache_command(find_command(service_perfdata_file_processing_command));
+	for (i = 0; i < num_objects.hosts; i++) {
+		if (bitmap_isset(map.hosts, i))
+			nsplit_cache_host(host_ary[i]);
+	}
+	nsplit_partial_groups();
+	if (fclose(fp)) {
+		printf("Failed to write '%s': %m\n", path);
+		_exit(EXIT_FAILURE);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static int nsplit_partitions(const char *groups, const char *outfile)
+{
+	unsigned int i, p, *hosts, *services, cut_parents, cut_deps;
+	double total, *load, max_load = 0;
+	char *path;
+	int ret = 0;
+
+	/* partition all hosts, or just the ones in the given groups */
+	pm.universe = bitmap_create(num_objects.hosts);
+	if (groups) {
+		char *grps = nm_strdup(groups), *grp, *comma;
+		for (grp = grps; grp; grp = comma ? comma + 1 : NULL) {
+			if ((comma = strchr(grp, ',')))
+				*comma = 0;
+			if (map_hostgroup_hosts(grp) < 0)
+				return -1;
+		}
+		free(grps);
+		bitmap_unite(pm.universe, map.hosts);
+		bitmap_clear(map.hosts);
+	} else {
+		for (i = 0; i < num_objects.hosts; i++)
+			bitmap_set(pm.universe, i);
+	}
+
+	total = nsplit_map_load();
+	timing_point("%lu hosts, %u dependency and %u parent edges mapped\n",
+	             bitmap_count_set_bits(pm.universe), pm.ndeps, pm.nparents);
+	nsplit_partition(total);
+	timing_point("Hosts partitioned\n");
+
+	load = nm_calloc(pm.nparts, sizeof(double));
+	hosts = nm_calloc(pm.nparts, sizeof(unsigned int));
+	services = nm_calloc(pm.nparts, sizeof(unsigned int));
+	for (i = 0; i < num_objects.hosts; i++) {
+		if (!bitmap_isset(pm.universe, i))
+			continue;
+		load[pm.part[i]] += pm.weight[i];
+		hosts[pm.part[i]]++;
+		services[pm.part[i]] += host_ary[i]->total_services;
+	}
+
+	path = nm_malloc(strlen(outfile) + 16);
+	for (p = 0; p < pm.nparts; p++) {
+		sprintf(path, "%s.%u", outfile, p);
+		if (nsplit_write_partition(p, path) < 0) {
+			printf("Failed to write partition %u to %s\n", p, path);
+			ret = -1;
+		}
+		if (load[p] > max_load)
+			max_load = load[p];
+		printf("partition %u: %u hosts, %u services, %.3f checks/s (%.1f%% of average) in %s\n",
+		       p, hosts[p], services[p], load[p],
+		       total > 0 ? 100.0 * load[p] * pm.nparts / total : 0.0, path);
+	}
+
+	cut_parents = count_cut_edges(pm.parents, pm.nparents);
+	cut_deps = count_cut_edges(pm.deps, pm.ndeps);
+	printf("imbalance: heaviest partition is %.1f%% of average\n",
+	       total > 0 ? 100.0 * max_load * pm.nparts / total : 0.0);
+	printf("cut edges: %u of %u parent, %u of %u dependency\n",
+	       cut_parents, pm.nparents, cut_deps, pm.ndeps);
+
+	free(path);
+	free(load);
+	free(hosts);
+	free(services);
+	return ret;
+}
+
 static void usage(const char *fmt, ...)
 {
 	printf("Usage: %s [options] </path/to/naemon.cfg>\n", self_name);
@@ -363,12 +773,22 @@ static void usage(const char *fmt, ...)
 	printf("  -q, --quiet                Shut up about progress\n");
 	printf("  -o, --outfile              Where we should write config\n");
 	printf("  -f, --force                Force subcache generation\n");
+	printf("  -p, --partitions <N>       Split all hosts (or those in --groups) into N\n");
+	printf("                             partitions balanced on checks per second,\n");
+	printf("                             written to <outfile>.0 to <outfile>.N-1\n");
 	printf("\n");
 	printf("Example: %s -g network1,linux -o oconf.cache\n", self_name);
 	printf("will cause the hostgroups network1 and linux to be written to the\n");
 	printf("file oconf.cache, along with all the objects required for oconf.cache\n");
 	printf("to be a valid naemon configuration on its own.\n");
 	printf("\n");
+	printf("Example: %s -p 4 -o poller.cache\n", self_name);
+	printf("will split all hosts into four files poller.cache.0 to poller.cache.3\n");
+	printf("with about the same number of checks to run each. Hosts that depend on\n");
+	printf("each other always end up together, and parents stay with their children\n");
+	printf("as long as that doesn't unbalance the partitions. The load of each\n");
+	printf("partition and the parent/child relations cut between them are reported.\n");
+	printf("\n");
 	printf("Note: This program will first try to use the object_cache_file,\n");
 	printf("Then the object_precache_file, and last it will fall back to use\n");
 	printf("the raw configuration files. There's no way to avoid that with this\n");
@@ -405,6 +825,7 @@ int main(int argc, char **argv)
 		{"outfile", required_argument, 0, 'o' },
 		{"naemon-cfg", required_argument, 0, 'c' },
 		{"force", no_argument, 0, 'f' },
+		{"partitions", required_argument, 0, 'p' },
 		{ 0, 0, 0, 0 }
 	};
 #define getopt(a, b, c) getopt_long(a, b, c, long_options, &option_index)
@@ -420,7 +841,7 @@ int main(int argc, char **argv)
 
 	enable_timing_point = 1;
 	for (;;) {
-		c = getopt(argc, argv, "hVqvfg:i:o:O:");
+		c = getopt(argc, argv, "hVqvfg:i:o:O:p:");
 		if (c < 0 || c == EOF)
 			break;
 
@@ -450,13 +871,21 @@ int main(int argc, char **argv)
 		case 'f':
 			/* force = 1;, but ignored for now */
 			break;
+		case 'p':
+			pm.nparts = (unsigned int)strtoul(optarg, NULL, 10);
+			if (!pm.nparts)
+				usage("Number of partitions must be a positive number\n");
+			break;
 		default:
 			usage("Unknown argument\n");
 			exit(EXIT_FAILURE);
 		}
 	}
 
-	if (outfile) {
+	if (pm.nparts) {
+		if (!outfile)
+			usage("Partitions need an outfile to be named after\n");
+	} else if (outfile) {
 		fp = fopen(outfile, "w");
 		if (!fp) {
 			printf("Failed to open '%s' for writing: %m\n", outfile);
@@ -466,7 +895,7 @@ int main(int argc, char **argv)
 		usage("Can't cache groups without an outfile. Try again, will ya?\n");
 	}
 
-	if (!groups && !cache_file) {
+	if (!groups && !cache_file && !pm.nparts) {
 		usage("No groups specified. Redo from start\n");
 	}
 
@@ -540,7 +969,7 @@ int main(int argc, char **argv)
 		printf("Pre-flight circular check failed. Bailing out\n");
 		exit(EXIT_FAILURE);
 	}
-	if (cache_file && !groups) {
+	if (cache_file && !groups && !pm.nparts) {
 		if (verbose || !outfile)
 			printf("%u objects check out ok\n", ocount_total(&num_objects));
 		if (outfile) {
@@ -560,6 +989,16 @@ int main(int argc, char **argv)
 	map.contactgroups = bitmap_create(num_objects.contactgroups);
 	map.hostgroups = bitmap_create(num_objects.hostgroups);
 
+	if (pm.nparts) {
+		if (nsplit_partitions(groups, outfile) < 0) {
+			printf("Partitioning failed. Bailing out\n");
+			return EXIT_FAILURE;
+		}
+		cleanup();
+		timing_point("Done cleaning up. Exiting\n");
+		return EXIT_SUCCESS;
+	}
+
 	/* global commands are always included */
 	nsplit_cache_command(ochp_command_ptr);
 	nsplit_cache_command(ocsp_command_ptr);
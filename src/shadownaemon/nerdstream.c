@@ -0,0 +1,244 @@
+/**
+ * Follows the check results of a remote core through the NERD channels
+ * of its query handler. The lines there are meant for humans:
+ *
+ *   <host> from <old state> -> <new state>: <output>
+ *   <host>;<service> from <old state> -> <new state>: <output>
+ *
+ * but all we need from them is which object they're about. Plugin
+ * output can hold newlines, so the odd line may be a piece of output
+ * that happens to look like an event. That only makes us fetch an
+ * object that didn't change, which is harmless.
+ */
+
+#include "config.h"
+#include "nerdstream.h"
+#include "lib/libnaemon.h"
+#include <naemon/nm_alloc.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static const char *subscriptions[] = {
+    "@nerd subscribe hostchecks",
+    "@nerd subscribe servicechecks",
+};
+
+struct nerdstream *nerdstream_create(const char *path,
+                                     void (*host_event)(const char *, void *),
+                                     void (*service_event)(const char *, const char *, void *),
+                                     void *arg) {
+    struct nerdstream *ns = nm_calloc(1, sizeof(*ns));
+
+    ns->path          = nm_strdup(path);
+    ns->sd            = -1;
+    ns->host_event    = host_event;
+    ns->service_event = service_event;
+    ns->arg           = arg;
+    return(ns);
+}
+
+void nerdstream_destroy(struct nerdstream *ns) {
+    if(ns == NULL)
+        return;
+    nerdstream_disconnect(ns);
+    nm_free(ns->path);
+    nm_free(ns);
+}
+
+/*
+ * connects to a query handler exposed over tcp, given as host:port
+ * the same way as livestatus input sources are. Returns the socket,
+ * or -1 on errors
+ */
+static int connect_tcp(const char *source) {
+    struct addrinfo hints, *res, *ai;
+    char *host = nm_strdup(source), *port;
+    int sd = -1;
+
+    port = strrchr(host, ':');
+    *port++ = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, port, &hints, &res) != 0) {
+        nm_free(host);
+        return(-1);
+    }
+    for(ai = res; ai != NULL; ai = ai->ai_next) {
+        if((sd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+            continue;
+        if(connect(sd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(sd);
+        sd = -1;
+    }
+    freeaddrinfo(res);
+    nm_free(host);
+    return(sd);
+}
+
+/* connect and subscribe. Returns 0 on success, -1 otherwise */
+int nerdstream_connect(struct nerdstream *ns) {
+    unsigned int i;
+
+    nerdstream_disconnect(ns);
+    /* host:port, like the livestatus input source, or a unix socket */
+    if(strchr(ns->path, ':') != NULL)
+        ns->sd = connect_tcp(ns->path);
+    else
+        ns->sd = nsock_unix(ns->path, NSOCK_TCP | NSOCK_CONNECT);
+    if(ns->sd < 0) {
+        ns->sd = -1;
+        return(-1);
+    }
+    /* connected sockets are left blocking */
+    if(fcntl(ns->sd, F_SETFL, fcntl(ns->sd, F_GETFL) | O_NONBLOCK) < 0) {
+        nerdstream_disconnect(ns);
+        return(-1);
+    }
+
+    for(i = 0; i < sizeof(subscriptions) / sizeof(subscriptions[0]); i++) {
+        /* including the nul byte, which ends each request */
+        size_t len = strlen(subscriptions[i]) + 1;
+        if(nsock_write_all(ns->sd, subscriptions[i], len) < 0) {
+            nerdstream_disconnect(ns);
+            return(-1);
+        }
+        ns->bytes_out += len;
+    }
+    ns->connects++;
+    return(0);
+}
+
+void nerdstream_disconnect(struct nerdstream *ns) {
+    if(ns->sd >= 0)
+        close(ns->sd);
+    ns->sd       = -1;
+    ns->len      = 0;
+    ns->skipping = 0;
+}
+
+/* reads a number and returns what follows it, or NULL if there is none */
+static char *skip_number(char *p) {
+    if(!isdigit((unsigned char)*p))
+        return(NULL);
+    while(isdigit((unsigned char)*p))
+        p++;
+    return(p);
+}
+
+/*
+ * splits an event line into the names of the object it's about.
+ * Returns NERDSTREAM_HOST or NERDSTREAM_SERVICE, with the names
+ * pointing into 'line', or NERDSTREAM_NONE if it isn't an event.
+ */
+int nerdstream_parse(char *line, char **host_name, char **service_description) {
+    char *p, *q, *sep;
+
+    for(p = strstr(line, " from "); p; p = strstr(p + 1, " from ")) {
+        if(!(q = skip_number(p + 6)) || strncmp(q, " -> ", 4))
+            continue;
+        if(!(q = skip_number(q + 4)) || strncmp(q, ": ", 2))
+            continue;
+        break;
+    }
+    if(p == NULL || p == line)
+        return(NERDSTREAM_NONE);
+
+    *p = 0;
+    *host_name = line;
+    /* host names can't have semicolons in them, service descriptions can */
+    if((sep = strchr(line, ';')) == NULL) {
+        *service_description = NULL;
+        return(NERDSTREAM_HOST);
+    }
+    *sep = 0;
+    *service_description = sep + 1;
+    if(!*line || !**service_description)
+        return(NERDSTREAM_NONE);
+    return(NERDSTREAM_SERVICE);
+}
+
+/* hands the complete lines in the buffer to the callbacks */
+static int handle_lines(struct nerdstream *ns) {
+    char *line = ns->buf, *end = ns->buf + ns->len, *eol;
+    char *host_name, *service_description;
+    int events = 0;
+
+    for(;;) {
+        /* the query handler ends its own responses with a nul byte */
+        for(eol = line; eol < end && *eol != '\n' && *eol != '\0'; eol++)
+            ;
+        if(eol == end)
+            break;
+        *eol = 0;
+        if(ns->skipping) {
+            ns->skipping = 0;
+        } else if(*line) {
+            switch(nerdstream_parse(line, &host_name, &service_description)) {
+            case NERDSTREAM_HOST:
+                ns->host_event(host_name, ns->arg);
+                events++;
+                break;
+            case NERDSTREAM_SERVICE:
+                ns->service_event(host_name, service_description, ns->arg);
+                events++;
+                break;
+            default:
+                ns->ignored++;
+            }
+        }
+        line = eol + 1;
+    }
+
+    ns->len = end - line;
+    if(ns->len == sizeof(ns->buf)) {
+        /* no line fits in the buffer. Throw it away up to its end */
+        if(!ns->skipping)
+            ns->ignored++;
+        ns->skipping = 1;
+        ns->len = 0;
+    }
+    memmove(ns->buf, line, ns->len);
+    return(events);
+}
+
+/*
+ * reads whatever has arrived without blocking. Returns the number of
+ * events handled, or -1 if the connection is gone.
+ */
+int nerdstream_read(struct nerdstream *ns) {
+    int events = 0;
+    ssize_t got;
+
+    if(ns->sd < 0)
+        return(-1);
+
+    for(;;) {
+        got = read(ns->sd, ns->buf + ns->len, sizeof(ns->buf) - ns->len);
+        if(got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            nerdstream_disconnect(ns);
+            return(-1);
+        }
+        if(got < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        ns->bytes_in += got;
+        ns->len      += got;
+        events       += handle_lines(ns);
+    }
+
+    if(events > 0) {
+        ns->events    += events;
+        ns->last_event = time(NULL);
+    }
+    return(events);
+}
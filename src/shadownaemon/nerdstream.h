@@ -0,0 +1,47 @@
+#ifndef NERDSTREAM_H_
+#define NERDSTREAM_H_
+
+/**
+ * A subscription to the hostchecks and servicechecks NERD channels of
+ * a remote core's query handler. shadownaemon uses it to learn which
+ * objects got new check results, so it only has to fetch those from
+ * livestatus instead of polling for everything that might have changed.
+ */
+
+#include <time.h>
+
+#define NERDSTREAM_BUFSIZE 65536
+
+/* what nerdstream_parse() found in a line */
+#define NERDSTREAM_NONE    0
+#define NERDSTREAM_HOST    1
+#define NERDSTREAM_SERVICE 2
+
+struct nerdstream {
+    char *path;                          /* query handler socket, or host:port, we subscribe through */
+    int sd;                              /* -1 when not connected */
+    char buf[NERDSTREAM_BUFSIZE];
+    unsigned int len;                    /* bytes in buf */
+    int skipping;                        /* discarding the rest of an overlong line */
+    void (*host_event)(const char *host_name, void *arg);
+    void (*service_event)(const char *host_name, const char *service_description, void *arg);
+    void *arg;
+    unsigned long long bytes_in;         /* bytes received over all connections */
+    unsigned long long bytes_out;        /* ...and sent */
+    unsigned long long events;           /* lines naming a host or service */
+    unsigned long long ignored;          /* lines we couldn't make sense of */
+    unsigned long connects;              /* successful (re)connections */
+    time_t last_event;                   /* when we last got an event */
+};
+
+struct nerdstream *nerdstream_create(const char *path,
+                                     void (*host_event)(const char *, void *),
+                                     void (*service_event)(const char *, const char *, void *),
+                                     void *arg);
+void nerdstream_destroy(struct nerdstream *ns);
+int nerdstream_connect(struct nerdstream *ns);
+void nerdstream_disconnect(struct nerdstream *ns);
+int nerdstream_read(struct nerdstream *ns);
+int nerdstream_parse(char *line, char **host_name, char **service_description);
+
+#endif
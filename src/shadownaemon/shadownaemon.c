@@ -6,8 +6,10 @@
  */
 
 #include "shadownaemon.h"
+#include "nerdstream.h"
 #include <naemon/nm_alloc.h>
 #include <libgen.h>
+#include <poll.h>
 
 static int verbose                         = FALSE;
 static int daemonmode                      = FALSE;
@@ -36,6 +38,21 @@ static char *livestatus_module;
 static char *dummy_command;
 static const char *self_name;
 static const char *input_source;
+static const char *stream_source;
+static struct nerdstream *stream;
+static struct dirty_set dirty_hosts, dirty_services;
+
+/* how much we move and how far behind the remote site we are */
+static struct {
+    unsigned long long livestatus_bytes_out;
+    unsigned long long livestatus_bytes_in;
+    unsigned long full_syncs;
+    unsigned long refreshes;
+    time_t last_full_sync;
+    unsigned long rows;              /* hosts and services updated by the last refresh */
+    time_t staleness_max;            /* oldest check result among them */
+    double staleness_sum;
+} repl;
 
 /* be nice an help people using this tool */
 void usage(const char *fmt, ...) {
@@ -60,6 +77,10 @@ void usage(const char *fmt, ...) {
     printf("  -o, --output <folder>             Folder where all runtime data will be stored and the output socket will be created.\n");
     printf("  -l, --livestatus <modulepath>     Path to livestatus module, default: %s\n", get_default_livestatus_module());
     printf("  -r, --refresh <seconds>           Refresh Interval, default: 3 seconds.\n");
+    printf("  -s, --stream <connectionstring>   Query handler of the remote core, as a local unix socket or\n");
+    printf("                                    a host:port tcp socket it's made available on. Follow its check\n");
+    printf("                                    results and only fetch hosts and services that changed.\n");
+    printf("                                    Everything is fetched again whenever the stream reconnects.\n");
     printf("\n");
     printf("\n");
     printf("Example:\n");
@@ -91,6 +112,8 @@ int main(int argc, char **argv) {
         {"input", required_argument, 0, 'i' },
         {"output", required_argument, 0, 'o' },
         {"refresh", required_argument, 0, 'r' },
+        {"stream", required_argument, 0, 's' },
+        {0, 0, 0, 0 },
     };
 #define getopt(a, b, c) getopt_long(a, b, c, long_options, &option_index)
 #endif
@@ -100,7 +123,7 @@ int main(int argc, char **argv) {
 
     enable_timing_point = 0;
     for (;;) {
-        c = getopt(argc, argv, "hVvdi:r:o:l:");
+        c = getopt(argc, argv, "hVvdi:r:o:l:s:");
         if (c < 0 || c == EOF)
             break;
 
@@ -127,6 +150,9 @@ int main(int argc, char **argv) {
             case 'l':
                 livestatus_module = optarg;
                 break;
+            case 's':
+                stream_source = optarg;
+                break;
             case 'r':
                 short_shadow_update_interval = atof(optarg) * 1000000;
                 if(short_shadow_update_interval <= 0) {
@@ -224,6 +250,9 @@ error_out:
         livestatus_mode = LIVESTATUS_MODE_SOCKET;
     }
 
+    if(stream_source != NULL)
+        stream = nerdstream_create(stream_source, stream_host_event, stream_service_event, NULL);
+
     /* handle signals (interrupts) before we do any socket I/O */
     setup_sighandler();
     signal(SIGINT, sighandler);
@@ -246,6 +275,7 @@ error_out:
 
     /* clean up */
     clean_output_folder();
+    nerdstream_destroy(stream);
 
     /* free some locations */
     nm_free(config_file);
@@ -651,8 +681,10 @@ int livestatus_query_socket(result_list **result, char *socket_path, char *query
         input_socket = -1;
         return(-1);
     }
+    repl.livestatus_bytes_out += size;
     if(query[strlen(query)-1] != '\n') {
-        send(input_socket, "\n", 1, 0);
+        if(send(input_socket, "\n", 1, 0) == 1)
+            repl.livestatus_bytes_out++;
     }
     columnslength = 0;
     for(x=0; x<columnssize; x++)
@@ -668,9 +700,13 @@ int livestatus_query_socket(result_list **result, char *socket_path, char *query
     }
     strcat(columnsheader, "\n");
     size = send(input_socket, columnsheader, strlen(columnsheader), 0);
+    if(size > 0)
+        repl.livestatus_bytes_out += size;
     if(verbose)
         nm_log(NSLOG_PROCESS_INFO, "query: %s\n", columnsheader);
     size = send(input_socket, send_header, strlen(send_header), 0);
+    if(size > 0)
+        repl.livestatus_bytes_out += size;
     if(verbose)
         nm_log(NSLOG_PROCESS_INFO, "query: %s\n", send_header);
     nm_free(columnsheader);
@@ -684,6 +720,7 @@ int livestatus_query_socket(result_list **result, char *socket_path, char *query
         return(-1);
     }
     header[size] = '\0';
+    repl.livestatus_bytes_in += size;
     strncpy(buffer, header, 3);
     buffer[3] = '\0';
     return_code = atoi(buffer);
@@ -718,6 +755,7 @@ int livestatus_query_socket(result_list **result, char *socket_path, char *query
         return(-1);
     }
     result_string[total_read] = '\0';
+    repl.livestatus_bytes_in += total_read;
 
     // split result in arrays of arrays
     while((ptr = strsep( &result_string, "\x1")) != NULL) {
@@ -963,7 +1001,8 @@ int update_program_status_data() {
 
 /* updates host status based on remote sites data */
 int update_host_status_data(char * host_name) {
-    int num, running, len;
+    int num, running, len, delta = FALSE;
+    unsigned int i;
     host *hst = NULL;
     result_list *row = NULL;
     result_list *answer = nm_malloc(sizeof(result_list));
@@ -1013,6 +1052,20 @@ int update_host_status_data(char * host_name) {
     filtered_query = nm_calloc(max_number_of_executing_objects, 500);
     if(host_name != NULL) {
         len = sprintf(filtered_query, "%s\nFilter: host_name = %s\n", query, host_name);
+    } else if(stream_is_up() && !full_refresh_required && dirty_hosts.count <= (unsigned int)max_number_of_executing_objects) {
+        /* the stream told us which hosts got new results, fetch just those */
+        if(dirty_hosts.count == 0) {
+            nm_free(filtered_query);
+            nm_free(answer);
+            timing_point("no hosts changed\n");
+            return(OK);
+        }
+        len = sprintf(filtered_query, "%s\n", query);
+        for(i = 0; i < dirty_hosts.count; i++)
+            len += sprintf(filtered_query+len, "Filter: name = %s\n", ((host *)dirty_hosts.objects[i])->name);
+        if(dirty_hosts.count > 1)
+            len += sprintf(filtered_query+len, "Or: %u\n", dirty_hosts.count);
+        delta = TRUE;
     } else {
         len = sprintf(filtered_query, "%s\nFilter: is_executing = 1\nFilter: last_check >= %d\nOr: 2\n", query, (int)last_refresh);
 
@@ -1062,6 +1115,7 @@ int update_host_status_data(char * host_name) {
             hst->is_executing                   = atoi(row->set[11]);
             hst->is_flapping                    = atoi(row->set[12]);
             hst->last_check                     = atoi(row->set[13]);
+            note_staleness(hst->last_check);
             hst->last_notification              = atoi(row->set[14]);
             hst->last_state_change              = atoi(row->set[15]);
             hst->latency                        = atof(row->set[16]);
@@ -1096,13 +1150,15 @@ int update_host_status_data(char * host_name) {
         nm_log(NSLOG_INFO_MESSAGE, "updating hosts status failed\n");
         return(ERROR);
     }
-    timing_point("updated %d hosts\n", num);
+    clear_dirty_set(&dirty_hosts);
+    timing_point("updated %d %shosts\n", num, delta ? "changed " : "");
     return(OK);
 }
 
 /* updates service status based on remote sites data */
 int update_service_status_data(char * host_name, char * service_description) {
-    int num, running, len;
+    int num, running, len, delta = FALSE;
+    unsigned int i;
     service *svc = NULL;
     result_list *row = NULL;
     result_list *answer = nm_malloc(sizeof(result_list));
@@ -1154,6 +1210,22 @@ int update_service_status_data(char * host_name, char * service_description) {
     filtered_query = nm_calloc(max_number_of_executing_objects, 1000);
     if(host_name != NULL && service_description != NULL) {
         len = sprintf(filtered_query, "%s\nFilter: host_name = %s\nFilter: description = %s\nAnd: 2\n", query, host_name, service_description);
+    } else if(stream_is_up() && !full_refresh_required && dirty_services.count <= (unsigned int)max_number_of_executing_objects) {
+        /* the stream told us which services got new results, fetch just those */
+        if(dirty_services.count == 0) {
+            nm_free(filtered_query);
+            nm_free(answer);
+            timing_point("no services changed\n");
+            return(OK);
+        }
+        len = sprintf(filtered_query, "%s\n", query);
+        for(i = 0; i < dirty_services.count; i++) {
+            svc = dirty_services.objects[i];
+            len += sprintf(filtered_query+len, "Filter: host_name = %s\nFilter: description = %s\nAnd: 2\n", svc->host_name, svc->description);
+        }
+        if(dirty_services.count > 1)
+            len += sprintf(filtered_query+len, "Or: %u\n", dirty_services.count);
+        delta = TRUE;
     } else {
         len = sprintf(filtered_query, "%s\nFilter: is_executing = 1\nFilter: last_check >= %d\nOr: 2\n", query, (int)last_refresh);
 
@@ -1202,6 +1274,7 @@ int update_service_status_data(char * host_name, char * service_description) {
             svc->is_executing                   = atoi(row->set[12]);
             svc->is_flapping                    = atoi(row->set[13]);
             svc->last_check                     = atoi(row->set[14]);
+            note_staleness(svc->last_check);
             svc->last_notification              = atoi(row->set[15]);
             svc->last_state_change              = atoi(row->set[16]);
             svc->latency                        = atof(row->set[17]);
@@ -1237,7 +1310,8 @@ int update_service_status_data(char * host_name, char * service_description) {
         nm_log(NSLOG_INFO_MESSAGE, "updating service status failed\n");
         return(ERROR);
     }
-    timing_point("updated %d services\n", num);
+    clear_dirty_set(&dirty_services);
+    timing_point("updated %d %sservices\n", num, delta ? "changed " : "");
     return(OK);
 }
 
@@ -1623,6 +1697,10 @@ int update_comment_data() {
 
 /* updates everything based on remote sites data */
 int update_all_runtime_data() {
+    repl.rows          = 0;
+    repl.staleness_max = 0;
+    repl.staleness_sum = 0;
+
     if(update_program_status_data() != OK)
         return(ERROR);
 
@@ -1645,6 +1723,12 @@ int update_all_runtime_data() {
     if(update_service_status_data(NULL, NULL) != OK)
         return(ERROR);
 
+    repl.refreshes++;
+    if(full_refresh_required || last_refresh == 0) {
+        repl.full_syncs++;
+        repl.last_full_sync = time(NULL);
+    }
+
     // reset full refresh flag
     full_refresh_required = FALSE;
     return(OK);
@@ -1659,6 +1743,11 @@ int run_refresh_loop() {
     struct timeval refresh_start, refresh_end;
 
     initialize_core();
+    create_dirty_set(&dirty_hosts, num_objects.hosts);
+    create_dirty_set(&dirty_services, num_objects.services);
+
+    /* subscribe before the first fetch, so nothing can change in between unnoticed */
+    connect_stream();
 
     /* fetch runtime data once before starting livestatus */
     if(update_downtime_data_by_id(0) != OK || update_comment_data_by_id(0) != OK || update_all_runtime_data() != OK) {
@@ -1676,9 +1765,11 @@ int run_refresh_loop() {
     nm_log(NSLOG_PROCESS_INFO, "started caching %s to %s\n", input_source, output_socket_path);
 
     /* sleep normal interval because we just have fetched all data */
-    usleep(short_shadow_update_interval);
+    write_replication_stats();
+    wait_for_changes(short_shadow_update_interval, short_shadow_update_interval);
 
     while(sigshutdown == FALSE && sigrestart == FALSE) {
+        connect_stream();
         gettimeofday(&refresh_start, NULL);
         if(update_all_runtime_data() != OK) {
             program_start = 0;
@@ -1692,6 +1783,7 @@ int run_refresh_loop() {
             result       = OK;
             last_refresh = refresh_start.tv_sec;
         }
+        write_replication_stats();
         if(sigrestart == TRUE || sigshutdown == TRUE) {
             if(sigrestart == TRUE)
                 write_config_files();
@@ -1712,7 +1804,7 @@ int run_refresh_loop() {
             while(sleep_remaining > 0 && delta_requests == 0 && sigshutdown == FALSE && sigrestart == FALSE) {
                 gettimeofday(&refresh_end, NULL);
                 duration = tv_delta_f(&refresh_start, &refresh_end);
-                usleep(short_shadow_update_interval);
+                wait_for_changes(short_shadow_update_interval, short_shadow_update_interval);
                 sleep_remaining = long_shadow_update_interval - (duration*1000000);
                 delta_requests = get_delta_request_count();
                 if(verbose && delta_requests > 0)
@@ -1724,11 +1816,17 @@ int run_refresh_loop() {
         }
         if(sigshutdown == TRUE || sigrestart == TRUE)
             sleep_remaining = 0;
+        /* with a stream, refresh as soon as something changed, but no more than once a second */
         if(sleep_remaining > 0)
-            usleep(sleep_remaining);
+            wait_for_changes(sleep_remaining, 1000000 - (duration*1000000));
         timing_point("refresh loop waiting...\n");
     }
 
+    if(stream != NULL)
+        nerdstream_disconnect(stream);
+    destroy_dirty_set(&dirty_hosts);
+    destroy_dirty_set(&dirty_services);
+
     nm_free(dummy_command);
     dummy_command = NULL;
     deinitialize_core();
@@ -2123,6 +2221,162 @@ int write_custom_variables(FILE *file, char* rawnames, char* rawvalues) {
     return(OK);
 }
 
+/* sets up a set to remember up to size objects in */
+void create_dirty_set(struct dirty_set *set, unsigned int size) {
+    if(size == 0)
+        size = 1;
+    set->map     = bitmap_create(size);
+    set->objects = nm_calloc(size, sizeof(void *));
+    set->count   = 0;
+}
+
+void destroy_dirty_set(struct dirty_set *set) {
+    bitmap_destroy(set->map);
+    nm_free(set->objects);
+    set->map   = NULL;
+    set->count = 0;
+}
+
+/* remembers an object, unless we already know it changed */
+void mark_dirty(struct dirty_set *set, unsigned int id, void *object) {
+    if(set->map == NULL || bitmap_isset(set->map, id))
+        return;
+    bitmap_set(set->map, id);
+    set->objects[set->count++] = object;
+}
+
+void clear_dirty_set(struct dirty_set *set) {
+    if(set->map == NULL || set->count == 0)
+        return;
+    bitmap_clear(set->map);
+    set->count = 0;
+}
+
+/* called by the stream for every check result of the remote site */
+void stream_host_event(const char *host_name, void *arg) {
+    host *hst = find_host(host_name);
+    if(hst != NULL)
+        mark_dirty(&dirty_hosts, hst->id, hst);
+}
+
+void stream_service_event(const char *host_name, const char *service_description, void *arg) {
+    service *svc = find_service(host_name, service_description);
+    if(svc != NULL)
+        mark_dirty(&dirty_services, svc->id, svc);
+}
+
+int stream_is_up() {
+    return(stream != NULL && stream->sd >= 0);
+}
+
+/* (re)connects the stream. Whatever happened while we were away, we only learn from a full sync */
+void connect_stream() {
+    static int warned = FALSE;
+
+    if(stream == NULL || stream_is_up())
+        return;
+    if(nerdstream_connect(stream) != 0) {
+        if(!warned)
+            nm_log(NSLOG_RUNTIME_WARNING, "cannot follow %s: %s, polling instead\n", stream_source, strerror(errno));
+        warned = TRUE;
+        return;
+    }
+    warned = FALSE;
+    nm_log(NSLOG_PROCESS_INFO, "following check results of %s\n", stream_source);
+    clear_dirty_set(&dirty_hosts);
+    clear_dirty_set(&dirty_services);
+    full_refresh_required = TRUE;
+}
+
+/*
+ * sleeps for usec microseconds, reading the stream in the meantime.
+ * Returns early once the stream named changed objects and at least
+ * min_usec microseconds have passed.
+ */
+void wait_for_changes(double usec, double min_usec) {
+    struct timeval start, now;
+    struct pollfd pfd;
+    double waited, until;
+
+    gettimeofday(&start, NULL);
+    while(sigshutdown == FALSE && sigrestart == FALSE) {
+        gettimeofday(&now, NULL);
+        waited = tv_delta_f(&start, &now) * 1000000;
+        if(waited >= usec)
+            return;
+        if(!stream_is_up()) {
+            usleep(usec - waited);
+            return;
+        }
+        until = usec;
+        if(dirty_hosts.count > 0 || dirty_services.count > 0) {
+            if(waited >= min_usec)
+                return;
+            until = min_usec;
+        }
+        pfd.fd     = stream->sd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, (until - waited) / 1000 + 1) > 0 && nerdstream_read(stream) < 0)
+            nm_log(NSLOG_RUNTIME_WARNING, "lost connection to %s, polling until it is back\n", stream_source);
+    }
+}
+
+/* remembers how old the check result of an object we just updated is */
+void note_staleness(time_t last_check) {
+    time_t age;
+
+    if(last_check <= 0)
+        return;
+    age = time(NULL) - last_check;
+    if(age < 0)
+        age = 0;
+    repl.rows++;
+    repl.staleness_sum += age;
+    if(age > repl.staleness_max)
+        repl.staleness_max = age;
+}
+
+/* writes transfer and staleness counters to tmp/shadownaemon.stats */
+int write_replication_stats() {
+    char path[256], tmp_path[260];
+    time_t now = time(NULL);
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/shadownaemon.stats", tmp_folder);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if((fp = fopen(tmp_path, "w")) == NULL)
+        return(ERROR);
+
+    fprintf(fp, "livestatus_bytes_sent=%llu\n", repl.livestatus_bytes_out);
+    fprintf(fp, "livestatus_bytes_received=%llu\n", repl.livestatus_bytes_in);
+    fprintf(fp, "stream_connected=%d\n", stream_is_up());
+    if(stream != NULL) {
+        fprintf(fp, "stream_bytes_sent=%llu\n", stream->bytes_out);
+        fprintf(fp, "stream_bytes_received=%llu\n", stream->bytes_in);
+        fprintf(fp, "stream_events=%llu\n", stream->events);
+        fprintf(fp, "stream_ignored_lines=%llu\n", stream->ignored);
+        fprintf(fp, "stream_connects=%lu\n", stream->connects);
+        fprintf(fp, "stream_last_event=%lu\n", (unsigned long)stream->last_event);
+    }
+    fprintf(fp, "refreshes=%lu\n", repl.refreshes);
+    fprintf(fp, "full_syncs=%lu\n", repl.full_syncs);
+    fprintf(fp, "last_full_sync=%lu\n", (unsigned long)repl.last_full_sync);
+    fprintf(fp, "last_refresh=%lu\n", (unsigned long)last_refresh);
+    fprintf(fp, "objects_refreshed=%lu\n", repl.rows);
+    fprintf(fp, "staleness_max=%lu\n", (unsigned long)repl.staleness_max);
+    fprintf(fp, "staleness_avg=%.2f\n", repl.rows ? repl.staleness_sum / repl.rows : 0.0);
+    fprintf(fp, "time=%lu\n", (unsigned long)now);
+
+    if(fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return(ERROR);
+    }
+    if(verbose)
+        timing_point("refreshed %lu objects, oldest result %lus, %llu bytes from livestatus so far\n",
+                     repl.rows, (unsigned long)repl.staleness_max, repl.livestatus_bytes_in);
+    return(OK);
+}
+
 /* returns number of requests since last check */
 int get_delta_request_count() {
     int delta = 0;
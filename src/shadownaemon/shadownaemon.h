@@ -42,6 +42,13 @@ struct result_l {
 };
 typedef struct result_l result_list;
 
+/* objects the stream told us about since we last fetched them */
+struct dirty_set {
+    bitmap *map;
+    void **objects;
+    unsigned int count;
+};
+
 #define LIVESTATUS_MODE_SOCKET 1
 #define LIVESTATUS_MODE_TCP    2
 #define LIVESTATUS_MODE_HTTP   3
@@ -90,3 +97,14 @@ int open_tcp_socket(char *connection_string);
 int write_list_attribute(FILE *file, char* attr, char* rawlist);
 int write_custom_variables(FILE *file, char* rawnames, char* rawvalues);
 int get_delta_request_count(void);
+void create_dirty_set(struct dirty_set *set, unsigned int size);
+void destroy_dirty_set(struct dirty_set *set);
+void mark_dirty(struct dirty_set *set, unsigned int id, void *object);
+void clear_dirty_set(struct dirty_set *set);
+void stream_host_event(const char *host_name, void *arg);
+void stream_service_event(const char *host_name, const char *service_description, void *arg);
+int stream_is_up(void);
+void connect_stream(void);
+void wait_for_changes(double usec, double min_usec);
+void note_staleness(time_t last_check);
+int write_replication_stats(void);
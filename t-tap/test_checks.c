@@ -10,6 +10,7 @@
 #include "naemon/macros.h"
 #include "naemon/broker.h"
 #include "naemon/perfdata.h"
+#include "naemon/nm_alloc.h"
 #include "tap.h"
 
 int date_format;
@@ -91,12 +92,252 @@ void setup_objects(time_t when)
 
 }
 
+void test_service_freshness(time_t now)
+{
+	svc1->check_freshness = TRUE;
+	svc1->freshness_threshold = 60;
+	svc1->has_been_checked = TRUE;
+	svc1->checks_enabled = TRUE;
+	svc1->is_executing = FALSE;
+	svc1->is_being_freshened = FALSE;
+	svc1->check_type = CHECK_TYPE_ACTIVE;
+	svc1->last_check = now - 30;
+	check_service_freshness = TRUE;
+
+	update_service_freshness_deadline(svc1);
+	ok(freshness_queue_size(TRUE) == 1, "Service is queued for freshness checking");
+	ok(svc1->freshness_deadline == now + 31, "Deadline is just after the results expire") || diag("deadline=%lu", (unsigned long)svc1->freshness_deadline);
+
+	check_service_result_freshness();
+	ok(freshness_stats.services_evaluated == 0, "Fresh service isn't evaluated");
+	ok(svc1->is_being_freshened == FALSE, "Fresh service isn't freshened");
+
+	/* as if an old result had been loaded from retention data */
+	svc1->last_check = now - 120;
+	update_service_freshness_deadline(svc1);
+	check_service_result_freshness();
+	ok(freshness_stats.services_evaluated == 1, "Stale service is evaluated");
+	ok(freshness_stats.services_stale == 1, "Stale service is found stale");
+	ok(svc1->is_being_freshened == TRUE, "Stale service is being freshened");
+
+	check_service_result_freshness();
+	ok(freshness_stats.services_evaluated == 1 && freshness_stats.services_stale == 0, "Service being freshened stays queued, but isn't freshened twice");
+
+	svc1->check_freshness = FALSE;
+	update_service_freshness_deadline(svc1);
+	ok(freshness_queue_size(TRUE) == 0, "Service is dropped from the queue when freshness checking is disabled");
+}
+
+void test_allocations(void)
+{
+	struct nm_alloc_stats as;
+	struct nm_scratch_stats ss;
+	check_result *cr, *cr2;
+	char *str, *short_output, *long_output, *perf_data;
+	int i;
+
+	cr = nm_slab_alloc(&check_result_cache);
+	cr->output = "dirty";
+	nm_slab_free(&check_result_cache, cr);
+	cr2 = nm_slab_alloc(&check_result_cache);
+	ok(cr2 == cr, "Released check result is handed out again");
+	ok(cr2->output == NULL, "Check results from the cache are zeroed");
+	ok(check_result_cache.in_use == 1, "Cache knows how many objects are in use") || diag("in_use=%lu", check_result_cache.in_use);
+
+	nm_scratch_reset();
+	str = nm_scratch_strdup("scratch");
+	ok(!strcmp(str, "scratch") && !((unsigned long)str & 15), "Scratch strings are copied and aligned");
+	nm_scratch_reset();
+	ok(nm_scratch_strdup("again") == str, "Scratch arena is reused after a reset");
+	nm_scratch_get_stats(&ss);
+	ok(ss.resets >= 1 && ss.reserved >= ss.peak, "Scratch arena stats add up");
+
+	/* modules may call this from anywhere, so it must stay off the arena */
+	nm_scratch_reset();
+	parse_check_output("short | perf=1\nlong", &short_output, &long_output, &perf_data, TRUE, FALSE);
+	nm_scratch_get_stats(&ss);
+	ok(ss.used == 0 && !strcmp(short_output, "short") && !strcmp(long_output, "long") && !strcmp(perf_data, "perf=1"),
+	   "parse_check_output() doesn't use the scratch arena") || diag("used=%lu", (unsigned long)ss.used);
+	nm_free(short_output);
+	nm_free(long_output);
+	nm_free(perf_data);
+
+	/* count what a plain service check result costs, once warmed up */
+	cr2->object_check_type = SERVICE_CHECK;
+	cr2->check_type = CHECK_TYPE_ACTIVE;
+	cr2->exited_ok = TRUE;
+	cr2->output = "OK - all is well | time=0.01s";
+	handle_async_service_check_result(svc1, cr2);
+	nm_alloc_count(TRUE);
+	for (i = 0; i < 1000; i++) {
+		handle_async_service_check_result(svc1, cr2);
+		nm_scratch_reset();
+	}
+	nm_alloc_count(FALSE);
+	nm_alloc_get_stats(&as);
+	ok(nm_alloc_total(&as) > 0, "Allocations are counted");
+	diag("%.2f allocations per service check result", (double)nm_alloc_total(&as) / 1000);
+	nm_alloc_count(TRUE);
+	nm_alloc_get_stats(&as);
+	ok(nm_alloc_total(&as) == 0, "Counting again starts from zero");
+	nm_alloc_count(FALSE);
+	nm_slab_free(&check_result_cache, cr2);
+}
+
+/*
+ * A synthetic dependency graph: DEP_LEVELS levels of DEP_WIDTH
+ * services, each depending on DEP_FANOUT services in the level below
+ * and inheriting their dependencies, so every service on the top level
+ * sits on top of DEP_FANOUT^(DEP_LEVELS-1) dependency chains
+ */
+#define DEP_LEVELS 10
+#define DEP_WIDTH 100
+#define DEP_FANOUT 3
+#define DEP_BENCH_RUNS 1000
+
+static service dep_services[DEP_LEVELS * DEP_WIDTH];
+
+/* the uncached walk, as check_service_dependencies() used to do it */
+static int reference_dependencies(service *svc, int dependency_type)
+{
+	objectlist *list = dependency_type == NOTIFICATION_DEPENDENCY ? svc->notify_deps : svc->exec_deps;
+
+	for (; list; list = list->next) {
+		servicedependency *dep = (servicedependency *)list->object_ptr;
+		service *master = dep->master_service_ptr;
+		int state;
+
+		if (master->state_type == SOFT_STATE && soft_state_dependencies == FALSE)
+			state = master->last_hard_state;
+		else
+			state = master->current_state;
+		if (flag_isset(dep->failure_options, 1 << state))
+			return DEPENDENCIES_FAILED;
+		if (dep->inherits_parent == TRUE && reference_dependencies(master, dependency_type) != DEPENDENCIES_OK)
+			return DEPENDENCIES_FAILED;
+	}
+	return DEPENDENCIES_OK;
+}
+
+static void setup_dependency_graph(void)
+{
+	int level, i, j;
+
+	for (level = 0; level < DEP_LEVELS; level++) {
+		for (i = 0; i < DEP_WIDTH; i++) {
+			service *svc = &dep_services[level * DEP_WIDTH + i];
+
+			svc->state_type = HARD_STATE;
+			if (!level)
+				continue;
+			for (j = 0; j < DEP_FANOUT; j++) {
+				servicedependency *dep = nm_calloc(1, sizeof(*dep));
+
+				dep->master_service_ptr = &dep_services[(level - 1) * DEP_WIDTH + (i + j * 7) % DEP_WIDTH];
+				dep->master_service_ptr->dependents++;
+				dep->dependent_service_ptr = svc;
+				dep->inherits_parent = TRUE;
+				dep->failure_options = OPT_CRITICAL;
+				prepend_object_to_objectlist(&svc->exec_deps, dep);
+			}
+		}
+	}
+}
+
+/* sets the states of the masters; one in 'critical' of them is CRITICAL */
+static void set_dependency_states(int critical)
+{
+	int i;
+
+	for (i = 0; i < (DEP_LEVELS - 1) * DEP_WIDTH; i++) {
+		service *svc = &dep_services[i];
+
+		svc->current_state = rand() % critical ? rand() % 2 : STATE_CRITICAL;
+		svc->last_hard_state = rand() % 2 ? svc->current_state : STATE_OK;
+		svc->state_type = rand() % 2 ? HARD_STATE : SOFT_STATE;
+	}
+	invalidate_dependency_cache();
+}
+
+static void test_dependency_cache(time_t now)
+{
+	int round, i, mismatches = 0, failed = 0;
+	service dependent = { .description = "dependent" };
+	servicedependency dep = { .failure_options = OPT_CRITICAL };
+
+	setup_dependency_graph();
+	srand(now);
+	for (round = 0; round < 20; round++) {
+		set_dependency_states(round < 10 ? 500 : 50);
+		/* twice, so the second pass is all cache hits */
+		for (i = 0; i < 2 * DEP_LEVELS * DEP_WIDTH; i++) {
+			service *svc = &dep_services[i % (DEP_LEVELS * DEP_WIDTH)];
+			int result = check_service_dependencies(svc, EXECUTION_DEPENDENCY);
+
+			if (result != reference_dependencies(svc, EXECUTION_DEPENDENCY))
+				mismatches++;
+			failed += result == DEPENDENCIES_FAILED;
+		}
+	}
+	ok(!mismatches, "Cached dependency results match walking the dependencies every time") || diag("%d mismatches", mismatches);
+	ok(failed > 0, "Some dependencies failed along the way");
+
+	/* a state change only shows up when it's handed over as a check result */
+	setup_objects(now);
+	svc1->current_state = STATE_OK;
+	svc1->last_hard_state = STATE_OK;
+	svc1->state_type = HARD_STATE;
+	svc1->max_attempts = 1;
+	svc1->dependents = 1;
+	dep.master_service_ptr = svc1;
+	prepend_object_to_objectlist(&dependent.exec_deps, &dep);
+	ok(check_service_dependencies(&dependent, EXECUTION_DEPENDENCY) == DEPENDENCIES_OK, "Dependency on an OK service is OK");
+
+	setup_check_result();
+	tmp_check_result->return_code = STATE_CRITICAL;
+	tmp_check_result->output = strdup("CRITICAL failure");
+	handle_async_service_check_result(svc1, tmp_check_result);
+	ok(check_service_dependencies(&dependent, EXECUTION_DEPENDENCY) == DEPENDENCIES_FAILED,
+	   "A master's check result going CRITICAL invalidates what its dependents remember");
+	free_objectlist(&dependent.exec_deps);
+}
+
+static void bench_dependencies(void)
+{
+	struct timeval start, stop;
+	int i, j;
+	double cold, warm;
+
+	set_dependency_states(1000000);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < DEP_WIDTH; i++)
+		reference_dependencies(&dep_services[(DEP_LEVELS - 1) * DEP_WIDTH + i], EXECUTION_DEPENDENCY);
+	gettimeofday(&stop, NULL);
+	diag("%d-level dependency graph, %d services per level, %d masters each:", DEP_LEVELS, DEP_WIDTH, DEP_FANOUT);
+	diag("  uncached: %.1f usec per top level service", tv_delta_f(&start, &stop) * 1000000.0 / DEP_WIDTH);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < DEP_WIDTH; i++)
+		check_service_dependencies(&dep_services[(DEP_LEVELS - 1) * DEP_WIDTH + i], EXECUTION_DEPENDENCY);
+	gettimeofday(&stop, NULL);
+	cold = tv_delta_f(&start, &stop) * 1000000.0 / DEP_WIDTH;
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < DEP_BENCH_RUNS; j++) {
+		for (i = 0; i < DEP_WIDTH; i++)
+			check_service_dependencies(&dep_services[(DEP_LEVELS - 1) * DEP_WIDTH + i], EXECUTION_DEPENDENCY);
+	}
+	gettimeofday(&stop, NULL);
+	warm = tv_delta_f(&start, &stop) * 1000000.0 / (DEP_WIDTH * DEP_BENCH_RUNS);
+	diag("  cached: %.2f usec right after an invalidation, %.3f usec after that", cold, warm);
+}
+
 int main(int argc, char **argv)
 {
 	time_t now = 0L;
 
 
-	plan_tests(35);
+	plan_tests(57);
 
 	time(&now);
 
@@ -361,6 +602,10 @@ int main(int argc, char **argv)
 	ok(host1->current_attempt == 1, "Attempts reset") || diag("current_attempt=%d", host1->current_attempt);
 	ok(strcmp(host1->plugin_output, "UP again") == 0, "output set") || diag("plugin_output=%s", host1->plugin_output);
 
+	test_service_freshness(now);
+	test_allocations();
+	test_dependency_cache(now);
+	bench_dependencies();
 
 	return exit_status();
 }
@@ -28,6 +28,7 @@
 #include "naemon/defaults.h"
 #include "naemon/sretention.h"
 #include "naemon/events.h"
+#include "naemon/nm_alloc.h"
 
 static int *received_persistent;
 static char *received_host;
@@ -406,8 +407,14 @@ void test_host_commands(void) {
 	host *target_host = NULL;
 	int pre = 0, prev_comment_id = next_comment_id;
 	unsigned int prev_downtime_id;
+	scheduled_downtime *temp_downtime;
+	timed_event *event1, *event2;
+	unsigned long events_in_use;
 	time_t check_time =0;
 	char *cmdstr = NULL;
+	servicesmember *sm;
+	comment *temp_comment;
+	int walked, expected;
 	target_host = find_host(host_name);
 	target_host->obsess = FALSE;
 	pre = number_of_host_comments(host_name);
@@ -442,6 +449,38 @@ void test_host_commands(void) {
 	ok(CMD_ERROR_OK == process_external_command1("[1234567890] DEL_ALL_HOST_COMMENTS;host1"), "core command: DEL_ALL_HOST_COMMENTS");
 	ok(0 == number_of_host_comments(host_name), "DEL_ALL_HOST_COMMENTS deletes all host comments");
 
+	asprintf(&cmdstr, "[1234567890] ADD_SVC_COMMENT;host1;%s;0;myself;service comment", target_host->services->service_ptr->description);
+	ok(CMD_ERROR_OK == process_external_command1(cmdstr), "core command: ADD_SVC_COMMENT");
+	free(cmdstr);
+	ok(1 == number_of_service_comments(host_name, target_host->services->service_ptr->description), "ADD_SVC_COMMENT adds a service comment");
+	ok(get_first_comment_by_host(host_name) == target_host->services->service_ptr->comments, "Service comments are found when walking the host's comments");
+	asprintf(&cmdstr, "[1234567890] DEL_ALL_SVC_COMMENTS;host1;%s", target_host->services->service_ptr->description);
+	assert(CMD_ERROR_OK == process_external_command1(cmdstr));
+	free(cmdstr);
+	ok(0 == number_of_service_comments(host_name, target_host->services->service_ptr->description), "DEL_ALL_SVC_COMMENTS deletes all service comments");
+
+	for (sm = target_host->services; sm; sm = sm->next) {
+		asprintf(&cmdstr, "[1234567890] ADD_SVC_COMMENT;host1;%s;0;myself;service comment", sm->service_ptr->description);
+		assert(CMD_ERROR_OK == process_external_command1(cmdstr));
+		free(cmdstr);
+	}
+	expected = number_of_host_comments(host_name);
+	for (sm = target_host->services; sm; sm = sm->next)
+		expected += number_of_service_comments(host_name, sm->service_ptr->description);
+	walked = 0;
+	for (temp_comment = get_first_comment_by_host(host_name); temp_comment; temp_comment = get_next_comment_by_host(host_name, temp_comment)) {
+		if (temp_comment->host_ptr != target_host)
+			break;
+		walked++;
+	}
+	ok(temp_comment == NULL && walked == expected,
+	   "Walking a host's comments finds its own and those of every service");
+	for (sm = target_host->services; sm; sm = sm->next) {
+		asprintf(&cmdstr, "[1234567890] DEL_ALL_SVC_COMMENTS;host1;%s", sm->service_ptr->description);
+		assert(CMD_ERROR_OK == process_external_command1(cmdstr));
+		free(cmdstr);
+	}
+
 	ok(CMD_ERROR_OK == process_external_command1("[1234567890] DISABLE_HOST_NOTIFICATIONS;host1"), "core command: DISABLE_HOST_NOTIFICATIONS");
 	ok(!target_host->notifications_enabled, "DISABLE_HOST_NOTIFICATIONS disables host notifications");
 
@@ -498,6 +537,26 @@ void test_host_commands(void) {
 	ok(!find_host_downtime(prev_downtime_id), "DEL_HOST_DOWNTIME deletes a scheduled host downtime");
 	free(cmdstr);
 
+	/* a pending flexible downtime has an expire event that goes with it */
+	prev_downtime_id = next_downtime_id;
+	asprintf(&cmdstr, "[1234567890] SCHEDULE_HOST_DOWNTIME;host1;%llu;%llu;0;0;600;myself;my flexible downtime", (unsigned long long int)time(NULL), (unsigned long long int)time(NULL) + 1500);
+	ok(CMD_ERROR_OK == process_external_command1(cmdstr), "core command: SCHEDULE_HOST_DOWNTIME, flexible");
+	free(cmdstr);
+	temp_downtime = find_host_downtime(prev_downtime_id);
+	ok(temp_downtime && temp_downtime->stop_event, "A flexible host downtime gets an expire event");
+	events_in_use = timed_event_cache.in_use;
+	asprintf(&cmdstr, "[1234567890] DEL_HOST_DOWNTIME;%i", prev_downtime_id);
+	ok(CMD_ERROR_OK == process_external_command1(cmdstr), "core command: DEL_HOST_DOWNTIME, flexible");
+	free(cmdstr);
+	ok(timed_event_cache.in_use == events_in_use - 1, "Deleting the downtime frees its expire event once");
+	event1 = schedule_new_event(EVENT_USER_FUNCTION, TRUE, time(NULL) + 3600, FALSE, 0, NULL, FALSE, NULL, NULL, 0);
+	event2 = schedule_new_event(EVENT_USER_FUNCTION, TRUE, time(NULL) + 3600, FALSE, 0, NULL, FALSE, NULL, NULL, 0);
+	ok(event1 && event2 && event1 != event2, "Events scheduled after deleting a downtime are distinct");
+	remove_event(nagios_squeue, event1);
+	nm_slab_free(&timed_event_cache, event1);
+	remove_event(nagios_squeue, event2);
+	nm_slab_free(&timed_event_cache, event2);
+
 	ok(CMD_ERROR_OK == process_external_command1("[1234567890] DISABLE_HOST_FLAP_DETECTION;host1"), "core command: DISABLE_HOST_FLAP_DETECTION");
 	ok(!target_host->flap_detection_enabled, "DISABLE_HOST_FLAP_DETECTION disables host flap detection");
 
@@ -562,7 +621,7 @@ void test_core_commands(void) {
 int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
 {
 	const char *test_config_file = get_default_config_file();
-	plan_tests(489);
+	plan_tests(499);
 	init_event_queue();
 
 	config_file_dir = nspath_absolute_dirname(test_config_file, NULL);
@@ -0,0 +1,190 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include "tap.h"
+#include "naemon/globals.h"
+#include "naemon/objects.h"
+#include "naemon/flapping.h"
+#include "naemon/nm_alloc.h"
+
+#define NUM_SEQUENCES 2000
+#define SEQUENCE_LENGTH 200
+
+/* how the percent state change was worked out by walking the history */
+static double legacy_pct(int *history, int idx)
+{
+	double low_curve_value = 0.75;
+	double high_curve_value = 1.25;
+	double curved_changes = 0.0;
+	int last, x, y;
+
+	last = history[idx];
+	y = idx;
+	for (x = 1; x < MAX_STATE_HISTORY_ENTRIES; x++) {
+		if (last != history[y])
+			curved_changes += (((double)(x - 1) * (high_curve_value - low_curve_value)) / ((double)(MAX_STATE_HISTORY_ENTRIES - 2))) + low_curve_value;
+		last = history[y];
+		y++;
+		if (y >= MAX_STATE_HISTORY_ENTRIES)
+			y = 0;
+	}
+	return (double)(((double)curved_changes * 100.0) / (double)(MAX_STATE_HISTORY_ENTRIES - 1));
+}
+
+/* the same double, bit for bit */
+static int same_pct(double a, double b)
+{
+	return !memcmp(&a, &b, sizeof(a));
+}
+
+/* a state that changes with a probability picked per sequence, so all flap rates show up */
+static int next_state(int state, int max_state, int change_pct)
+{
+	if (rand() % 100 >= change_pct)
+		return state;
+	return rand() % (max_state + 1);
+}
+
+static void test_services(void)
+{
+	service *svc = nm_calloc(1, sizeof(*svc));
+	int i, n, change_pct, bad = 0, checks = 0, flapping = 0;
+
+	svc->description = "flappy";
+	svc->host_name = "host";
+	svc->flap_detection_options = ~0;
+	svc->state_type = HARD_STATE;
+
+	for (i = 0; i < NUM_SEQUENCES; i++) {
+		change_pct = rand() % 101;
+		for (n = 0; n < SEQUENCE_LENGTH; n++) {
+			svc->current_state = next_state(svc->current_state, STATE_UNKNOWN, change_pct);
+			check_for_service_flapping(svc, TRUE, FALSE);
+			checks++;
+			if (!same_pct(svc->percent_state_change, legacy_pct(svc->state_history, svc->state_history_index)))
+				bad++;
+			if (svc->percent_state_change >= high_service_flap_threshold)
+				flapping++;
+		}
+	}
+	ok(bad == 0, "Service percent state change matches the history walk %d times", checks);
+	ok(flapping > 0 && flapping < checks, "Services both flap and don't");
+	nm_free(svc);
+}
+
+static void test_hosts(void)
+{
+	host *hst = nm_calloc(1, sizeof(*hst));
+	int i, n, change_pct, bad = 0, checks = 0;
+
+	hst->name = "flappy";
+	hst->flap_detection_options = ~0;
+	hst->state_type = HARD_STATE;
+
+	for (i = 0; i < NUM_SEQUENCES; i++) {
+		change_pct = rand() % 101;
+		for (n = 0; n < SEQUENCE_LENGTH; n++) {
+			hst->current_state = next_state(hst->current_state, STATE_UNREACHABLE, change_pct);
+			check_for_host_flapping(hst, TRUE, TRUE, FALSE);
+			checks++;
+			if (!same_pct(hst->percent_state_change, legacy_pct(hst->state_history, hst->state_history_index)))
+				bad++;
+		}
+	}
+	ok(bad == 0, "Host percent state change matches the history walk %d times", checks);
+	nm_free(hst);
+}
+
+/* histories loaded from the retention file start out at index 0 */
+static void test_retained(void)
+{
+	service *svc = nm_calloc(1, sizeof(*svc));
+	int i, n, bad = 0;
+
+	svc->description = "retained";
+	svc->host_name = "host";
+	svc->flap_detection_options = ~0;
+	svc->state_type = HARD_STATE;
+
+	for (i = 0; i < NUM_SEQUENCES; i++) {
+		for (n = 0; n < MAX_STATE_HISTORY_ENTRIES; n++)
+			svc->state_history[n] = rand() % 4;
+		svc->state_history_index = 0;
+		svc->state_history_changes = pack_state_history(svc->state_history, 0);
+		for (n = 0; n < MAX_STATE_HISTORY_ENTRIES; n++) {
+			svc->current_state = next_state(svc->current_state, STATE_UNKNOWN, 50);
+			check_for_service_flapping(svc, TRUE, FALSE);
+			if (!same_pct(svc->percent_state_change, legacy_pct(svc->state_history, svc->state_history_index)))
+				bad++;
+		}
+	}
+	ok(bad == 0, "Retained histories carry on as they would have");
+	nm_free(svc);
+}
+
+static void test_extremes(void)
+{
+	int history[MAX_STATE_HISTORY_ENTRIES];
+	service *svc = nm_calloc(1, sizeof(*svc));
+	int n;
+
+	svc->description = "extreme";
+	svc->host_name = "host";
+	svc->flap_detection_options = ~0;
+	svc->state_type = HARD_STATE;
+
+	for (n = 0; n < MAX_STATE_HISTORY_ENTRIES; n++) {
+		svc->current_state = STATE_CRITICAL;
+		check_for_service_flapping(svc, TRUE, FALSE);
+	}
+	ok(svc->state_history_changes == 0 && svc->percent_state_change == 0.0,
+	   "A steady state doesn't flap");
+
+	for (n = 0; n < MAX_STATE_HISTORY_ENTRIES; n++) {
+		svc->current_state = n & 1 ? STATE_OK : STATE_CRITICAL;
+		check_for_service_flapping(svc, TRUE, FALSE);
+		history[n] = svc->current_state;
+	}
+	ok(svc->state_history_changes == pack_state_history(history, 0) &&
+	   same_pct(svc->percent_state_change, legacy_pct(history, 0)),
+	   "A state that changes every time flaps as much as it can");
+
+	svc->state_type = SOFT_STATE;
+	svc->current_state = STATE_WARNING;
+	check_for_service_flapping(svc, TRUE, FALSE);
+	ok(svc->state_history_changes == pack_state_history(history, 0),
+	   "Soft problem states aren't recorded");
+	nm_free(svc);
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	plan_tests(7);
+
+	srand(4711);
+	enable_flap_detection = FALSE;
+	high_service_flap_threshold = 20.0;
+
+	test_services();
+	test_hosts();
+	test_retained();
+	test_extremes();
+
+	return exit_status();
+}
@@ -1,6 +1,7 @@
 #include "fixtures.h"
 
 #include "naemon/nebmods.h"
+#include "naemon/neberrors.h"
 #include "naemon/broker.h"
 #include "naemon/nebstructs.h"
 #include "naemon/statusdata.h"
@@ -8,6 +9,9 @@
 #include "naemon/checks.h"
 #include "tap.h"
 #include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
 #define NUM_NEBTYPES 2000
 nebmodule *test_nebmodule;
 void *received_callback_data[NEBCALLBACK_NUMITEMS][NUM_NEBTYPES];
@@ -168,13 +172,228 @@ int test_cb_host_check_processed(void)
 	return 0;
 }
 
+static int dummy_cb(int type, void *data)
+{
+	return 0;
+}
+
+static int other_dummy_cb(int type, void *data)
+{
+	return 0;
+}
+
+int test_has_callbacks(void)
+{
+	ok(!neb_has_callbacks(NEBCALLBACK_COMMENT_DATA), "No comment listeners to begin with");
+	assert(OK == neb_register_callback(NEBCALLBACK_COMMENT_DATA, test_nebmodule->module_handle, 0, dummy_cb));
+	assert(OK == neb_register_callback(NEBCALLBACK_COMMENT_DATA, test_nebmodule->module_handle, 0, other_dummy_cb));
+	ok(neb_has_callbacks(NEBCALLBACK_COMMENT_DATA), "Registering a callback adds a listener");
+	ok(!neb_has_callbacks(NEBCALLBACK_DOWNTIME_DATA), "Other callback types are unaffected");
+	assert(OK == neb_deregister_callback(NEBCALLBACK_COMMENT_DATA, dummy_cb));
+	ok(neb_has_callbacks(NEBCALLBACK_COMMENT_DATA), "Deregistering the first of two callbacks leaves a listener");
+	assert(OK == neb_deregister_callback(NEBCALLBACK_COMMENT_DATA, other_dummy_cb));
+	ok(!neb_has_callbacks(NEBCALLBACK_COMMENT_DATA), "Deregistering the last callback removes the listener");
+	return 0;
+}
+
+static int cancel_cb(int type, void *data)
+{
+	usleep(1500);
+	return NEBERROR_CALLBACKCANCEL;
+}
+
+static int self_deregistering_cb(int type, void *data)
+{
+	neb_deregister_callback(type, self_deregistering_cb);
+	return 0;
+}
+
+/* run a query through the @neb handler and return what it printed */
+static char *neb_query(const char *query)
+{
+	static char out[16384];
+	char buf[64];
+	int pfd[2], ret;
+	ssize_t len;
+
+	assert(pipe(pfd) == 0);
+	strcpy(buf, query);
+	ret = neb_qh_handler(pfd[1], buf, strlen(buf));
+	close(pfd[1]);
+	len = read(pfd[0], out, sizeof(out) - 1);
+	close(pfd[0]);
+	out[len > 0 ? len : 0] = 0;
+	if (ret)
+		sprintf(out, "%d", ret);
+	return out;
+}
+
+int test_callback_profiling(void)
+{
+	nebstruct_comment_data ds;
+	char *out, expect[128];
+	int i;
+
+	memset(&ds, 0, sizeof(ds));
+	neb_callback_profiling = TRUE;
+	neb_query("reset");
+	assert(OK == neb_register_callback(NEBCALLBACK_COMMENT_DATA, test_nebmodule->module_handle, 0, cancel_cb));
+	assert(OK == neb_register_callback(NEBCALLBACK_DOWNTIME_DATA, test_nebmodule->module_handle, 0, self_deregistering_cb));
+	for (i = 0; i < NEB_PROFILE_SAMPLE + 1; i++)
+		neb_make_callbacks(NEBCALLBACK_COMMENT_DATA, &ds);
+	neb_make_callbacks(NEBCALLBACK_DOWNTIME_DATA, &ds);
+	ok(!neb_has_callbacks(NEBCALLBACK_DOWNTIME_DATA), "Callbacks can deregister themselves while being profiled");
+
+	out = neb_query("callbacks");
+	ok(strstr(out, "profiling=on\n") == out, "Profiling state is reported") || diag("%s", out);
+	sprintf(expect, "module=test-module;callback=comment_data;priority=0;calls=%d;cancels=%d;overrides=0;timed=2;",
+	        NEB_PROFILE_SAMPLE + 1, NEB_PROFILE_SAMPLE + 1);
+	ok(strstr(out, expect) != NULL,
+	   "Calls and cancellations are counted per module and callback type, a sample is timed") || diag("%s", out);
+	ok(strstr(out, "lt_10ms=2;") != NULL, "Slow callbacks land in the right latency bucket") || diag("%s", out);
+	ok(strstr(out, "downtime_data") == NULL, "Deregistered callbacks are not listed");
+
+	ok(!strcmp(neb_query("reset"), "200"), "Statistics can be reset");
+	out = neb_query("callbacks");
+	ok(strstr(out, "callback=comment_data;priority=0;calls=0;cancels=0;") != NULL, "Reset clears the counters") || diag("%s", out);
+
+	ok(!strcmp(neb_query("disable"), "200") && !neb_callback_profiling, "Profiling can be disabled");
+	neb_make_callbacks(NEBCALLBACK_COMMENT_DATA, &ds);
+	out = neb_query("callbacks");
+	ok(strstr(out, "profiling=off\n") == out && strstr(out, "calls=0;") != NULL, "Nothing is counted while disabled") || diag("%s", out);
+	neb_query("enable");
+
+	assert(OK == neb_deregister_callback(NEBCALLBACK_COMMENT_DATA, cancel_cb));
+	return 0;
+}
+
+static pthread_t main_thread;
+static int async_calls, async_gate, async_on_main_thread, sync_calls;
+static const char *async_host_name = "MyHost";
+static int async_first_copied, async_first_object_cleared;
+static char async_first_host[64], async_first_comment[64];
+
+static int counting_cb(int type, void *data)
+{
+	sync_calls++;
+	return 0;
+}
+
+static int async_cb(int type, void *data)
+{
+	nebstruct_comment_data *ds = data;
+
+	if (pthread_equal(pthread_self(), main_thread))
+		async_on_main_thread = 1;
+	if (!__atomic_load_n(&async_calls, __ATOMIC_ACQUIRE)) {
+		async_first_copied = ds->host_name && ds->host_name != async_host_name;
+		async_first_object_cleared = ds->object_ptr == NULL;
+		strcpy(async_first_host, ds->host_name ? ds->host_name : "");
+		strcpy(async_first_comment, ds->comment_data ? ds->comment_data : "");
+	}
+	while (!__atomic_load_n(&async_gate, __ATOMIC_ACQUIRE))
+		usleep(1000);
+	__atomic_add_fetch(&async_calls, 1, __ATOMIC_RELEASE);
+	return NEBERROR_CALLBACKCANCEL;
+}
+
+/* this unloads the test module, so it has to run last */
+int test_async_callbacks(void)
+{
+	nebstruct_comment_data ds;
+	char comment[64], *out;
+	int i, cancelled = 0;
+
+	main_thread = pthread_self();
+	neb_async_queue_size = 3; /* rounded up to 4 */
+	ok(neb_register_async_callback(NEBCALLBACK_HOST_STATUS_DATA, test_nebmodule->module_handle, 0, async_cb) == NEBERROR_CALLBACKNOTASYNC,
+	   "Callback types that only carry an object pointer can't be asynchronous");
+	assert(OK == neb_register_async_callback(NEBCALLBACK_COMMENT_DATA, test_nebmodule->module_handle, 0, async_cb));
+	assert(OK == neb_register_callback(NEBCALLBACK_COMMENT_DATA, test_nebmodule->module_handle, 1, counting_cb));
+
+	memset(&ds, 0, sizeof(ds));
+	ds.host_name = (char *)async_host_name;
+	ds.comment_data = comment;
+	ds.object_ptr = &ds;
+	for (i = 0; i < 10; i++) {
+		sprintf(comment, "Comment %d", i);
+		if (neb_make_callbacks(NEBCALLBACK_COMMENT_DATA, &ds))
+			cancelled++;
+	}
+	ok(!cancelled && sync_calls == 10, "Asynchronous callbacks can't cancel other callbacks");
+	/* the first event is stuck in the callback and still takes up its slot */
+	out = neb_query("async");
+	ok(!strcmp(out, "module=test-module;capacity=4;queued=4;delivered=0;dropped=6;pending=4\n"),
+	   "Events that don't fit in the queue are dropped and counted") || diag("%s", out);
+
+	__atomic_store_n(&async_gate, 1, __ATOMIC_RELEASE);
+	assert(OK == neb_unload_module(test_nebmodule, NEBMODULE_FORCE_UNLOAD, NEBMODULE_NEB_SHUTDOWN));
+	ok(__atomic_load_n(&async_calls, __ATOMIC_ACQUIRE) == 4, "Queued events are delivered before the module is unloaded");
+	ok(!async_on_main_thread, "Asynchronous callbacks run on a thread of their own");
+	ok(async_first_copied && !strcmp(async_first_host, "MyHost"), "Strings in the event data are copied");
+	ok(!strcmp(async_first_comment, "Comment 0"), "Events are copied when they happen");
+	ok(async_first_object_cleared, "Object pointers are cleared in the copy");
+	ok(test_nebmodule->async_queue == NULL && !neb_has_callbacks(NEBCALLBACK_COMMENT_DATA), "Unloading removes the queue and the callbacks");
+	return 0;
+}
+
+static double bench_service_results(struct service *svc, struct check_result *cr, int runs)
+{
+	struct timeval start, stop;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < runs; i++)
+		handle_async_service_check_result(svc, cr);
+	gettimeofday(&stop, NULL);
+	return runs / tv_delta_f(&start, &stop);
+}
+
+/*
+ * Check result throughput with nothing listening, which should skip
+ * building any broker data, and with a do-nothing module listening
+ * to everything.
+ */
+int bench_check_results(void)
+{
+	struct check_result *cr = check_result_new(0, "Some output");
+	struct host *hst = host_new("MyBenchHost");
+	struct service *svc = service_new(hst, "MyBenchService");
+	double idle, busy, profiled;
+	int i;
+
+	event_broker_options = BROKER_EVERYTHING;
+	idle = bench_service_results(svc, cr, 100000);
+	for (i = 0; i < NEBCALLBACK_NUMITEMS; i++)
+		neb_register_callback(i, test_nebmodule->module_handle, 0, dummy_cb);
+	neb_callback_profiling = FALSE;
+	busy = bench_service_results(svc, cr, 100000);
+	neb_callback_profiling = TRUE;
+	profiled = bench_service_results(svc, cr, 100000);
+	for (i = 0; i < NEBCALLBACK_NUMITEMS; i++)
+		neb_deregister_callback(i, dummy_cb);
+	diag("service check results/sec: %.0f without listeners, %.0f with a dummy module", idle, busy);
+	diag("service check results/sec: %.0f with a dummy module and callback profiling", profiled);
+	ok(!neb_callback_mask, "Dummy module left no listeners behind");
+
+	check_result_destroy(cr);
+	service_destroy(svc);
+	host_destroy(hst);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
-	plan_tests(19);
+	plan_tests(43);
 	assert(OK == neb_init_callback_list());
-	test_nebmodule = malloc(sizeof(nebmodule));
+	test_nebmodule = calloc(1, sizeof(nebmodule));
+	test_nebmodule->filename = "test-module";
 	neb_add_core_module(test_nebmodule);
+	test_has_callbacks();
+	test_callback_profiling();
+	bench_check_results();
 	test_cb_service_check_processed();
 	test_cb_host_check_processed();
+	test_async_callbacks();
 	return exit_status();
 }
@@ -0,0 +1,269 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "tap.h"
+#include "lib/libnaemon.h"
+#include "naemon/nm_alloc.h"
+#include "shadownaemon/nerdstream.h"
+
+static const char subscribe[] = "@nerd subscribe hostchecks\0@nerd subscribe servicechecks";
+
+/* what the callbacks saw, one "host" or "host;service" per line */
+static char seen[4096];
+
+static void host_event(const char *host_name, void *arg)
+{
+	(*(int *)arg)++;
+	strcat(seen, host_name);
+	strcat(seen, "\n");
+}
+
+static void service_event(const char *host_name, const char *service_description, void *arg)
+{
+	(*(int *)arg)++;
+	strcat(seen, host_name);
+	strcat(seen, ";");
+	strcat(seen, service_description);
+	strcat(seen, "\n");
+}
+
+/* plays the remote core's query handler: sends data down the subscription */
+static void upstream_send(int sd, const char *buf, size_t len)
+{
+	if (nsock_write_all(sd, buf, len) < 0)
+		diag("fake upstream failed to write %lu bytes", (unsigned long)len);
+}
+
+/* reads from the stream until it has handled 'want' events, or a second passed */
+static int pump(struct nerdstream *ns, int want)
+{
+	struct pollfd pfd;
+	int events = 0, ret, i;
+
+	for (i = 0; i < 100 && events < want; i++) {
+		pfd.fd = ns->sd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 10) <= 0)
+			continue;
+		if ((ret = nerdstream_read(ns)) < 0)
+			return ret;
+		events += ret;
+	}
+	return events;
+}
+
+/* accepts the stream's connection and checks that it subscribes */
+static int accept_subscriber(int listener)
+{
+	struct pollfd pfd = { .fd = listener, .events = POLLIN };
+	char buf[sizeof(subscribe) + 16];
+	size_t got = 0;
+	ssize_t ret;
+	int sd;
+
+	if (poll(&pfd, 1, 1000) <= 0 || (sd = accept(listener, NULL, NULL)) < 0)
+		return -1;
+	while (got < sizeof(subscribe)) {
+		pfd.fd = sd;
+		if (poll(&pfd, 1, 1000) <= 0 || (ret = read(sd, buf + got, sizeof(buf) - got)) <= 0)
+			break;
+		got += ret;
+	}
+	ok(got == sizeof(subscribe) && !memcmp(buf, subscribe, got),
+	   "The stream subscribes to host and service check results");
+	return sd;
+}
+
+static void test_parse(void)
+{
+	char *host_name, *service_description;
+	char line[256];
+
+	strcpy(line, "web01 from 0 -> 1: CRITICAL - Host Unreachable (10.0.0.1)");
+	ok(nerdstream_parse(line, &host_name, &service_description) == NERDSTREAM_HOST &&
+	   !strcmp(host_name, "web01") && service_description == NULL,
+	   "Host check results name their host");
+
+	strcpy(line, "web01;HTTP from 2 -> 0: HTTP OK: 200 from upstream -> 3: fine");
+	ok(nerdstream_parse(line, &host_name, &service_description) == NERDSTREAM_SERVICE &&
+	   !strcmp(host_name, "web01") && !strcmp(service_description, "HTTP"),
+	   "Service check results name their host and service");
+
+	strcpy(line, "db01;Backup from nas;daily from 1 -> 0: OK");
+	ok(nerdstream_parse(line, &host_name, &service_description) == NERDSTREAM_SERVICE &&
+	   !strcmp(host_name, "db01") && !strcmp(service_description, "Backup from nas;daily"),
+	   "Service descriptions may hold semicolons and ' from '");
+
+	strcpy(line, "db01 from 0 -> 0: ");
+	ok(nerdstream_parse(line, &host_name, &service_description) == NERDSTREAM_HOST &&
+	   !strcmp(host_name, "db01"), "Empty plugin output is fine");
+
+	strcpy(line, "long output from a plugin");
+	ok(nerdstream_parse(line, &host_name, &service_description) == NERDSTREAM_NONE,
+	   "Lines without a state transition aren't events");
+	strcpy(line, " from 0 -> 1: no name");
+	ok(nerdstream_parse(line, &host_name, &service_description) == NERDSTREAM_NONE,
+	   "Lines without a name aren't events");
+	strcpy(line, "web01 from x -> 1: garbled");
+	ok(nerdstream_parse(line, &host_name, &service_description) == NERDSTREAM_NONE,
+	   "Lines with garbled states aren't events");
+	strcpy(line, ";HTTP from 0 -> 1: no host");
+	ok(nerdstream_parse(line, &host_name, &service_description) == NERDSTREAM_NONE,
+	   "Service lines without a host aren't events");
+}
+
+static void test_stream(const char *path)
+{
+	struct nerdstream *ns;
+	unsigned long long sent = 0;
+	char *big;
+	int listener, sd, events = 0;
+	const char *chunk;
+
+	listener = nsock_unix(path, NSOCK_TCP | NSOCK_UNLINK);
+	if (listener < 0) {
+		fail("Failed to create the fake upstream at %s: %s", path, nsock_strerror(listener));
+		return;
+	}
+
+	ns = nerdstream_create(path, host_event, service_event, &events);
+	ok(nerdstream_connect(ns) == 0 && ns->sd >= 0 && ns->connects == 1, "The stream connects to the upstream");
+	ok(ns->bytes_out == sizeof(subscribe), "Bytes sent are counted");
+	sd = accept_subscriber(listener);
+
+	ok(nerdstream_read(ns) == 0, "Reading without data doesn't block");
+
+	/* what the query handler says to the subscriptions, then two results */
+	chunk = "200: OK\0" "web01 from 0 -> 1: CRITICAL\nweb01;HTTP from 0 -> 2: CRITICAL\n";
+	upstream_send(sd, chunk, 8 + strlen(chunk + 8));
+	sent += 8 + strlen(chunk + 8);
+	ok(pump(ns, 2) == 2 && !strcmp(seen, "web01\nweb01;HTTP\n"),
+	   "Host and service results reach the callbacks");
+	ok(ns->ignored == 1, "The query handler's own responses are ignored");
+
+	/* a line split over several reads */
+	*seen = 0;
+	upstream_send(sd, "db01;Disk /var fr", 17);
+	ok(pump(ns, 1) == 0, "Half a line isn't an event yet");
+	upstream_send(sd, "om 0 -> 1: WARNING - 91% used\nd", 31);
+	upstream_send(sd, "b02 from 1 -> 0: OK\n", 20);
+	sent += 17 + 31 + 20;
+	ok(pump(ns, 2) == 2 && !strcmp(seen, "db01;Disk /var\ndb02\n"),
+	   "Lines split over several reads are put back together");
+
+	/* plugin output with newlines in it */
+	*seen = 0;
+	chunk = "db01;Disk / from 0 -> 1: WARNING\n/ 81%\n/boot 12%\n";
+	upstream_send(sd, chunk, strlen(chunk));
+	sent += strlen(chunk);
+	ok(pump(ns, 1) == 1 && !strcmp(seen, "db01;Disk /\n") && ns->ignored == 3,
+	   "Long plugin output doesn't make events");
+
+	/* a line that doesn't fit in the buffer is dropped, the next one isn't */
+	*seen = 0;
+	big = nm_malloc(NERDSTREAM_BUFSIZE + 1000);
+	memset(big, 'x', NERDSTREAM_BUFSIZE + 1000);
+	upstream_send(sd, big, NERDSTREAM_BUFSIZE + 1000);
+	free(big);
+	chunk = " from 0 -> 1: too long\nweb02 from 1 -> 0: OK\n";
+	upstream_send(sd, chunk, strlen(chunk));
+	sent += NERDSTREAM_BUFSIZE + 1000 + strlen(chunk);
+	ok(pump(ns, 1) == 1 && !strcmp(seen, "web02\n"), "Overlong lines are skipped");
+	ok(ns->bytes_in == sent, "Bytes received are counted");
+	ok(ns->events == 6 && events == 6, "Events are counted");
+	ok(ns->last_event > 0, "The time of the last event is kept");
+
+	/* the remote core goes away */
+	close(sd);
+	ok(pump(ns, 1) == -1 && ns->sd == -1, "Losing the upstream is noticed");
+	ok(nerdstream_read(ns) == -1, "Reading a lost stream fails");
+
+	/* and comes back */
+	ok(nerdstream_connect(ns) == 0 && ns->connects == 2, "The stream reconnects");
+	sd = accept_subscriber(listener);
+	*seen = 0;
+	upstream_send(sd, "web03 from 0 -> 0: OK\n", 22);
+	ok(pump(ns, 1) == 1 && !strcmp(seen, "web03\n"), "Events flow again after reconnecting");
+	close(sd);
+
+	close(listener);
+	unlink(path);
+	ok(nerdstream_connect(ns) < 0 && ns->sd == -1 && ns->connects == 2,
+	   "Connecting fails while the upstream is down");
+	nerdstream_destroy(ns);
+}
+
+/* a query handler made available over tcp, such as through socat */
+static void test_tcp_stream(void)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	struct nerdstream *ns;
+	char source[64];
+	int listener, sd, events = 0;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(listener, 1) < 0 ||
+	    getsockname(listener, (struct sockaddr *)&sin, &len) < 0) {
+		fail("Failed to create the fake tcp upstream");
+		return;
+	}
+	snprintf(source, sizeof(source), "127.0.0.1:%u", ntohs(sin.sin_port));
+
+	*seen = 0;
+	ns = nerdstream_create(source, host_event, service_event, &events);
+	ok(nerdstream_connect(ns) == 0 && ns->sd >= 0, "The stream connects to a host:port upstream");
+	sd = accept_subscriber(listener);
+	upstream_send(sd, "web04 from 0 -> 1: CRITICAL\n", 28);
+	ok(pump(ns, 1) == 1 && !strcmp(seen, "web04\n"), "Events come in over tcp");
+	close(sd);
+	close(listener);
+	ok(nerdstream_connect(ns) < 0 && ns->sd == -1, "Connecting over tcp fails while the upstream is down");
+	nerdstream_destroy(ns);
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	char dir[64], path[128];
+
+	plan_tests(31);
+
+	test_parse();
+
+	snprintf(dir, sizeof(dir), "/tmp/test_nerdstream.XXXXXX");
+	if (!mkdtemp(dir)) {
+		fail("Failed to create a temporary directory");
+		return exit_status();
+	}
+	snprintf(path, sizeof(path), "%s/naemon.qh", dir);
+	test_stream(path);
+	rmdir(dir);
+	test_tcp_stream();
+
+	return exit_status();
+}
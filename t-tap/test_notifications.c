@@ -0,0 +1,271 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <sys/time.h>
+#include "tap.h"
+#include "naemon/objects.h"
+#include "naemon/notifications.h"
+#include "naemon/macros.h"
+#include "naemon/globals.h"
+#include "naemon/utils.h"
+#include "naemon/nm_alloc.h"
+
+#define NUM_CONTACTS 2000
+#define NUM_GROUPS 400
+#define GROUP_SIZE 500
+#define BENCH_RUNS 50
+
+static contact *contacts[NUM_CONTACTS];
+static contactgroup *groups[NUM_GROUPS];
+
+static contact *contact_new(unsigned int id)
+{
+	contact *c = nm_calloc(1, sizeof(*c));
+	c->id = id;
+	nm_asprintf(&c->name, "contact%u", id);
+	c->host_notifications_enabled = TRUE;
+	c->service_notifications_enabled = TRUE;
+	return c;
+}
+
+static contactsmember *contactsmember_new(contact *c, contactsmember *next)
+{
+	contactsmember *m = nm_calloc(1, sizeof(*m));
+	m->contact_name = c->name;
+	m->contact_ptr = c;
+	m->next = next;
+	return m;
+}
+
+/*
+ * Builds a host whose contactgroups overlap heavily, the way
+ * "everyone in ops" style groups tend to, so nearly every member
+ * seen while building the notification list is a duplicate.
+ */
+static host *setup_fanout_host(void)
+{
+	host *hst = nm_calloc(1, sizeof(*hst));
+	contactgroupsmember *cgm;
+	unsigned int i, x;
+
+	hst->name = "fanout-host";
+	for (i = 0; i < NUM_CONTACTS; i++)
+		contacts[i] = contact_new(i);
+	num_objects.contacts = NUM_CONTACTS;
+
+	/* the first two contacts are also named directly */
+	hst->contacts = contactsmember_new(contacts[1], NULL);
+	hst->contacts = contactsmember_new(contacts[0], hst->contacts);
+
+	for (i = 0; i < NUM_GROUPS; i++) {
+		groups[i] = nm_calloc(1, sizeof(contactgroup));
+		groups[i]->id = i;
+		for (x = 0; x < GROUP_SIZE; x++) {
+			contact *c = contacts[(i * (NUM_CONTACTS / NUM_GROUPS) + x) % NUM_CONTACTS];
+			groups[i]->members = contactsmember_new(c, groups[i]->members);
+		}
+		cgm = nm_calloc(1, sizeof(*cgm));
+		cgm->group_ptr = groups[i];
+		cgm->next = hst->contact_groups;
+		hst->contact_groups = cgm;
+	}
+
+	return hst;
+}
+
+/* a service on the fanout host, notifying the same contacts and groups */
+static service *setup_fanout_service(host *hst)
+{
+	service *svc = nm_calloc(1, sizeof(*svc));
+
+	svc->host_name = hst->name;
+	svc->description = "fanout-service";
+	svc->host_ptr = hst;
+	svc->contacts = hst->contacts;
+	svc->contact_groups = hst->contact_groups;
+	return svc;
+}
+
+static int notification_list_length(void)
+{
+	notification *n;
+	int len = 0;
+
+	for (n = notification_list; n; n = n->next)
+		len++;
+	return len;
+}
+
+static int recipients_are_unique(const char *recipients, int expected)
+{
+	bitmap *seen = bitmap_create(NUM_CONTACTS);
+	char *buf = nm_strdup(recipients), *p, *save = NULL;
+	int ret = 1, count = 0;
+
+	for (p = strtok_r(buf, ",", &save); p; p = strtok_r(NULL, ",", &save)) {
+		unsigned int id = strtoul(p + strlen("contact"), NULL, 10);
+		if (bitmap_isset(seen, id))
+			ret = 0;
+		bitmap_set(seen, id);
+		count++;
+	}
+	free(buf);
+	bitmap_destroy(seen);
+	return ret && count == expected;
+}
+
+static void test_fanout(host *hst)
+{
+	nagios_macros mac;
+	int escalated = -1;
+	char *first;
+
+	memset(&mac, 0, sizeof(mac));
+	ok(OK == create_notification_list_from_host(&mac, hst, NOTIFICATION_OPTION_FORCED, &escalated, NOTIFICATION_NORMAL), "Notification list created");
+	ok(escalated == FALSE, "Notification is not escalated");
+	ok(notification_list_length() == NUM_CONTACTS, "Every contact is on the list exactly once") || diag("length=%d", notification_list_length());
+	ok(mac.x[MACRO_NOTIFICATIONRECIPIENTS] != NULL && recipients_are_unique(mac.x[MACRO_NOTIFICATIONRECIPIENTS], NUM_CONTACTS), "Recipients macro holds every contact once");
+	ok(mac.x[MACRO_NOTIFICATIONRECIPIENTS] && !strncmp(mac.x[MACRO_NOTIFICATIONRECIPIENTS], "contact0,contact1,", 18), "Recipients are listed in the order they were added");
+	ok(find_notification(contacts[NUM_CONTACTS - 1]) != NULL, "find_notification() finds a group member");
+
+	/* a second run must not see contacts from the first as duplicates */
+	first = mac.x[MACRO_NOTIFICATIONRECIPIENTS];
+	mac.x[MACRO_NOTIFICATIONRECIPIENTS] = NULL;
+	nm_free(mac.x[MACRO_NOTIFICATIONISESCALATED]);
+	free_notification_list();
+	ok(find_notification(contacts[0]) == NULL, "Freed list forgets its contacts");
+	create_notification_list_from_host(&mac, hst, NOTIFICATION_OPTION_FORCED, &escalated, NOTIFICATION_NORMAL);
+	ok(notification_list_length() == NUM_CONTACTS, "Rebuilt list holds every contact again");
+	ok(!strcmp(first, mac.x[MACRO_NOTIFICATIONRECIPIENTS]), "Rebuilt recipients macro is identical");
+
+	nm_free(first);
+	nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
+	nm_free(mac.x[MACRO_NOTIFICATIONISESCALATED]);
+	free_notification_list();
+}
+
+static void test_service_fanout(service *svc)
+{
+	nagios_macros mac;
+	int escalated = -1;
+
+	memset(&mac, 0, sizeof(mac));
+	ok(OK == create_notification_list_from_service(&mac, svc, NOTIFICATION_OPTION_FORCED, &escalated, NOTIFICATION_NORMAL), "Service notification list created");
+	ok(escalated == FALSE, "Service notification is not escalated");
+	ok(notification_list_length() == NUM_CONTACTS, "Every service contact is on the list exactly once") || diag("length=%d", notification_list_length());
+	ok(mac.x[MACRO_NOTIFICATIONRECIPIENTS] != NULL && recipients_are_unique(mac.x[MACRO_NOTIFICATIONRECIPIENTS], NUM_CONTACTS), "Service recipients macro holds every contact once");
+
+	nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
+	nm_free(mac.x[MACRO_NOTIFICATIONISESCALATED]);
+	free_notification_list();
+}
+
+/*
+ * An escalation whose contactgroups are half of the host's own, plus
+ * a contact the host also names directly. A broadcast reaches both
+ * the escalated and the normal contacts, so every one of them is
+ * seen at least twice.
+ */
+static void test_escalated_fanout(host *hst)
+{
+	hostescalation *he = nm_calloc(1, sizeof(*he));
+	contactgroupsmember *cgm;
+	nagios_macros mac;
+	int escalated = -1, options, want, i;
+
+	he->host_ptr = hst;
+	he->first_notification = 1;
+	he->escalation_options = ~0;
+	he->contacts = contactsmember_new(contacts[0], NULL);
+	for (i = 0; i < NUM_GROUPS / 2; i++) {
+		cgm = nm_calloc(1, sizeof(*cgm));
+		cgm->group_ptr = groups[i];
+		cgm->next = he->contact_groups;
+		he->contact_groups = cgm;
+	}
+	prepend_object_to_objectlist(&hst->escalation_list, he);
+	hst->current_state = STATE_DOWN;
+	hst->current_notification_number = 1;
+
+	for (i = 0; i < 2; i++) {
+		options = NOTIFICATION_OPTION_FORCED | (i ? NOTIFICATION_OPTION_BROADCAST : 0);
+		/* on its own, the escalation only reaches the members of its groups */
+		want = i ? NUM_CONTACTS : (NUM_GROUPS / 2 - 1) * (NUM_CONTACTS / NUM_GROUPS) + GROUP_SIZE;
+		memset(&mac, 0, sizeof(mac));
+		create_notification_list_from_host(&mac, hst, options, &escalated, NOTIFICATION_NORMAL);
+		ok(escalated == TRUE, "Notification is escalated%s", i ? " for a broadcast" : "");
+		ok(notification_list_length() == want, "Every escalated%s contact is on the list exactly once", i ? " and normal" : "")
+		|| diag("length=%d", notification_list_length());
+		ok(mac.x[MACRO_NOTIFICATIONRECIPIENTS] != NULL && recipients_are_unique(mac.x[MACRO_NOTIFICATIONRECIPIENTS], want),
+		   "Escalated%s recipients macro holds every contact once", i ? " broadcast" : "");
+		nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
+		nm_free(mac.x[MACRO_NOTIFICATIONISESCALATED]);
+		free_notification_list();
+	}
+
+	/* leave the host as the other tests expect it */
+	free_objectlist(&hst->escalation_list);
+	hst->current_state = STATE_UP;
+	hst->current_notification_number = 0;
+	while ((cgm = he->contact_groups)) {
+		he->contact_groups = cgm->next;
+		free(cgm);
+	}
+	free(he->contacts);
+	free(he);
+}
+
+static void bench_fanout(host *hst, service *svc)
+{
+	nagios_macros mac;
+	struct timeval start, stop;
+	int escalated, i;
+	double usecs;
+
+	memset(&mac, 0, sizeof(mac));
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_RUNS; i++) {
+		if (svc)
+			create_notification_list_from_service(&mac, svc, NOTIFICATION_OPTION_FORCED, &escalated, NOTIFICATION_NORMAL);
+		else
+			create_notification_list_from_host(&mac, hst, NOTIFICATION_OPTION_FORCED, &escalated, NOTIFICATION_NORMAL);
+		nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
+		nm_free(mac.x[MACRO_NOTIFICATIONISESCALATED]);
+		free_notification_list();
+	}
+	gettimeofday(&stop, NULL);
+	usecs = tv_delta_f(&start, &stop) * 1000000.0;
+	diag("%d contacts in %d overlapping groups of %d: %.0f usec per %s notification list",
+	     NUM_CONTACTS, NUM_GROUPS, GROUP_SIZE, usecs / BENCH_RUNS, svc ? "service" : "host");
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	host *hst;
+	service *svc;
+
+	plan_tests(19);
+	hst = setup_fanout_host();
+	svc = setup_fanout_service(hst);
+	test_fanout(hst);
+	test_service_fanout(svc);
+	test_escalated_fanout(hst);
+	bench_fanout(hst, NULL);
+	bench_fanout(hst, svc);
+	return exit_status();
+}
@@ -0,0 +1,206 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "tap.h"
+#include "naemon/globals.h"
+#include "naemon/query-handler.h"
+#include "naemon/utils.h"
+#include "naemon/nm_alloc.h"
+#include "lib/nsock.h"
+
+#define NUM_CLIENTS 200
+#define BIG_ECHO (512 * 1024)
+
+static char qh_path[64];
+
+static int qh_connect(void)
+{
+	int sd = nsock_unix(qh_path, NSOCK_TCP | NSOCK_CONNECT);
+	if (sd < 0)
+		diag("connect to %s failed: %s", qh_path, strerror(errno));
+	return sd;
+}
+
+static void run_broker(int msecs)
+{
+	struct timeval start, now;
+
+	gettimeofday(&start, NULL);
+	do {
+		iobroker_poll(nagios_iobs, 1);
+		gettimeofday(&now, NULL);
+	} while (tv_delta_msec(&start, &now) < msecs);
+}
+
+/* we're the server too, so keep it running while we write */
+static int write_all(int sd, const char *buf, int len)
+{
+	int sent = 0, ret;
+
+	while (sent < len) {
+		ret = send(sd, buf + sent, len - sent, MSG_DONTWAIT);
+		if (ret < 0 && errno != EAGAIN)
+			return -1;
+		if (ret > 0)
+			sent += ret;
+		run_broker(1);
+	}
+	return sent;
+}
+
+/* read until we have 'len' bytes or the other end goes away */
+static int read_all(int sd, char *buf, int len)
+{
+	int got = 0, ret;
+
+	while (got < len) {
+		run_broker(1);
+		ret = recv(sd, buf + got, len - got, MSG_DONTWAIT);
+		if (ret == 0)
+			break;
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				continue;
+			break;
+		}
+		got += ret;
+	}
+	return got;
+}
+
+/* run a oneshot query and return its nul-terminated response */
+static char *qh_query(const char *query)
+{
+	static char out[4096];
+	int sd, got = 0, ret;
+
+	sd = qh_connect();
+	nsock_printf_nul(sd, "%s", query);
+	for (;;) {
+		run_broker(1);
+		ret = recv(sd, out + got, sizeof(out) - 1 - got, MSG_DONTWAIT);
+		if (ret == 0 || (ret < 0 && errno != EAGAIN))
+			break;
+		if (ret > 0)
+			got += ret;
+	}
+	close(sd);
+	out[got] = 0;
+	return out;
+}
+
+static unsigned long long qh_stat(const char *name)
+{
+	char key[64], *p;
+
+	snprintf(key, sizeof(key), "%s=", name);
+	p = strstr(qh_query("#core qhstats"), key);
+	return p ? strtoull(p + strlen(key), NULL, 10) : ~0ULL;
+}
+
+static void test_requests(void)
+{
+	char buf[64];
+	int sd;
+
+	ok(!strcmp(qh_query("#echo hello"), "hello"), "Oneshot echo is echoed back");
+	ok(!strncmp(qh_query("#nosuchhandler"), "404: ", 5), "Unknown handler is a 404");
+
+	/* keepalive client sending several requests in one go */
+	sd = qh_connect();
+	ok(write(sd, "@echo one\0@echo two\0@echo three", 32) == 32, "Pipelined requests sent");
+	ok(read_all(sd, buf, 11) == 11 && !memcmp(buf, "onetwothree", 11), "Pipelined requests are all answered, in order");
+	close(sd);
+}
+
+static void test_accept_burst(void)
+{
+	int sds[NUM_CLIENTS], i, answered = 0;
+	char buf[2];
+
+	for (i = 0; i < NUM_CLIENTS; i++) {
+		sds[i] = qh_connect();
+		nsock_printf_nul(sds[i], "#echo x");
+	}
+	for (i = 0; i < NUM_CLIENTS; i++) {
+		if (read_all(sds[i], buf, 1) == 1 && *buf == 'x')
+			answered++;
+		close(sds[i]);
+	}
+	if (!ok(answered == NUM_CLIENTS, "Every client in a burst of %d is answered", NUM_CLIENTS))
+		diag("answered=%d", answered);
+	ok(qh_stat("accept_batch_max") > 1, "More than one connection is accepted per wakeup");
+}
+
+static void test_slow_client(void)
+{
+	char *query, *big;
+	int slow, bufsize = 4096, got;
+	struct timeval start, stop;
+	unsigned long long queued = qh_stat("output_queued");
+
+	slow = qh_connect();
+	setsockopt(slow, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	query = nm_malloc(BIG_ECHO + 7);
+	memcpy(query, "@echo ", 6);
+	memset(query + 6, 'a', BIG_ECHO);
+	query[BIG_ECHO + 6] = 0;
+	ok(write_all(slow, query, BIG_ECHO + 7) == BIG_ECHO + 7, "Large request sent by client that doesn't read");
+
+	/* let it get its request in, but don't read what it gets back */
+	run_broker(50);
+	gettimeofday(&start, NULL);
+	ok(!strcmp(qh_query("#echo fast"), "fast"), "Other clients are served while a client doesn't read");
+	gettimeofday(&stop, NULL);
+	ok(tv_delta_msec(&start, &stop) < 1000, "...without waiting for it");
+	ok(qh_stat("clients_blocked") == 1, "The slow client waits for its socket to become writable");
+	ok(qh_stat("output_queued") == queued + 1, "Its response is queued");
+
+	big = nm_malloc(BIG_ECHO);
+	got = read_all(slow, big, BIG_ECHO);
+	if (!ok(got == BIG_ECHO && !memcmp(big, query + 6, BIG_ECHO), "The slow client eventually gets all of its response"))
+		diag("got=%d", got);
+	close(slow);
+	run_broker(10);
+	ok(qh_stat("clients_blocked") == 0, "No client is left waiting once it's all sent");
+	free(query);
+	free(big);
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	plan_tests(14);
+
+	snprintf(qh_path, sizeof(qh_path), "/tmp/test_qh.%d", (int)getpid());
+	nagios_iobs = iobroker_create();
+	ok(qh_init(qh_path) == OK, "Query handler initialized");
+
+	test_requests();
+	test_accept_burst();
+	test_slow_client();
+
+	qh_deinit(qh_path);
+	iobroker_destroy(nagios_iobs, IOBROKER_CLOSE_SOCKETS);
+	return exit_status();
+}
@@ -0,0 +1,220 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <math.h>
+#include "naemon/events.c"
+#include "tap.h"
+
+static struct timeval at(time_t sec, suseconds_t usec)
+{
+	struct timeval tv;
+
+	tv.tv_sec = sec;
+	tv.tv_usec = usec;
+	return tv;
+}
+
+static void test_check_tokens(time_t t0)
+{
+	struct timeval now;
+	int i;
+
+	max_check_rate = 5;
+	memset(&dispatch, 0, sizeof(dispatch));
+	now = at(t0, 0);
+	ok(check_token_available(&now) && dispatch.tokens == 5.0, "The bucket starts out with a second's worth of checks");
+	for (i = 0; i < 5; i++)
+		spend_check_token();
+	ok(!check_token_available(&now), "Checks are held back once the bucket is empty");
+
+	now = at(t0, 200000);
+	ok(check_token_available(&now) && fabs(dispatch.tokens - 1.0) < 0.001, "The bucket refills at max_check_rate") || diag("tokens: %f", dispatch.tokens);
+	for (i = 0; i < 10; i++)
+		check_token_available(&now);
+	ok(fabs(dispatch.tokens - 1.0) < 0.001, "Looking for a token doesn't use it up");
+
+	now = at(t0 + 60, 0);
+	ok(check_token_available(&now) && dispatch.tokens == 5.0, "The bucket never holds more than a second's worth of checks");
+
+	max_check_rate = 0.5;
+	memset(&dispatch, 0, sizeof(dispatch));
+	ok(check_token_available(&now) && dispatch.tokens == 1.0, "The bucket holds at least one check");
+
+	max_check_rate = 0;
+	memset(&dispatch, 0, sizeof(dispatch));
+	for (i = 0; i < 10; i++)
+		spend_check_token();
+	ok(check_token_available(&now) && dispatch.tokens == 0.0, "Without max_check_rate every check may run");
+}
+
+static void test_dispatch_slots(time_t t0)
+{
+	struct timeval now = at(t0, 500000);
+	time_t slot;
+	int i;
+
+	max_check_rate = 4;
+	memset(&dispatch, 0, sizeof(dispatch));
+	ok(next_dispatch_slot(&now) == t0 + 1 && dispatch.next_slot == t0 + 1.5, "The first held back check is retried a second later");
+	for (i = 0; i < 3; i++)
+		slot = next_dispatch_slot(&now);
+	ok(slot == t0 + 2 && dispatch.next_slot == t0 + 2.25, "Held back checks are lined up 1/max_check_rate apart") || diag("next_slot: %f", dispatch.next_slot);
+
+	now = at(t0 + 30, 0);
+	ok(next_dispatch_slot(&now) == t0 + 31, "Once the backlog has drained, checks are again retried a second later");
+
+	max_check_rate = 0;
+	memset(&dispatch, 0, sizeof(dispatch));
+	slot = next_dispatch_slot(&now);
+	ok(slot >= t0 + 35 && slot <= t0 + 47 && dispatch.next_slot == 0.0, "Without max_check_rate held back checks are just nudged") || diag("slot: %lu", (unsigned long)(slot - t0));
+}
+
+static void test_skipped_check(void)
+{
+	service svc;
+	timed_event *event;
+	struct timeval now;
+	int i;
+
+	memset(&svc, 0, sizeof(svc));
+	svc.host_name = "host1";
+	svc.description = "service1";
+	svc.checks_enabled = FALSE;
+
+	max_check_rate = 5;
+	execute_service_checks = TRUE;
+	memset(&dispatch, 0, sizeof(dispatch));
+	gettimeofday(&now, NULL);
+	check_token_available(&now);
+	for (i = 0; i < 4; i++)
+		spend_check_token();
+
+	event = schedule_new_event(EVENT_SERVICE_CHECK, FALSE, time(NULL), FALSE, 0, NULL, TRUE, &svc, NULL, 0);
+	ok(should_run_event(event) == TRUE, "A check is let through while there's a token left");
+	handle_timed_event(event);
+	ok(svc.is_executing == FALSE && dispatch.tokens >= 1.0, "A check that's never handed to a worker doesn't use up a token") || diag("tokens: %f", dispatch.tokens);
+	remove_event(nagios_squeue, event);
+	nm_slab_free(&timed_event_cache, event);
+}
+
+static host hosts[3];
+static service services[9];
+
+/* three hosts with three services each, all due every minute */
+static void setup_objects(void)
+{
+	unsigned int i;
+
+	memset(hosts, 0, sizeof(hosts));
+	memset(services, 0, sizeof(services));
+	for (i = 0; i < ARRAY_SIZE(hosts); i++) {
+		hosts[i].id = i;
+		hosts[i].check_interval = 1;
+		hosts[i].state_type = HARD_STATE;
+		hosts[i].should_be_scheduled = TRUE;
+		hosts[i].next = i + 1 < ARRAY_SIZE(hosts) ? &hosts[i + 1] : NULL;
+	}
+	for (i = 0; i < ARRAY_SIZE(services); i++) {
+		services[i].host_ptr = &hosts[i / 3];
+		services[i].check_interval = 1;
+		services[i].state_type = HARD_STATE;
+		services[i].should_be_scheduled = TRUE;
+		services[i].next = i + 1 < ARRAY_SIZE(services) ? &services[i + 1] : NULL;
+	}
+	host_list = hosts;
+	service_list = services;
+	num_objects.hosts = ARRAY_SIZE(hosts);
+	scheduling_info.total_scheduled_hosts = ARRAY_SIZE(hosts);
+	scheduling_info.total_scheduled_services = ARRAY_SIZE(services);
+	interval_length = 60;
+}
+
+/* tells if the check times of all services but skip are n evenly spaced seconds in a minute */
+static int evenly_spread(time_t t0, unsigned int n, const service *skip)
+{
+	int seen[60] = { 0 };
+	unsigned int i, k;
+
+	for (i = 0; i < ARRAY_SIZE(services); i++) {
+		if (&services[i] == skip)
+			continue;
+		if (services[i].next_check < t0 || services[i].next_check >= t0 + 60)
+			return FALSE;
+		seen[services[i].next_check - t0]++;
+	}
+	for (k = 0; k < n; k++) {
+		if (seen[k * 60 / n] != 1)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_even_spreading(time_t t0)
+{
+	setup_objects();
+	initial_check_scheduling = CHECK_SCHEDULING_EVEN;
+	spread_service_checks(t0);
+	ok(evenly_spread(t0, 9, NULL), "Service checks are spread evenly over their check window");
+	ok(services[0].next_check == t0 && services[1].next_check == t0 + 6 && services[2].next_check == t0 + 13,
+	   "Even spreading keeps the order of the services");
+
+	setup_objects();
+	services[4].next_check = t0 + 30;
+	spread_service_checks(t0);
+	ok(services[4].next_check == t0 + 30, "A retained check time inside the check window is kept");
+	ok(evenly_spread(t0, 8, &services[4]), "The other checks are spread evenly around it");
+
+	setup_objects();
+	hosts[2].check_interval = 2;
+	spread_host_checks(t0);
+	ok(hosts[0].next_check == t0 && hosts[1].next_check == t0 + 30 && hosts[2].next_check == t0,
+	   "Host checks are spread over their own check window");
+}
+
+static void test_interleaved_spreading(time_t t0)
+{
+	unsigned int i;
+	int turns = TRUE;
+
+	setup_objects();
+	initial_check_scheduling = CHECK_SCHEDULING_INTERLEAVED;
+	spread_service_checks(t0);
+	ok(evenly_spread(t0, 9, NULL), "Interleaved service checks are spread evenly over their check window");
+	for (i = 0; i < ARRAY_SIZE(services); i++) {
+		if (services[i].next_check != t0 + ((i % 3) * 3 + i / 3) * 60 / 9)
+			turns = FALSE;
+	}
+	ok(turns, "Every host gets its turn before any host gets its next one");
+	ok(services[3].next_check - services[0].next_check < 60 / 3,
+	   "The first check of each host comes early in the window");
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	time_t t0 = 1400000000;
+
+	plan_tests(21);
+
+	init_event_queue();
+	test_check_tokens(t0);
+	test_dispatch_slots(t0);
+	test_skipped_check();
+	test_even_spreading(t0);
+	test_interleaved_spreading(t0);
+
+	return exit_status();
+}
@@ -0,0 +1,320 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/socket.h>
+#include "tap.h"
+#include "naemon/globals.h"
+#include "naemon/objects.h"
+#include "naemon/statusdata.h"
+#include "naemon/query-handler.h"
+#include "naemon/utils.h"
+#include "naemon/nm_alloc.h"
+#include "lib/nsock.h"
+
+#define NUM_HOSTS 50
+#define NUM_SERVICES 300
+#define NUM_UPDATES 20000
+
+static char qh_path[64];
+static host *hosts[NUM_HOSTS];
+static service *services[NUM_SERVICES];
+
+/* what naemonstats would work out from status.dat for one kind of object */
+struct recount {
+	unsigned int entries, checked, scheduled, flapping, in_downtime, state[4];
+	unsigned int checks[2], last[2][4];
+	double min[2][3], max[2][3], sum[2][3];
+	double psc_min, psc_max, psc_sum;
+};
+
+/* run a oneshot query and return its nul-terminated response */
+static char *qh_query(const char *query)
+{
+	static char out[16384];
+	int sd, got = 0, ret;
+
+	sd = nsock_unix(qh_path, NSOCK_TCP | NSOCK_CONNECT);
+	nsock_printf_nul(sd, "%s", query);
+	for (;;) {
+		iobroker_poll(nagios_iobs, 1);
+		ret = recv(sd, out + got, sizeof(out) - 1 - got, MSG_DONTWAIT);
+		if (ret == 0 || (ret < 0 && errno != EAGAIN))
+			break;
+		if (ret > 0)
+			got += ret;
+	}
+	close(sd);
+	out[got] = 0;
+	return out;
+}
+
+static double stat_value(const char *out, const char *name)
+{
+	char key[128];
+	const char *p;
+
+	snprintf(key, sizeof(key), "\n%s=", name);
+	p = strstr(out, key);
+	return p ? strtod(p + strlen(key), NULL) : -1.0;
+}
+
+static void recount_one(struct recount *rc, time_t now, int active, int state, double latency,
+                        double execution_time, double state_change, int flapping, int downtime,
+                        int checked, int scheduled, time_t last_check)
+{
+	static const unsigned long ages[4] = { 60, 300, 900, 3600 };
+	double v[3];
+	int i;
+
+	v[0] = latency;
+	v[1] = execution_time;
+	v[2] = state_change;
+	rc->entries++;
+	rc->checked += checked;
+	rc->scheduled += scheduled;
+	rc->flapping += flapping;
+	rc->in_downtime += downtime;
+	rc->state[state]++;
+	if (rc->entries == 1 || state_change < rc->psc_min)
+		rc->psc_min = state_change;
+	if (rc->entries == 1 || state_change > rc->psc_max)
+		rc->psc_max = state_change;
+	rc->psc_sum += state_change;
+	for (i = 0; i < 3; i++) {
+		if (!rc->checks[active] || v[i] < rc->min[active][i])
+			rc->min[active][i] = v[i];
+		if (!rc->checks[active] || v[i] > rc->max[active][i])
+			rc->max[active][i] = v[i];
+		rc->sum[active][i] += v[i];
+	}
+	rc->checks[active]++;
+	for (i = 0; i < 4; i++) {
+		if ((unsigned long)(now - last_check) <= ages[i])
+			rc->last[active][i]++;
+	}
+}
+
+/* compares the query handler's numbers with a recount, returns how many differ */
+static int compare(const char *out, const char *noun, struct recount *rc, const char *states[4])
+{
+	static const char *types[2] = { "passive", "active" };
+	static const char *values[3] = { "latency", "execution_time", "state_change" };
+	static const char *windows[4] = { "1min", "5min", "15min", "1hour" };
+	char name[128];
+	int i, t, bad = 0;
+
+#define EXPECT(want) do { \
+		double got_ = stat_value(out, name); \
+		if (fabs(got_ - (want)) > 0.000002) { \
+			diag("%s is %f, expected %f", name, got_, (double)(want)); \
+			bad++; \
+		} \
+	} while (0)
+
+	snprintf(name, sizeof(name), "status_%s_entries", noun);
+	EXPECT(rc->entries);
+	snprintf(name, sizeof(name), "%ss_checked", noun);
+	EXPECT(rc->checked);
+	snprintf(name, sizeof(name), "%ss_scheduled", noun);
+	EXPECT(rc->scheduled);
+	snprintf(name, sizeof(name), "%ss_flapping", noun);
+	EXPECT(rc->flapping);
+	snprintf(name, sizeof(name), "%ss_in_downtime", noun);
+	EXPECT(rc->in_downtime);
+	for (i = 0; i < 4; i++) {
+		if (!states[i])
+			continue;
+		snprintf(name, sizeof(name), "%ss_%s", noun, states[i]);
+		EXPECT(rc->state[i]);
+	}
+	snprintf(name, sizeof(name), "min_%s_state_change", noun);
+	EXPECT(rc->psc_min);
+	snprintf(name, sizeof(name), "max_%s_state_change", noun);
+	EXPECT(rc->psc_max);
+	snprintf(name, sizeof(name), "average_%s_state_change", noun);
+	EXPECT(rc->psc_sum / rc->entries);
+
+	for (t = 0; t < 2; t++) {
+		snprintf(name, sizeof(name), "%s_%s_checks", types[t], noun);
+		EXPECT(rc->checks[t]);
+		for (i = 0; i < 3; i++) {
+			if (!t && i == 1)
+				continue;
+			snprintf(name, sizeof(name), "min_%s_%s_%s", types[t], noun, values[i]);
+			EXPECT(rc->checks[t] ? rc->min[t][i] : 0.0);
+			snprintf(name, sizeof(name), "max_%s_%s_%s", types[t], noun, values[i]);
+			EXPECT(rc->checks[t] ? rc->max[t][i] : 0.0);
+			snprintf(name, sizeof(name), "average_%s_%s_%s", types[t], noun, values[i]);
+			EXPECT(rc->checks[t] ? rc->sum[t][i] / rc->checks[t] : 0.0);
+		}
+		for (i = 0; i < 4; i++) {
+			snprintf(name, sizeof(name), "%s_%ss_checked_last_%s", types[t], noun, windows[i]);
+			EXPECT(rc->last[t][i]);
+		}
+	}
+#undef EXPECT
+	return bad;
+}
+
+/* latencies and state changes come in few distinct values, so mins and maxes are shared */
+static double random_value(void)
+{
+	return (rand() % 20) / 4.0;
+}
+
+static void randomize(int *check_type, int *state, int max_state, double *latency,
+                      double *execution_time, double *state_change, int *flapping,
+                      int *downtime, int *checked, int *scheduled, time_t *last_check, time_t now)
+{
+	*check_type = rand() % 4 ? CHECK_TYPE_ACTIVE : CHECK_TYPE_PASSIVE;
+	*state = rand() % (max_state + 1);
+	*latency = random_value();
+	*execution_time = random_value();
+	*state_change = random_value() * 5;
+	*flapping = !(rand() % 10);
+	*downtime = rand() % 10 ? 0 : 1 + rand() % 2;
+	*checked = rand() % 5 > 0;
+	*scheduled = rand() % 5 > 0;
+	/* now and then never checked, or in the future */
+	*last_check = rand() % 20 ? now - rand() % 4000 : (rand() % 2 ? 0 : now + 5);
+}
+
+static int check_all(const char *out, time_t now)
+{
+	static const char *host_states[4] = { "up", "down", "unreachable", NULL };
+	static const char *service_states[4] = { "ok", "warning", "critical", "unknown" };
+	struct recount hrc, src;
+	int i;
+
+	memset(&hrc, 0, sizeof(hrc));
+	memset(&src, 0, sizeof(src));
+	for (i = 0; i < NUM_HOSTS; i++) {
+		host *h = hosts[i];
+		recount_one(&hrc, now, h->check_type == CHECK_TYPE_ACTIVE, h->current_state, h->latency,
+		            h->execution_time, h->percent_state_change, h->is_flapping,
+		            h->scheduled_downtime_depth > 0, h->has_been_checked, h->should_be_scheduled,
+		            h->last_check);
+	}
+	for (i = 0; i < NUM_SERVICES; i++) {
+		service *s = services[i];
+		recount_one(&src, now, s->check_type == CHECK_TYPE_ACTIVE, s->current_state, s->latency,
+		            s->execution_time, s->percent_state_change, s->is_flapping,
+		            s->scheduled_downtime_depth > 0, s->has_been_checked, s->should_be_scheduled,
+		            s->last_check);
+	}
+	return compare(out, "host", &hrc, host_states) + compare(out, "service", &src, service_states);
+}
+
+static void test_aggregates(void)
+{
+	time_t now = time(NULL);
+	int i, bad = 0, checks = 0;
+	char *out;
+
+	for (i = 0; i < NUM_HOSTS; i++) {
+		hosts[i] = nm_calloc(1, sizeof(host));
+		hosts[i]->id = i;
+		hosts[i]->name = "host";
+		hosts[i]->next = i ? hosts[i - 1] : NULL;
+	}
+	for (i = 0; i < NUM_SERVICES; i++) {
+		services[i] = nm_calloc(1, sizeof(service));
+		services[i]->id = i;
+		services[i]->host_name = "host";
+		services[i]->description = "service";
+		services[i]->host_ptr = hosts[i % NUM_HOSTS];
+		services[i]->next = i ? services[i - 1] : NULL;
+	}
+	host_list = hosts[NUM_HOSTS - 1];
+	service_list = services[NUM_SERVICES - 1];
+	num_objects.hosts = NUM_HOSTS;
+	num_objects.services = NUM_SERVICES;
+
+	/* some state from before the aggregates were started */
+	hosts[0]->current_state = STATE_DOWN;
+	hosts[0]->latency = 2.5;
+	hosts[0]->last_check = now - 30;
+	services[0]->current_state = STATE_CRITICAL;
+
+	ok(init_status_aggregates() == OK, "Status aggregates initialized");
+	out = qh_query("#stats");
+	ok(check_all(out, time(NULL)) == 0, "They start out counting every object as it is");
+	ok(stat_value(out, "active_hosts_checked_last_1min") == 1.0, "Recent checks are counted");
+	ok(strstr(out, "\nactive_scheduled_service_check_stats=") != NULL, "Check statistics are included");
+	ok(*qh_query("#stats help") && !strncmp(qh_query("#stats nonsense"), "400", 3),
+	   "The handler has help and rejects what it doesn't know");
+
+	for (i = 1; i <= NUM_UPDATES; i++) {
+		if (rand() % 5) {
+			service *s = services[rand() % NUM_SERVICES];
+			randomize(&s->check_type, &s->current_state, STATE_UNKNOWN, &s->latency,
+			          &s->execution_time, &s->percent_state_change, &s->is_flapping,
+			          &s->scheduled_downtime_depth, &s->has_been_checked,
+			          &s->should_be_scheduled, &s->last_check, now);
+			update_service_status(s, FALSE);
+		} else {
+			host *h = hosts[rand() % NUM_HOSTS];
+			randomize(&h->check_type, &h->current_state, STATE_UNREACHABLE, &h->latency,
+			          &h->execution_time, &h->percent_state_change, &h->is_flapping,
+			          &h->scheduled_downtime_depth, &h->has_been_checked,
+			          &h->should_be_scheduled, &h->last_check, now);
+			update_host_status(h, FALSE);
+		}
+		if (!(i % 500)) {
+			now = time(NULL);
+			bad += check_all(qh_query("#stats"), now);
+			checks++;
+		}
+	}
+	ok(bad == 0, "The aggregates match a full recount %d times over %d random updates", checks, NUM_UPDATES);
+
+	/* the same update twice must not count the object twice */
+	update_service_status(services[1], FALSE);
+	update_service_status(services[1], FALSE);
+	ok(check_all(qh_query("#stats"), time(NULL)) == 0, "Updating an unchanged object changes nothing");
+
+	free_status_aggregates();
+	update_host_status(hosts[0], FALSE);
+	ok(!strncmp(qh_query("#stats"), "503", 3), "Without aggregates, there's nothing to serve");
+
+	for (i = 0; i < NUM_HOSTS; i++)
+		free(hosts[i]);
+	for (i = 0; i < NUM_SERVICES; i++)
+		free(services[i]);
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	plan_tests(9);
+
+	srand(4711);
+	snprintf(qh_path, sizeof(qh_path), "/tmp/test_statusdata.%d.qh", (int)getpid());
+	nagios_iobs = iobroker_create();
+	ok(qh_init(qh_path) == OK, "Query handler initialized");
+
+	test_aggregates();
+
+	qh_deinit(qh_path);
+	iobroker_destroy(nagios_iobs, IOBROKER_CLOSE_SOCKETS);
+	return exit_status();
+}
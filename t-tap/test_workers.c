@@ -0,0 +1,175 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "naemon/workers.c"
+#include "tap.h"
+
+/* what a job's callback was told */
+struct job_outcome {
+	int called;
+	int orphaned;
+	char *output;
+};
+
+static void job_done(struct wproc_result *wpres, void *data, int flags)
+{
+	struct job_outcome *out = (struct job_outcome *)data;
+
+	out->called++;
+	out->orphaned = !wpres && (flags & WPROC_JOB_ORPHANED);
+	out->output = wpres && wpres->outstd ? nm_strdup(wpres->outstd) : NULL;
+}
+
+/* registers a worker we play ourselves. Returns our end of its socket */
+static int add_fake_worker(const char *name, struct wproc_worker **wp)
+{
+	char buf[64];
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return -1;
+	snprintf(buf, sizeof(buf), "name=%s;pid=%d;max_jobs=10", name, (int)getpid());
+	register_worker(sv[0], buf, strlen(buf));
+	*wp = workers.wps[workers.len - 1];
+	return sv[1];
+}
+
+/* sends a result for a job, as a worker would */
+static void send_result(int sd, unsigned int job_id, const char *output)
+{
+	struct kvvec *kvv = kvvec_create(4);
+
+	kvvec_addkv_long(kvv, "job_id", job_id);
+	kvvec_addkv(kvv, "wait_status", "0");
+	kvvec_addkv(kvv, "outstd", (char *)output);
+	worker_send_kvvec(sd, kvv);
+	kvvec_destroy(kvv, 0);
+}
+
+/* reads the jobs sent to a worker, as a worker would before it dies */
+static void read_jobs(int sd)
+{
+	char buf[4096];
+
+	while (recv(sd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		; /* empty loop */
+}
+
+/* run a query through the @wproc handler and return what it printed */
+static char *wproc_query(const char *query)
+{
+	static char out[4096];
+	char buf[64];
+	int pfd[2];
+	ssize_t len;
+
+	if (pipe(pfd) < 0)
+		return "";
+	strcpy(buf, query);
+	wproc_query_handler(pfd[1], buf, strlen(buf));
+	close(pfd[1]);
+	len = read(pfd[0], out, sizeof(out) - 1);
+	close(pfd[0]);
+	out[len > 0 ? len : 0] = 0;
+	return out;
+}
+
+static struct wproc_job *queued_job(void)
+{
+	return pqueue_peek(job_deadlines);
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	struct job_outcome first = { 0 }, second = { 0 }, third = { 0 };
+	struct wproc_worker *wp1, *wp2;
+	struct wproc_job *job;
+	time_t now = time(NULL);
+	int sd1, sd2;
+	char *out;
+
+	plan_tests(16);
+
+	nagios_iobs = iobroker_create();
+	sd1 = add_fake_worker("fake1", &wp1);
+	ok(sd1 >= 0 && workers.len == 1, "A worker can be registered");
+
+	/* a job whose result never comes back */
+	ok(wproc_run_callback("/bin/true one", 5, job_done, &first, NULL) == OK, "A job can be handed to a worker");
+	job = queued_job();
+	ok(job && pqueue_size(job_deadlines) == 1 && job->deadline >= now + 5 + WPROC_JOB_SLACK,
+	   "The job is queued with its timeout plus some slack as deadline");
+	wproc_check_orphaned_jobs();
+	ok(!first.called && pqueue_size(job_deadlines) == 1, "Jobs aren't orphaned before their deadline");
+
+	out = wproc_query("jobs");
+	ok(strstr(out, "jobs_running=1;jobs_orphaned=0;oldest_age=") == out &&
+	   strstr(out, "\nname=fake1;pid=") && strstr(out, ";jobs_running=1;oldest_age="),
+	   "#wproc jobs lists the job, in total and per worker") || diag("%s", out);
+
+	/* pretend the job was started long enough ago */
+	job->start = now - 5 - WPROC_JOB_SLACK - 1;
+	pqueue_change_priority(job_deadlines, now - 1, job);
+	wproc_check_orphaned_jobs();
+	ok(first.called == 1 && first.orphaned, "Jobs past their deadline are orphaned, with a NULL result");
+	ok(pqueue_size(job_deadlines) == 0 && fanout_num_entries(wp1->jobs) == 0 && wp1->jobs_running == 0,
+	   "Orphaned jobs are gone from the deadline queue and the worker");
+	ok(wproc_jobs_orphaned == 1, "Orphaned jobs are counted");
+	out = wproc_query("jobs");
+	ok(strstr(out, "jobs_running=0;jobs_orphaned=1;oldest_age=0\n") == out, "#wproc jobs counts orphans") || diag("%s", out);
+
+	/* a job whose result comes back in time */
+	wproc_run_callback("/bin/true two", 5, job_done, &second, NULL);
+	job = queued_job();
+	send_result(sd1, job->id, "all is well");
+	handle_worker_result(wp1->sd, 0, wp1);
+	ok(second.called == 1 && !second.orphaned && second.output && !strcmp(second.output, "all is well"),
+	   "Results that come back reach the callback");
+	ok(pqueue_size(job_deadlines) == 0, "Jobs with results leave the deadline queue");
+
+	/* a worker dies with a job in flight, and another one takes over */
+	sd2 = add_fake_worker("fake2", &wp2);
+	workers.idx = 0;
+	wproc_run_callback("/bin/true three", 5, job_done, &third, NULL);
+	ok(fanout_num_entries(wp1->jobs) == 1, "The job went to the first worker");
+	read_jobs(sd1);
+	close(sd1);
+	handle_worker_result(wp1->sd, 0, wp1);
+	job = queued_job();
+	ok(!third.called && job && job->wp == wp2 && pqueue_size(job_deadlines) == 1 && fanout_num_entries(wp2->jobs) == 1,
+	   "Jobs of a dead worker are handed to another one and stay queued");
+	send_result(sd2, job->id, "rescued");
+	handle_worker_result(wp2->sd, 0, wp2);
+	ok(third.called == 1 && third.output && !strcmp(third.output, "rescued"),
+	   "The result from the new worker reaches the callback");
+
+	/* the last worker dies with a job in flight */
+	memset(&third, 0, sizeof(third));
+	wproc_run_callback("/bin/true four", 5, job_done, &third, NULL);
+	read_jobs(sd2);
+	close(sd2);
+	handle_worker_result(wp2->sd, 0, wp2);
+	ok(third.called == 1 && third.orphaned, "Jobs are orphaned right away when no worker is left");
+	ok(pqueue_size(job_deadlines) == 0 && wproc_jobs_orphaned == 2, "...and leave the deadline queue");
+
+	nm_free(second.output);
+	return exit_status();
+}
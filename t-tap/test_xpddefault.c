@@ -0,0 +1,370 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "naemon/workers.c"
+#include "tap.h"
+#include "naemon/globals.h"
+#include "naemon/defaults.h"
+#include "naemon/objects.h"
+#include "naemon/macros.h"
+#include "naemon/events.h"
+#include "naemon/xpddefault.h"
+#include "naemon/utils.h"
+#include "naemon/nm_alloc.h"
+
+#define NUM_LINES 10
+
+static host test_host = {
+	.name = "name'&%", .address = "address'&%",
+	.plugin_output = "host output", .perf_data = "rta=1ms"
+};
+
+static service test_service = {
+	.host_name = "name'&%", .description = "service description",
+	.plugin_output = "service output", .perf_data = "time=0.1s;1;2",
+};
+
+static char dir[64], path[128];
+
+static char *read_file(const char *name)
+{
+	FILE *fp;
+	struct stat st;
+	char *buf;
+
+	if (stat(name, &st) < 0 || !(fp = fopen(name, "r")))
+		return nm_strdup("");
+	buf = nm_malloc(st.st_size + 1);
+	buf[fread(buf, 1, st.st_size, fp)] = 0;
+	fclose(fp);
+	return buf;
+}
+
+/* writes NUM_LINES lines using the given template and reads them back */
+static char *write_lines(nagios_macros *mac, const char *template)
+{
+	int i;
+
+	unlink(path);
+	service_perfdata_file = nm_strdup(path);
+	service_perfdata_file_template = nm_strdup(template);
+	xpddefault_initialize_performance_data(NULL);
+	for (i = 0; i < NUM_LINES; i++)
+		xpddefault_update_service_performance_data_file(mac, &test_service);
+	xpddefault_cleanup_performance_data();
+
+	return read_file(path);
+}
+
+/* lines must come out exactly like process_macros_r() makes them */
+static void test_templates(nagios_macros *mac)
+{
+	const char *templates[] = {
+		"[SERVICEPERFDATA]\t$HOSTNAME$\t$SERVICEDESC$\t$SERVICEOUTPUT$\t$SERVICEPERFDATA$",
+		"no macros at all",
+		"$$ and $$$$ are escaped, $IDONOTEXIST$ is left alone",
+		"$HOSTADDRESS$ $ARG1$ $USER1$ $_SERVICEFOO$ $HOSTNAME:nosuchhost$",
+		"ends in a macro $HOSTNAME",
+		"ends in a $",
+		"$SERVICEDESC$$HOSTNAME$",
+	};
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(templates); i++) {
+		char *tmpl, *line = NULL, *expect, *got;
+
+		/* the same way the core gets them from the config */
+		tmpl = nm_strdup(templates[i]);
+		process_macros_r(mac, tmpl, &line, 0);
+		expect = nm_malloc(NUM_LINES * (strlen(line) + 1) + 1);
+		*expect = 0;
+		for (j = 0; j < NUM_LINES; j++) {
+			strcat(expect, line);
+			strcat(expect, "\n");
+		}
+
+		got = write_lines(mac, templates[i]);
+		if (!ok(!strcmp(got, expect), "Template '%s' expands like process_macros_r() does", templates[i]))
+			diag("got '%s', expected '%s'", got, expect);
+		free(tmpl);
+		free(line);
+		free(expect);
+		free(got);
+	}
+}
+
+static void test_buffering(nagios_macros *mac)
+{
+	struct stat st;
+	int i;
+
+	unlink(path);
+	perfdata_file_flush_interval = 0;
+	service_perfdata_file = nm_strdup(path);
+	service_perfdata_file_template = nm_strdup("$HOSTNAME$\t$SERVICEPERFDATA$");
+	xpddefault_initialize_performance_data(NULL);
+
+	for (i = 0; i < NUM_LINES; i++)
+		xpddefault_update_service_performance_data_file(mac, &test_service);
+	ok(!stat(path, &st) && st.st_size == 0, "Lines are buffered, not written one by one");
+
+	xpddefault_flush_perfdata_files();
+	ok(!stat(path, &st) && st.st_size == NUM_LINES * (long)strlen("name'&%\ttime=0.1s;1;2\n"),
+	   "Flushing writes out all buffered lines");
+
+	xpddefault_cleanup_performance_data();
+	perfdata_file_flush_interval = DEFAULT_PERFDATA_FILE_FLUSH_INTERVAL;
+}
+
+static void test_rotation(nagios_macros *mac)
+{
+	char pattern[160], *data;
+	glob_t gl;
+	size_t i, total = 0;
+	int j;
+
+	/* write each line right away and rotate after the second one */
+	unlink(path);
+	perfdata_file_buffer_size = 0;
+	service_perfdata_file_rotation_size = 2 * strlen("name'&%\n");
+	service_perfdata_file = nm_strdup(path);
+	service_perfdata_file_template = nm_strdup("$HOSTNAME$");
+	xpddefault_initialize_performance_data(NULL);
+	for (j = 0; j < NUM_LINES; j++)
+		xpddefault_update_service_performance_data_file(mac, &test_service);
+	xpddefault_cleanup_performance_data();
+
+	snprintf(pattern, sizeof(pattern), "%s.*", path);
+	ok(glob(pattern, 0, NULL, &gl) == 0 && gl.gl_pathc == NUM_LINES / 2,
+	   "The file is rotated every time it reaches its rotation size");
+	for (i = 0; i < gl.gl_pathc; i++) {
+		data = read_file(gl.gl_pathv[i]);
+		if (!strcmp(data, "name'&%\nname'&%\n"))
+			total++;
+		free(data);
+		unlink(gl.gl_pathv[i]);
+	}
+	ok(total == NUM_LINES / 2, "Each rotated file holds the lines written to it");
+	data = read_file(path);
+	ok(!*data, "A new, empty, file replaces the rotated one");
+	free(data);
+	globfree(&gl);
+
+	perfdata_file_buffer_size = DEFAULT_PERFDATA_FILE_BUFFER_SIZE;
+	service_perfdata_file_rotation_size = 0;
+}
+
+/* registers a worker we play ourselves. Returns our end of its socket */
+static int add_fake_worker(struct wproc_worker **wp)
+{
+	char buf[64];
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return -1;
+	snprintf(buf, sizeof(buf), "name=fake;pid=%d;max_jobs=10", (int)getpid());
+	register_worker(sv[0], buf, strlen(buf));
+	*wp = workers.wps[workers.len - 1];
+	return sv[1];
+}
+
+/* reads a job sent to our worker and returns its command, if there is one */
+static char *read_job(int sd, unsigned int *job_id)
+{
+	char buf[4096], *cmd = NULL;
+	struct kvvec *kvv;
+	ssize_t len;
+	int i;
+
+	len = recv(sd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (len <= 0)
+		return NULL;
+	kvv = buf2kvvec(buf, len - 3, '=', 0, KVVEC_COPY);
+	for (i = 0; kvv && i < kvv->kv_pairs; i++) {
+		if (!strcmp(kvv->kv[i].key, "command"))
+			cmd = nm_strdup(kvv->kv[i].value);
+		else if (!strcmp(kvv->kv[i].key, "job_id"))
+			*job_id = atoi(kvv->kv[i].value);
+	}
+	kvvec_destroy(kvv, KVVEC_FREE_ALL);
+	return cmd;
+}
+
+/* runs a job the way a worker would and sends its result back */
+static void run_job(int sd, unsigned int job_id, const char *cmd)
+{
+	struct kvvec *kvv = kvvec_create(4);
+
+	kvvec_addkv_long(kvv, "job_id", job_id);
+	kvvec_addkv_long(kvv, "wait_status", system(cmd));
+	kvvec_addkv(kvv, "exited_ok", "1");
+	worker_send_kvvec(sd, kvv);
+	kvvec_destroy(kvv, 0);
+}
+
+static char *processing_stats(void)
+{
+	static char out[4096];
+	int pfd[2];
+	ssize_t len;
+
+	if (pipe(pfd) < 0)
+		return "";
+	xpddefault_dump_processing_stats(pfd[1]);
+	close(pfd[1]);
+	len = read(pfd[0], out, sizeof(out) - 1);
+	close(pfd[0]);
+	out[len > 0 ? len : 0] = 0;
+	return out;
+}
+
+static int rotated_files_left(void)
+{
+	char pattern[160];
+	glob_t gl;
+	int ret;
+
+	snprintf(pattern, sizeof(pattern), "%s.*", path);
+	ret = glob(pattern, 0, NULL, &gl) == 0;
+	globfree(&gl);
+	return ret;
+}
+
+static void start_processing(nagios_macros *mac, const char *command)
+{
+	int j;
+
+	unlink(path);
+	service_perfdata_file = nm_strdup(path);
+	service_perfdata_file_template = nm_strdup("$HOSTNAME$");
+	service_perfdata_file_processing_command = nm_strdup(command);
+	xpddefault_initialize_performance_data(NULL);
+	for (j = 0; j < NUM_LINES; j++)
+		xpddefault_update_service_performance_data_file(mac, &test_service);
+}
+
+static void test_processing(nagios_macros *mac)
+{
+	unsigned int ocount[NUM_OBJECT_TYPES] = { 0 }, job_id = 0;
+	char processed[160], rotated[160], *cmdline, *cmd, *data, *expect;
+	struct wproc_worker *wp;
+	int sd, j;
+
+	snprintf(processed, sizeof(processed), "%s/processed", dir);
+	snprintf(rotated, sizeof(rotated), "/bin/mv %s.", path);
+	ocount[OBJTYPE_COMMAND] = 2;
+	create_object_tables(ocount);
+	nm_asprintf(&cmdline, "/bin/mv $SERVICEPERFDATAFILE$ %s", processed);
+	add_command(nm_strdup("process-file"), cmdline);
+	nm_asprintf(&cmdline, "/bin/mv %s %s", path, processed);
+	add_command(nm_strdup("process-hardcoded"), cmdline);
+	expect = nm_malloc(NUM_LINES * strlen("name'&%\n") + 1);
+	*expect = 0;
+	for (j = 0; j < NUM_LINES; j++)
+		strcat(expect, "name'&%\n");
+
+	nagios_iobs = iobroker_create();
+	sd = add_fake_worker(&wp);
+	perfdata_file_buffer_size = 0;
+
+	/* a command that processes the file it's told to */
+	start_processing(mac, "process-file");
+	xpddefault_process_service_perfdata_file();
+	cmd = read_job(sd, &job_id);
+	ok(cmd && !strncmp(cmd, rotated, strlen(rotated)), "The processing command goes to a worker and is told to process the rotated file") || diag("%s", cmd);
+	xpddefault_update_service_performance_data_file(mac, &test_service);
+	xpddefault_process_service_perfdata_file();
+	ok(!read_job(sd, &job_id), "The command isn't run again while it's still running");
+
+	run_job(sd, job_id, cmd);
+	handle_worker_result(wp->sd, 0, wp);
+	data = read_file(processed);
+	ok(!strcmp(data, expect), "The command processes the lines written before it started");
+	free(data);
+	data = read_file(path);
+	ok(!strcmp(data, "name'&%\n"), "Lines written while it runs go to a new file");
+	free(data);
+	ok(!rotated_files_left(), "No rotated file is left over");
+	ok(strstr(processing_stats(), "service_running=0;service_runs=1;service_skipped=1;service_timeouts=0;service_failures=0;") != NULL,
+	   "#core perfdatastats counts the run and the skipped one") || diag("%s", processing_stats());
+	xpddefault_cleanup_performance_data();
+	nm_free(cmd);
+
+	/* a command with the path hardcoded, which gets the file as it is */
+	unlink(processed);
+	start_processing(mac, "process-hardcoded");
+	xpddefault_process_service_perfdata_file();
+	cmd = read_job(sd, &job_id);
+	ok(cmd && strstr(cmd, path) && !strstr(cmd, rotated + strlen("/bin/mv ")), "A command with the path hardcoded goes to a worker too") || diag("%s", cmd);
+	xpddefault_update_service_performance_data_file(mac, &test_service);
+	data = read_file(path);
+	ok(!strcmp(data, expect), "Lines written while it runs are held back");
+	free(data);
+	run_job(sd, job_id, cmd);
+	handle_worker_result(wp->sd, 0, wp);
+	data = read_file(processed);
+	ok(!strcmp(data, expect), "The command processes the file itself");
+	free(data);
+	data = read_file(path);
+	ok(!strcmp(data, "name'&%\n"), "The held back lines go to a new file once it's done");
+	free(data);
+	ok(!rotated_files_left(), "No rotated file is left over");
+	xpddefault_cleanup_performance_data();
+	nm_free(cmd);
+
+	unlink(processed);
+	free(expect);
+	close(sd);
+	perfdata_file_buffer_size = DEFAULT_PERFDATA_FILE_BUFFER_SIZE;
+}
+
+int main(int /*@unused@*/ argc, char /*@unused@*/ **arv)
+{
+	nagios_macros mac;
+
+	plan_tests(23);
+
+	reset_variables();
+	init_event_queue();
+	snprintf(dir, sizeof(dir), "/tmp/test_xpd.XXXXXX");
+	if (!mkdtemp(dir)) {
+		fail("Failed to create a temporary directory");
+		return exit_status();
+	}
+	snprintf(path, sizeof(path), "%s/service-perfdata", dir);
+
+	memset(&mac, 0, sizeof(mac));
+	grab_host_macros_r(&mac, &test_host);
+	grab_service_macros_r(&mac, &test_service);
+
+	test_templates(&mac);
+	test_buffering(&mac);
+	test_rotation(&mac);
+	test_processing(&mac);
+
+	unlink(path);
+	rmdir(dir);
+	clear_volatile_macros_r(&mac);
+	return exit_status();
+}
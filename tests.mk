@@ -3,7 +3,7 @@ BROKEN = test_downtime test_events test_nagios_config test_xsddefault
 AM_CFLAGS += -Wno-error
 
 T_TAP_AM_CPPFLAGS = $(AM_CPPFLAGS) -I$(abs_srcdir)/tap/src -DNAEMON_BUILDOPTS_H__ '-DNAEMON_SYSCONFDIR="$(abs_builddir)/t-tap/smallconfig/"' '-DNAEMON_LOCALSTATEDIR="$(abs_builddir)/t-tap/"' '-DNAEMON_LOGDIR="$(abs_builddir)/t-tap/"' '-DNAEMON_LOCKFILE="$(lockfile)"' -DNAEMON_COMPILATION
-T_TAP_LDADD = -ltap -L$(top_builddir)/tap/src -L$(top_builddir)/lib -lnaemon -ldl -lm
+T_TAP_LDADD = -ltap -L$(top_builddir)/tap/src -L$(top_builddir)/lib -lnaemon -ldl -lm -lpthread
 BASE_DEPS = broker.o checks.o commands.o comments.o \
 	configuration.o downtime.o events.o flapping.o logging.o \
 	macros.o nebmods.o notifications.o objects.o perfdata.o \
@@ -16,6 +16,29 @@ CHECKS_DEPS = $(BASE_DEPS) utils.o
 NEB_CALLBACKS_DEPS = $(BASE_DEPS) utils.o
 CONFIG_DEPS = $(BASE_DEPS) utils.o
 COMMANDS_DEPS = $(BASE_DEPS) utils.o
+NOTIFICATIONS_DEPS = $(BASE_DEPS) utils.o
+QUERY_HANDLER_DEPS = $(BASE_DEPS) utils.o
+XPDDEFAULT_DEPS = broker.o checks.o commands.o comments.o \
+	configuration.o downtime.o events.o flapping.o logging.o \
+	macros.o nebmods.o notifications.o objects.o perfdata.o \
+	query-handler.o sehandlers.o shared.o sretention.o statusdata.o \
+	xodtemplate.o xpddefault.o xrddefault.o \
+	xsddefault.o nm_alloc.o utils.o
+NERDSTREAM_DEPS = $(BASE_DEPS) utils.o
+STATUSDATA_DEPS = $(BASE_DEPS) utils.o
+FLAPPING_DEPS = $(BASE_DEPS) utils.o
+WORKERS_DEPS = broker.o checks.o commands.o comments.o \
+	configuration.o downtime.o events.o flapping.o logging.o \
+	macros.o nebmods.o notifications.o objects.o perfdata.o \
+	query-handler.o sehandlers.o shared.o sretention.o statusdata.o \
+	xodtemplate.o xpddefault.o xrddefault.o \
+	xsddefault.o nm_alloc.o utils.o
+SCHEDULING_DEPS = broker.o checks.o commands.o comments.o \
+	configuration.o downtime.o flapping.o logging.o \
+	macros.o nebmods.o notifications.o objects.o perfdata.o \
+	query-handler.o sehandlers.o shared.o sretention.o statusdata.o \
+	workers.o xodtemplate.o xpddefault.o xrddefault.o \
+	xsddefault.o nm_alloc.o utils.o
 t_tap_test_timeperiods_SOURCES = t-tap/test_timeperiods.c src/naemon/defaults.c
 t_tap_test_timeperiods_LDADD = $(TIMEPERIODS_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
 t_tap_test_timeperiods_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
@@ -34,9 +57,36 @@ t_tap_test_config_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
 t_tap_test_commands_SOURCES = t-tap/test_commands.c src/naemon/defaults.c
 t_tap_test_commands_LDADD = $(COMMANDS_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
 t_tap_test_commands_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
+t_tap_test_notifications_SOURCES = t-tap/test_notifications.c src/naemon/defaults.c
+t_tap_test_notifications_LDADD = $(NOTIFICATIONS_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
+t_tap_test_notifications_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
+t_tap_test_query_handler_SOURCES = t-tap/test_query_handler.c src/naemon/defaults.c
+t_tap_test_query_handler_LDADD = $(QUERY_HANDLER_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
+t_tap_test_query_handler_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
+t_tap_test_xpddefault_SOURCES = t-tap/test_xpddefault.c src/naemon/defaults.c
+t_tap_test_xpddefault_LDADD = $(XPDDEFAULT_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
+t_tap_test_xpddefault_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
+t_tap_test_nerdstream_SOURCES = t-tap/test_nerdstream.c src/shadownaemon/nerdstream.c src/naemon/defaults.c
+t_tap_test_nerdstream_LDADD = $(NERDSTREAM_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
+t_tap_test_nerdstream_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
+t_tap_test_statusdata_SOURCES = t-tap/test_statusdata.c src/naemon/defaults.c
+t_tap_test_statusdata_LDADD = $(STATUSDATA_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
+t_tap_test_statusdata_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
+t_tap_test_flapping_SOURCES = t-tap/test_flapping.c src/naemon/defaults.c
+t_tap_test_flapping_LDADD = $(FLAPPING_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
+t_tap_test_flapping_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
+t_tap_test_workers_SOURCES = t-tap/test_workers.c src/naemon/defaults.c
+t_tap_test_workers_LDADD = $(WORKERS_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
+t_tap_test_workers_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
+t_tap_test_scheduling_SOURCES = t-tap/test_scheduling.c src/naemon/defaults.c
+t_tap_test_scheduling_LDADD = $(SCHEDULING_DEPS:%=$(top_builddir)/src/naemon/%) $(T_TAP_LDADD)
+t_tap_test_scheduling_CPPFLAGS = $(T_TAP_AM_CPPFLAGS)
 dist_check_SCRIPTS = t/705naemonstats.t t/900-configparsing.t t/910-noservice.t t/920-nocontactgroup.t t/930-emptygroups.t
 check_PROGRAMS += t-tap/test_macros t-tap/test_timeperiods t-tap/test_checks \
-	t-tap/test_neb_callbacks t-tap/test_config t-tap/test_commands
+	t-tap/test_neb_callbacks t-tap/test_config t-tap/test_commands \
+	t-tap/test_notifications t-tap/test_query_handler t-tap/test_xpddefault \
+	t-tap/test_nerdstream t-tap/test_statusdata t-tap/test_flapping t-tap/test_workers \
+	t-tap/test_scheduling
 distclean-local:
 	if test "${abs_srcdir}" != "${abs_builddir}"; then \
 		rm -r t; \
@@ -61,7 +111,7 @@ TESTS_ENVIRONMENT = \
 					   fi; \
 					   builddir=$(abs_builddir); export builddir;
 if HAVE_CHECK
-TESTS_LDADD = @CHECK_LIBS@ -Llib -lnaemon -lm -ldl
+TESTS_LDADD = @CHECK_LIBS@ -Llib -lnaemon -lm -ldl -lpthread
 TESTS_AM_CPPFLAGS = $(AM_CPPFLAGS) -Isrc '-DSYSCONFDIR="$(abs_srcdir)/tests/configs/"' -DNAEMON_COMPILATION
 AM_CFLAGS += @CHECK_CFLAGS@
 GENERAL_DEPS = nebmods.o commands.o broker.o query-handler.o utils.o events.o notifications.o \